@@ -0,0 +1,116 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include <dawn-gfx/Visibility.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace dw::gfx;
+
+namespace {
+constexpr int kObjectCount = 100000;
+constexpr int kFrameCount = 100;
+// Fraction of objects which move each frame.
+constexpr float kMovingFraction = 0.1f;
+constexpr float kWorldSize = 2000.0f;
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+AABB randomBounds(std::mt19937& rng) {
+    std::uniform_real_distribution<float> position(-kWorldSize * 0.5f, kWorldSize * 0.5f);
+    std::uniform_real_distribution<float> size(0.5f, 10.0f);
+    const Vec3 centre{position(rng), position(rng), position(rng)};
+    const Vec3 half_size{size(rng), size(rng), size(rng)};
+    return AABB{centre - half_size, centre + half_size};
+}
+
+// Reference implementation which tests every object against every plane.
+usize bruteForceCull(const std::vector<AABB>& bounds, const Frustum& frustum) {
+    Plane planes[6];
+    frustum.GetPlanes(planes);
+    usize visible = 0;
+    for (const auto& b : bounds) {
+        const Vec3 centre = b.CenterPoint();
+        const Vec3 extent = b.HalfSize();
+        bool outside = false;
+        for (const auto& plane : planes) {
+            const float radius = std::abs(plane.normal.x) * extent.x +
+                                 std::abs(plane.normal.y) * extent.y +
+                                 std::abs(plane.normal.z) * extent.z;
+            outside |= plane.normal.Dot(centre) - plane.d > radius;
+        }
+        visible += outside ? 0 : 1;
+    }
+    return visible;
+}
+}  // namespace
+
+int main() {
+    std::mt19937 rng{1234};
+    std::vector<AABB> bounds;
+    bounds.reserve(kObjectCount);
+    for (int i = 0; i < kObjectCount; ++i) {
+        bounds.emplace_back(randomBounds(rng));
+    }
+
+    // Build.
+    VisibilityWorld world{1.0f};
+    std::vector<VisibilityWorld::ObjectId> ids;
+    ids.reserve(kObjectCount);
+    auto start = Clock::now();
+    for (const auto& b : bounds) {
+        ids.emplace_back(world.insert(b));
+    }
+    std::cout << "Inserted " << kObjectCount << " objects in " << elapsedMs(start)
+              << " ms (tree height " << world.height() << ")" << std::endl;
+
+    // Simulate frames with a rotating camera and a fraction of the objects moving.
+    Frustum frustum;
+    frustum.SetKind(math::FrustumSpaceGL, math::FrustumRightHanded);
+    frustum.SetViewPlaneDistances(0.1f, kWorldSize);
+    frustum.SetPerspective(M_HALF_PI, M_HALF_PI * 9.0f / 16.0f);
+    std::uniform_int_distribution<usize> object(0, kObjectCount - 1);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    std::vector<VisibilityWorld::ObjectId> visible;
+    double move_ms = 0.0, cull_ms = 0.0, brute_force_ms = 0.0;
+    usize visible_total = 0, brute_force_total = 0, reinserted = 0;
+    for (int frame = 0; frame < kFrameCount; ++frame) {
+        const float angle = 2.0f * M_PI * frame / kFrameCount;
+        frustum.SetFrame(Vec3{0.0f, 0.0f, 0.0f}, Vec3{std::cos(angle), 0.0f, std::sin(angle)},
+                         Vec3{0.0f, 1.0f, 0.0f});
+
+        start = Clock::now();
+        for (int i = 0; i < static_cast<int>(kObjectCount * kMovingFraction); ++i) {
+            const usize index = object(rng);
+            const Vec3 delta{offset(rng), offset(rng), offset(rng)};
+            bounds[index] = AABB{bounds[index].minPoint + delta, bounds[index].maxPoint + delta};
+            reinserted += world.move(ids[index], bounds[index]) ? 1 : 0;
+        }
+        move_ms += elapsedMs(start);
+
+        start = Clock::now();
+        world.cull(frustum, visible);
+        cull_ms += elapsedMs(start);
+        visible_total += visible.size();
+
+        start = Clock::now();
+        brute_force_total += bruteForceCull(bounds, frustum);
+        brute_force_ms += elapsedMs(start);
+    }
+
+    std::cout << "Over " << kFrameCount << " frames:" << std::endl;
+    std::cout << "  move:        " << move_ms / kFrameCount << " ms/frame ("
+              << reinserted / kFrameCount << " reinsertions/frame)" << std::endl;
+    std::cout << "  cull:        " << cull_ms / kFrameCount << " ms/frame ("
+              << visible_total / kFrameCount << " visible/frame)" << std::endl;
+    std::cout << "  brute force: " << brute_force_ms / kFrameCount << " ms/frame ("
+              << brute_force_total / kFrameCount << " visible/frame)" << std::endl;
+    return 0;
+}
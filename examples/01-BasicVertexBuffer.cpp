@@ -30,8 +30,8 @@ public:
         };
         VertexDecl decl;
         decl.begin()
-            .add(VertexDecl::Attribute::Position, 2, VertexDecl::AttributeType::Float)
-            .add(VertexDecl::Attribute::Colour, 4, VertexDecl::AttributeType::Uint8, true)
+            .add<float[2]>(VertexDecl::Attribute::Position)
+            .add<u8[4]>(VertexDecl::Attribute::Colour, true)
             .end();
         vb_ = r.createVertexBuffer(Memory(vertices, sizeof(vertices)), decl);
     }
@@ -10,7 +10,6 @@ public:
     ProgramHandle box_program_;
 
     ProgramHandle post_process_;
-    FrameBufferHandle fb_handle_;
 
     void start() override {
         // Load shaders.
@@ -22,9 +21,6 @@ public:
         // Create box.
         box_ = MeshBuilder{r}.normals(true).texcoords(true).createBox(10.0f);
 
-        // Set up frame buffer.
-        fb_handle_ = r.createFrameBuffer(width(), height(), TextureFormat::RGBA8);
-
         // Load post process shader.
         auto pp_vs =
             util::loadShader(r, ShaderStage::Vertex, util::media("shaders/post_process.vert"));
@@ -34,8 +30,10 @@ public:
     }
 
     void render(float dt) override {
-        // Set up render queue to frame buffer.
-        r.startRenderQueue(fb_handle_);
+        // Set up render queue to a 4x multisampled frame buffer which is only used for this frame.
+        auto fb_handle =
+            r.acquireTransientFrameBuffer({width(), height(), {TextureFormat::RGBA8}, 4});
+        r.startRenderQueue(fb_handle);
         r.setRenderQueueClear({0.0f, 0.0f, 0.2f});
 
         // Calculate matrices.
@@ -59,7 +57,7 @@ public:
         r.setRenderQueueClear({0.0f, 0.2f, 0.0f});
 
         // Draw fb.
-        r.setTexture(1, r.getFrameBufferTexture(fb_handle_, 0));
+        r.setTexture(1, r.getFrameBufferTexture(fb_handle, 0));
         r.submitFullscreenQuad(post_process_);
     }
 
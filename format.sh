@@ -17,5 +17,6 @@ PATHS=(
     include
     src
     examples
+    tests
 )
 find "${PATHS[@]}" -name "*.h" -o -name "*.cpp" -not -path "./src/dawn-gfx/gl/glad/*" -exec $CLANG_FORMAT -i {} \;
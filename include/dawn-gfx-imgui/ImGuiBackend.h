@@ -34,6 +34,8 @@ private:
 // Implementation.
 ImGuiBackend::ImGuiBackend(Renderer& r, ImGuiIO& io) : r_(r), io_(io) {
     io.BackendPlatformName = io.BackendRendererName = "dawn-gfx";
+    // Draw commands are submitted with a base vertex, so large meshes can use 16-bit indices.
+    io.BackendFlags |= ImGuiBackendFlags_RendererHasVtxOffset;
 
     // TODO: Resize this on screen size change.
     // TODO: Fill others settings of the io structure later.
@@ -152,66 +154,80 @@ void ImGuiBackend::render(ImDrawData* draw_data) {
         return;
     }
 
-    // Setup projection matrix.
-    Mat4 proj_matrix = Mat4::OpenGLOrthoProjRH(-1.0f, 1.0f, io_.DisplaySize.x, io_.DisplaySize.y) *
-                       Mat4::Translate(-io_.DisplaySize.x * 0.5f, io_.DisplaySize.y * 0.5f, 0.0f) *
-                       Mat4::Scale(1.0f, -1.0f, 1.0f);
-    r_.setUniform("proj_matrix", proj_matrix);
-
     // Create a new render queue specific for the UI elements.
     r_.startRenderQueue();
 
-    // Process command lists.
+    // Copy all command lists into a single transient vertex and index buffer. No render state is
+    // set until this has succeeded, so giving up doesn't leave state pending for later items.
+    if (draw_data->TotalVtxCount == 0 || draw_data->TotalIdxCount == 0) {
+        return;
+    }
+    auto tvb = r_.allocTransientVertexBuffer(draw_data->TotalVtxCount, vertex_decl_);
+    if (!tvb) {
+        return;
+    }
+    auto tib = r_.allocTransientIndexBuffer(
+        draw_data->TotalIdxCount,
+        sizeof(ImDrawIdx) == sizeof(u16) ? IndexBufferType::U16 : IndexBufferType::U32);
+    if (!tib) {
+        return;
+    }
+    auto* vtx_dst = reinterpret_cast<ImDrawVert*>(r_.getTransientVertexBufferData(*tvb));
+    auto* idx_dst = reinterpret_cast<ImDrawIdx*>(r_.getTransientIndexBufferData(*tib));
     for (int n = 0; n < draw_data->CmdListsCount; ++n) {
-        auto cmd_list = draw_data->CmdLists[n];
-
-        // Update GPU buffers.
-        auto& vtx_buffer = cmd_list->VtxBuffer;
-        auto& idx_buffer = cmd_list->IdxBuffer;
-        auto tvb = r_.allocTransientVertexBuffer(vtx_buffer.Size, vertex_decl_);
-        if (!tvb) {
-            return;
-        }
-        auto tib = r_.allocTransientIndexBuffer(idx_buffer.Size);
-        if (!tib) {
-            return;
-        }
-        memcpy(r_.getTransientVertexBufferData(*tvb), vtx_buffer.Data,
-               vtx_buffer.Size * sizeof(ImDrawVert));
-        memcpy(r_.getTransientIndexBufferData(*tib), idx_buffer.Data,
-               idx_buffer.Size * sizeof(ImDrawIdx));
+        const auto* cmd_list = draw_data->CmdLists[n];
+        memcpy(vtx_dst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+        memcpy(idx_dst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+        vtx_dst += cmd_list->VtxBuffer.Size;
+        idx_dst += cmd_list->IdxBuffer.Size;
+    }
 
-        // Execute draw commands.
-        uint offset = 0;
+    // Setup projection matrix.
+    const Mat4 proj_matrix =
+        Mat4::OpenGLOrthoProjRH(-1.0f, 1.0f, io_.DisplaySize.x, io_.DisplaySize.y) *
+        Mat4::Translate(-io_.DisplaySize.x * 0.5f, io_.DisplaySize.y * 0.5f, 0.0f) *
+        Mat4::Scale(1.0f, -1.0f, 1.0f);
+
+    // Execute draw commands.
+    const float scale_x = io_.DisplayFramebufferScale.x;
+    const float scale_y = io_.DisplayFramebufferScale.y;
+    uint global_vtx_offset = 0;
+    uint global_idx_offset = 0;
+    for (int n = 0; n < draw_data->CmdListsCount; ++n) {
+        const auto* cmd_list = draw_data->CmdLists[n];
         for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; ++cmd_i) {
             const ImDrawCmd* cmd = &cmd_list->CmdBuffer[cmd_i];
             if (cmd->UserCallback) {
                 cmd->UserCallback(cmd_list, cmd);
-            } else {
-                // Set render state.
-                r_.setStateEnable(RenderState::Blending);
-                r_.setStateBlendEquation(BlendEquation::Add, BlendFunc::SrcAlpha,
-                                         BlendFunc::OneMinusSrcAlpha);
-                r_.setStateDisable(RenderState::CullFace);
-                r_.setStateDisable(RenderState::Depth);
-                r_.setScissor(static_cast<u16>(cmd->ClipRect.x * io_.DisplayFramebufferScale.x),
-                              static_cast<u16>(cmd->ClipRect.y * io_.DisplayFramebufferScale.y),
-                              static_cast<u16>((cmd->ClipRect.z - cmd->ClipRect.x) *
-                                               io_.DisplayFramebufferScale.x),
-                              static_cast<u16>((cmd->ClipRect.w - cmd->ClipRect.y) *
-                                               io_.DisplayFramebufferScale.y));
-
-                // Set resources.
-                r_.setTexture(1, TextureHandle{static_cast<TextureHandle::base_type>(
-                                     reinterpret_cast<dga::uintptr>(cmd->TextureId))});
-                r_.setVertexBuffer(*tvb);
-                r_.setIndexBuffer(*tib);
-
-                // Draw.
-                r_.submit(shader_program_, cmd->ElemCount, offset);
+                continue;
             }
-            offset += cmd->ElemCount;
+
+            // The pending render item is reset after each submit, so every command sets the full
+            // state. The renderer merges adjacent commands which end up identical, such as
+            // commands which share a texture and scissor.
+            r_.setStateEnable(RenderState::Blending);
+            r_.setStateBlendEquation(BlendEquation::Add, BlendFunc::SrcAlpha,
+                                     BlendFunc::OneMinusSrcAlpha);
+            r_.setStateDisable(RenderState::CullFace);
+            r_.setStateDisable(RenderState::Depth);
+            r_.setScissor(static_cast<u16>(cmd->ClipRect.x * scale_x),
+                          static_cast<u16>(cmd->ClipRect.y * scale_y),
+                          static_cast<u16>((cmd->ClipRect.z - cmd->ClipRect.x) * scale_x),
+                          static_cast<u16>((cmd->ClipRect.w - cmd->ClipRect.y) * scale_y));
+
+            // Set resources.
+            r_.setUniform("proj_matrix", proj_matrix);
+            r_.setTexture(1, TextureHandle{static_cast<TextureHandle::base_type>(
+                                 reinterpret_cast<dga::uintptr>(cmd->TextureId))});
+            r_.setVertexBuffer(*tvb);
+            r_.setIndexBuffer(*tib);
+
+            // Draw.
+            r_.submit(shader_program_, cmd->ElemCount, global_idx_offset + cmd->IdxOffset,
+                      global_vtx_offset + cmd->VtxOffset);
         }
+        global_vtx_offset += cmd_list->VtxBuffer.Size;
+        global_idx_offset += cmd_list->IdxBuffer.Size;
     }
 }
 
@@ -0,0 +1,78 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "Renderer.h"
+#include "TriangleBuffer.h"
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// Allocates ranges of elements from a fixed capacity. Uses best fit, and merges freed ranges with
+// their free neighbours so that the free list stays defragmented.
+class DW_API OffsetAllocator {
+public:
+    explicit OffsetAllocator(u32 capacity);
+    ~OffsetAllocator() = default;
+
+    std::optional<u32> allocate(u32 size);
+    void free(u32 offset, u32 size);
+
+    u32 capacity() const;
+    u32 freeSpace() const;
+    u32 largestFreeRange() const;
+
+private:
+    u32 capacity_;
+    u32 free_space_;
+    // Offset -> size of each free range, ordered by offset.
+    std::map<u32, u32> free_ranges_;
+};
+
+// Suballocates meshes from a small number of large vertex and index buffer pairs, so that
+// consecutive draws of different meshes don't need to bind new buffers. Every mesh in a pool must
+// use the same vertex layout.
+//
+// Meshes returned from add() share vb and ib with other meshes, so they must be drawn with their
+// base vertex and first index:
+//     r.submit(program, mesh.index_count, mesh.first_index, mesh.base_vertex);
+class DW_API GeometryPool {
+public:
+    GeometryPool(Renderer& r, const VertexDecl& decl, uint vertices_per_page = 1 << 20,
+                 uint indices_per_page = 1 << 22);
+    ~GeometryPool();
+
+    GeometryPool(const GeometryPool&) = delete;
+    GeometryPool& operator=(const GeometryPool&) = delete;
+
+    /// Uploads the contents of a triangle buffer into the pool. Returns std::nullopt if the vertex
+    /// layout doesn't match the pool, or if the mesh is larger than a page.
+    std::optional<Mesh> add(const TriangleBuffer& buffer);
+
+    /// Returns the space used by a mesh to the pool.
+    void remove(const Mesh& mesh);
+
+    const VertexDecl& decl() const;
+    usize pageCount() const;
+
+private:
+    struct Page {
+        VertexBufferHandle vb;
+        IndexBufferHandle ib;
+        OffsetAllocator vertices;
+        OffsetAllocator indices;
+    };
+
+    Renderer& r_;
+    VertexDecl decl_;
+    uint vertices_per_page_;
+    uint indices_per_page_;
+    std::vector<Page> pages_;
+};
+}  // namespace gfx
+}  // namespace dw
@@ -45,6 +45,11 @@ using Quat = math::Quat;
 // Plane
 using Plane = math::Plane;
 
+// Bounding volumes.
+using AABB = math::AABB;
+using Sphere = math::Sphere;
+using Frustum = math::Frustum;
+
 // Memory alignment.
 inline u32 strideAlign(u32 stride, u32 alignment) {
     return (stride + alignment - 1) & ~(alignment - 1);
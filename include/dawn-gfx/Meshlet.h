@@ -0,0 +1,99 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "MathDefs.h"
+#include "Renderer.h"
+#include "TriangleBuffer.h"
+#include <vector>
+#include <optional>
+
+namespace dw {
+namespace gfx {
+// A small cluster of triangles, which can be culled as a unit.
+struct Meshlet {
+    // Ranges inside MeshletMesh::vertices and MeshletMesh::triangles.
+    u32 vertex_offset;
+    u32 vertex_count;
+    u32 triangle_offset;
+    u32 triangle_count;
+
+    // Bounding sphere in object space.
+    Vec3 centre;
+    float radius;
+
+    // Normal cone. Every triangle in the meshlet is backfacing if
+    // dot(normalize(cone_apex - camera_position), cone_axis) > cone_cutoff. A cutoff greater than 1
+    // means that the meshlet can never be cone culled.
+    Vec3 cone_apex;
+    Vec3 cone_axis;
+    float cone_cutoff;
+};
+
+struct MeshletMesh {
+    std::vector<Meshlet> meshlets;
+    // Meshlet local vertex index -> mesh vertex index.
+    std::vector<u32> vertices;
+    // Three meshlet local vertex indices per triangle.
+    std::vector<u8> triangles;
+    // Number of vertices in the source mesh.
+    uint source_vertex_count;
+};
+
+static constexpr uint kMaxMeshletVertices = 64;
+static constexpr uint kMaxMeshletTriangles = 124;
+
+// Splits the triangles in a triangle buffer into meshlets. Triangles are consumed in index order,
+// so meshes which are optimised for the vertex cache produce tighter meshlets.
+DW_API MeshletMesh buildMeshlets(const TriangleBuffer& buffer,
+                                 uint max_vertices = kMaxMeshletVertices,
+                                 uint max_triangles = kMaxMeshletTriangles);
+
+// Culls the meshlets of a mesh on the CPU, and writes the triangles of the surviving meshlets to a
+// transient index buffer. The index buffer references the vertex buffer created by
+// TriangleBuffer::end().
+class DW_API MeshletCuller {
+public:
+    struct Result {
+        TransientIndexBufferHandle index_buffer;
+        uint index_count;
+        uint visible_meshlets;
+    };
+
+    explicit MeshletCuller(MeshletMesh mesh);
+    ~MeshletCuller() = default;
+
+    /// Culls the meshlets against the view frustum and the meshlet normal cones.
+    /// @param model_view_proj Object space to clip space matrix.
+    /// @param camera_position Camera position in object space.
+    /// @return The compacted index buffer, or std::nullopt if no meshlets are visible or the
+    /// transient index buffer is full.
+    std::optional<Result> cull(Renderer& r, const Mat4& model_view_proj,
+                               const Vec3& camera_position);
+
+    const MeshletMesh& mesh() const;
+
+private:
+    MeshletMesh mesh_;
+
+    // Meshlet bounds in SoA form, padded to a multiple of 4.
+    std::vector<float> centre_x_;
+    std::vector<float> centre_y_;
+    std::vector<float> centre_z_;
+    std::vector<float> radius_;
+    std::vector<float> apex_x_;
+    std::vector<float> apex_y_;
+    std::vector<float> apex_z_;
+    std::vector<float> axis_x_;
+    std::vector<float> axis_y_;
+    std::vector<float> axis_z_;
+    std::vector<float> cutoff_;
+
+    // Visible meshlet indices, reused between calls.
+    std::vector<u32> visible_;
+};
+}  // namespace gfx
+}  // namespace dw
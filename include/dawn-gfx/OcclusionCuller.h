@@ -0,0 +1,90 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "MathDefs.h"
+#include "TriangleBuffer.h"
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// Software occlusion culling. Occluders (usually simplified versions of large meshes, such as
+// walls and floors) are rasterized into a low resolution depth buffer on the CPU, then the bounds
+// of other objects are tested against it to find objects which are completely hidden, so they can
+// be skipped before they are submitted to the renderer:
+//
+//     culler.beginFrame(proj * view);
+//     culler.addOccluder(wall_buffer, wall_transform);
+//     culler.rasterize();
+//     if (culler.isVisible(object_bounds)) {
+//         r.submit(...);
+//     }
+//
+// The depth buffer stores 1/w, so larger values are closer to the camera. It's split into 8x8
+// tiles, and the farthest depth in each tile is kept as a coarse level so that most occludees can
+// be rejected without reading individual pixels. Rasterization runs in parallel on rows of tiles.
+class DW_API OcclusionCuller {
+public:
+    static constexpr uint kTileWidth = 8;
+    static constexpr uint kTileHeight = 8;
+
+    /// The width and height are rounded up to a multiple of the tile size.
+    explicit OcclusionCuller(uint width = 256, uint height = 128);
+    ~OcclusionCuller() = default;
+
+    /// Clears the depth buffer and the occluders.
+    /// @param view_proj World space to clip space matrix used for both occluders and occludees.
+    void beginFrame(const Mat4& view_proj);
+
+    /// Adds an occluder. Triangles are rasterized from both sides, so the winding order doesn't
+    /// matter.
+    void addOccluder(const TriangleBuffer& buffer, const Mat4& model);
+    void addOccluder(const Vec3* positions, usize vertex_count, const u32* indices,
+                     usize index_count, const Mat4& model);
+
+    /// Rasterizes the occluders added since beginFrame().
+    void rasterize();
+
+    /// Returns false if a box is completely hidden behind the occluders, or outside the screen.
+    /// Safe to call from multiple threads after rasterize().
+    bool isVisible(const AABB& world_bounds) const;
+
+    uint width() const;
+    uint height() const;
+    usize occluderTriangleCount() const;
+
+private:
+    // A screen space triangle, stored as edge functions (a * x + b * y + c >= 0 inside) and a
+    // depth plane.
+    struct Triangle {
+        float edge_a[3];
+        float edge_b[3];
+        float edge_c[3];
+        float z0, dzdx, dzdy;
+        float x0, y0;
+        int min_x, min_y, max_x, max_y;
+    };
+
+    uint width_;
+    uint height_;
+    uint tiles_x_;
+    uint tiles_y_;
+    Mat4 view_proj_;
+
+    std::vector<Triangle> triangles_;
+    // Per pixel depth, and farthest depth per tile.
+    std::vector<float> depth_;
+    std::vector<float> tile_depth_;
+
+    // Scratch space for transformed vertices.
+    std::vector<Vec4> clip_vertices_;
+
+    void addTriangles(const u32* indices, usize index_count);
+    void setupTriangle(const Vec4& v0, const Vec4& v1, const Vec4& v2);
+    void rasterizeTileRows(uint begin, uint end);
+};
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,193 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "Renderer.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// Builds render queues from a set of passes which declare the textures they read and write.
+// Before the passes are executed, the graph:
+// - culls passes whose results are never used,
+// - orders the passes so that each pass runs after the passes that write the textures it reads,
+//   and after the earlier passes that write the textures it writes,
+// - allocates transient textures, sharing the same texture between transient textures with the
+//   same size and format whose lifetimes don't overlap. Passes which render to transient textures
+//   without declaring a depth texture get a transient depth texture of their own, so depth buffers
+//   are shared in the same way.
+//
+// Declarations which can't be executed, such as a pass reading a texture that it writes, are
+// rejected with an error and ignored. Passes in a dependency cycle are reported as an error and not
+// executed.
+//
+// A typical deferred shading setup looks like:
+//
+//     auto albedo = graph.createTexture({width, height, TextureFormat::RGBA8});
+//     auto normal = graph.createTexture({width, height, TextureFormat::RGBA16F});
+//     graph.addPass("gbuffer", [&](RenderGraph::PassBuilder& b) {
+//         b.write(albedo);
+//         b.write(normal);
+//         b.setClear({0.0f, 0.0f, 0.0f});
+//     }, [&](Renderer& r, uint queue) { ... });
+//     graph.addPass("lighting", [&](RenderGraph::PassBuilder& b) {
+//         b.read(albedo);
+//         b.read(normal);
+//         b.writeBackbuffer();
+//     }, [&](Renderer& r, uint queue) {
+//         r.setTexture(0, graph.texture(albedo));
+//         ...
+//     });
+//     graph.execute();
+//
+// Passes are added again every frame, but the textures and frame buffers backing transient
+// textures are kept between frames. Textures and frame buffers which haven't been used for
+// kEvictAfterExecutions executions are deleted.
+class DW_API RenderGraph {
+    struct Pass;
+
+public:
+    using TextureId = u32;
+
+    struct TextureDesc {
+        u16 width;
+        u16 height;
+        TextureFormat format;
+
+        bool operator<(const TextureDesc& other) const {
+            return std::tie(width, height, format) <
+                   std::tie(other.width, other.height, other.format);
+        }
+    };
+
+    class DW_API PassBuilder {
+    public:
+        /// Declares that the pass samples a texture. A pass can't read a texture that it writes.
+        /// Returns false if the declaration was rejected.
+        bool read(TextureId texture);
+
+        /// Declares that the pass renders to a texture. The textures written by a pass make up the
+        /// colour attachments of its frame buffer, in the order they are declared. Returns false
+        /// if the declaration was rejected.
+        bool write(TextureId texture);
+
+        /// Declares that the pass renders to a depth texture, which becomes the depth attachment
+        /// of its frame buffer. Returns false if the declaration was rejected.
+        bool writeDepth(TextureId texture);
+
+        /// Declares that the pass renders to the backbuffer. Passes which write to the backbuffer
+        /// are never culled, and can't also write to textures. Returns false if the declaration
+        /// was rejected.
+        bool writeBackbuffer();
+
+        /// Clears the frame buffer before the pass is executed.
+        void setClear(const Colour& colour, bool clear_colour = true, bool clear_depth = true);
+
+    private:
+        friend class RenderGraph;
+
+        RenderGraph* graph_;
+        Pass* pass_;
+        PassBuilder(RenderGraph* graph, Pass* pass);
+
+        bool isValid(TextureId texture) const;
+        bool canWriteTextures() const;
+    };
+
+    using SetupFunction = std::function<void(PassBuilder& builder)>;
+    using ExecuteFunction = std::function<void(Renderer& r, uint render_queue)>;
+
+    RenderGraph(Logger& logger, Renderer& r);
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    /// Creates a texture which only lives for a single execution of the graph. Textures with a
+    /// depth format are written with PassBuilder::writeDepth.
+    TextureId createTexture(const TextureDesc& desc);
+
+    /// Imports a texture owned by the caller. Imported textures are never aliased, and passes which
+    /// write to them are never culled.
+    TextureId importTexture(TextureHandle handle);
+
+    /// Adds a pass. The setup function is called immediately to declare the pass's resources, and
+    /// the execute function is called from execute() to submit the pass's render items.
+    void addPass(const std::string& name, const SetupFunction& setup, ExecuteFunction execute);
+
+    /// Culls, orders and allocates the passes, then executes them, each in a new render queue. All
+    /// passes and textures are removed afterwards. Returns false if some passes weren't executed
+    /// because they are in, or depend on, a dependency cycle.
+    bool execute();
+
+    /// Returns the texture backing a texture id. Only valid inside an execute function.
+    TextureHandle texture(TextureId id) const;
+
+    /// Statistics from the last call to execute().
+    usize executedPassCount() const;
+    usize culledPassCount() const;
+    usize allocatedTextureCount() const;
+
+private:
+    struct Texture {
+        TextureDesc desc;
+        bool imported;
+        std::optional<TextureHandle> handle;
+        // Index of the first and last executed pass which uses the texture.
+        uint first_use;
+        uint last_use;
+    };
+
+    struct PooledTexture {
+        TextureHandle handle;
+        // The last executed pass which uses the texture during the current execution.
+        std::optional<uint> busy_until;
+        // The last execution which used the texture.
+        u64 last_used;
+    };
+
+    struct CachedFrameBuffer {
+        FrameBufferHandle handle;
+        // The last execution which used the frame buffer.
+        u64 last_used;
+    };
+
+    // Number of executions a pooled texture or cached frame buffer can go unused before it's
+    // deleted.
+    static constexpr u64 kEvictAfterExecutions = 3;
+
+    // Format of the depth textures created for passes which don't declare one.
+    static constexpr TextureFormat kTransientDepthFormat = TextureFormat::D24S8;
+
+    Logger& logger_;
+    Renderer& r_;
+    std::vector<Texture> textures_;
+    std::vector<std::unique_ptr<Pass>> passes_;
+
+    // Transient textures and frame buffers, kept between executions.
+    std::map<TextureDesc, std::vector<PooledTexture>> texture_pool_;
+    std::map<std::vector<TextureHandle::base_type>, CachedFrameBuffer> frame_buffer_cache_;
+
+    u64 execution_count_;
+    usize executed_pass_count_;
+    usize culled_pass_count_;
+
+    std::vector<Pass*> cullPasses();
+    // Passes in or depending on a cycle are reported and left out of the result.
+    std::vector<Pass*> orderPasses(const std::vector<Pass*>& passes);
+    void allocateTextures(const std::vector<Pass*>& passes);
+    FrameBufferHandle findOrCreateFrameBuffer(const std::vector<TextureHandle>& colour_textures,
+                                              std::optional<TextureHandle> depth_texture);
+    void evictUnusedResources();
+};
+}  // namespace gfx
+}  // namespace dw
@@ -23,6 +23,9 @@
 #include <atomic>
 #include <thread>
 #include <optional>
+#include <memory>
+#include <type_traits>
+#include <typeindex>
 
 #define DW_MAX_TEXTURE_SAMPLERS 8
 #define DW_MAX_TRANSIENT_VERTEX_BUFFER_SIZE (1 << 20)
@@ -60,8 +63,10 @@ DEFINE_HANDLE_TYPE(TransientIndexBufferHandle);
 DEFINE_HANDLE_TYPE(ShaderHandle);
 DEFINE_HANDLE_TYPE(ProgramHandle);
 DEFINE_HANDLE_TYPE(UniformBufferHandle);
+DEFINE_HANDLE_TYPE(StorageBufferHandle);
 DEFINE_HANDLE_TYPE(TextureHandle);
 DEFINE_HANDLE_TYPE(FrameBufferHandle);
+DEFINE_HANDLE_TYPE(OcclusionQueryHandle);
 
 namespace dw {
 namespace gfx {
@@ -69,8 +74,11 @@ namespace gfx {
 // Renderer type.
 enum class RendererType { Null, OpenGL, Vulkan };
 
+// Identifies a vertex decl interned by the renderer. Layout 0 is the empty vertex decl.
+using VertexLayoutId = u16;
+
 // Shader type.
-enum class ShaderStage { Vertex, Geometry, Fragment };
+enum class ShaderStage { Vertex, Geometry, Fragment, Compute };
 
 // Buffer usage.
 enum class BufferUsage {
@@ -150,6 +158,10 @@ enum class TextureFormat {
     Count
 };
 
+constexpr bool isDepthFormat(TextureFormat format) {
+    return format >= TextureFormat::D16 && format < TextureFormat::Count;
+}
+
 // Sampler flags.
 namespace SamplerFlag {
 enum Enum : std::uint32_t {
@@ -210,6 +222,21 @@ constexpr auto maskMipFilter = 0x0c00;
 constexpr auto shiftMipFilter = 10;
 }  // namespace SamplerFlag
 
+// Parts of the pending render item which are reset after it's submitted. Parts which aren't
+// discarded are kept for the next item, so drawing the same mesh many times only needs the
+// changes to be set between submits.
+namespace Discard {
+enum Enum : std::uint32_t {
+    None = 0,
+    VertexBuffer = 0x01,   // Vertex buffer, offset and vertex decl override.
+    IndexBuffer = 0x02,    // Index buffer, offset and index type override.
+    Uniforms = 0x04,       // Uniforms and uniform buffer bindings.
+    Textures = 0x08,       // Texture bindings.
+    State = 0x10,          // Render state and scissor.
+    All = 0x1f
+};
+}  // namespace Discard
+
 // Render states.
 enum class RenderState { CullFace, Depth, Blending };
 enum class CullFrontFace { CCW, CW };
@@ -233,6 +260,155 @@ enum class BlendFunc {
 };
 enum class BlendEquation { Add, Subtract, ReverseSubtract, Min, Max };
 
+// Fixed function state of a render item, packed into a single 64-bit word. Two states are compared
+// with one integer comparison, and the fields which differ are found by testing the masks below
+// against the XOR of the two words.
+class PackedRenderState {
+public:
+    static constexpr u64 kDepthEnabled = u64{1} << 0;
+    static constexpr u64 kDepthWrite = u64{1} << 1;
+    static constexpr u64 kCullFaceEnabled = u64{1} << 2;
+    static constexpr u64 kCullFrontFace = u64{1} << 3;
+    static constexpr u64 kPolygonMode = u64{1} << 4;
+    static constexpr u64 kColourWrite = u64{1} << 5;
+    static constexpr u64 kBlendEnabled = u64{1} << 6;
+    static constexpr u64 kBlendEquationRgb = u64{0x7} << 8;
+    static constexpr u64 kBlendEquationA = u64{0x7} << 11;
+    static constexpr u64 kBlendSrcRgb = u64{0xf} << 16;
+    static constexpr u64 kBlendDestRgb = u64{0xf} << 20;
+    static constexpr u64 kBlendSrcA = u64{0xf} << 24;
+    static constexpr u64 kBlendDestA = u64{0xf} << 28;
+    static constexpr u64 kBlendEquation = kBlendEquationRgb | kBlendEquationA;
+    static constexpr u64 kBlendFunc = kBlendSrcRgb | kBlendDestRgb | kBlendSrcA | kBlendDestA;
+
+    // Depth test, depth write, back face culling of counter-clockwise faces, filled polygons,
+    // colour write, and blending disabled with an additive One/Zero blend function.
+    PackedRenderState()
+        : bits_(kDepthEnabled | kDepthWrite | kCullFaceEnabled | kColourWrite |
+                encode(kBlendSrcRgb, BlendFunc::One) | encode(kBlendSrcA, BlendFunc::One)) {
+    }
+
+    u64 bits() const {
+        return bits_;
+    }
+
+    bool depthEnabled() const {
+        return (bits_ & kDepthEnabled) != 0;
+    }
+    bool depthWrite() const {
+        return (bits_ & kDepthWrite) != 0;
+    }
+    bool cullFaceEnabled() const {
+        return (bits_ & kCullFaceEnabled) != 0;
+    }
+    CullFrontFace cullFrontFace() const {
+        return decode<CullFrontFace>(kCullFrontFace);
+    }
+    PolygonMode polygonMode() const {
+        return decode<PolygonMode>(kPolygonMode);
+    }
+    bool colourWrite() const {
+        return (bits_ & kColourWrite) != 0;
+    }
+    bool blendEnabled() const {
+        return (bits_ & kBlendEnabled) != 0;
+    }
+    BlendEquation blendEquationRgb() const {
+        return decode<BlendEquation>(kBlendEquationRgb);
+    }
+    BlendEquation blendEquationA() const {
+        return decode<BlendEquation>(kBlendEquationA);
+    }
+    BlendFunc blendSrcRgb() const {
+        return decode<BlendFunc>(kBlendSrcRgb);
+    }
+    BlendFunc blendDestRgb() const {
+        return decode<BlendFunc>(kBlendDestRgb);
+    }
+    BlendFunc blendSrcA() const {
+        return decode<BlendFunc>(kBlendSrcA);
+    }
+    BlendFunc blendDestA() const {
+        return decode<BlendFunc>(kBlendDestA);
+    }
+
+    void setDepthEnabled(bool enabled) {
+        set(kDepthEnabled, enabled);
+    }
+    void setDepthWrite(bool enabled) {
+        set(kDepthWrite, enabled);
+    }
+    void setCullFaceEnabled(bool enabled) {
+        set(kCullFaceEnabled, enabled);
+    }
+    void setCullFrontFace(CullFrontFace front_face) {
+        set(kCullFrontFace, front_face);
+    }
+    void setPolygonMode(PolygonMode polygon_mode) {
+        set(kPolygonMode, polygon_mode);
+    }
+    void setColourWrite(bool enabled) {
+        set(kColourWrite, enabled);
+    }
+    void setBlendEnabled(bool enabled) {
+        set(kBlendEnabled, enabled);
+    }
+    void setBlendEquation(BlendEquation equation_rgb, BlendFunc src_rgb, BlendFunc dest_rgb,
+                          BlendEquation equation_a, BlendFunc src_a, BlendFunc dest_a) {
+        set(kBlendEquationRgb, equation_rgb);
+        set(kBlendEquationA, equation_a);
+        set(kBlendSrcRgb, src_rgb);
+        set(kBlendDestRgb, dest_rgb);
+        set(kBlendSrcA, src_a);
+        set(kBlendDestA, dest_a);
+    }
+
+    bool operator==(const PackedRenderState& other) const {
+        return bits_ == other.bits_;
+    }
+    bool operator!=(const PackedRenderState& other) const {
+        return bits_ != other.bits_;
+    }
+
+private:
+    u64 bits_;
+
+    // Returns the index of the lowest bit of a field.
+    static constexpr u64 shift(u64 mask) {
+        u64 s = 0;
+        while ((mask & 1) == 0) {
+            mask >>= 1;
+            ++s;
+        }
+        return s;
+    }
+    template <typename T> static constexpr u64 encode(u64 mask, T value) {
+        return (static_cast<u64>(value) << shift(mask)) & mask;
+    }
+    template <typename T> T decode(u64 mask) const {
+        return static_cast<T>((bits_ & mask) >> shift(mask));
+    }
+    template <typename T> void set(u64 mask, T value) {
+        bits_ = (bits_ & ~mask) | encode(mask, value);
+    }
+};
+
+// What happens to the contents of a frame buffer attachment at the start and end of a render
+// queue. DontCare allows the backend to skip loading or storing the attachment.
+enum class AttachmentLoadOp { Clear, Load, DontCare };
+enum class AttachmentStoreOp { Store, DontCare };
+struct AttachmentOps {
+    AttachmentLoadOp colour_load;
+    AttachmentStoreOp colour_store;
+    AttachmentLoadOp depth_load;
+    AttachmentStoreOp depth_store;
+
+    bool operator==(const AttachmentOps& other) const {
+        return colour_load == other.colour_load && colour_store == other.colour_store &&
+               depth_load == other.depth_load && depth_store == other.depth_store;
+    }
+};
+
 // Shader stage info.
 struct ShaderStageInfo {
     ShaderStage stage;
@@ -242,11 +418,16 @@ struct ShaderStageInfo {
 
 // Render commands.
 namespace cmd {
+struct CreateVertexLayout {
+    VertexLayoutId id;
+    VertexDecl decl;
+};
+
 struct CreateVertexBuffer {
     VertexBufferHandle handle;
     Memory data;
     uint size;
-    VertexDecl decl;
+    VertexLayoutId layout;
     BufferUsage usage;
 };
 
@@ -287,6 +468,40 @@ struct DeleteProgram {
     ProgramHandle handle;
 };
 
+struct CreateUniformBuffer {
+    UniformBufferHandle handle;
+    Memory data;
+    uint size;
+    BufferUsage usage;
+};
+
+struct UpdateUniformBuffer {
+    UniformBufferHandle handle;
+    Memory data;
+    uint offset;
+};
+
+struct DeleteUniformBuffer {
+    UniformBufferHandle handle;
+};
+
+struct CreateStorageBuffer {
+    StorageBufferHandle handle;
+    Memory data;
+    uint size;
+    BufferUsage usage;
+};
+
+struct UpdateStorageBuffer {
+    StorageBufferHandle handle;
+    Memory data;
+    uint offset;
+};
+
+struct DeleteStorageBuffer {
+    StorageBufferHandle handle;
+};
+
 struct CreateTexture2D {
     TextureHandle handle;
     u16 width;
@@ -295,6 +510,8 @@ struct CreateTexture2D {
     Memory data;
     bool generate_mipmaps;
     bool framebuffer_usage;
+    // Allows the texture to be bound as a storage image in compute programs.
+    bool storage_usage;
 };
 
 struct DeleteTexture {
@@ -307,16 +524,30 @@ struct CreateFrameBuffer {
     u16 height;
     // TODO: do we own textures or does the user own textures? add a flag?
     std::vector<TextureHandle> textures;
+    // If not set, the frame buffer has its own depth buffer which can't be sampled.
+    std::optional<TextureHandle> depth_texture;
+    // If greater than 1, rendering happens into multisampled attachments owned by the frame
+    // buffer, which are resolved into the textures at the end of each render queue.
+    uint samples;
 };
 
 struct DeleteFrameBuffer {
     FrameBufferHandle handle;
 };
+
+struct CreateOcclusionQuery {
+    OcclusionQueryHandle handle;
+};
+
+struct DeleteOcclusionQuery {
+    OcclusionQueryHandle handle;
+};
 }  // namespace cmd
 
 // clang-format off
 using RenderCommand =
-    std::variant<cmd::CreateVertexBuffer,
+    std::variant<cmd::CreateVertexLayout,
+            cmd::CreateVertexBuffer,
             cmd::UpdateVertexBuffer,
             cmd::DeleteVertexBuffer,
             cmd::CreateIndexBuffer,
@@ -324,15 +555,90 @@ using RenderCommand =
             cmd::DeleteIndexBuffer,
             cmd::CreateProgram,
             cmd::DeleteProgram,
+            cmd::CreateUniformBuffer,
+            cmd::UpdateUniformBuffer,
+            cmd::DeleteUniformBuffer,
+            cmd::CreateStorageBuffer,
+            cmd::UpdateStorageBuffer,
+            cmd::DeleteStorageBuffer,
             cmd::CreateTexture2D,
             cmd::DeleteTexture,
             cmd::CreateFrameBuffer,
-            cmd::DeleteFrameBuffer>;
+            cmd::DeleteFrameBuffer,
+            cmd::CreateOcclusionQuery,
+            cmd::DeleteOcclusionQuery>;
 // clang-format on
 
-using UniformData = std::variant<int, float, Vec2, Vec3, Vec4, Mat3, Mat4>;
+// The elements of a uniform array, packed with the std140 layout of the array. Each element starts
+// at a multiple of the stride, which is a multiple of 16 bytes.
+struct UniformArray {
+    uint stride;
+    std::vector<byte> data;
+
+    bool operator==(const UniformArray& other) const {
+        return stride == other.stride && data == other.data;
+    }
+};
+
+using UniformData = std::variant<int, float, Vec2, Vec3, Vec4, Mat3, Mat4, UniformArray>;
+
+// The size and members of a struct passed to Renderer::setUniformBlock. Members are checked
+// against the members with the same name in each uniform block that the struct is used with.
+struct UniformBlockLayout {
+    struct Member {
+        std::string name;
+        uint offset;
+    };
+
+    uint size;
+    std::vector<Member> members;
+};
+
+// A range of elements in one of a frame's arenas.
+struct ArenaRange {
+    u32 offset = 0;
+    u32 count = 0;
+
+    bool operator==(const ArenaRange& other) const {
+        return offset == other.offset && count == other.count;
+    }
+};
+
+// The elements of an arena which are in a range.
+template <typename T> class ArenaView {
+public:
+    ArenaView(const std::vector<T>& arena, ArenaRange range)
+        : begin_(arena.data() + range.offset), end_(begin_ + range.count) {
+    }
+
+    const T* begin() const {
+        return begin_;
+    }
+
+    const T* end() const {
+        return end_;
+    }
+
+    usize size() const {
+        return static_cast<usize>(end_ - begin_);
+    }
+
+    bool empty() const {
+        return begin_ == end_;
+    }
+
+    const T& operator[](usize index) const {
+        return begin_[index];
+    }
+
+private:
+    const T* begin_;
+    const T* end_;
+};
 
-// Current render state.
+// A draw or dispatch submitted to a render queue. Items are trivially copyable: their uniforms and
+// bindings are stored in the arenas of the frame that they were submitted to, and the item only
+// holds the ranges of the arenas which belong to it.
 struct RenderItem {
     struct SamplerInfo {
         u32 sampler_flags;
@@ -354,18 +660,66 @@ struct RenderItem {
         }
     };
 
+    struct UniformBufferBinding {
+        uint binding_location;
+        UniformBufferHandle handle;
+        uint offset;
+
+        bool operator==(const UniformBufferBinding& other) const {
+            return binding_location == other.binding_location && handle == other.handle &&
+                   offset == other.offset;
+        }
+    };
+
+    struct UniformBlockData {
+        uint binding_location;
+        // Range of the frame's uniform block data arena holding the block's contents.
+        ArenaRange data;
+        // Layout of the struct that the data was set from, or nullptr if it was set from bytes.
+        const UniformBlockLayout* layout;
+    };
+
+    struct StorageBufferBinding {
+        uint binding_location;
+        StorageBufferHandle handle;
+
+        bool operator==(const StorageBufferBinding& other) const {
+            return binding_location == other.binding_location && handle == other.handle;
+        }
+    };
+
+    struct StorageImageBinding {
+        uint binding_location;
+        TextureHandle handle;
+
+        bool operator==(const StorageImageBinding& other) const {
+            return binding_location == other.binding_location && handle == other.handle;
+        }
+    };
+
     // Vertices and indices.
     std::optional<VertexBufferHandle> vb;
     uint vb_offset = 0;  // Offset in bytes.
-    VertexDecl vertex_decl_override;
+    VertexLayoutId vertex_layout = 0;
     std::optional<IndexBufferHandle> ib;  // Offset in bytes.
     uint ib_offset = 0;
+    std::optional<IndexBufferType> index_type_override;
+    uint base_vertex = 0;  // Added to each index before fetching vertices.
     uint primitive_count = 0;
 
-    // Shader program and parameters.
+    // Shader program, and the ranges of the frame's arenas holding its parameters.
     std::optional<ProgramHandle> program;
-    std::unordered_map<std::string, UniformData> uniforms;
-    std::vector<TextureBinding> textures;
+    ArenaRange uniforms;
+    ArenaRange uniform_blocks;
+    ArenaRange uniform_buffers;
+    ArenaRange textures;
+    ArenaRange storage_buffers;
+    ArenaRange storage_images;
+
+    // Number of work groups of a compute item.
+    uint group_count_x = 0;
+    uint group_count_y = 0;
+    uint group_count_z = 0;
 
     // Scissor.
     bool scissor_enabled = false;
@@ -374,21 +728,43 @@ struct RenderItem {
     u16 scissor_width = 0;
     u16 scissor_height = 0;
 
-    // Render state.
-    bool depth_enabled = true;
-    bool cull_face_enabled = true;
-    CullFrontFace cull_front_face = CullFrontFace::CCW;
-    PolygonMode polygon_mode = PolygonMode::Fill;
-    bool blend_enabled = false;
-    BlendEquation blend_equation_rgb = BlendEquation::Add;
-    BlendFunc blend_src_rgb = BlendFunc::One;
-    BlendFunc blend_dest_rgb = BlendFunc::Zero;
-    BlendEquation blend_equation_a = BlendEquation::Add;
-    BlendFunc blend_src_a = BlendFunc::One;
-    BlendFunc blend_dest_a = BlendFunc::Zero;
-    bool colour_write = true;  // TODO: make component-wise
-    bool depth_write = true;
-    // TODO: Stencil write.
+    // Render state. TODO: Make colour write component-wise, and add stencil write.
+    PackedRenderState state;
+
+    // Occlusion query which counts the samples drawn by this item. Items which share a query must
+    // be submitted one after another to the same render queue.
+    std::optional<OcclusionQueryHandle> occlusion_query;
+    // Query checked when this item is submitted. The item is dropped if the last result of the
+    // query was zero samples.
+    std::optional<OcclusionQueryHandle> occlusion_condition;
+
+    // Set when this item is identical to the previous item in the same render queue except for
+    // its index range and scissor, so backends only need to update the scissor and draw.
+    bool continues_previous = false;
+};
+static_assert(std::is_trivially_copyable<RenderItem>::value,
+              "Render items must be trivially copyable.");
+
+// State set for the next render item. Its uniforms and bindings are written to the frame's arenas
+// when the item is submitted. Uniforms and uniform blocks which are kept between items are only
+// written again once they change, so the items share the same ranges until then.
+struct PendingRenderItem {
+    struct UniformBlock {
+        uint binding_location;
+        std::vector<byte> data;
+        const UniformBlockLayout* layout;
+    };
+
+    RenderItem item;
+    std::unordered_map<std::string, UniformData> uniforms;
+    std::vector<UniformBlock> uniform_blocks;
+    std::vector<RenderItem::UniformBufferBinding> uniform_buffers;
+    std::vector<RenderItem::TextureBinding> textures;
+    std::vector<RenderItem::StorageBufferBinding> storage_buffers;
+    std::vector<RenderItem::StorageImageBinding> storage_images;
+    // Whether item.uniforms and item.uniform_blocks hold the current uniforms and uniform blocks.
+    bool uniforms_written = true;
+    bool uniform_blocks_written = true;
 };
 
 // Render queue.
@@ -399,19 +775,89 @@ struct RenderQueue {
         bool clear_depth;
     };
     std::optional<ClearParameters> clear_parameters;
+    // Set explicitly with Renderer::setRenderQueueAttachmentOps, otherwise derived from the clear
+    // parameters and later render queues when the frame is submitted.
+    std::optional<AttachmentOps> attachment_ops;
     std::optional<FrameBufferHandle> frame_buffer;
+    // Textures sampled by this queue which were rendered to by an earlier queue. Backends which
+    // need explicit barriers transition these before the queue starts.
+    std::vector<TextureHandle> read_textures;
+    // Uniforms shared by the render items in this queue. Backends apply them whenever the program
+    // changes between render items, before the item's own uniforms.
+    std::unordered_map<std::string, UniformData> uniforms;
+    // Textures bound for each render item submitted to this queue, unless the item binds its own
+    // texture to the same binding location.
+    std::vector<RenderItem::TextureBinding> textures;
+    // Compute items, dispatched in order before the render items. Backends insert barriers after
+    // each dispatch so that later dispatches and the render items see the results.
+    std::vector<RenderItem> compute_items;
     std::vector<RenderItem> render_items;
 };
 
+// Description of the attachments of a frame buffer.
+struct FrameBufferDesc {
+    // Colour attachments. Can be empty for depth only frame buffers, such as shadow maps.
+    std::vector<TextureHandle> colour_textures;
+    // Depth attachment, which must be a texture with a depth format. It can be sampled once the
+    // frame buffer has been rendered to, and shared between frame buffers of the same size. If not
+    // set, the frame buffer has its own depth buffer.
+    std::optional<TextureHandle> depth_texture;
+    // Multisampled frame buffers can't have a depth texture, as depth isn't resolved. Creating one
+    // fails.
+    uint samples = 1;
+};
+
+// Description of a frame buffer acquired with Renderer::acquireTransientFrameBuffer.
+struct TransientFrameBufferDesc {
+    u16 width;
+    u16 height;
+    // One colour attachment per format.
+    std::vector<TextureFormat> formats;
+    uint samples = 1;
+
+    bool operator==(const TransientFrameBufferDesc& other) const {
+        return width == other.width && height == other.height && formats == other.formats &&
+               samples == other.samples;
+    }
+};
+
+// Statistics about the items submitted in a frame.
+struct FrameStats {
+    usize submitted_items = 0;
+    // Items merged into the previous item in the same render queue, as they drew the next range of
+    // the same buffers with identical state.
+    usize merged_items = 0;
+    // Items which only changed the scissor or index range of the previous item.
+    usize continued_items = 0;
+};
+
 // Frame.
 class Renderer;
 struct Frame {
     Frame();
     void clear();
 
-    RenderItem pending_item;
+    // The arena ranges of a render item submitted to this frame.
+    ArenaView<std::pair<std::string, UniformData>> uniforms(const RenderItem& item) const;
+    ArenaView<RenderItem::UniformBlockData> uniformBlocks(const RenderItem& item) const;
+    ArenaView<byte> uniformBlockData(const RenderItem::UniformBlockData& block) const;
+    ArenaView<RenderItem::UniformBufferBinding> uniformBuffers(const RenderItem& item) const;
+    ArenaView<RenderItem::TextureBinding> textures(const RenderItem& item) const;
+    ArenaView<RenderItem::StorageBufferBinding> storageBuffers(const RenderItem& item) const;
+    ArenaView<RenderItem::StorageImageBinding> storageImages(const RenderItem& item) const;
+
+    PendingRenderItem pending;
     std::vector<RenderQueue> render_queues;
 
+    // Arenas holding the uniforms and bindings of the render items submitted to this frame.
+    std::vector<std::pair<std::string, UniformData>> uniform_arena;
+    std::vector<RenderItem::UniformBlockData> uniform_block_arena;
+    std::vector<byte> uniform_block_data_arena;
+    std::vector<RenderItem::UniformBufferBinding> uniform_buffer_arena;
+    std::vector<RenderItem::TextureBinding> texture_arena;
+    std::vector<RenderItem::StorageBufferBinding> storage_buffer_arena;
+    std::vector<RenderItem::StorageImageBinding> storage_image_arena;
+
     std::vector<RenderCommand> commands_pre;
     std::vector<RenderCommand> commands_post;
 
@@ -432,7 +878,7 @@ struct Frame {
     struct TransientVertexBufferData {
         byte* data;
         uint size;
-        VertexDecl decl;
+        VertexLayoutId layout;
     };
     std::unordered_map<TransientVertexBufferHandle, TransientVertexBufferData>
         transient_vertex_buffers_;
@@ -440,6 +886,7 @@ struct Frame {
     struct TransientIndexBufferData {
         byte* data;
         uint size;
+        IndexBufferType type;
     };
     std::unordered_map<TransientIndexBufferHandle, TransientIndexBufferData>
         transient_index_buffers_;
@@ -472,6 +919,10 @@ public:
     /// (OpenGL, D3D).
     bool hasFlippedViewport() const;
 
+    /// Interns a vertex decl, returning the id of its layout. Vertex decls which compare equal
+    /// share the same layout, which is only created in the backend once.
+    VertexLayoutId createVertexLayout(const VertexDecl& decl);
+
     /// Create vertex buffer.
     VertexBufferHandle createVertexBuffer(Memory data, const VertexDecl& decl,
                                           BufferUsage usage = BufferUsage::Static);
@@ -493,7 +944,8 @@ public:
     void setVertexBuffer(TransientVertexBufferHandle handle);
 
     /// Transient index buffer.
-    std::optional<TransientIndexBufferHandle> allocTransientIndexBuffer(uint index_count);
+    std::optional<TransientIndexBufferHandle> allocTransientIndexBuffer(
+        uint index_count, IndexBufferType type = IndexBufferType::U16);
     byte* getTransientIndexBufferData(TransientIndexBufferHandle handle);
     void setIndexBuffer(TransientIndexBufferHandle handle);
 
@@ -511,21 +963,88 @@ public:
     void setUniform(const std::string& uniform_name, const Mat4& value);
     void setUniform(const std::string& uniform_name, UniformData data);
 
+    /// Sets the elements of a uniform array, such as a bone palette or a list of lights, starting
+    /// from the first element. Elements past the end of the array in the shader are ignored.
+    void setUniformArray(const std::string& uniform_name, const int* values, uint count);
+    void setUniformArray(const std::string& uniform_name, const float* values, uint count);
+    void setUniformArray(const std::string& uniform_name, const Vec2* values, uint count);
+    void setUniformArray(const std::string& uniform_name, const Vec3* values, uint count);
+    void setUniformArray(const std::string& uniform_name, const Vec4* values, uint count);
+    void setUniformArray(const std::string& uniform_name, const Mat3* values, uint count);
+    void setUniformArray(const std::string& uniform_name, const Mat4* values, uint count);
+
+    /// Sets every uniform in a uniform block at once from a struct with the block's std140 layout.
+    /// Matrices must be stored column-major. The first time a struct is drawn with a block of a
+    /// shader program, its size and declared members are checked against the block, and the
+    /// result is kept for later items. Uniforms set with setUniform are applied after the block.
+    template <typename T> void setUniformBlock(uint binding_location, const T& data) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Uniform blocks must be trivially copyable.");
+        setUniformBlock(binding_location, reinterpret_cast<const byte*>(&data), sizeof(T),
+                        findOrCreateUniformBlockLayout(typeid(T), sizeof(T)));
+    }
+    void setUniformBlock(uint binding_location, const byte* data, uint size);
+
+    /// Declares the offsets of the members of a struct used with setUniformBlock, so that they're
+    /// checked against the offsets of the members with the same names in the block. A struct must
+    /// be declared before it's first used. For example:
+    ///
+    ///     r.declareUniformBlock<Camera>({{"view", offsetof(Camera, view)},
+    ///                                    {"position", offsetof(Camera, position)}});
+    template <typename T>
+    void declareUniformBlock(std::vector<UniformBlockLayout::Member> members) {
+        declareUniformBlock(typeid(T), sizeof(T), std::move(members));
+    }
+
+    /// Uniform buffers hold the contents of a uniform block, so that uniforms shared by many items
+    /// (such as camera and lighting parameters) are uploaded once instead of being set on each
+    /// item. A buffer created with only a size is uninitialised until it's updated, and defaults
+    /// to stream usage so that it can be updated every frame without waiting for the GPU.
+    UniformBufferHandle createUniformBuffer(uint size, BufferUsage usage = BufferUsage::Stream);
+    UniformBufferHandle createUniformBuffer(Memory data, BufferUsage usage = BufferUsage::Static);
+    void updateUniformBuffer(UniformBufferHandle handle, Memory data, uint offset = 0);
+    void deleteUniformBuffer(UniformBufferHandle handle);
+
+    /// Binds a range of a uniform buffer to a uniform block binding location defined in the current
+    /// shader program, instead of the uniforms set with setUniform. The offset is in bytes, and
+    /// must be a multiple of the backend's uniform buffer offset alignment, which is never more
+    /// than 256 bytes.
+    void setUniformBuffer(uint binding_location, UniformBufferHandle handle, uint offset = 0);
+
     // Create texture.
     TextureHandle createTexture2D(u16 width, u16 height, TextureFormat format, Memory data,
-                                  bool generate_mipmaps = true, bool framebuffer_usage = false);
+                                  bool generate_mipmaps = true, bool framebuffer_usage = false,
+                                  bool storage_usage = false);
     // get texture information.
     void deleteTexture(TextureHandle handle);
     // Binds a texture to a binding location defined in the current shader program.
     bool setTexture(uint binding_location, TextureHandle handle,
                     u32 sampler_flags = SamplerFlag::Default, float max_anisotropy = 0.0f);
 
-    // Framebuffer.
-    FrameBufferHandle createFrameBuffer(u16 width, u16 height, TextureFormat format);
-    FrameBufferHandle createFrameBuffer(std::vector<TextureHandle> textures);
+    // Framebuffer. If samples is greater than 1, the frame buffer renders to multisampled
+    // attachments which are resolved into its textures at the end of each render queue. The
+    // multisampled colour is discarded after resolving, so loading colour in a later render queue
+    // doesn't load the samples. The sample count is reduced to the highest count supported by the
+    // backend. If the format passed to createFrameBuffer is a depth format, the frame buffer only
+    // has a depth texture. If the frame buffer can't be created, an error is logged and an invalid
+    // handle is returned.
+    FrameBufferHandle createFrameBuffer(u16 width, u16 height, TextureFormat format,
+                                        uint samples = 1);
+    FrameBufferHandle createFrameBuffer(std::vector<TextureHandle> textures, uint samples = 1);
+    FrameBufferHandle createFrameBuffer(const FrameBufferDesc& desc);
     TextureHandle getFrameBufferTexture(FrameBufferHandle handle, uint index);
+    std::optional<TextureHandle> getFrameBufferDepthTexture(FrameBufferHandle handle);
     void deleteFrameBuffer(FrameBufferHandle handle);
 
+    /// Returns a frame buffer from a pool of frame buffers which is only valid until the end of the
+    /// current frame. Frame buffers are reused by later acquires with the same description, and are
+    /// deleted once they haven't been acquired for a number of frames. The returned frame buffer
+    /// must not be deleted by the caller.
+    FrameBufferHandle acquireTransientFrameBuffer(const TransientFrameBufferDesc& desc);
+
+    /// Sets the number of frames after which an unused transient frame buffer is deleted.
+    void setTransientFrameBufferIdleFrames(uint frames);
+
     /// Creates a new render queue that outputs to a specific frame buffer.
     /// @param frame_buffer Framebuffer to output to. To output to the backbuffer, set this to
     /// std::nullopt.
@@ -545,6 +1064,79 @@ public:
     void setRenderQueueClear(uint render_queue, const Colour& colour, bool clear_colour = true,
                              bool clear_depth = true);
 
+    /// Declares the textures that a render queue samples which were rendered to by an earlier
+    /// render queue, so that the backend can transition them before the queue is processed.
+    /// Attachments of the render queue's own frame buffer can't be inputs, and are skipped with an
+    /// error.
+    void setRenderQueueInputs(uint render_queue, std::vector<TextureHandle> textures);
+
+    /// Overrides how a render queue loads and stores its frame buffer's attachments. By default,
+    /// attachments are cleared if the render queue has clear parameters and loaded otherwise,
+    /// colour is always stored, and depth is only stored if a later render queue in the same frame
+    /// loads it. Depth is not preserved between frames unless it is stored explicitly.
+    void setRenderQueueAttachmentOps(uint render_queue, const AttachmentOps& ops);
+
+    /// Sets a uniform for every render item in a render queue, such as the view and projection
+    /// matrices, so that it's only set and uploaded once. Render items can override it by setting
+    /// the same uniform or its uniform block, which only lasts for that render item.
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name, int value);
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name, float value);
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                               const Vec2& value);
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                               const Vec3& value);
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                               const Vec4& value);
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                               const Mat3& value);
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                               const Mat4& value);
+    void setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                               UniformData data);
+
+    /// Sets the elements of a uniform array for every render item in a render queue, starting from
+    /// the first element, like setUniformArray.
+    void setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                    const int* values, uint count);
+    void setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                    const float* values, uint count);
+    void setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                    const Vec2* values, uint count);
+    void setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                    const Vec3* values, uint count);
+    void setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                    const Vec4* values, uint count);
+    void setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                    const Mat3* values, uint count);
+    void setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                    const Mat4* values, uint count);
+
+    /// Binds a texture for every render item submitted to a render queue after this call, unless
+    /// the render item binds its own texture to the same binding location.
+    bool setRenderQueueTexture(uint render_queue, uint binding_location, TextureHandle handle,
+                               u32 sampler_flags = SamplerFlag::Default,
+                               float max_anisotropy = 0.0f);
+
+    /// Storage buffers, which can be read and written by compute programs.
+    StorageBufferHandle createStorageBuffer(Memory data, BufferUsage usage = BufferUsage::Static);
+    void updateStorageBuffer(StorageBufferHandle handle, Memory data, uint offset);
+    void deleteStorageBuffer(StorageBufferHandle handle);
+
+    /// Binds a storage buffer to a binding location defined in the current compute program.
+    void setStorageBuffer(uint binding_location, StorageBufferHandle handle);
+
+    /// Binds a texture created with storage usage as a storage image to a binding location defined
+    /// in the current compute program.
+    void setStorageImage(uint binding_location, TextureHandle handle);
+
+    /// Update uniform state, then dispatches a compute program with the given number of work
+    /// groups. Dispatches in a render queue run in order before the queue's draws, and writes to
+    /// storage buffers and images are visible to everything that runs after them. The uniforms,
+    /// textures and buffer bindings set before the dispatch are used by it and reset afterwards,
+    /// but the vertex buffer, index buffer and render state set for the next draw are kept.
+    void dispatch(uint render_queue, ProgramHandle program, uint group_count_x,
+                  uint group_count_y = 1, uint group_count_z = 1);
+
     /// Update state.
     void setStateEnable(RenderState state);
     void setStateDisable(RenderState state);
@@ -559,6 +1151,24 @@ public:
     /// Scissor.
     void setScissor(u16 x, u16 y, u16 width, u16 height);
 
+    /// Occlusion queries. Items submitted between beginOcclusionQuery() and endOcclusionQuery()
+    /// are counted by the query, and the result becomes available asynchronously once the GPU has
+    /// finished the frame, which is usually the following frame.
+    OcclusionQueryHandle createOcclusionQuery();
+    void deleteOcclusionQuery(OcclusionQueryHandle handle);
+    void beginOcclusionQuery(OcclusionQueryHandle handle);
+    void endOcclusionQuery();
+
+    /// Returns true if any samples passed the depth test the last time the query completed, or
+    /// std::nullopt if no result is available yet.
+    std::optional<bool> getOcclusionQueryResult(OcclusionQueryHandle handle) const;
+
+    /// Skips the next submitted item if the last result of an occlusion query passed zero samples.
+    /// Items are never skipped before the query has a result. The query itself usually surrounds a
+    /// cheap proxy such as a bounding box, so that the query is still updated while the expensive
+    /// item is skipped.
+    void setOcclusionCondition(OcclusionQueryHandle handle);
+
     /// Update uniform and draw state, but submit no geometry. Submits to the last created render
     /// queue.
     void submit(ProgramHandle program);
@@ -568,11 +1178,17 @@ public:
 
     /// Update uniform and draw state, then draw. Submits to the last created render queue.
     /// Offset is in vertices/indices depending on whether an index buffer is being used.
-    void submit(ProgramHandle program, uint vertex_count, uint offset = 0);
+    /// Base vertex is added to each index when drawing with an index buffer.
+    /// Discard is a combination of Discard flags, which selects the state that is reset afterwards.
+    void submit(ProgramHandle program, uint vertex_count, uint offset = 0, uint base_vertex = 0,
+                u32 discard = Discard::All);
 
     /// Update uniform and draw state, then draw.
     /// Offset is in vertices/indices depending on whether an index buffer is being used.
-    void submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset = 0);
+    /// Base vertex is added to each index when drawing with an index buffer.
+    /// Discard is a combination of Discard flags, which selects the state that is reset afterwards.
+    void submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset = 0,
+                uint base_vertex = 0, u32 discard = Discard::All);
 
     /// Update uniform and draw state, then draws a full screen quad. Submits to the last created
     /// render queue.
@@ -596,6 +1212,9 @@ public:
     /// Get the currently active renderer.
     RendererType rendererType() const;
 
+    /// Get statistics about the last frame.
+    const FrameStats& frameStats() const;
+
 private:
     Logger& logger_;
 
@@ -611,21 +1230,35 @@ private:
     HandleGenerator<IndexBufferHandle> index_buffer_handle_;
     HandleGenerator<ShaderHandle> shader_handle_;
     HandleGenerator<ProgramHandle> program_handle_;
+    HandleGenerator<UniformBufferHandle> uniform_buffer_handle_;
+    HandleGenerator<StorageBufferHandle> storage_buffer_handle_;
     HandleGenerator<TextureHandle> texture_handle_;
     HandleGenerator<FrameBufferHandle> frame_buffer_handle_;
+    HandleGenerator<OcclusionQueryHandle> occlusion_query_handle_;
+
+    // Vertex layouts, indexed by id.
+    std::vector<VertexDecl> vertex_layouts_;
+    std::unordered_map<VertexDecl, VertexLayoutId> vertex_layout_ids_;
 
     // Vertex/index buffers.
     struct VertexBufferInfo {
-        VertexDecl decl;
+        VertexLayoutId layout;
         BufferUsage usage;
     };
     std::unordered_map<VertexBufferHandle, VertexBufferInfo> vertex_buffer_info_;
     std::unordered_map<IndexBufferHandle, IndexBufferType> index_buffer_types_;
+    std::unordered_map<UniformBufferHandle, BufferUsage> uniform_buffer_usages_;
+    std::unordered_map<StorageBufferHandle, BufferUsage> storage_buffer_usages_;
     VertexBufferHandle transient_vb;
     uint transient_vb_max_size;
     IndexBufferHandle transient_ib;
     uint transient_ib_max_size;
 
+    // Layouts of the structs used with setUniformBlock. Render items point to these, so they're
+    // never removed.
+    std::unordered_map<std::type_index, std::unique_ptr<UniformBlockLayout>>
+        uniform_block_layouts_;
+
     // Textures.
     struct TextureData {
         u16 width;
@@ -635,11 +1268,29 @@ private:
     std::unordered_map<TextureHandle, TextureData> texture_data_;
 
     // Framebuffers.
-    std::unordered_map<FrameBufferHandle, std::vector<TextureHandle>> frame_buffer_textures_;
+    std::unordered_map<FrameBufferHandle, FrameBufferDesc> frame_buffer_descs_;
+
+    // Transient framebuffers.
+    struct TransientFrameBuffer {
+        TransientFrameBufferDesc desc;
+        FrameBufferHandle handle;
+        bool in_use;
+        u64 last_used_frame;
+    };
+    std::vector<TransientFrameBuffer> transient_frame_buffers_;
+    uint transient_frame_buffer_idle_frames_;
+    u64 frame_counter_;
 
     // Fullscreen quad.
     VertexBufferHandle fullscreen_quad_vb_;
 
+    // Occlusion query applied to submitted items.
+    std::optional<OcclusionQueryHandle> active_occlusion_query_;
+
+    // Frame statistics.
+    FrameStats frame_stats_;
+    FrameStats last_frame_stats_;
+
     // Shared.
     std::atomic<bool> shared_rt_should_exit_;
     bool shared_rt_finished_;
@@ -652,10 +1303,27 @@ private:
     Frame* submit_;
     Frame* render_;
 
+    // Uniform blocks.
+    const UniformBlockLayout* findOrCreateUniformBlockLayout(std::type_index type, uint size);
+    void declareUniformBlock(std::type_index type, uint size,
+                             std::vector<UniformBlockLayout::Member> members);
+    void setUniformBlock(uint binding_location, const byte* data, uint size,
+                         const UniformBlockLayout* layout);
+
     // Add a command to the submit thread.
     void submitPreFrameCommand(RenderCommand command);
     void submitPostFrameCommand(RenderCommand command);
 
+    // Merges an item into the previous item in its render queue if it draws the next range of the
+    // same buffers with identical state. Returns true if the item was merged.
+    bool mergeRenderItem(RenderItem& previous, RenderItem& item);
+
+    // Releases transient frame buffers acquired this frame and deletes idle ones.
+    void recycleTransientFrameBuffers();
+
+    // Fills in the attachment ops of render queues which didn't set them explicitly.
+    void resolveAttachmentOps(Frame& frame);
+
     // Renderer.
     std::unique_ptr<RenderContext> shared_render_context_;
 
@@ -0,0 +1,58 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "MathDefs.h"
+#include "Renderer.h"
+#include "TriangleBuffer.h"
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// Merges many static meshes which share a material into a single mesh per material, so that they
+// can be drawn with one draw call. Geometry is transformed into world space when the batch is built.
+//
+// Triangle buffers passed to add() are not copied, so they must outlive the call to build(). The
+// same triangle buffer can be added many times with different transforms.
+class DW_API StaticBatchBuilder {
+public:
+    struct Batch {
+        u64 material_key;
+        // Spatial cell which contains the centre of every entry in this batch. Always (0, 0, 0) if
+        // batches aren't split by cell.
+        i32 cell_x, cell_y, cell_z;
+        Mesh mesh;
+    };
+
+    StaticBatchBuilder() = default;
+    ~StaticBatchBuilder() = default;
+
+    /// Splits batches into cubic cells of this size in world space, so that each batch can be
+    /// culled separately. An entry is placed in the cell containing the centre of its bounds. A
+    /// size of 0 (the default) disables splitting.
+    void setCellSize(float cell_size);
+
+    /// Adds a mesh to the batch.
+    void add(const TriangleBuffer& buffer, const Mat4& transform, u64 material_key);
+
+    /// Builds one mesh for each material key (and cell) and clears the builder. Entries which share
+    /// a material key should also share a vertex layout.
+    std::vector<Batch> build(Renderer& r);
+
+    usize entryCount() const;
+
+private:
+    struct Entry {
+        const TriangleBuffer* buffer;
+        Mat4 transform;
+        u64 material_key;
+    };
+
+    float cell_size_ = 0.0f;
+    std::vector<Entry> entries_;
+};
+}  // namespace gfx
+}  // namespace dw
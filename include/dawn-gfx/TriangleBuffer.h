@@ -16,12 +16,25 @@ struct Mesh {
     IndexBufferHandle ib;
     uint vertex_count;
     uint index_count;
+    // Location of the mesh inside vb/ib, when the buffers are shared with other meshes.
+    uint base_vertex = 0;
+    uint first_index = 0;
+    // Bounds in object space.
+    AABB bounds = AABB{Vec3{0.0f, 0.0f, 0.0f}, Vec3{0.0f, 0.0f, 0.0f}};
+    Sphere bounding_sphere = Sphere{Vec3{0.0f, 0.0f, 0.0f}, 0.0f};
 };
 
 Vec3 calculateTangent(const Vec3& p1, const Vec3& p2, const Vec3& p3, const Vec2& tc1, const Vec2& tc2, const Vec2& tc3);
 
 class DW_API TriangleBuffer {
 public:
+    struct Vertex {
+        Vec3 position = {0.0f, 0.0f, 0.0f};
+        Vec3 normal = {0.0f, 0.0f, 0.0f};
+        Vec2 tex_coord = {0.0f, 0.0f};
+        Vec3 tangent = {0.0f, 0.0f, 0.0f};
+    };
+
     TriangleBuffer();
     ~TriangleBuffer() = default;
 
@@ -35,6 +48,14 @@ public:
     // Compile the vertex and index arrays into GPU buffers.
     Mesh end(Renderer& r);
 
+    // The vertex layout and packed vertex data used by end().
+    VertexDecl vertexDecl() const;
+    Memory packVertices() const;
+
+    // Bounds of the vertex positions, stored on the Mesh by end().
+    AABB boundingBox() const;
+    Sphere boundingSphere() const;
+
     // Add a vertex.
     void position(const Vec3& p);
     void normal(const Vec3& n);
@@ -44,16 +65,30 @@ public:
     // Add a triangle.
     void triangle(u32 v0, u32 v1, u32 v2);
 
-    // Calculate tangents.
+    // Append the geometry of another triangle buffer, transformed by an affine transform. Normals
+    // and tangents are transformed by the upper 3x3 of the transform (normals by its inverse
+    // transpose) and renormalised.
+    void append(const TriangleBuffer& other, const Mat4& transform);
+
+    // Calculate smooth normals from the vertex positions. Vertices which share a position share a
+    // normal.
+    void calculateNormals();
+
+    // Calculate tangents, accumulated over the triangles adjacent to each vertex and
+    // orthogonalised against the normal. If the buffer has no normals, temporary smooth normals are
+    // used, and the buffer still has no normals afterwards.
+    //
+    // Tangents are stored as a Vec3 without the handedness sign of the bitangent, so shaders which
+    // compute the bitangent as cross(normal, tangent) assume that texture coordinates are not
+    // mirrored. Meshes with mirrored UVs need to derive the sign themselves, for example from the
+    // screen space derivatives of the texture coordinates.
     void calculateTangents();
 
+    // Access the geometry added so far.
+    const std::vector<Vertex>& vertices() const;
+    const std::vector<u32>& indices() const;
+
 private:
-    struct Vertex {
-        Vec3 position = {0.0f, 0.0f, 0.0f};
-        Vec3 normal = {0.0f, 0.0f, 0.0f};
-        Vec2 tex_coord = {0.0f, 0.0f};
-        Vec3 tangent = {0.0f, 0.0f, 0.0f};
-    };
     bool contains_normals_;
     bool contains_texcoords_;
     bool contains_tangents_;
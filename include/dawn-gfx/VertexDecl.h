@@ -5,6 +5,7 @@
 #pragma once
 
 #include "Base.h"
+#include "MathDefs.h"
 #include <vector>
 #include <utility>
 #include <cstddef>
@@ -27,6 +28,8 @@ public:
     // TODO: Combine type, count and normalised, so it's a compiler error if the user gets these wrong.
     // TODO: Alternatively, combine type and normalised, and make count an enum.
     VertexDecl& add(Attribute attribute, usize count, AttributeType type, bool normalised = false);
+    // Adds an attribute with the count and type of a C++ type, such as Vec3 or u8[4].
+    template <typename T> VertexDecl& add(Attribute attribute, bool normalised = false);
     VertexDecl& end();
 
     bool operator==(const VertexDecl& other) const;
@@ -49,6 +52,40 @@ public:
     std::vector<std::pair<u16, byte*>> attributes_;
     u16 stride_;
 };
+
+// Maps a C++ type to the count and type of a vertex attribute.
+template <typename T> struct VertexAttributeTraits;
+template <> struct VertexAttributeTraits<float> {
+    static constexpr usize count = 1;
+    static constexpr VertexDecl::AttributeType type = VertexDecl::AttributeType::Float;
+};
+template <> struct VertexAttributeTraits<u8> {
+    static constexpr usize count = 1;
+    static constexpr VertexDecl::AttributeType type = VertexDecl::AttributeType::Uint8;
+};
+template <> struct VertexAttributeTraits<Vec2> {
+    static constexpr usize count = 2;
+    static constexpr VertexDecl::AttributeType type = VertexDecl::AttributeType::Float;
+};
+template <> struct VertexAttributeTraits<Vec3> {
+    static constexpr usize count = 3;
+    static constexpr VertexDecl::AttributeType type = VertexDecl::AttributeType::Float;
+};
+template <> struct VertexAttributeTraits<Vec4> {
+    static constexpr usize count = 4;
+    static constexpr VertexDecl::AttributeType type = VertexDecl::AttributeType::Float;
+};
+template <typename T, usize N> struct VertexAttributeTraits<T[N]> {
+    static constexpr usize count = N * VertexAttributeTraits<T>::count;
+    static constexpr VertexDecl::AttributeType type = VertexAttributeTraits<T>::type;
+};
+
+template <typename T> VertexDecl& VertexDecl::add(Attribute attribute, bool normalised) {
+    static_assert(VertexAttributeTraits<T>::count >= 1 && VertexAttributeTraits<T>::count <= 4,
+                  "Vertex attributes must have between 1 and 4 components.");
+    return add(attribute, VertexAttributeTraits<T>::count, VertexAttributeTraits<T>::type,
+               normalised);
+}
 }  // namespace gfx
 }  // namespace dw
 
@@ -0,0 +1,85 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "MathDefs.h"
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// A set of objects with world space bounds, stored in a dynamic AABB tree so that the objects
+// inside a view frustum can be found without testing every object.
+//
+// Objects are stored with bounds that are enlarged by a margin, so that objects which move by a
+// small amount don't need to be reinserted into the tree. As a result, culling is conservative and
+// may return objects which are just outside the frustum.
+class DW_API VisibilityWorld {
+public:
+    using ObjectId = u32;
+
+    explicit VisibilityWorld(float margin = 0.1f);
+    ~VisibilityWorld() = default;
+
+    /// Adds an object to the world. The returned id is stable until the object is removed, after
+    /// which it may be reused.
+    ObjectId insert(const AABB& bounds);
+
+    /// Updates the bounds of an object. Returns true if the object had to be reinserted into the
+    /// tree.
+    bool move(ObjectId id, const AABB& bounds);
+
+    /// Removes an object from the world.
+    void remove(ObjectId id);
+
+    /// Finds the objects which intersect a frustum. Large worlds are culled in parallel, with each
+    /// thread processing a separate set of subtrees.
+    /// @param visible Cleared, then filled with the ids of the visible objects.
+    void cull(const Frustum& frustum, std::vector<ObjectId>& visible) const;
+
+    /// Returns the enlarged bounds of an object.
+    const AABB& bounds(ObjectId id) const;
+
+    usize objectCount() const;
+    int height() const;
+
+private:
+    static constexpr i32 kNullNode = -1;
+
+    struct Node {
+        AABB bounds;
+        // Parent when allocated, next free node when in the free list.
+        i32 parent;
+        i32 child1;
+        i32 child2;
+        // 0 for leaves, -1 for free nodes.
+        int height;
+
+        bool isLeaf() const {
+            return child1 == kNullNode;
+        }
+    };
+
+    // Frustum planes in SoA form, padded to 8 planes.
+    struct FrustumPlanes;
+
+    float margin_;
+    std::vector<Node> nodes_;
+    i32 root_;
+    i32 free_list_;
+    usize object_count_;
+
+    i32 allocateNode();
+    void freeNode(i32 node);
+    void insertLeaf(i32 leaf);
+    void removeLeaf(i32 leaf);
+    void refit(i32 node);
+    i32 balance(i32 node);
+
+    void cullSubtree(i32 root, const FrustumPlanes& planes, std::vector<ObjectId>& visible) const;
+    void collectLeaves(i32 root, std::vector<i32>& stack, std::vector<ObjectId>& visible) const;
+};
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,167 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "GeometryPool.h"
+
+#include <algorithm>
+
+namespace dw {
+namespace gfx {
+OffsetAllocator::OffsetAllocator(u32 capacity) : capacity_(capacity), free_space_(capacity) {
+    if (capacity > 0) {
+        free_ranges_.emplace(0, capacity);
+    }
+}
+
+std::optional<u32> OffsetAllocator::allocate(u32 size) {
+    if (size == 0 || size > free_space_) {
+        return std::nullopt;
+    }
+
+    // Find the smallest free range which fits.
+    auto best = free_ranges_.end();
+    for (auto it = free_ranges_.begin(); it != free_ranges_.end(); ++it) {
+        if (it->second >= size && (best == free_ranges_.end() || it->second < best->second)) {
+            best = it;
+            if (best->second == size) {
+                break;
+            }
+        }
+    }
+    if (best == free_ranges_.end()) {
+        return std::nullopt;
+    }
+
+    // Take the allocation from the start of the range.
+    u32 offset = best->first;
+    u32 remaining = best->second - size;
+    free_ranges_.erase(best);
+    if (remaining > 0) {
+        free_ranges_.emplace(offset + size, remaining);
+    }
+    free_space_ -= size;
+    return offset;
+}
+
+void OffsetAllocator::free(u32 offset, u32 size) {
+    if (size == 0) {
+        return;
+    }
+    assert(offset + size <= capacity_);
+    free_space_ += size;
+
+    // Merge with the following range.
+    auto next = free_ranges_.lower_bound(offset);
+    assert(next == free_ranges_.end() || next->first >= offset + size);
+    if (next != free_ranges_.end() && next->first == offset + size) {
+        size += next->second;
+        next = free_ranges_.erase(next);
+    }
+
+    // Merge with the preceding range.
+    if (next != free_ranges_.begin()) {
+        auto previous = std::prev(next);
+        assert(previous->first + previous->second <= offset);
+        if (previous->first + previous->second == offset) {
+            previous->second += size;
+            return;
+        }
+    }
+    free_ranges_.emplace_hint(next, offset, size);
+}
+
+u32 OffsetAllocator::capacity() const {
+    return capacity_;
+}
+
+u32 OffsetAllocator::freeSpace() const {
+    return free_space_;
+}
+
+u32 OffsetAllocator::largestFreeRange() const {
+    u32 largest = 0;
+    for (const auto& range : free_ranges_) {
+        largest = std::max(largest, range.second);
+    }
+    return largest;
+}
+
+GeometryPool::GeometryPool(Renderer& r, const VertexDecl& decl, uint vertices_per_page,
+                           uint indices_per_page)
+    : r_(r), decl_(decl), vertices_per_page_(vertices_per_page), indices_per_page_(indices_per_page) {
+}
+
+GeometryPool::~GeometryPool() {
+    for (auto& page : pages_) {
+        r_.deleteVertexBuffer(page.vb);
+        r_.deleteIndexBuffer(page.ib);
+    }
+}
+
+std::optional<Mesh> GeometryPool::add(const TriangleBuffer& buffer) {
+    const auto vertex_count = static_cast<u32>(buffer.vertices().size());
+    const auto index_count = static_cast<u32>(buffer.indices().size());
+    if (buffer.vertexDecl() != decl_ || vertex_count == 0 || index_count == 0 ||
+        vertex_count > vertices_per_page_ || index_count > indices_per_page_) {
+        return std::nullopt;
+    }
+
+    // Find a page with enough space for both the vertices and the indices.
+    Page* page = nullptr;
+    std::optional<u32> base_vertex, first_index;
+    for (auto& candidate : pages_) {
+        base_vertex = candidate.vertices.allocate(vertex_count);
+        if (!base_vertex) {
+            continue;
+        }
+        first_index = candidate.indices.allocate(index_count);
+        if (!first_index) {
+            candidate.vertices.free(*base_vertex, vertex_count);
+            continue;
+        }
+        page = &candidate;
+        break;
+    }
+
+    // Otherwise, start a new page.
+    if (!page) {
+        pages_.emplace_back(Page{
+            r_.createVertexBuffer(Memory(vertices_per_page_ * decl_.stride()), decl_,
+                                  BufferUsage::Dynamic),
+            r_.createIndexBuffer(Memory(indices_per_page_ * sizeof(u32)), IndexBufferType::U32,
+                                 BufferUsage::Dynamic),
+            OffsetAllocator{vertices_per_page_}, OffsetAllocator{indices_per_page_}});
+        page = &pages_.back();
+        base_vertex = page->vertices.allocate(vertex_count);
+        first_index = page->indices.allocate(index_count);
+    }
+
+    // Upload. Indices stay relative to the base vertex.
+    r_.updateVertexBuffer(page->vb, buffer.packVertices(), *base_vertex * decl_.stride());
+    r_.updateIndexBuffer(page->ib, Memory(buffer.indices()), *first_index * sizeof(u32));
+    Mesh mesh{page->vb, page->ib, vertex_count, index_count, *base_vertex, *first_index};
+    mesh.bounds = buffer.boundingBox();
+    mesh.bounding_sphere = buffer.boundingSphere();
+    return mesh;
+}
+
+void GeometryPool::remove(const Mesh& mesh) {
+    auto page = std::find_if(pages_.begin(), pages_.end(),
+                             [&mesh](const Page& p) { return p.vb == mesh.vb && p.ib == mesh.ib; });
+    if (page == pages_.end()) {
+        return;
+    }
+    page->vertices.free(mesh.base_vertex, mesh.vertex_count);
+    page->indices.free(mesh.first_index, mesh.index_count);
+}
+
+const VertexDecl& GeometryPool::decl() const {
+    return decl_;
+}
+
+usize GeometryPool::pageCount() const {
+    return pages_.size();
+}
+}  // namespace gfx
+}  // namespace dw
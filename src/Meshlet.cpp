@@ -0,0 +1,307 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Meshlet.h"
+#include "SIMD.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dw {
+namespace gfx {
+namespace {
+constexpr u16 kNoLocalIndex = 0xffff;
+
+// Computes the bounding sphere and normal cone of a meshlet, using the same construction as
+// meshoptimizer's meshopt_computeClusterBounds.
+void computeMeshletBounds(Meshlet& meshlet, const MeshletMesh& mesh,
+                          const std::vector<TriangleBuffer::Vertex>& vertices) {
+    auto position = [&](u32 local_index) -> const Vec3& {
+        return vertices[mesh.vertices[meshlet.vertex_offset + local_index]].position;
+    };
+
+    // Bounding sphere (Ritter). Start with the pair of axis extremes which are furthest apart, then
+    // grow the sphere to contain every vertex.
+    u32 min_vertex[3] = {0, 0, 0};
+    u32 max_vertex[3] = {0, 0, 0};
+    for (u32 i = 1; i < meshlet.vertex_count; ++i) {
+        const Vec3& p = position(i);
+        for (int axis = 0; axis < 3; ++axis) {
+            if (p[axis] < position(min_vertex[axis])[axis]) {
+                min_vertex[axis] = i;
+            }
+            if (p[axis] > position(max_vertex[axis])[axis]) {
+                max_vertex[axis] = i;
+            }
+        }
+    }
+    int widest_axis = 0;
+    float widest_span = 0.0f;
+    for (int axis = 0; axis < 3; ++axis) {
+        float span = (position(max_vertex[axis]) - position(min_vertex[axis])).LengthSq();
+        if (span > widest_span) {
+            widest_axis = axis;
+            widest_span = span;
+        }
+    }
+    Vec3 centre =
+        (position(min_vertex[widest_axis]) + position(max_vertex[widest_axis])) * 0.5f;
+    float radius = std::sqrt(widest_span) * 0.5f;
+    for (u32 i = 0; i < meshlet.vertex_count; ++i) {
+        const Vec3& p = position(i);
+        float distance = (p - centre).Length();
+        if (distance > radius) {
+            float new_radius = (radius + distance) * 0.5f;
+            centre += (p - centre) * ((new_radius - radius) / distance);
+            radius = new_radius;
+        }
+    }
+    meshlet.centre = centre;
+    meshlet.radius = radius;
+
+    // Normal cone. Degenerate triangles are ignored.
+    std::vector<Vec3> normals(meshlet.triangle_count, Vec3::zero);
+    Vec3 axis_sum = Vec3::zero;
+    for (u32 t = 0; t < meshlet.triangle_count; ++t) {
+        const u8* triangle = &mesh.triangles[(meshlet.triangle_offset + t) * 3];
+        const Vec3& p0 = position(triangle[0]);
+        Vec3 normal = (position(triangle[1]) - p0).Cross(position(triangle[2]) - p0);
+        float length = normal.Length();
+        if (length > 0.0f) {
+            normals[t] = normal / length;
+            axis_sum += normals[t];
+        }
+    }
+    meshlet.cone_apex = centre;
+    meshlet.cone_axis = Vec3::unitZ;
+    meshlet.cone_cutoff = 2.0f;
+    float axis_length = axis_sum.Length();
+    if (axis_length <= M_LARGE_EPSILON) {
+        return;
+    }
+    Vec3 axis = axis_sum / axis_length;
+    float min_dot = 1.0f;
+    for (const auto& normal : normals) {
+        if (!normal.IsZero()) {
+            min_dot = std::min(min_dot, normal.Dot(axis));
+        }
+    }
+    // The cone is too wide to ever reject the meshlet.
+    if (min_dot <= 0.1f) {
+        return;
+    }
+
+    // Move the apex back along the axis until it is behind every triangle plane.
+    float max_t = 0.0f;
+    for (u32 t = 0; t < meshlet.triangle_count; ++t) {
+        if (normals[t].IsZero()) {
+            continue;
+        }
+        const Vec3& p0 = position(mesh.triangles[(meshlet.triangle_offset + t) * 3]);
+        float t_plane = (centre - p0).Dot(normals[t]) / axis.Dot(normals[t]);
+        max_t = std::max(max_t, t_plane);
+    }
+    meshlet.cone_apex = centre - axis * max_t;
+    meshlet.cone_axis = axis;
+    meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+template <typename T>
+void writeMeshletIndices(T* out, const MeshletMesh& mesh, const std::vector<u32>& visible) {
+    for (u32 meshlet_index : visible) {
+        const Meshlet& meshlet = mesh.meshlets[meshlet_index];
+        const u32* vertices = &mesh.vertices[meshlet.vertex_offset];
+        const u8* triangles = &mesh.triangles[meshlet.triangle_offset * 3];
+        for (u32 i = 0; i < meshlet.triangle_count * 3; ++i) {
+            *out++ = static_cast<T>(vertices[triangles[i]]);
+        }
+    }
+}
+}  // namespace
+
+MeshletMesh buildMeshlets(const TriangleBuffer& buffer, uint max_vertices, uint max_triangles) {
+    assert(max_vertices > 2 && max_vertices <= 256);
+    assert(max_triangles > 0);
+    const auto& vertices = buffer.vertices();
+    const auto& indices = buffer.indices();
+    assert(indices.size() % 3 == 0);
+
+    MeshletMesh result;
+    result.source_vertex_count = static_cast<uint>(vertices.size());
+    result.meshlets.reserve(indices.size() / 3 / max_triangles + 1);
+    result.vertices.reserve(vertices.size());
+    result.triangles.reserve(indices.size());
+
+    // Local index of each mesh vertex inside the meshlet currently being built.
+    std::vector<u16> local_index(vertices.size(), kNoLocalIndex);
+
+    Meshlet meshlet{};
+    auto flush = [&]() {
+        if (meshlet.triangle_count == 0) {
+            return;
+        }
+        for (u32 i = 0; i < meshlet.vertex_count; ++i) {
+            local_index[result.vertices[meshlet.vertex_offset + i]] = kNoLocalIndex;
+        }
+        computeMeshletBounds(meshlet, result, vertices);
+        result.meshlets.emplace_back(meshlet);
+        meshlet = Meshlet{};
+        meshlet.vertex_offset = static_cast<u32>(result.vertices.size());
+        meshlet.triangle_offset = static_cast<u32>(result.triangles.size() / 3);
+    };
+
+    for (usize i = 0; i < indices.size(); i += 3) {
+        const u32 triangle[3] = {indices[i], indices[i + 1], indices[i + 2]};
+        uint new_vertices = 0;
+        for (u32 v : triangle) {
+            new_vertices += local_index[v] == kNoLocalIndex ? 1 : 0;
+        }
+        if (meshlet.vertex_count + new_vertices > max_vertices ||
+            meshlet.triangle_count + 1 > max_triangles) {
+            flush();
+        }
+        for (u32 v : triangle) {
+            if (local_index[v] == kNoLocalIndex) {
+                local_index[v] = static_cast<u16>(meshlet.vertex_count++);
+                result.vertices.emplace_back(v);
+            }
+            result.triangles.emplace_back(static_cast<u8>(local_index[v]));
+        }
+        meshlet.triangle_count++;
+    }
+    flush();
+    return result;
+}
+
+MeshletCuller::MeshletCuller(MeshletMesh mesh) : mesh_(std::move(mesh)) {
+    const usize padded_count = (mesh_.meshlets.size() + 3) & ~usize(3);
+    for (auto* array : {&centre_x_, &centre_y_, &centre_z_, &radius_, &apex_x_, &apex_y_, &apex_z_,
+                        &axis_x_, &axis_y_, &axis_z_, &cutoff_}) {
+        array->resize(padded_count, 0.0f);
+    }
+    for (usize i = 0; i < mesh_.meshlets.size(); ++i) {
+        const Meshlet& meshlet = mesh_.meshlets[i];
+        centre_x_[i] = meshlet.centre.x;
+        centre_y_[i] = meshlet.centre.y;
+        centre_z_[i] = meshlet.centre.z;
+        radius_[i] = meshlet.radius;
+        apex_x_[i] = meshlet.cone_apex.x;
+        apex_y_[i] = meshlet.cone_apex.y;
+        apex_z_[i] = meshlet.cone_apex.z;
+        axis_x_[i] = meshlet.cone_axis.x;
+        axis_y_[i] = meshlet.cone_axis.y;
+        axis_z_[i] = meshlet.cone_axis.z;
+        cutoff_[i] = meshlet.cone_cutoff;
+    }
+    visible_.reserve(mesh_.meshlets.size());
+}
+
+std::optional<MeshletCuller::Result> MeshletCuller::cull(Renderer& r, const Mat4& model_view_proj,
+                                                         const Vec3& camera_position) {
+    // Extract the frustum planes in object space (Gribb & Hartmann). The near plane uses the
+    // OpenGL clip space convention, which is conservative for a D3D style projection matrix.
+    const Vec4& row0 = model_view_proj.Row(0);
+    const Vec4& row1 = model_view_proj.Row(1);
+    const Vec4& row2 = model_view_proj.Row(2);
+    const Vec4& row3 = model_view_proj.Row(3);
+    Vec4 planes[6] = {row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2};
+    for (auto& plane : planes) {
+        float length = plane.xyz().Length();
+        if (length > 0.0f) {
+            plane = plane * (1.0f / length);
+        }
+    }
+
+    // Test meshlets. A meshlet is visible if its bounding sphere is not fully behind any frustum
+    // plane, and if the camera is not inside its backfacing cone.
+    visible_.clear();
+    const usize meshlet_count = mesh_.meshlets.size();
+#ifdef DW_SIMD_SSE
+    const __m128 camera_x = _mm_set1_ps(camera_position.x);
+    const __m128 camera_y = _mm_set1_ps(camera_position.y);
+    const __m128 camera_z = _mm_set1_ps(camera_position.z);
+    for (usize i = 0; i < meshlet_count; i += 4) {
+        const __m128 centre_x = _mm_loadu_ps(&centre_x_[i]);
+        const __m128 centre_y = _mm_loadu_ps(&centre_y_[i]);
+        const __m128 centre_z = _mm_loadu_ps(&centre_z_[i]);
+        const __m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius_[i]));
+        __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const auto& plane : planes) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(centre_x, _mm_set1_ps(plane.x)),
+                           _mm_mul_ps(centre_y, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(centre_z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            visible = _mm_and_ps(visible, _mm_cmpgt_ps(distance, negative_radius));
+        }
+
+        const __m128 to_apex_x = _mm_sub_ps(_mm_loadu_ps(&apex_x_[i]), camera_x);
+        const __m128 to_apex_y = _mm_sub_ps(_mm_loadu_ps(&apex_y_[i]), camera_y);
+        const __m128 to_apex_z = _mm_sub_ps(_mm_loadu_ps(&apex_z_[i]), camera_z);
+        const __m128 length = _mm_sqrt_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(to_apex_x, to_apex_x), _mm_mul_ps(to_apex_y, to_apex_y)),
+                       _mm_mul_ps(to_apex_z, to_apex_z)));
+        const __m128 dot = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(to_apex_x, _mm_loadu_ps(&axis_x_[i])),
+                       _mm_mul_ps(to_apex_y, _mm_loadu_ps(&axis_y_[i]))),
+            _mm_mul_ps(to_apex_z, _mm_loadu_ps(&axis_z_[i])));
+        const __m128 backfacing = _mm_cmpgt_ps(dot, _mm_mul_ps(_mm_loadu_ps(&cutoff_[i]), length));
+        visible = _mm_andnot_ps(backfacing, visible);
+
+        int mask = _mm_movemask_ps(visible);
+        for (usize lane = 0; lane < 4 && i + lane < meshlet_count; ++lane) {
+            if (mask & (1 << lane)) {
+                visible_.emplace_back(static_cast<u32>(i + lane));
+            }
+        }
+    }
+#else
+    for (usize i = 0; i < meshlet_count; ++i) {
+        const Meshlet& meshlet = mesh_.meshlets[i];
+        bool visible = true;
+        for (const auto& plane : planes) {
+            if (plane.xyz().Dot(meshlet.centre) + plane.w <= -meshlet.radius) {
+                visible = false;
+                break;
+            }
+        }
+        if (visible) {
+            Vec3 to_apex = meshlet.cone_apex - camera_position;
+            if (to_apex.Dot(meshlet.cone_axis) > meshlet.cone_cutoff * to_apex.Length()) {
+                visible = false;
+            }
+        }
+        if (visible) {
+            visible_.emplace_back(static_cast<u32>(i));
+        }
+    }
+#endif
+
+    // Write the triangles of the visible meshlets to a transient index buffer.
+    uint triangle_count = 0;
+    for (u32 meshlet_index : visible_) {
+        triangle_count += mesh_.meshlets[meshlet_index].triangle_count;
+    }
+    if (triangle_count == 0) {
+        return std::nullopt;
+    }
+    const IndexBufferType type =
+        mesh_.source_vertex_count > 0x10000 ? IndexBufferType::U32 : IndexBufferType::U16;
+    auto index_buffer = r.allocTransientIndexBuffer(triangle_count * 3, type);
+    if (!index_buffer) {
+        return std::nullopt;
+    }
+    byte* data = r.getTransientIndexBufferData(*index_buffer);
+    if (type == IndexBufferType::U16) {
+        writeMeshletIndices(reinterpret_cast<u16*>(data), mesh_, visible_);
+    } else {
+        writeMeshletIndices(reinterpret_cast<u32*>(data), mesh_, visible_);
+    }
+    return Result{*index_buffer, triangle_count * 3, static_cast<uint>(visible_.size())};
+}
+
+const MeshletMesh& MeshletCuller::mesh() const {
+    return mesh_;
+}
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,321 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "OcclusionCuller.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Signed distance to the near plane (z = -w) in clip space.
+inline float nearDistance(const Vec4& v) {
+    return v.z + v.w;
+}
+
+inline Vec4 lerp(const Vec4& a, const Vec4& b, float t) {
+    return Vec4{a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t,
+                a.w + (b.w - a.w) * t};
+}
+
+#ifdef DW_SIMD_SSE
+inline Vec4 transformToClip(const __m128 columns[4], const Vec3& p) {
+    alignas(16) float result[4];
+    _mm_store_ps(result, _mm_add_ps(_mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(p.x)),
+                                               _mm_mul_ps(columns[1], _mm_set1_ps(p.y))),
+                                    _mm_add_ps(_mm_mul_ps(columns[2], _mm_set1_ps(p.z)),
+                                               columns[3])));
+    return Vec4{result[0], result[1], result[2], result[3]};
+}
+#endif
+
+// Transforms a set of positions into clip space.
+template <typename PositionFn>
+void transformPositions(const Mat4& mvp, usize count, PositionFn&& position,
+                        std::vector<Vec4>& out) {
+    out.resize(count);
+#ifdef DW_SIMD_SSE
+    // MathGeoLib matrices are row-major, so load the columns.
+    const __m128 columns[4] = {_mm_setr_ps(mvp.At(0, 0), mvp.At(1, 0), mvp.At(2, 0), mvp.At(3, 0)),
+                               _mm_setr_ps(mvp.At(0, 1), mvp.At(1, 1), mvp.At(2, 1), mvp.At(3, 1)),
+                               _mm_setr_ps(mvp.At(0, 2), mvp.At(1, 2), mvp.At(2, 2), mvp.At(3, 2)),
+                               _mm_setr_ps(mvp.At(0, 3), mvp.At(1, 3), mvp.At(2, 3), mvp.At(3, 3))};
+    for (usize i = 0; i < count; ++i) {
+        out[i] = transformToClip(columns, position(i));
+    }
+#else
+    for (usize i = 0; i < count; ++i) {
+        const Vec3& p = position(i);
+        out[i] = mvp * Vec4{p.x, p.y, p.z, 1.0f};
+    }
+#endif
+}
+}  // namespace
+
+OcclusionCuller::OcclusionCuller(uint width, uint height)
+    : width_((width + kTileWidth - 1) / kTileWidth * kTileWidth),
+      height_((height + kTileHeight - 1) / kTileHeight * kTileHeight),
+      tiles_x_(width_ / kTileWidth),
+      tiles_y_(height_ / kTileHeight),
+      view_proj_(Mat4::identity),
+      depth_(width_ * height_, 0.0f),
+      tile_depth_(tiles_x_ * tiles_y_, 0.0f) {
+}
+
+void OcclusionCuller::beginFrame(const Mat4& view_proj) {
+    view_proj_ = view_proj;
+    triangles_.clear();
+    std::fill(depth_.begin(), depth_.end(), 0.0f);
+    std::fill(tile_depth_.begin(), tile_depth_.end(), 0.0f);
+}
+
+void OcclusionCuller::addOccluder(const TriangleBuffer& buffer, const Mat4& model) {
+    const auto& vertices = buffer.vertices();
+    transformPositions(view_proj_ * model, vertices.size(),
+                       [&vertices](usize i) -> const Vec3& { return vertices[i].position; },
+                       clip_vertices_);
+    addTriangles(buffer.indices().data(), buffer.indices().size());
+}
+
+void OcclusionCuller::addOccluder(const Vec3* positions, usize vertex_count, const u32* indices,
+                                  usize index_count, const Mat4& model) {
+    transformPositions(view_proj_ * model, vertex_count,
+                       [positions](usize i) -> const Vec3& { return positions[i]; },
+                       clip_vertices_);
+    addTriangles(indices, index_count);
+}
+
+void OcclusionCuller::rasterize() {
+    parallelFor(tiles_y_, 1, [this](usize begin, usize end) {
+        rasterizeTileRows(static_cast<uint>(begin), static_cast<uint>(end));
+    });
+}
+
+bool OcclusionCuller::isVisible(const AABB& world_bounds) const {
+    // Find the screen space bounds and the nearest depth of the box.
+    float min_x = M_INFINITY, min_y = M_INFINITY, max_x = -M_INFINITY, max_y = -M_INFINITY;
+    float nearest_depth = 0.0f;
+    for (int i = 0; i < 8; ++i) {
+        const Vec4 corner{i & 1 ? world_bounds.maxPoint.x : world_bounds.minPoint.x,
+                          i & 2 ? world_bounds.maxPoint.y : world_bounds.minPoint.y,
+                          i & 4 ? world_bounds.maxPoint.z : world_bounds.minPoint.z, 1.0f};
+        const Vec4 clip = view_proj_ * corner;
+        if (nearDistance(clip) < 0.0f || clip.w <= 0.0f) {
+            // The box crosses the near plane, so it can't be occluded.
+            return true;
+        }
+        const float inv_w = 1.0f / clip.w;
+        const float x = (clip.x * inv_w * 0.5f + 0.5f) * width_;
+        const float y = (clip.y * inv_w * 0.5f + 0.5f) * height_;
+        min_x = std::min(min_x, x);
+        min_y = std::min(min_y, y);
+        max_x = std::max(max_x, x);
+        max_y = std::max(max_y, y);
+        nearest_depth = std::max(nearest_depth, inv_w);
+    }
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= width_ || min_y >= height_) {
+        return false;
+    }
+    const int x0 = std::max(0, static_cast<int>(min_x));
+    const int y0 = std::max(0, static_cast<int>(min_y));
+    const int x1 = std::min(static_cast<int>(width_) - 1, static_cast<int>(max_x));
+    const int y1 = std::min(static_cast<int>(height_) - 1, static_cast<int>(max_y));
+
+    // Test against the farthest depth in each tile first, and only read pixels in tiles which
+    // aren't entirely in front of the box.
+    for (int ty = y0 / kTileHeight; ty <= y1 / static_cast<int>(kTileHeight); ++ty) {
+        for (int tx = x0 / kTileWidth; tx <= x1 / static_cast<int>(kTileWidth); ++tx) {
+            if (tile_depth_[ty * tiles_x_ + tx] > nearest_depth) {
+                continue;
+            }
+            const int py0 = std::max(y0, ty * static_cast<int>(kTileHeight));
+            const int py1 = std::min(y1, (ty + 1) * static_cast<int>(kTileHeight) - 1);
+            const int px0 = std::max(x0, tx * static_cast<int>(kTileWidth));
+            const int px1 = std::min(x1, (tx + 1) * static_cast<int>(kTileWidth) - 1);
+            for (int y = py0; y <= py1; ++y) {
+                const float* row = depth_.data() + y * width_;
+                for (int x = px0; x <= px1; ++x) {
+                    if (row[x] <= nearest_depth) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+uint OcclusionCuller::width() const {
+    return width_;
+}
+
+uint OcclusionCuller::height() const {
+    return height_;
+}
+
+usize OcclusionCuller::occluderTriangleCount() const {
+    return triangles_.size();
+}
+
+void OcclusionCuller::addTriangles(const u32* indices, usize index_count) {
+    for (usize i = 0; i + 2 < index_count; i += 3) {
+        const Vec4 input[3] = {clip_vertices_[indices[i]], clip_vertices_[indices[i + 1]],
+                               clip_vertices_[indices[i + 2]]};
+        const float distance[3] = {nearDistance(input[0]), nearDistance(input[1]),
+                                   nearDistance(input[2])};
+        if (distance[0] >= 0.0f && distance[1] >= 0.0f && distance[2] >= 0.0f) {
+            setupTriangle(input[0], input[1], input[2]);
+            continue;
+        }
+
+        // Clip against the near plane, which produces a polygon with up to 4 vertices.
+        Vec4 clipped[4];
+        int clipped_count = 0;
+        for (int j = 0; j < 3; ++j) {
+            const int k = (j + 1) % 3;
+            if (distance[j] >= 0.0f) {
+                clipped[clipped_count++] = input[j];
+            }
+            if ((distance[j] >= 0.0f) != (distance[k] >= 0.0f)) {
+                const float t = distance[j] / (distance[j] - distance[k]);
+                clipped[clipped_count++] = lerp(input[j], input[k], t);
+            }
+        }
+        for (int j = 2; j < clipped_count; ++j) {
+            setupTriangle(clipped[0], clipped[j - 1], clipped[j]);
+        }
+    }
+}
+
+void OcclusionCuller::setupTriangle(const Vec4& v0, const Vec4& v1, const Vec4& v2) {
+    // Project to screen space, keeping 1/w as the depth.
+    float x[3], y[3], z[3];
+    const Vec4* v[3] = {&v0, &v1, &v2};
+    for (int i = 0; i < 3; ++i) {
+        if (v[i]->w <= 0.0f) {
+            return;
+        }
+        z[i] = 1.0f / v[i]->w;
+        x[i] = (v[i]->x * z[i] * 0.5f + 0.5f) * width_;
+        y[i] = (v[i]->y * z[i] * 0.5f + 0.5f) * height_;
+    }
+
+    // Rasterize both sides by making every triangle counter-clockwise.
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area < 0.0f) {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+    if (area <= 0.0f) {
+        return;
+    }
+
+    Triangle tri;
+    tri.min_x = std::max(0, static_cast<int>(std::floor(std::min({x[0], x[1], x[2]}))));
+    tri.min_y = std::max(0, static_cast<int>(std::floor(std::min({y[0], y[1], y[2]}))));
+    tri.max_x = std::min(static_cast<int>(width_) - 1,
+                         static_cast<int>(std::ceil(std::max({x[0], x[1], x[2]}))));
+    tri.max_y = std::min(static_cast<int>(height_) - 1,
+                         static_cast<int>(std::ceil(std::max({y[0], y[1], y[2]}))));
+    if (tri.min_x > tri.max_x || tri.min_y > tri.max_y) {
+        return;
+    }
+
+    // Edge i goes from vertex i to vertex i + 1, and is positive on the inside.
+    for (int i = 0; i < 3; ++i) {
+        const int j = (i + 1) % 3;
+        tri.edge_a[i] = y[i] - y[j];
+        tri.edge_b[i] = x[j] - x[i];
+        tri.edge_c[i] = -(tri.edge_a[i] * x[i] + tri.edge_b[i] * y[i]);
+    }
+
+    // 1/w is linear in screen space.
+    tri.x0 = x[0];
+    tri.y0 = y[0];
+    tri.z0 = z[0];
+    tri.dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+    tri.dzdy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+    triangles_.emplace_back(tri);
+}
+
+void OcclusionCuller::rasterizeTileRows(uint begin, uint end) {
+    const int band_y0 = static_cast<int>(begin * kTileHeight);
+    const int band_y1 = static_cast<int>(end * kTileHeight) - 1;
+    for (const auto& tri : triangles_) {
+        if (tri.max_y < band_y0 || tri.min_y > band_y1) {
+            continue;
+        }
+        const int y0 = std::max(tri.min_y, band_y0);
+        const int y1 = std::min(tri.max_y, band_y1);
+        // Pixels are processed in groups of 4. The width is a multiple of the tile width, so a
+        // group never crosses the end of a row.
+        const int x0 = tri.min_x & ~3;
+        const int x1 = tri.max_x;
+        for (int y = y0; y <= y1; ++y) {
+            const float py = static_cast<float>(y) + 0.5f;
+            float* row = depth_.data() + y * width_;
+#ifdef DW_SIMD_SSE
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 row_z = _mm_set1_ps(tri.z0 + tri.dzdy * (py - tri.y0));
+            const __m128 dzdx = _mm_set1_ps(tri.dzdx);
+            __m128 row_e[3], a[3];
+            for (int i = 0; i < 3; ++i) {
+                row_e[i] = _mm_set1_ps(tri.edge_b[i] * py + tri.edge_c[i]);
+                a[i] = _mm_set1_ps(tri.edge_a[i]);
+            }
+            for (int x = x0; x <= x1; x += 4) {
+                const float fx = static_cast<float>(x) + 0.5f;
+                const __m128 px = _mm_add_ps(_mm_set1_ps(fx), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), row_e[0]), zero);
+                inside = _mm_and_ps(
+                    inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), row_e[1]), zero));
+                inside = _mm_and_ps(
+                    inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), row_e[2]), zero));
+                if (_mm_movemask_ps(inside) == 0) {
+                    continue;
+                }
+                const __m128 z = _mm_add_ps(
+                    row_z, _mm_mul_ps(dzdx, _mm_sub_ps(px, _mm_set1_ps(tri.x0))));
+                const __m128 depth = _mm_loadu_ps(row + x);
+                const __m128 closest = _mm_max_ps(depth, z);
+                _mm_storeu_ps(row + x,
+                              _mm_or_ps(_mm_and_ps(inside, closest), _mm_andnot_ps(inside, depth)));
+            }
+#else
+            const float row_z = tri.z0 + tri.dzdy * (py - tri.y0);
+            for (int x = x0; x <= x1; ++x) {
+                const float px = static_cast<float>(x) + 0.5f;
+                bool inside = true;
+                for (int i = 0; i < 3; ++i) {
+                    inside &= tri.edge_a[i] * px + tri.edge_b[i] * py + tri.edge_c[i] >= 0.0f;
+                }
+                if (inside) {
+                    row[x] = std::max(row[x], row_z + tri.dzdx * (px - tri.x0));
+                }
+            }
+#endif
+        }
+    }
+
+    // Update the farthest depth of each tile in the band.
+    for (uint ty = begin; ty < end; ++ty) {
+        for (uint tx = 0; tx < tiles_x_; ++tx) {
+            float farthest = M_INFINITY;
+            for (uint y = ty * kTileHeight; y < (ty + 1) * kTileHeight; ++y) {
+                const float* row = depth_.data() + y * width_ + tx * kTileWidth;
+                for (uint x = 0; x < kTileWidth; ++x) {
+                    farthest = std::min(farthest, row[x]);
+                }
+            }
+            tile_depth_[ty * tiles_x_ + tx] = farthest;
+        }
+    }
+}
+}  // namespace gfx
+}  // namespace dw
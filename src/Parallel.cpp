@@ -0,0 +1,90 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Parallel.h"
+
+namespace dw {
+namespace gfx {
+WorkerPool& WorkerPool::instance() {
+    static WorkerPool pool;
+    return pool;
+}
+
+WorkerPool::WorkerPool()
+    : task_(nullptr), task_count_(0), next_task_(0), pending_tasks_(0), stop_(false) {
+#ifndef DGA_EMSCRIPTEN
+    // The thread which calls run() processes tasks too, so it doesn't need a worker.
+    const usize worker_count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    workers_.reserve(worker_count);
+    for (usize i = 0; i < worker_count; ++i) {
+        workers_.emplace_back([this]() { workerMain(); });
+    }
+#endif
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+usize WorkerPool::threadCount() const {
+    return workers_.size() + 1;
+}
+
+void WorkerPool::run(usize task_count, const std::function<void(usize)>& task) {
+    std::unique_lock<std::mutex> run_lock{run_mutex_, std::try_to_lock};
+    if (!run_lock.owns_lock() || workers_.empty() || task_count <= 1) {
+        for (usize i = 0; i < task_count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    task_ = &task;
+    task_count_ = task_count;
+    next_task_ = 0;
+    pending_tasks_ = task_count;
+    work_cv_.notify_all();
+
+    // Process tasks on this thread until none are left, then wait for the workers to finish
+    // theirs.
+    while (next_task_ < task_count_) {
+        const usize index = next_task_++;
+        lock.unlock();
+        task(index);
+        lock.lock();
+        --pending_tasks_;
+    }
+    done_cv_.wait(lock, [this]() { return pending_tasks_ == 0; });
+    task_ = nullptr;
+    task_count_ = 0;
+    next_task_ = 0;
+}
+
+void WorkerPool::workerMain() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+        work_cv_.wait(lock, [this]() { return stop_ || next_task_ < task_count_; });
+        if (stop_) {
+            return;
+        }
+        const usize index = next_task_++;
+        const auto* task = task_;
+        lock.unlock();
+        (*task)(index);
+        lock.lock();
+        if (--pending_tasks_ == 0) {
+            done_cv_.notify_all();
+        }
+    }
+}
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,78 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// A set of worker threads which lives for the duration of the program, so that parallelFor doesn't
+// start new threads on every call.
+class WorkerPool {
+public:
+    static WorkerPool& instance();
+
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Number of threads which run tasks, including the calling thread.
+    usize threadCount() const;
+
+    // Calls task(i) for each i in [0, task_count) on the workers and the calling thread, and
+    // returns once every call has completed. If the pool is already running tasks for another
+    // caller, such as a task which calls run() itself, the tasks run on the calling thread instead.
+    void run(usize task_count, const std::function<void(usize)>& task);
+
+private:
+    std::vector<std::thread> workers_;
+
+    // Held by the caller whose tasks are running.
+    std::mutex run_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(usize)>* task_;
+    usize task_count_;
+    usize next_task_;
+    usize pending_tasks_;
+    bool stop_;
+
+    WorkerPool();
+    void workerMain();
+};
+
+// Splits [0, count) into contiguous ranges and calls fn(begin, end) for each range, one range per
+// thread in the worker pool. The calling thread also processes ranges. Ranges smaller than
+// min_range_size are not worth the cost of handing them to another thread, so small inputs run on
+// the calling thread.
+template <typename Fn> void parallelFor(usize count, usize min_range_size, Fn&& fn) {
+    if (count == 0) {
+        return;
+    }
+    WorkerPool& pool = WorkerPool::instance();
+    const usize max_ranges = (count + min_range_size - 1) / std::max(min_range_size, usize{1});
+    const usize range_count = std::min(pool.threadCount(), max_ranges);
+    if (range_count <= 1) {
+        fn(usize{0}, count);
+        return;
+    }
+    const usize range_size = (count + range_count - 1) / range_count;
+    pool.run((count + range_size - 1) / range_size, [&fn, count, range_size](usize range) {
+        const usize begin = range * range_size;
+        fn(begin, std::min(count, begin + range_size));
+    });
+}
+}  // namespace gfx
+}  // namespace dw
@@ -6,7 +6,9 @@
 
 #include "Renderer.h"
 #include "Input.h"
+#include <algorithm>
 #include <functional>
+#include <mutex>
 
 namespace dw {
 namespace gfx {
@@ -40,8 +42,49 @@ public:
     virtual void processCommandList(std::vector<RenderCommand>& command_list) = 0;
     virtual bool frame(const Frame* frame) = 0;
 
+    // Occlusion query results. Written on the render thread, and read on the main thread.
+    std::optional<bool> occlusionQueryResult(OcclusionQueryHandle handle) const {
+        std::lock_guard<std::mutex> lock{occlusion_query_results_mutex_};
+        auto it = occlusion_query_results_.find(handle);
+        if (it == occlusion_query_results_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
 protected:
     Logger& logger_;
+
+    // Returns true if a render item replaces any of its render queue's uniforms, either by setting
+    // the same uniform or by setting a uniform block, so the queue's uniforms have to be applied
+    // again before the next item.
+    static bool overridesQueueUniforms(const Frame& frame, const RenderQueue& queue,
+                                       const RenderItem& item) {
+        if (queue.uniforms.empty()) {
+            return false;
+        }
+        if (item.uniform_blocks.count > 0) {
+            return true;
+        }
+        auto uniforms = frame.uniforms(item);
+        return std::any_of(uniforms.begin(), uniforms.end(), [&queue](const auto& entry) {
+            return queue.uniforms.count(entry.first) > 0;
+        });
+    }
+
+    void setOcclusionQueryResult(OcclusionQueryHandle handle, bool any_samples_passed) {
+        std::lock_guard<std::mutex> lock{occlusion_query_results_mutex_};
+        occlusion_query_results_[handle] = any_samples_passed;
+    }
+
+    void removeOcclusionQueryResult(OcclusionQueryHandle handle) {
+        std::lock_guard<std::mutex> lock{occlusion_query_results_mutex_};
+        occlusion_query_results_.erase(handle);
+    }
+
+private:
+    mutable std::mutex occlusion_query_results_mutex_;
+    std::unordered_map<OcclusionQueryHandle, bool> occlusion_query_results_;
 };
 }  // namespace gfx
 }  // namespace dw
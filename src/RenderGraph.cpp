@@ -0,0 +1,496 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <set>
+
+namespace dw {
+namespace gfx {
+struct RenderGraph::Pass {
+    std::string name;
+    usize index;
+    std::vector<TextureId> reads;
+    std::vector<TextureId> writes;
+    std::optional<TextureId> depth_write;
+    bool writes_backbuffer = false;
+    std::optional<RenderQueue::ClearParameters> clear_parameters;
+    ExecuteFunction execute;
+};
+
+RenderGraph::PassBuilder::PassBuilder(RenderGraph* graph, Pass* pass)
+    : graph_(graph), pass_(pass) {
+}
+
+bool RenderGraph::PassBuilder::read(TextureId texture) {
+    if (!isValid(texture)) {
+        return false;
+    }
+    // Reading an attachment of the pass's own frame buffer would be a feedback loop, which the
+    // backends can't synchronise within a render pass.
+    if (std::find(pass_->writes.begin(), pass_->writes.end(), texture) != pass_->writes.end() ||
+        pass_->depth_write == texture) {
+        graph_->logger_.error("Render graph pass '{}' can't read texture {} which it writes.",
+                              pass_->name, texture);
+        return false;
+    }
+    pass_->reads.emplace_back(texture);
+    return true;
+}
+
+bool RenderGraph::PassBuilder::write(TextureId texture) {
+    if (!isValid(texture) || !canWriteTextures()) {
+        return false;
+    }
+    const auto& desc = graph_->textures_[texture];
+    if (!desc.imported && isDepthFormat(desc.desc.format)) {
+        graph_->logger_.error(
+            "Render graph pass '{}' can't write depth texture {} as a colour attachment.",
+            pass_->name, texture);
+        return false;
+    }
+    if (std::find(pass_->writes.begin(), pass_->writes.end(), texture) != pass_->writes.end()) {
+        return true;
+    }
+    if (std::find(pass_->reads.begin(), pass_->reads.end(), texture) != pass_->reads.end()) {
+        graph_->logger_.error("Render graph pass '{}' can't write texture {} which it reads.",
+                              pass_->name, texture);
+        return false;
+    }
+    pass_->writes.emplace_back(texture);
+    return true;
+}
+
+bool RenderGraph::PassBuilder::writeDepth(TextureId texture) {
+    if (!isValid(texture) || !canWriteTextures()) {
+        return false;
+    }
+    const auto& desc = graph_->textures_[texture];
+    if (!desc.imported && !isDepthFormat(desc.desc.format)) {
+        graph_->logger_.error(
+            "Render graph pass '{}' can't write colour texture {} as a depth attachment.",
+            pass_->name, texture);
+        return false;
+    }
+    if (pass_->depth_write && *pass_->depth_write != texture) {
+        graph_->logger_.error("Render graph pass '{}' already writes depth texture {}.",
+                              pass_->name, *pass_->depth_write);
+        return false;
+    }
+    if (std::find(pass_->reads.begin(), pass_->reads.end(), texture) != pass_->reads.end()) {
+        graph_->logger_.error("Render graph pass '{}' can't write texture {} which it reads.",
+                              pass_->name, texture);
+        return false;
+    }
+    pass_->depth_write = texture;
+    return true;
+}
+
+bool RenderGraph::PassBuilder::writeBackbuffer() {
+    if (!pass_->writes.empty() || pass_->depth_write) {
+        graph_->logger_.error(
+            "Render graph pass '{}' can't write to the backbuffer as it writes to textures.",
+            pass_->name);
+        return false;
+    }
+    pass_->writes_backbuffer = true;
+    return true;
+}
+
+bool RenderGraph::PassBuilder::isValid(TextureId texture) const {
+    if (texture >= graph_->textures_.size()) {
+        graph_->logger_.error("Render graph pass '{}' uses unknown texture {}.", pass_->name,
+                              texture);
+        return false;
+    }
+    return true;
+}
+
+bool RenderGraph::PassBuilder::canWriteTextures() const {
+    if (pass_->writes_backbuffer) {
+        graph_->logger_.error(
+            "Render graph pass '{}' can't write to textures as it writes to the backbuffer.",
+            pass_->name);
+        return false;
+    }
+    return true;
+}
+
+void RenderGraph::PassBuilder::setClear(const Colour& colour, bool clear_colour,
+                                        bool clear_depth) {
+    pass_->clear_parameters = RenderQueue::ClearParameters{colour, clear_colour, clear_depth};
+}
+
+RenderGraph::RenderGraph(Logger& logger, Renderer& r)
+    : logger_(logger),
+      r_(r),
+      execution_count_(0),
+      executed_pass_count_(0),
+      culled_pass_count_(0) {
+}
+
+RenderGraph::~RenderGraph() {
+    for (const auto& entry : frame_buffer_cache_) {
+        r_.deleteFrameBuffer(entry.second.handle);
+    }
+    for (const auto& entry : texture_pool_) {
+        for (const auto& texture : entry.second) {
+            r_.deleteTexture(texture.handle);
+        }
+    }
+}
+
+RenderGraph::TextureId RenderGraph::createTexture(const TextureDesc& desc) {
+    textures_.emplace_back(Texture{desc, false, std::nullopt, 0, 0});
+    return static_cast<TextureId>(textures_.size() - 1);
+}
+
+RenderGraph::TextureId RenderGraph::importTexture(TextureHandle handle) {
+    textures_.emplace_back(Texture{TextureDesc{0, 0, TextureFormat::RGBA8}, true, handle, 0, 0});
+    return static_cast<TextureId>(textures_.size() - 1);
+}
+
+void RenderGraph::addPass(const std::string& name, const SetupFunction& setup,
+                          ExecuteFunction execute) {
+    auto pass = std::make_unique<Pass>();
+    pass->name = name;
+    pass->index = passes_.size();
+    pass->execute = std::move(execute);
+    PassBuilder builder{this, pass.get()};
+    setup(builder);
+
+    // Give passes which render to transient textures without a depth texture a transient one of
+    // their own, so that it's pooled and shared between passes like the colour textures.
+    if (!pass->writes.empty() && !pass->depth_write) {
+        const auto& first = textures_[pass->writes.front()];
+        if (!first.imported) {
+            pass->depth_write = createTexture(
+                TextureDesc{first.desc.width, first.desc.height, kTransientDepthFormat});
+        }
+    }
+    passes_.emplace_back(std::move(pass));
+}
+
+bool RenderGraph::execute() {
+    auto live_passes = cullPasses();
+    auto passes = orderPasses(live_passes);
+    allocateTextures(passes);
+
+    for (Pass* pass : passes) {
+        std::optional<FrameBufferHandle> frame_buffer;
+        if (!pass->writes.empty() || pass->depth_write) {
+            std::vector<TextureHandle> attachments;
+            attachments.reserve(pass->writes.size());
+            for (TextureId id : pass->writes) {
+                attachments.emplace_back(texture(id));
+            }
+            std::optional<TextureHandle> depth_attachment;
+            if (pass->depth_write) {
+                depth_attachment = texture(*pass->depth_write);
+            }
+            frame_buffer = findOrCreateFrameBuffer(attachments, depth_attachment);
+        }
+
+        uint render_queue = r_.startRenderQueue(frame_buffer);
+        if (pass->clear_parameters) {
+            r_.setRenderQueueClear(render_queue, pass->clear_parameters->colour,
+                                   pass->clear_parameters->clear_colour,
+                                   pass->clear_parameters->clear_depth);
+        }
+        if (!pass->reads.empty()) {
+            std::vector<TextureHandle> inputs;
+            inputs.reserve(pass->reads.size());
+            for (TextureId id : pass->reads) {
+                inputs.emplace_back(texture(id));
+            }
+            r_.setRenderQueueInputs(render_queue, std::move(inputs));
+        }
+        if (pass->execute) {
+            pass->execute(r_, render_queue);
+        }
+    }
+
+    executed_pass_count_ = passes.size();
+    culled_pass_count_ = passes_.size() - passes.size();
+    passes_.clear();
+    textures_.clear();
+
+    evictUnusedResources();
+    ++execution_count_;
+    return passes.size() == live_passes.size();
+}
+
+TextureHandle RenderGraph::texture(TextureId id) const {
+    assert(id < textures_.size() && textures_[id].handle.has_value());
+    return *textures_[id].handle;
+}
+
+usize RenderGraph::executedPassCount() const {
+    return executed_pass_count_;
+}
+
+usize RenderGraph::culledPassCount() const {
+    return culled_pass_count_;
+}
+
+usize RenderGraph::allocatedTextureCount() const {
+    usize count = 0;
+    for (const auto& entry : texture_pool_) {
+        count += entry.second.size();
+    }
+    return count;
+}
+
+std::vector<RenderGraph::Pass*> RenderGraph::cullPasses() {
+    // Find the passes which write each texture.
+    std::vector<std::vector<Pass*>> writers(textures_.size());
+    for (const auto& pass : passes_) {
+        for (TextureId id : pass->writes) {
+            writers[id].emplace_back(pass.get());
+        }
+        if (pass->depth_write) {
+            writers[*pass->depth_write].emplace_back(pass.get());
+        }
+    }
+
+    // Passes with side effects are always kept. Then, walk backwards from those passes through the
+    // textures that they read.
+    std::vector<bool> live(passes_.size(), false);
+    std::vector<Pass*> stack;
+    for (const auto& pass : passes_) {
+        bool has_side_effects =
+            pass->writes_backbuffer ||
+            std::any_of(pass->writes.begin(), pass->writes.end(),
+                        [this](TextureId id) { return textures_[id].imported; }) ||
+            (pass->depth_write && textures_[*pass->depth_write].imported);
+        if (has_side_effects) {
+            live[pass->index] = true;
+            stack.emplace_back(pass.get());
+        }
+    }
+    // Passes which write a texture that an earlier pass wrote render on top of its results, so
+    // they depend on the earlier pass too.
+    while (!stack.empty()) {
+        Pass* pass = stack.back();
+        stack.pop_back();
+        auto visit = [&](TextureId id, bool earlier_only) {
+            for (Pass* writer : writers[id]) {
+                if (earlier_only && writer->index >= pass->index) {
+                    break;
+                }
+                if (!live[writer->index]) {
+                    live[writer->index] = true;
+                    stack.emplace_back(writer);
+                }
+            }
+        };
+        for (TextureId id : pass->reads) {
+            visit(id, false);
+        }
+        for (TextureId id : pass->writes) {
+            visit(id, true);
+        }
+        if (pass->depth_write) {
+            visit(*pass->depth_write, true);
+        }
+    }
+
+    std::vector<Pass*> live_passes;
+    for (const auto& pass : passes_) {
+        if (live[pass->index]) {
+            live_passes.emplace_back(pass.get());
+        }
+    }
+    return live_passes;
+}
+
+std::vector<RenderGraph::Pass*> RenderGraph::orderPasses(const std::vector<Pass*>& passes) {
+    // Build edges from each pass that writes a texture to each pass that reads it, and to each
+    // later pass that writes it.
+    std::vector<std::vector<Pass*>> writers(textures_.size());
+    for (Pass* pass : passes) {
+        for (TextureId id : pass->writes) {
+            writers[id].emplace_back(pass);
+        }
+        if (pass->depth_write) {
+            writers[*pass->depth_write].emplace_back(pass);
+        }
+    }
+    std::vector<std::vector<Pass*>> dependents(passes_.size());
+    std::vector<uint> dependency_count(passes_.size(), 0);
+    for (Pass* pass : passes) {
+        std::set<usize> dependencies;
+        for (TextureId id : pass->reads) {
+            for (Pass* writer : writers[id]) {
+                dependencies.emplace(writer->index);
+            }
+        }
+        auto add_earlier_writers = [&](TextureId id) {
+            for (Pass* writer : writers[id]) {
+                if (writer->index >= pass->index) {
+                    break;
+                }
+                dependencies.emplace(writer->index);
+            }
+        };
+        for (TextureId id : pass->writes) {
+            add_earlier_writers(id);
+        }
+        if (pass->depth_write) {
+            add_earlier_writers(*pass->depth_write);
+        }
+        for (usize dependency : dependencies) {
+            dependents[dependency].emplace_back(pass);
+        }
+        dependency_count[pass->index] = static_cast<uint>(dependencies.size());
+    }
+
+    // Topologically sort the passes. When multiple passes are ready, the pass which was added
+    // first runs first, so independent passes keep the order they were added in.
+    std::set<usize> ready;
+    for (Pass* pass : passes) {
+        if (dependency_count[pass->index] == 0) {
+            ready.emplace(pass->index);
+        }
+    }
+    std::vector<Pass*> ordered;
+    ordered.reserve(passes.size());
+    while (!ready.empty()) {
+        Pass* pass = passes_[*ready.begin()].get();
+        ready.erase(ready.begin());
+        ordered.emplace_back(pass);
+        for (Pass* dependent : dependents[pass->index]) {
+            if (--dependency_count[dependent->index] == 0) {
+                ready.emplace(dependent->index);
+            }
+        }
+    }
+
+    // Passes in a cycle, and the passes which depend on them, can't be ordered.
+    if (ordered.size() != passes.size()) {
+        std::string names;
+        for (Pass* pass : passes) {
+            if (dependency_count[pass->index] > 0) {
+                names += names.empty() ? "'" : ", '";
+                names += pass->name + "'";
+            }
+        }
+        logger_.error(
+            "Render graph passes {} are in or depend on a dependency cycle, and won't be executed.",
+            names);
+    }
+    return ordered;
+}
+
+void RenderGraph::allocateTextures(const std::vector<Pass*>& passes) {
+    // Find the lifetime of each transient texture.
+    std::vector<bool> used(textures_.size(), false);
+    for (uint i = 0; i < passes.size(); ++i) {
+        auto mark_used = [&](TextureId id) {
+            auto& texture = textures_[id];
+            if (!used[id]) {
+                used[id] = true;
+                texture.first_use = i;
+            }
+            texture.last_use = i;
+        };
+        std::for_each(passes[i]->reads.begin(), passes[i]->reads.end(), mark_used);
+        std::for_each(passes[i]->writes.begin(), passes[i]->writes.end(), mark_used);
+        if (passes[i]->depth_write) {
+            mark_used(*passes[i]->depth_write);
+        }
+    }
+    std::vector<TextureId> transient_textures;
+    for (TextureId id = 0; id < textures_.size(); ++id) {
+        if (used[id] && !textures_[id].imported) {
+            transient_textures.emplace_back(id);
+        }
+    }
+    std::sort(transient_textures.begin(), transient_textures.end(),
+              [this](TextureId a, TextureId b) {
+                  return textures_[a].first_use < textures_[b].first_use;
+              });
+
+    // Assign each transient texture to a pooled texture with the same description which isn't in
+    // use during its lifetime.
+    for (auto& entry : texture_pool_) {
+        for (auto& pooled : entry.second) {
+            pooled.busy_until.reset();
+        }
+    }
+    for (TextureId id : transient_textures) {
+        auto& texture = textures_[id];
+        auto& pool = texture_pool_[texture.desc];
+        auto it = std::find_if(pool.begin(), pool.end(), [&texture](const PooledTexture& pooled) {
+            return !pooled.busy_until || *pooled.busy_until < texture.first_use;
+        });
+        if (it == pool.end()) {
+            TextureHandle handle = r_.createTexture2D(texture.desc.width, texture.desc.height,
+                                                      texture.desc.format, Memory(), false, true);
+            it = pool.insert(pool.end(), PooledTexture{handle, std::nullopt, execution_count_});
+        }
+        it->busy_until = texture.last_use;
+        it->last_used = execution_count_;
+        texture.handle = it->handle;
+    }
+}
+
+FrameBufferHandle RenderGraph::findOrCreateFrameBuffer(
+    const std::vector<TextureHandle>& colour_textures, std::optional<TextureHandle> depth_texture) {
+    // The key starts with the number of colour attachments, so that a depth attachment can't be
+    // mistaken for a colour attachment.
+    std::vector<TextureHandle::base_type> key;
+    key.reserve(colour_textures.size() + 2);
+    key.emplace_back(static_cast<TextureHandle::base_type>(colour_textures.size()));
+    for (TextureHandle handle : colour_textures) {
+        key.emplace_back(static_cast<TextureHandle::base_type>(handle));
+    }
+    if (depth_texture) {
+        key.emplace_back(static_cast<TextureHandle::base_type>(*depth_texture));
+    }
+    auto it = frame_buffer_cache_.find(key);
+    if (it == frame_buffer_cache_.end()) {
+        FrameBufferHandle handle =
+            r_.createFrameBuffer(FrameBufferDesc{colour_textures, depth_texture, 1});
+        it = frame_buffer_cache_
+                 .emplace(std::move(key), CachedFrameBuffer{handle, execution_count_})
+                 .first;
+    }
+    it->second.last_used = execution_count_;
+    return it->second.handle;
+}
+
+void RenderGraph::evictUnusedResources() {
+    auto is_unused = [this](u64 last_used) {
+        return execution_count_ - last_used >= kEvictAfterExecutions;
+    };
+
+    // Frame buffers are deleted first, as they reference pooled textures. A frame buffer is always
+    // used in the same execution as its attachments, so an unused texture is never attached to a
+    // frame buffer which is kept.
+    for (auto it = frame_buffer_cache_.begin(); it != frame_buffer_cache_.end();) {
+        if (is_unused(it->second.last_used)) {
+            r_.deleteFrameBuffer(it->second.handle);
+            it = frame_buffer_cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = texture_pool_.begin(); it != texture_pool_.end();) {
+        auto& pool = it->second;
+        auto unused_begin = std::stable_partition(
+            pool.begin(), pool.end(),
+            [&is_unused](const PooledTexture& pooled) { return !is_unused(pooled.last_used); });
+        for (auto unused = unused_begin; unused != pool.end(); ++unused) {
+            r_.deleteTexture(unused->handle);
+        }
+        pool.erase(unused_begin, pool.end());
+        it = pool.empty() ? texture_pool_.erase(it) : std::next(it);
+    }
+}
+}  // namespace gfx
+}  // namespace dw
@@ -9,15 +9,230 @@
 #include "null/RenderContextNull.h"
 #include "vulkan/RenderContextVK.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <utility>
+
 namespace dw {
 namespace gfx {
+namespace {
+// Compares two sets of uniforms, which may be in any order.
+bool uniformsEqual(ArenaView<std::pair<std::string, UniformData>> a,
+                   ArenaView<std::pair<std::string, UniformData>> b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (const auto& entry : a) {
+        auto it = std::find_if(b.begin(), b.end(),
+                               [&entry](const std::pair<std::string, UniformData>& other) {
+                                   return other.first == entry.first;
+                               });
+        if (it == b.end() || it->second.index() != entry.second.index()) {
+            return false;
+        }
+        bool equal = std::visit(
+            [&other = it->second](const auto& value) {
+                using T = std::decay_t<decltype(value)>;
+                if constexpr (std::is_same_v<T, UniformArray>) {
+                    return value == std::get<T>(other);
+                } else {
+                    return std::memcmp(&value, &std::get<T>(other), sizeof(T)) == 0;
+                }
+            },
+            entry.second);
+        if (!equal) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// MathGeoLib stores matrices in row-major order, but render contexts expect matrices in
+// column-major order.
+UniformData toColumnMajor(UniformData data) {
+    if (Mat3* mat3_data = std::get_if<Mat3>(&data)) {
+        mat3_data->Transpose();
+    } else if (Mat4* mat4_data = std::get_if<Mat4>(&data)) {
+        mat4_data->Transpose();
+    }
+    return data;
+}
+
+// Packs the elements of a uniform array with the std140 array layout. Each element, and each
+// column of a matrix element, starts on a 16 byte boundary. Matrices are also converted to
+// column-major order.
+template <typename T> UniformArray packUniformArray(const T* values, uint count) {
+    constexpr uint kColumnStride = 4 * sizeof(float);
+    UniformArray array;
+    if constexpr (std::is_same_v<T, Mat3> || std::is_same_v<T, Mat4>) {
+        constexpr uint kColumns = std::is_same_v<T, Mat3> ? 3 : 4;
+        array.stride = kColumns * kColumnStride;
+        array.data.resize(array.stride * count, 0);
+        for (uint i = 0; i < count; ++i) {
+            T value = values[i].Transposed();
+            for (uint column = 0; column < kColumns; ++column) {
+                std::memcpy(array.data.data() + i * array.stride + column * kColumnStride,
+                            value.ptr() + column * kColumns, kColumns * sizeof(float));
+            }
+        }
+    } else {
+        static_assert(sizeof(T) <= kColumnStride, "Unsupported uniform array element type.");
+        array.stride = kColumnStride;
+        array.data.resize(array.stride * count, 0);
+        for (uint i = 0; i < count; ++i) {
+            std::memcpy(array.data.data() + i * array.stride, &values[i], sizeof(T));
+        }
+    }
+    return array;
+}
+
+bool uniformBlocksEqual(const Frame& frame, const RenderItem& a, const RenderItem& b) {
+    auto a_blocks = frame.uniformBlocks(a);
+    auto b_blocks = frame.uniformBlocks(b);
+    if (a_blocks.size() != b_blocks.size()) {
+        return false;
+    }
+    for (usize i = 0; i < a_blocks.size(); ++i) {
+        auto a_data = frame.uniformBlockData(a_blocks[i]);
+        auto b_data = frame.uniformBlockData(b_blocks[i]);
+        if (a_blocks[i].binding_location != b_blocks[i].binding_location ||
+            a_blocks[i].layout != b_blocks[i].layout || a_data.size() != b_data.size() ||
+            !std::equal(a_data.begin(), a_data.end(), b_data.begin())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T> bool viewsEqual(ArenaView<T> a, ArenaView<T> b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+// Appends values to an arena, and returns their range.
+template <typename T, typename Values>
+ArenaRange appendToArena(std::vector<T>& arena, const Values& values) {
+    ArenaRange range{static_cast<u32>(arena.size()), static_cast<u32>(values.size())};
+    arena.insert(arena.end(), values.begin(), values.end());
+    return range;
+}
+
+// Writes the pending item's uniforms and bindings to the frame's arenas, and sets their ranges in
+// an item. Uniforms and uniform blocks which were written by an earlier item and haven't changed
+// since are shared with it.
+void writeBindings(Frame& frame, PendingRenderItem& pending, RenderItem& item) {
+    if (!pending.uniforms_written) {
+        pending.item.uniforms = appendToArena(frame.uniform_arena, pending.uniforms);
+        pending.uniforms_written = true;
+    }
+    if (!pending.uniform_blocks_written) {
+        pending.item.uniform_blocks.offset = static_cast<u32>(frame.uniform_block_arena.size());
+        pending.item.uniform_blocks.count = static_cast<u32>(pending.uniform_blocks.size());
+        for (const auto& block : pending.uniform_blocks) {
+            frame.uniform_block_arena.emplace_back(RenderItem::UniformBlockData{
+                block.binding_location, appendToArena(frame.uniform_block_data_arena, block.data),
+                block.layout});
+        }
+        pending.uniform_blocks_written = true;
+    }
+    item.uniforms = pending.item.uniforms;
+    item.uniform_blocks = pending.item.uniform_blocks;
+    item.uniform_buffers = appendToArena(frame.uniform_buffer_arena, pending.uniform_buffers);
+    item.textures = appendToArena(frame.texture_arena, pending.textures);
+    item.storage_buffers = appendToArena(frame.storage_buffer_arena, pending.storage_buffers);
+    item.storage_images = appendToArena(frame.storage_image_arena, pending.storage_images);
+}
+
+// Clears the pending item's uniforms, uniform blocks and uniform buffer bindings.
+void clearUniforms(PendingRenderItem& pending) {
+    pending.uniforms.clear();
+    pending.uniform_blocks.clear();
+    pending.uniform_buffers.clear();
+    pending.item.uniforms = ArenaRange{};
+    pending.item.uniform_blocks = ArenaRange{};
+    pending.uniforms_written = true;
+    pending.uniform_blocks_written = true;
+}
+
+// Resets the state of the pending item which is discarded after it's submitted. Kept uniforms keep
+// their arena ranges, so they're shared with the next item. The occlusion condition only applies
+// to a single item, so it's never kept.
+void discardPendingState(PendingRenderItem& pending, u32 discard) {
+    const RenderItem& item = pending.item;
+    RenderItem kept;
+    if ((discard & Discard::VertexBuffer) == 0) {
+        kept.vb = item.vb;
+        kept.vb_offset = item.vb_offset;
+        kept.vertex_layout = item.vertex_layout;
+    }
+    if ((discard & Discard::IndexBuffer) == 0) {
+        kept.ib = item.ib;
+        kept.ib_offset = item.ib_offset;
+        kept.index_type_override = item.index_type_override;
+    }
+    if ((discard & Discard::Uniforms) == 0) {
+        kept.uniforms = item.uniforms;
+        kept.uniform_blocks = item.uniform_blocks;
+    }
+    if ((discard & Discard::State) == 0) {
+        kept.scissor_enabled = item.scissor_enabled;
+        kept.scissor_x = item.scissor_x;
+        kept.scissor_y = item.scissor_y;
+        kept.scissor_width = item.scissor_width;
+        kept.scissor_height = item.scissor_height;
+        kept.state = item.state;
+    }
+    pending.item = kept;
+    if ((discard & Discard::Uniforms) != 0) {
+        clearUniforms(pending);
+    }
+    if ((discard & Discard::Textures) != 0) {
+        pending.textures.clear();
+    }
+    pending.storage_buffers.clear();
+    pending.storage_images.clear();
+}
+
+// Returns true if an item has the same program, uniforms, textures, buffers and render state as the
+// item before it. Uniforms are compared as submitted, so an item which sets no uniforms only
+// matches an item which sets none either, as not every backend keeps the previous item's values.
+// The offsets into the buffers and the scissor are not compared.
+bool sameDrawState(const Frame& frame, const RenderItem& a, const RenderItem& b) {
+    return a.program == b.program && a.vb == b.vb && a.ib == b.ib &&
+           a.vertex_layout == b.vertex_layout && a.index_type_override == b.index_type_override &&
+           a.base_vertex == b.base_vertex && a.state == b.state &&
+           a.occlusion_query == b.occlusion_query &&
+           viewsEqual(frame.uniformBuffers(a), frame.uniformBuffers(b)) &&
+           viewsEqual(frame.textures(a), frame.textures(b)) &&
+           (a.uniform_blocks == b.uniform_blocks || uniformBlocksEqual(frame, a, b)) &&
+           (a.uniforms == b.uniforms || uniformsEqual(frame.uniforms(a), frame.uniforms(b)));
+}
+
+bool sameScissor(const RenderItem& a, const RenderItem& b) {
+    if (a.scissor_enabled != b.scissor_enabled) {
+        return false;
+    }
+    return !a.scissor_enabled || (a.scissor_x == b.scissor_x && a.scissor_y == b.scissor_y &&
+                                  a.scissor_width == b.scissor_width &&
+                                  a.scissor_height == b.scissor_height);
+}
+}  // namespace
+
 Frame::Frame() {
     clear();
 }
 
 void Frame::clear() {
-    pending_item = RenderItem();
+    pending = PendingRenderItem();
     render_queues.clear();
+    uniform_arena.clear();
+    uniform_block_arena.clear();
+    uniform_block_data_arena.clear();
+    uniform_buffer_arena.clear();
+    texture_arena.clear();
+    storage_buffer_arena.clear();
+    storage_image_arena.clear();
     commands_pre.clear();
     commands_post.clear();
     transient_vb_storage.size = 0;
@@ -35,6 +250,34 @@ void Frame::clear() {
     render_queues.emplace_back();
 }
 
+ArenaView<std::pair<std::string, UniformData>> Frame::uniforms(const RenderItem& item) const {
+    return {uniform_arena, item.uniforms};
+}
+
+ArenaView<RenderItem::UniformBlockData> Frame::uniformBlocks(const RenderItem& item) const {
+    return {uniform_block_arena, item.uniform_blocks};
+}
+
+ArenaView<byte> Frame::uniformBlockData(const RenderItem::UniformBlockData& block) const {
+    return {uniform_block_data_arena, block.data};
+}
+
+ArenaView<RenderItem::UniformBufferBinding> Frame::uniformBuffers(const RenderItem& item) const {
+    return {uniform_buffer_arena, item.uniform_buffers};
+}
+
+ArenaView<RenderItem::TextureBinding> Frame::textures(const RenderItem& item) const {
+    return {texture_arena, item.textures};
+}
+
+ArenaView<RenderItem::StorageBufferBinding> Frame::storageBuffers(const RenderItem& item) const {
+    return {storage_buffer_arena, item.storage_buffers};
+}
+
+ArenaView<RenderItem::StorageImageBinding> Frame::storageImages(const RenderItem& item) const {
+    return {storage_image_arena, item.storage_images};
+}
+
 Renderer::Renderer(Logger& logger)
     : logger_(logger),
       use_render_thread_(false),
@@ -45,7 +288,9 @@ Renderer::Renderer(Logger& logger)
       submit_(&frames_[0]),
       render_(&frames_[1]),
       transient_vb(-1),
-      transient_ib(-1) {
+      transient_ib(-1),
+      transient_frame_buffer_idle_frames_(8),
+      frame_counter_(0) {
 }
 
 Renderer::~Renderer() {
@@ -83,6 +328,10 @@ Result<void, std::string> Renderer::init(RendererType type, u16 width, u16 heigh
     use_render_thread_ = use_render_thread;
     is_first_frame_ = true;
 
+    // Register the empty vertex decl first, so it's layout 0, which is used by items without a
+    // vertex buffer.
+    createVertexLayout(VertexDecl{});
+
     // Initialise transient vb/ib.
     transient_vb_max_size = DW_MAX_TRANSIENT_VERTEX_BUFFER_SIZE;
     transient_vb =
@@ -162,20 +411,39 @@ bool Renderer::hasFlippedViewport() const {
     return false;
 }
 
+VertexLayoutId Renderer::createVertexLayout(const VertexDecl& decl) {
+    auto it = vertex_layout_ids_.find(decl);
+    if (it != vertex_layout_ids_.end()) {
+        return it->second;
+    }
+    if (vertex_layouts_.size() > std::numeric_limits<VertexLayoutId>::max()) {
+        logger_.error("Exceeded the maximum number of vertex layouts ({}).",
+                      vertex_layouts_.size());
+        return 0;
+    }
+    auto id = static_cast<VertexLayoutId>(vertex_layouts_.size());
+    vertex_layouts_.emplace_back(decl);
+    vertex_layout_ids_.emplace(decl, id);
+    submitPreFrameCommand(cmd::CreateVertexLayout{id, decl});
+    return id;
+}
+
 VertexBufferHandle Renderer::createVertexBuffer(Memory data, const VertexDecl& decl,
                                                 BufferUsage usage) {
     // TODO: Validate data.
     auto handle = vertex_buffer_handle_.next();
     uint data_size = data.size();
-    submitPreFrameCommand(cmd::CreateVertexBuffer{handle, std::move(data), data_size, decl, usage});
-    vertex_buffer_info_[handle] = VertexBufferInfo{decl, usage};
+    VertexLayoutId layout = createVertexLayout(decl);
+    submitPreFrameCommand(
+        cmd::CreateVertexBuffer{handle, std::move(data), data_size, layout, usage});
+    vertex_buffer_info_[handle] = VertexBufferInfo{layout, usage};
     return handle;
 }
 
 void Renderer::setVertexBuffer(VertexBufferHandle handle) {
-    submit_->pending_item.vb = handle;
-    submit_->pending_item.vb_offset = 0;
-    submit_->pending_item.vertex_decl_override = VertexDecl{};
+    submit_->pending.item.vb = handle;
+    submit_->pending.item.vb_offset = 0;
+    submit_->pending.item.vertex_layout = vertex_buffer_info_.at(handle).layout;
 }
 
 void Renderer::updateVertexBuffer(VertexBufferHandle handle, Memory data, uint offset) {
@@ -194,7 +462,7 @@ void Renderer::updateVertexBuffer(VertexBufferHandle handle, Memory data, uint o
 #ifdef DW_DEBUG
     if (submit_->updated_vertex_buffers.count(handle) != 0) {
         logger_.warn(
-            "Warning: Updating vertex buffer %d which has been updated already this frame.",
+            "Warning: Updating vertex buffer {} which has been updated already this frame.",
             handle.internal());
     } else {
         submit_->updated_vertex_buffers.insert(handle);
@@ -216,8 +484,9 @@ IndexBufferHandle Renderer::createIndexBuffer(Memory data, IndexBufferType type,
 }
 
 void Renderer::setIndexBuffer(IndexBufferHandle handle) {
-    submit_->pending_item.ib = handle;
-    submit_->pending_item.ib_offset = 0;
+    submit_->pending.item.ib = handle;
+    submit_->pending.item.ib_offset = 0;
+    submit_->pending.item.index_type_override.reset();
 }
 
 void Renderer::updateIndexBuffer(IndexBufferHandle handle, Memory data, uint offset) {
@@ -226,7 +495,7 @@ void Renderer::updateIndexBuffer(IndexBufferHandle handle, Memory data, uint off
 
 #ifdef DW_DEBUG
     if (submit_->updated_index_buffers.count(handle) != 0) {
-        logger_.warn("Warning: Updating index buffer %d which has been updated already this frame.",
+        logger_.warn("Warning: Updating index buffer {} which has been updated already this frame.",
                      handle.internal());
     } else {
         submit_->updated_index_buffers.insert(handle);
@@ -250,7 +519,7 @@ std::optional<TransientVertexBufferHandle> Renderer::allocTransientVertexBuffer(
     auto handle = submit_->transient_vertex_buffer_handle_generator_.next();
     byte* data = submit_->transient_vb_storage.data.data() + submit_->transient_vb_storage.size;
     submit_->transient_vb_storage.size += size;
-    submit_->transient_vertex_buffers_[handle] = {data, size, decl};
+    submit_->transient_vertex_buffers_[handle] = {data, size, createVertexLayout(decl)};
     return handle;
 }
 
@@ -264,23 +533,26 @@ byte* Renderer::getTransientVertexBufferData(TransientVertexBufferHandle handle)
 
 void Renderer::setVertexBuffer(TransientVertexBufferHandle handle) {
     Frame::TransientVertexBufferData& tvb = submit_->transient_vertex_buffers_.at(handle);
-    submit_->pending_item.vb = transient_vb;
-    submit_->pending_item.vb_offset = uint(tvb.data - submit_->transient_vb_storage.data.data());
-    submit_->pending_item.vertex_decl_override = tvb.decl;
-}
-
-std::optional<TransientIndexBufferHandle> Renderer::allocTransientIndexBuffer(uint index_count) {
-    // Check that we have enough space.
-    uint size = index_count * sizeof(u16);
-    if (size > transient_ib_max_size - submit_->transient_ib_storage.size) {
+    submit_->pending.item.vb = transient_vb;
+    submit_->pending.item.vb_offset = uint(tvb.data - submit_->transient_vb_storage.data.data());
+    submit_->pending.item.vertex_layout = tvb.layout;
+}
+
+std::optional<TransientIndexBufferHandle> Renderer::allocTransientIndexBuffer(
+    uint index_count, IndexBufferType type) {
+    // Check that we have enough space. 32-bit indices must start at a 4 byte aligned offset.
+    uint index_size = type == IndexBufferType::U16 ? sizeof(u16) : sizeof(u32);
+    uint offset = strideAlign(submit_->transient_ib_storage.size, index_size);
+    uint size = index_count * index_size;
+    if (offset > transient_ib_max_size || size > transient_ib_max_size - offset) {
         return std::nullopt;
     }
 
     // Allocate handle.
     auto handle = submit_->transient_index_buffer_handle_generator_.next();
-    byte* data = submit_->transient_ib_storage.data.data() + submit_->transient_ib_storage.size;
-    submit_->transient_ib_storage.size += size;
-    submit_->transient_index_buffers_[handle] = {data, size};
+    byte* data = submit_->transient_ib_storage.data.data() + offset;
+    submit_->transient_ib_storage.size = offset + size;
+    submit_->transient_index_buffers_[handle] = {data, size, type};
     return handle;
 }
 
@@ -294,8 +566,9 @@ byte* Renderer::getTransientIndexBufferData(TransientIndexBufferHandle handle) {
 
 void Renderer::setIndexBuffer(TransientIndexBufferHandle handle) {
     Frame::TransientIndexBufferData& tib = submit_->transient_index_buffers_.at(handle);
-    submit_->pending_item.ib = transient_ib;
-    submit_->pending_item.ib_offset = uint(tib.data - submit_->transient_ib_storage.data.data());
+    submit_->pending.item.ib = transient_ib;
+    submit_->pending.item.ib_offset = uint(tib.data - submit_->transient_ib_storage.data.data());
+    submit_->pending.item.index_type_override = tib.type;
 }
 
 ProgramHandle Renderer::createProgram(std::vector<ShaderStageInfo> stages) {
@@ -337,31 +610,136 @@ void Renderer::setUniform(const std::string& uniform_name, const Mat4& value) {
 }
 
 void Renderer::setUniform(const std::string& uniform_name, UniformData data) {
-    // MathGeoLib stores matrices in row-major order, but render contexts expect matrices in
-    // column-major order.
-    if (Mat3* mat3_data = std::get_if<Mat3>(&data)) {
-        mat3_data->Transpose();
-    } else if (Mat4* mat4_data = std::get_if<Mat4>(&data)) {
-        mat4_data->Transpose();
+    submit_->pending.uniforms[uniform_name] = toColumnMajor(std::move(data));
+    submit_->pending.uniforms_written = false;
+}
+
+void Renderer::setUniformArray(const std::string& uniform_name, const int* values, uint count) {
+    setUniform(uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setUniformArray(const std::string& uniform_name, const float* values, uint count) {
+    setUniform(uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setUniformArray(const std::string& uniform_name, const Vec2* values, uint count) {
+    setUniform(uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setUniformArray(const std::string& uniform_name, const Vec3* values, uint count) {
+    setUniform(uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setUniformArray(const std::string& uniform_name, const Vec4* values, uint count) {
+    setUniform(uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setUniformArray(const std::string& uniform_name, const Mat3* values, uint count) {
+    setUniform(uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setUniformArray(const std::string& uniform_name, const Mat4* values, uint count) {
+    setUniform(uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setUniformBlock(uint binding_location, const byte* data, uint size) {
+    setUniformBlock(binding_location, data, size, nullptr);
+}
+
+const UniformBlockLayout* Renderer::findOrCreateUniformBlockLayout(std::type_index type,
+                                                                   uint size) {
+    auto it = uniform_block_layouts_.find(type);
+    if (it == uniform_block_layouts_.end()) {
+        it = uniform_block_layouts_
+                 .emplace(type, std::make_unique<UniformBlockLayout>(UniformBlockLayout{size, {}}))
+                 .first;
+    }
+    return it->second.get();
+}
+
+void Renderer::declareUniformBlock(std::type_index type, uint size,
+                                   std::vector<UniformBlockLayout::Member> members) {
+    // Layouts can't change once they're used, as the backends keep the result of checking them.
+    if (uniform_block_layouts_.count(type) > 0) {
+        logger_.error("Uniform block struct {} has already been declared or used, skipping.",
+                      type.name());
+        return;
+    }
+    uniform_block_layouts_.emplace(
+        type, std::make_unique<UniformBlockLayout>(UniformBlockLayout{size, std::move(members)}));
+}
+
+void Renderer::setUniformBlock(uint binding_location, const byte* data, uint size,
+                               const UniformBlockLayout* layout) {
+    auto& blocks = submit_->pending.uniform_blocks;
+    auto it = std::find_if(blocks.begin(), blocks.end(),
+                           [binding_location](const PendingRenderItem::UniformBlock& block) {
+                               return block.binding_location == binding_location;
+                           });
+    if (it == blocks.end()) {
+        it = blocks.insert(blocks.end(),
+                           PendingRenderItem::UniformBlock{binding_location, {}, nullptr});
     }
-    submit_->pending_item.uniforms[uniform_name] = data;
+    it->data.assign(data, data + size);
+    it->layout = layout;
+    submit_->pending.uniform_blocks_written = false;
+}
+
+UniformBufferHandle Renderer::createUniformBuffer(uint size, BufferUsage usage) {
+    auto handle = uniform_buffer_handle_.next();
+    submitPreFrameCommand(cmd::CreateUniformBuffer{handle, Memory(), size, usage});
+    uniform_buffer_usages_[handle] = usage;
+    return handle;
+}
+
+UniformBufferHandle Renderer::createUniformBuffer(Memory data, BufferUsage usage) {
+    auto handle = uniform_buffer_handle_.next();
+    uint data_size = data.size();
+    submitPreFrameCommand(cmd::CreateUniformBuffer{handle, std::move(data), data_size, usage});
+    uniform_buffer_usages_[handle] = usage;
+    return handle;
+}
+
+void Renderer::updateUniformBuffer(UniformBufferHandle handle, Memory data, uint offset) {
+    auto usage = uniform_buffer_usages_.find(handle);
+    if (usage == uniform_buffer_usages_.end()) {
+        logger_.error("Uniform buffer handle {} invalid.", static_cast<u32>(handle));
+        return;
+    }
+    if (usage->second == BufferUsage::Static) {
+        logger_.error("Attempted to update a static uniform buffer {}, skipping.",
+                      static_cast<u32>(handle));
+        return;
+    }
+    submitPreFrameCommand(cmd::UpdateUniformBuffer{handle, std::move(data), offset});
+}
+
+void Renderer::deleteUniformBuffer(UniformBufferHandle handle) {
+    uniform_buffer_usages_.erase(handle);
+    submitPostFrameCommand(cmd::DeleteUniformBuffer{handle});
+}
+
+void Renderer::setUniformBuffer(uint binding_location, UniformBufferHandle handle, uint offset) {
+    submit_->pending.uniform_buffers.emplace_back(
+        RenderItem::UniformBufferBinding{binding_location, handle, offset});
 }
 
 TextureHandle Renderer::createTexture2D(u16 width, u16 height, TextureFormat format, Memory data,
-                                        bool generate_mipmaps, bool framebuffer_usage) {
+                                        bool generate_mipmaps, bool framebuffer_usage,
+                                        bool storage_usage) {
     auto handle = texture_handle_.next();
     texture_data_[handle] = {width, height, format};
     submitPreFrameCommand(cmd::CreateTexture2D{handle, width, height, format, std::move(data),
-                                               generate_mipmaps, framebuffer_usage});
+                                               generate_mipmaps, framebuffer_usage, storage_usage});
     return handle;
 }
 
 bool Renderer::setTexture(uint binding_location, TextureHandle handle, u32 sampler_flags,
                           float max_anisotropy) {
-    if (submit_->pending_item.textures.size() == DW_MAX_TEXTURE_SAMPLERS) {
+    if (submit_->pending.textures.size() == DW_MAX_TEXTURE_SAMPLERS) {
         return false;
     }
-    submit_->pending_item.textures.emplace_back(
+    submit_->pending.textures.emplace_back(
         RenderItem::TextureBinding{binding_location, handle, {sampler_flags, max_anisotropy}});
     return true;
 }
@@ -371,40 +749,142 @@ void Renderer::deleteTexture(TextureHandle handle) {
     submitPostFrameCommand(cmd::DeleteTexture{handle});
 }
 
-FrameBufferHandle Renderer::createFrameBuffer(u16 width, u16 height, TextureFormat format) {
-    auto handle = frame_buffer_handle_.next();
+FrameBufferHandle Renderer::createFrameBuffer(u16 width, u16 height, TextureFormat format,
+                                              uint samples) {
     auto texture_handle = createTexture2D(width, height, format, Memory(), false, true);
-    frame_buffer_textures_[handle] = {texture_handle};
-    submitPreFrameCommand(cmd::CreateFrameBuffer{handle, width, height, {texture_handle}});
-    return handle;
+    if (isDepthFormat(format)) {
+        return createFrameBuffer(FrameBufferDesc{{}, texture_handle, samples});
+    }
+    return createFrameBuffer(FrameBufferDesc{{texture_handle}, std::nullopt, samples});
 }
 
-FrameBufferHandle Renderer::createFrameBuffer(std::vector<TextureHandle> textures) {
-    auto handle = frame_buffer_handle_.next();
-    u16 width = texture_data_.at(textures[0]).width, height = texture_data_.at(textures[0]).height;
-    for (size_t i = 1; i < textures.size(); ++i) {
-        auto& data = texture_data_.at(textures[i]);
+FrameBufferHandle Renderer::createFrameBuffer(std::vector<TextureHandle> textures, uint samples) {
+    return createFrameBuffer(FrameBufferDesc{std::move(textures), std::nullopt, samples});
+}
+
+FrameBufferHandle Renderer::createFrameBuffer(const FrameBufferDesc& desc) {
+    std::vector<TextureHandle> attachments = desc.colour_textures;
+    if (desc.depth_texture) {
+        attachments.emplace_back(*desc.depth_texture);
+    }
+    assert(!attachments.empty());
+    u16 width = texture_data_.at(attachments[0]).width;
+    u16 height = texture_data_.at(attachments[0]).height;
+    for (size_t i = 1; i < attachments.size(); ++i) {
+        auto& data = texture_data_.at(attachments[i]);
         if (data.width != width || data.height != height) {
-            // TODO: error.
-            logger_.error("Frame buffer mismatch at index %d: Expected: %d x %d, Actual: %d x %d",
+            logger_.error("Frame buffer mismatch at index {}: Expected: {} x {}, Actual: {} x {}",
                           i, width, height, data.width, data.height);
+            return FrameBufferHandle{};
         }
     }
-    frame_buffer_textures_[handle] = textures;
-    submitPreFrameCommand(cmd::CreateFrameBuffer{handle, width, height, textures});
+    if (desc.depth_texture && !isDepthFormat(texture_data_.at(*desc.depth_texture).format)) {
+        logger_.error("Frame buffer depth texture {} doesn't have a depth format.",
+                      *desc.depth_texture);
+        return FrameBufferHandle{};
+    }
+    if (desc.depth_texture && desc.samples > 1) {
+        logger_.error("Multisampled frame buffers can't have a depth texture, as depth isn't "
+                      "resolved. Requested {} samples.",
+                      desc.samples);
+        return FrameBufferHandle{};
+    }
+    auto handle = frame_buffer_handle_.next();
+    frame_buffer_descs_[handle] = desc;
+    submitPreFrameCommand(cmd::CreateFrameBuffer{handle, width, height, desc.colour_textures,
+                                                 desc.depth_texture, desc.samples});
     return handle;
 }
 
 TextureHandle Renderer::getFrameBufferTexture(FrameBufferHandle handle, uint index) {
-    auto& textures = frame_buffer_textures_.at(handle);
+    auto& textures = frame_buffer_descs_.at(handle).colour_textures;
     return textures[index];
 }
 
+std::optional<TextureHandle> Renderer::getFrameBufferDepthTexture(FrameBufferHandle handle) {
+    return frame_buffer_descs_.at(handle).depth_texture;
+}
+
 void Renderer::deleteFrameBuffer(FrameBufferHandle handle) {
-    frame_buffer_textures_.erase(handle);
+    frame_buffer_descs_.erase(handle);
     submitPostFrameCommand(cmd::DeleteFrameBuffer{handle});
 }
 
+FrameBufferHandle Renderer::acquireTransientFrameBuffer(const TransientFrameBufferDesc& desc) {
+    for (auto& frame_buffer : transient_frame_buffers_) {
+        if (!frame_buffer.in_use && frame_buffer.desc == desc) {
+            frame_buffer.in_use = true;
+            return frame_buffer.handle;
+        }
+    }
+
+    std::vector<TextureHandle> textures;
+    textures.reserve(desc.formats.size());
+    for (TextureFormat format : desc.formats) {
+        textures.emplace_back(
+            createTexture2D(desc.width, desc.height, format, Memory(), false, true));
+    }
+    auto handle = createFrameBuffer(std::move(textures), desc.samples);
+    transient_frame_buffers_.emplace_back(TransientFrameBuffer{desc, handle, true, frame_counter_});
+    return handle;
+}
+
+void Renderer::setTransientFrameBufferIdleFrames(uint frames) {
+    transient_frame_buffer_idle_frames_ = frames;
+}
+
+void Renderer::resolveAttachmentOps(Frame& frame) {
+    // Walk backwards through the render queues, tracking whether the next render queue which
+    // targets each frame buffer loads its depth attachment. If it doesn't, the depth attachment
+    // doesn't need to be stored, unless it's a depth texture which may be sampled later.
+    std::unordered_map<FrameBufferHandle, bool> depth_loaded_later;
+    bool backbuffer_depth_loaded_later = false;
+    for (auto it = frame.render_queues.rbegin(); it != frame.render_queues.rend(); ++it) {
+        auto& q = *it;
+        bool& depth_loaded = q.frame_buffer ? depth_loaded_later[*q.frame_buffer]
+                                            : backbuffer_depth_loaded_later;
+        bool has_depth_texture = false;
+        if (q.frame_buffer) {
+            auto desc = frame_buffer_descs_.find(*q.frame_buffer);
+            has_depth_texture =
+                desc != frame_buffer_descs_.end() && desc->second.depth_texture.has_value();
+        }
+        if (!q.attachment_ops) {
+            bool clear_colour = q.clear_parameters && q.clear_parameters->clear_colour;
+            bool clear_depth = q.clear_parameters && q.clear_parameters->clear_depth;
+            q.attachment_ops = AttachmentOps{
+                clear_colour ? AttachmentLoadOp::Clear : AttachmentLoadOp::Load,
+                AttachmentStoreOp::Store,
+                clear_depth ? AttachmentLoadOp::Clear : AttachmentLoadOp::Load,
+                depth_loaded || has_depth_texture ? AttachmentStoreOp::Store
+                                                  : AttachmentStoreOp::DontCare};
+        }
+        depth_loaded = q.attachment_ops->depth_load == AttachmentLoadOp::Load;
+    }
+}
+
+void Renderer::recycleTransientFrameBuffers() {
+    // Return frame buffers used this frame to the pool, and delete frame buffers which haven't been
+    // used recently.
+    auto it = transient_frame_buffers_.begin();
+    while (it != transient_frame_buffers_.end()) {
+        if (it->in_use) {
+            it->in_use = false;
+            it->last_used_frame = frame_counter_;
+        } else if (frame_counter_ - it->last_used_frame >= transient_frame_buffer_idle_frames_) {
+            auto textures = frame_buffer_descs_.at(it->handle).colour_textures;
+            deleteFrameBuffer(it->handle);
+            for (TextureHandle texture : textures) {
+                deleteTexture(texture);
+            }
+            it = transient_frame_buffers_.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    frame_counter_++;
+}
+
 uint Renderer::startRenderQueue(std::optional<FrameBufferHandle> frame_buffer) {
     submit_->render_queues.emplace_back();
     submit_->render_queues.back().frame_buffer = frame_buffer;
@@ -425,16 +905,184 @@ void Renderer::setRenderQueueClear(uint render_queue, const Colour& colour, bool
         RenderQueue::ClearParameters{colour, clear_colour, clear_depth});
 }
 
+void Renderer::setRenderQueueInputs(uint render_queue, std::vector<TextureHandle> textures) {
+    auto& q = submit_->render_queues[render_queue];
+
+    // Sampling an attachment of the frame buffer being rendered to is a feedback loop, which
+    // backends can't synchronise within a render pass.
+    if (q.frame_buffer) {
+        const auto& desc = frame_buffer_descs_.at(*q.frame_buffer);
+        auto is_attachment = [&desc](TextureHandle texture) {
+            return desc.depth_texture == texture ||
+                   std::find(desc.colour_textures.begin(), desc.colour_textures.end(), texture) !=
+                       desc.colour_textures.end();
+        };
+        auto attachments_begin = std::remove_if(textures.begin(), textures.end(), is_attachment);
+        for (auto it = attachments_begin; it != textures.end(); ++it) {
+            logger_.error("Render queue {} can't read texture {} as it renders to it, skipping.",
+                          render_queue, static_cast<u32>(*it));
+        }
+        textures.erase(attachments_begin, textures.end());
+    }
+    q.read_textures = std::move(textures);
+}
+
+void Renderer::setRenderQueueAttachmentOps(uint render_queue, const AttachmentOps& ops) {
+    submit_->render_queues[render_queue].attachment_ops = ops;
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     int value) {
+    setRenderQueueUniform(render_queue, uniform_name, UniformData{value});
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     float value) {
+    setRenderQueueUniform(render_queue, uniform_name, UniformData{value});
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     const Vec2& value) {
+    setRenderQueueUniform(render_queue, uniform_name, UniformData{value});
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     const Vec3& value) {
+    setRenderQueueUniform(render_queue, uniform_name, UniformData{value});
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     const Vec4& value) {
+    setRenderQueueUniform(render_queue, uniform_name, UniformData{value});
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     const Mat3& value) {
+    setRenderQueueUniform(render_queue, uniform_name, UniformData{value});
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     const Mat4& value) {
+    setRenderQueueUniform(render_queue, uniform_name, UniformData{value});
+}
+
+void Renderer::setRenderQueueUniform(uint render_queue, const std::string& uniform_name,
+                                     UniformData data) {
+    submit_->render_queues[render_queue].uniforms[uniform_name] = toColumnMajor(std::move(data));
+}
+
+void Renderer::setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                          const int* values, uint count) {
+    setRenderQueueUniform(render_queue, uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                          const float* values, uint count) {
+    setRenderQueueUniform(render_queue, uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                          const Vec2* values, uint count) {
+    setRenderQueueUniform(render_queue, uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                          const Vec3* values, uint count) {
+    setRenderQueueUniform(render_queue, uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                          const Vec4* values, uint count) {
+    setRenderQueueUniform(render_queue, uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                          const Mat3* values, uint count) {
+    setRenderQueueUniform(render_queue, uniform_name, packUniformArray(values, count));
+}
+
+void Renderer::setRenderQueueUniformArray(uint render_queue, const std::string& uniform_name,
+                                          const Mat4* values, uint count) {
+    setRenderQueueUniform(render_queue, uniform_name, packUniformArray(values, count));
+}
+
+bool Renderer::setRenderQueueTexture(uint render_queue, uint binding_location,
+                                     TextureHandle handle, u32 sampler_flags,
+                                     float max_anisotropy) {
+    auto& textures = submit_->render_queues[render_queue].textures;
+    if (textures.size() == DW_MAX_TEXTURE_SAMPLERS) {
+        return false;
+    }
+    textures.emplace_back(
+        RenderItem::TextureBinding{binding_location, handle, {sampler_flags, max_anisotropy}});
+    return true;
+}
+
+StorageBufferHandle Renderer::createStorageBuffer(Memory data, BufferUsage usage) {
+    auto handle = storage_buffer_handle_.next();
+    uint data_size = data.size();
+    submitPreFrameCommand(cmd::CreateStorageBuffer{handle, std::move(data), data_size, usage});
+    storage_buffer_usages_[handle] = usage;
+    return handle;
+}
+
+void Renderer::updateStorageBuffer(StorageBufferHandle handle, Memory data, uint offset) {
+    auto usage = storage_buffer_usages_.find(handle);
+    if (usage == storage_buffer_usages_.end()) {
+        logger_.error("Storage buffer handle {} invalid.", static_cast<u32>(handle));
+        return;
+    }
+    if (usage->second == BufferUsage::Static) {
+        logger_.error("Attempted to update a static storage buffer {}, skipping.",
+                      static_cast<u32>(handle));
+        return;
+    }
+    submitPreFrameCommand(cmd::UpdateStorageBuffer{handle, std::move(data), offset});
+}
+
+void Renderer::deleteStorageBuffer(StorageBufferHandle handle) {
+    storage_buffer_usages_.erase(handle);
+    submitPostFrameCommand(cmd::DeleteStorageBuffer{handle});
+}
+
+void Renderer::setStorageBuffer(uint binding_location, StorageBufferHandle handle) {
+    submit_->pending.storage_buffers.emplace_back(
+        RenderItem::StorageBufferBinding{binding_location, handle});
+}
+
+void Renderer::setStorageImage(uint binding_location, TextureHandle handle) {
+    submit_->pending.storage_images.emplace_back(
+        RenderItem::StorageImageBinding{binding_location, handle});
+}
+
+void Renderer::dispatch(uint render_queue, ProgramHandle program, uint group_count_x,
+                        uint group_count_y, uint group_count_z) {
+    // Only the bindings which compute programs use are taken from the pending item. Vertex
+    // buffers, index buffers and render state set for the next draw are kept.
+    auto& pending = submit_->pending;
+    RenderItem item;
+    item.program = program;
+    writeBindings(*submit_, pending, item);
+    item.group_count_x = group_count_x;
+    item.group_count_y = group_count_y;
+    item.group_count_z = group_count_z;
+    submit_->render_queues[render_queue].compute_items.emplace_back(item);
+    clearUniforms(pending);
+    pending.textures.clear();
+    pending.storage_buffers.clear();
+    pending.storage_images.clear();
+}
+
 void Renderer::setStateEnable(RenderState state) {
     switch (state) {
         case RenderState::CullFace:
-            submit_->pending_item.cull_face_enabled = true;
+            submit_->pending.item.state.setCullFaceEnabled(true);
             break;
         case RenderState::Depth:
-            submit_->pending_item.depth_enabled = true;
+            submit_->pending.item.state.setDepthEnabled(true);
             break;
         case RenderState::Blending:
-            submit_->pending_item.blend_enabled = true;
+            submit_->pending.item.state.setBlendEnabled(true);
             break;
     }
 }
@@ -442,23 +1090,23 @@ void Renderer::setStateEnable(RenderState state) {
 void Renderer::setStateDisable(RenderState state) {
     switch (state) {
         case RenderState::CullFace:
-            submit_->pending_item.cull_face_enabled = false;
+            submit_->pending.item.state.setCullFaceEnabled(false);
             break;
         case RenderState::Depth:
-            submit_->pending_item.depth_enabled = false;
+            submit_->pending.item.state.setDepthEnabled(false);
             break;
         case RenderState::Blending:
-            submit_->pending_item.blend_enabled = false;
+            submit_->pending.item.state.setBlendEnabled(false);
             break;
     }
 }
 
 void Renderer::setStateCullFrontFace(CullFrontFace front_face) {
-    submit_->pending_item.cull_front_face = front_face;
+    submit_->pending.item.state.setCullFrontFace(front_face);
 }
 
 void Renderer::setStatePolygonMode(PolygonMode polygon_mode) {
-    submit_->pending_item.polygon_mode = polygon_mode;
+    submit_->pending.item.state.setPolygonMode(polygon_mode);
 }
 
 void Renderer::setStateBlendEquation(BlendEquation equation, BlendFunc src, BlendFunc dest) {
@@ -468,28 +1116,60 @@ void Renderer::setStateBlendEquation(BlendEquation equation, BlendFunc src, Blen
 void Renderer::setStateBlendEquation(BlendEquation equation_rgb, BlendFunc src_rgb,
                                      BlendFunc dest_rgb, BlendEquation equation_a, BlendFunc src_a,
                                      BlendFunc dest_a) {
-    submit_->pending_item.blend_equation_rgb = equation_rgb;
-    submit_->pending_item.blend_src_rgb = src_rgb;
-    submit_->pending_item.blend_dest_rgb = dest_rgb;
-    submit_->pending_item.blend_equation_a = equation_a;
-    submit_->pending_item.blend_src_a = src_a;
-    submit_->pending_item.blend_dest_a = dest_a;
+    submit_->pending.item.state.setBlendEquation(equation_rgb, src_rgb, dest_rgb, equation_a, src_a,
+                                                 dest_a);
 }
 
 void Renderer::setColourWrite(bool write_enabled) {
-    submit_->pending_item.colour_write = write_enabled;
+    submit_->pending.item.state.setColourWrite(write_enabled);
 }
 
 void Renderer::setDepthWrite(bool write_enabled) {
-    submit_->pending_item.depth_write = write_enabled;
+    submit_->pending.item.state.setDepthWrite(write_enabled);
 }
 
 void Renderer::setScissor(u16 x, u16 y, u16 width, u16 height) {
-    submit_->pending_item.scissor_enabled = true;
-    submit_->pending_item.scissor_x = x;
-    submit_->pending_item.scissor_y = y;
-    submit_->pending_item.scissor_width = width;
-    submit_->pending_item.scissor_height = height;
+    submit_->pending.item.scissor_enabled = true;
+    submit_->pending.item.scissor_x = x;
+    submit_->pending.item.scissor_y = y;
+    submit_->pending.item.scissor_width = width;
+    submit_->pending.item.scissor_height = height;
+}
+
+OcclusionQueryHandle Renderer::createOcclusionQuery() {
+    auto handle = occlusion_query_handle_.next();
+    submitPreFrameCommand(cmd::CreateOcclusionQuery{handle});
+    return handle;
+}
+
+void Renderer::deleteOcclusionQuery(OcclusionQueryHandle handle) {
+    if (active_occlusion_query_ == handle) {
+        active_occlusion_query_.reset();
+    }
+    submitPostFrameCommand(cmd::DeleteOcclusionQuery{handle});
+}
+
+void Renderer::beginOcclusionQuery(OcclusionQueryHandle handle) {
+    if (active_occlusion_query_) {
+        logger_.warn("Occlusion query {} started before occlusion query {} has ended.", handle,
+                     *active_occlusion_query_);
+    }
+    active_occlusion_query_ = handle;
+}
+
+void Renderer::endOcclusionQuery() {
+    active_occlusion_query_.reset();
+}
+
+std::optional<bool> Renderer::getOcclusionQueryResult(OcclusionQueryHandle handle) const {
+    if (shared_render_context_) {
+        return shared_render_context_->occlusionQueryResult(handle);
+    }
+    return std::nullopt;
+}
+
+void Renderer::setOcclusionCondition(OcclusionQueryHandle handle) {
+    submit_->pending.item.occlusion_condition = handle;
 }
 
 void Renderer::submit(ProgramHandle program) {
@@ -500,30 +1180,78 @@ void Renderer::submit(uint render_queue, ProgramHandle program) {
     submit(render_queue, program, 0);
 }
 
-void Renderer::submit(ProgramHandle program, uint vertex_count, uint offset) {
-    submit(lastCreatedRenderQueue(), program, vertex_count, offset);
+void Renderer::submit(ProgramHandle program, uint vertex_count, uint offset, uint base_vertex,
+                      u32 discard) {
+    submit(lastCreatedRenderQueue(), program, vertex_count, offset, base_vertex, discard);
 }
 
-void Renderer::submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset) {
-    // Complete item.
-    auto& item = submit_->pending_item;
+void Renderer::submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset,
+                      uint base_vertex, u32 discard) {
+    auto& pending = submit_->pending;
+
+    // Drop the item if it was hidden the last time the occlusion query completed.
+    if (pending.item.occlusion_condition.has_value()) {
+        auto visible = getOcclusionQueryResult(*pending.item.occlusion_condition);
+        if (visible.has_value() && !*visible) {
+            discardPendingState(pending, discard);
+            return;
+        }
+    }
+
+    // Complete the item. The pending item is left as it was, so that the state which is kept for
+    // the next item is unaffected by the offsets applied below.
+    Frame& frame = *submit_;
+    usize texture_arena_size = frame.texture_arena.size();
+    usize uniform_buffer_arena_size = frame.uniform_buffer_arena.size();
+    usize storage_buffer_arena_size = frame.storage_buffer_arena.size();
+    usize storage_image_arena_size = frame.storage_image_arena.size();
+    RenderItem item = pending.item;
+    writeBindings(frame, pending, item);
     item.program = program;
+    item.occlusion_query = active_occlusion_query_;
     item.primitive_count = vertex_count / 3;
+    item.base_vertex = item.ib.has_value() ? base_vertex : 0;
     if (vertex_count > 0) {
         if (item.ib.has_value()) {
-            IndexBufferType type = index_buffer_types_.at(*item.ib);
+            IndexBufferType type =
+                item.index_type_override.value_or(index_buffer_types_.at(*item.ib));
             item.ib_offset += offset * (type == IndexBufferType::U16 ? sizeof(u16) : sizeof(u32));
         } else if (item.vb.has_value()) {
-            const VertexDecl& decl = vertex_buffer_info_.at(*item.vb).decl;
-            item.vb_offset += offset * decl.stride();
+            item.vb_offset += offset * vertex_layouts_[item.vertex_layout].stride();
         } else {
             logger_.error("Submitted item with no vertex or index buffer bound.");
         }
     }
 
-    // Move the "pending" render item to the specified render queue.
-    submit_->render_queues[render_queue].render_items.emplace_back(std::move(item));
-    item = RenderItem();
+    // Bind the render queue's textures to the binding locations which the item doesn't use. The
+    // item's textures are the last ones in the arena, so the queue's textures extend its range.
+    auto& queue = submit_->render_queues[render_queue];
+    for (const auto& texture : queue.textures) {
+        auto item_textures = frame.textures(item);
+        bool overridden = std::any_of(item_textures.begin(), item_textures.end(),
+                                      [&texture](const RenderItem::TextureBinding& binding) {
+                                          return binding.binding_location ==
+                                                 texture.binding_location;
+                                      });
+        if (!overridden && item.textures.count < DW_MAX_TEXTURE_SAMPLERS) {
+            frame.texture_arena.emplace_back(texture);
+            item.textures.count++;
+        }
+    }
+
+    // Add the item to the specified render queue, unless it can be merged into the previous item.
+    // A merged item's bindings are dropped from the arenas again.
+    auto& render_items = queue.render_items;
+    frame_stats_.submitted_items++;
+    if (render_items.empty() || !mergeRenderItem(render_items.back(), item)) {
+        render_items.emplace_back(item);
+    } else {
+        frame.texture_arena.resize(texture_arena_size);
+        frame.uniform_buffer_arena.resize(uniform_buffer_arena_size);
+        frame.storage_buffer_arena.resize(storage_buffer_arena_size);
+        frame.storage_image_arena.resize(storage_image_arena_size);
+    }
+    discardPendingState(pending, discard);
 }
 
 void Renderer::submitFullscreenQuad(ProgramHandle program) {
@@ -532,12 +1260,18 @@ void Renderer::submitFullscreenQuad(ProgramHandle program) {
 
 void Renderer::submitFullscreenQuad(uint render_queue, ProgramHandle program) {
     setVertexBuffer(fullscreen_quad_vb_);
-    submit_->pending_item.ib.reset();
-    submit_->pending_item.ib_offset = 0;
+    submit_->pending.item.ib.reset();
+    submit_->pending.item.ib_offset = 0;
+    submit_->pending.item.index_type_override.reset();
     submit(render_queue, program, 3, 0);
 }
 
 bool Renderer::frame() {
+    // Transient frame buffers are recycled before the frame is swapped, so that deletions are
+    // submitted as part of this frame's post-frame commands.
+    recycleTransientFrameBuffers();
+    resolveAttachmentOps(*submit_);
+
     // If we are rendering in multithreaded mode, wait for the render thread.
     if (use_render_thread_) {
         // If the rendering thread is doing nothing, print a warning and give up.
@@ -565,6 +1299,10 @@ bool Renderer::frame() {
         }
     }
 
+    // Update statistics.
+    last_frame_stats_ = frame_stats_;
+    frame_stats_ = FrameStats{};
+
     // Update window events.
     shared_render_context_->processEvents();
     if (shared_render_context_->isWindowClosed()) {
@@ -596,6 +1334,41 @@ void Renderer::submitPostFrameCommand(RenderCommand command) {
     submit_->commands_post.emplace_back(std::move(command));
 }
 
+bool Renderer::mergeRenderItem(RenderItem& previous, RenderItem& item) {
+    // Items without geometry may be used to set up uniforms, so they're never merged.
+    if (previous.primitive_count == 0 || item.primitive_count == 0 ||
+        !sameDrawState(*submit_, previous, item)) {
+        return false;
+    }
+
+    // Check whether the item draws the range directly after the previous item.
+    bool contiguous;
+    if (item.ib) {
+        IndexBufferType type = item.index_type_override.value_or(index_buffer_types_.at(*item.ib));
+        uint index_size = type == IndexBufferType::U16 ? sizeof(u16) : sizeof(u32);
+        uint previous_end = previous.ib_offset + previous.primitive_count * 3 * index_size;
+        contiguous = item.vb_offset == previous.vb_offset && item.ib_offset == previous_end;
+    } else if (item.vb) {
+        u16 stride = vertex_layouts_[item.vertex_layout].stride();
+        contiguous = item.vb_offset == previous.vb_offset + previous.primitive_count * 3 * stride;
+    } else {
+        return false;
+    }
+    if (contiguous && sameScissor(previous, item)) {
+        previous.primitive_count += item.primitive_count;
+        frame_stats_.merged_items++;
+        return true;
+    }
+
+    // The item can't be merged, but indexed items which share the same vertex data only need a
+    // new scissor and index range.
+    if (item.ib && item.vb_offset == previous.vb_offset) {
+        item.continues_previous = true;
+        frame_stats_.continued_items++;
+    }
+    return false;
+}
+
 void Renderer::renderThread() {
     shared_render_context_->startRendering();
 
@@ -647,5 +1420,9 @@ bool Renderer::renderFrame(Frame* frame) {
 RendererType Renderer::rendererType() const {
     return shared_render_context_->type();
 }
+
+const FrameStats& Renderer::frameStats() const {
+    return last_frame_stats_;
+}
 }  // namespace gfx
 }  // namespace dw
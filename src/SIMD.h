@@ -0,0 +1,13 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+// SSE is available on every x86-64 target we build for. Other targets (such as emscripten) fall
+// back to the scalar code paths.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DW_SIMD_SSE
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
@@ -141,6 +141,9 @@ Result<ShaderStageInfo, ShaderCompileError> compileGLSL(
         case ShaderStage::Fragment:
             esh_stage = EShLangFragment;
             break;
+        case ShaderStage::Compute:
+            esh_stage = EShLangCompute;
+            break;
         default:
             return Error(
                 ShaderCompileError{fmt::format("Unexpected shader stage {}", esh_stage), ""});
@@ -0,0 +1,86 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "StaticBatchBuilder.h"
+
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+
+namespace dw {
+namespace gfx {
+void StaticBatchBuilder::setCellSize(float cell_size) {
+    cell_size_ = cell_size;
+}
+
+void StaticBatchBuilder::add(const TriangleBuffer& buffer, const Mat4& transform,
+                             u64 material_key) {
+    if (buffer.vertices().empty() || buffer.indices().empty()) {
+        return;
+    }
+    entries_.emplace_back(Entry{&buffer, transform, material_key});
+}
+
+std::vector<StaticBatchBuilder::Batch> StaticBatchBuilder::build(Renderer& r) {
+    using BatchKey = std::tuple<u64, i32, i32, i32>;
+
+    // Centre of the bounds of each triangle buffer, in object space.
+    std::unordered_map<const TriangleBuffer*, Vec3> local_centres;
+    auto local_centre = [&local_centres](const TriangleBuffer* buffer) {
+        auto it = local_centres.find(buffer);
+        if (it == local_centres.end()) {
+            Vec3 min = buffer->vertices()[0].position;
+            Vec3 max = min;
+            for (const auto& v : buffer->vertices()) {
+                min = min.Min(v.position);
+                max = max.Max(v.position);
+            }
+            it = local_centres.emplace(buffer, (min + max) * 0.5f).first;
+        }
+        return it->second;
+    };
+
+    // Group entries by material key and cell.
+    std::map<BatchKey, std::vector<const Entry*>> groups;
+    for (const auto& entry : entries_) {
+        i32 cell[3] = {0, 0, 0};
+        if (cell_size_ > 0.0f) {
+            Vec3 centre = entry.transform.TransformPos(local_centre(entry.buffer));
+            for (int i = 0; i < 3; ++i) {
+                cell[i] = static_cast<i32>(std::floor(centre[i] / cell_size_));
+            }
+        }
+        groups[BatchKey{entry.material_key, cell[0], cell[1], cell[2]}].emplace_back(&entry);
+    }
+
+    // Merge each group into a single mesh.
+    std::vector<Batch> batches;
+    batches.reserve(groups.size());
+    TriangleBuffer merged;
+    for (const auto& group : groups) {
+        usize vertex_count = 0, index_count = 0;
+        for (const auto* entry : group.second) {
+            vertex_count += entry->buffer->vertices().size();
+            index_count += entry->buffer->indices().size();
+        }
+        merged.begin();
+        merged.estimateVertexCount(static_cast<uint>(vertex_count));
+        merged.estimateIndexCount(static_cast<uint>(index_count));
+        for (const auto* entry : group.second) {
+            merged.append(*entry->buffer, entry->transform);
+        }
+        batches.emplace_back(Batch{std::get<0>(group.first), std::get<1>(group.first),
+                                   std::get<2>(group.first), std::get<3>(group.first),
+                                   merged.end(r)});
+    }
+    entries_.clear();
+    return batches;
+}
+
+usize StaticBatchBuilder::entryCount() const {
+    return entries_.size();
+}
+}  // namespace gfx
+}  // namespace dw
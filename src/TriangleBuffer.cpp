@@ -3,15 +3,339 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "TriangleBuffer.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <dga/hash_combine.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
 
 namespace dw {
 namespace gfx {
+namespace {
+constexpr usize kMinTrianglesPerThread = 16384;
+constexpr usize kMinVerticesPerThread = 16384;
+
+struct PositionHash {
+    std::size_t operator()(const Vec3& p) const {
+        std::size_t hash = 0;
+        dga::hashCombine(hash, p.x, p.y, p.z);
+        return hash;
+    }
+};
+
+struct PositionEqual {
+    bool operator()(const Vec3& a, const Vec3& b) const {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+};
+
+// One vector per triangle, stored as SoA.
+struct FaceVectors {
+    explicit FaceVectors(usize count) : x(count), y(count), z(count) {
+    }
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+};
+
+// Triangles adjacent to each vertex, in compressed row form. The triangles around vertex v are
+// triangles[offsets[v]] to triangles[offsets[v + 1] - 1].
+struct VertexTriangleAdjacency {
+    std::vector<u32> offsets;
+    std::vector<u32> triangles;
+};
+
+VertexTriangleAdjacency buildVertexTriangleAdjacency(const std::vector<u32>& indices,
+                                                     const std::vector<u32>& vertex_group,
+                                                     usize group_count) {
+    VertexTriangleAdjacency adjacency;
+    adjacency.offsets.resize(group_count + 1, 0);
+    for (u32 index : indices) {
+        adjacency.offsets[vertex_group[index] + 1]++;
+    }
+    for (usize g = 0; g < group_count; ++g) {
+        adjacency.offsets[g + 1] += adjacency.offsets[g];
+    }
+    std::vector<u32> cursor(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+    adjacency.triangles.resize(indices.size());
+    for (usize i = 0; i < indices.size(); ++i) {
+        adjacency.triangles[cursor[vertex_group[indices[i]]]++] = static_cast<u32>(i / 3);
+    }
+    return adjacency;
+}
+
+#ifdef DW_SIMD_SSE
+// Loads a component of one corner of four consecutive triangles.
+template <typename Getter>
+__m128 gatherCorners(const std::vector<TriangleBuffer::Vertex>& vertices,
+                     const std::vector<u32>& indices, usize first_triangle, int corner,
+                     Getter getter) {
+    const u32* index = &indices[first_triangle * 3 + corner];
+    return _mm_setr_ps(getter(vertices[index[0]]), getter(vertices[index[3]]),
+                       getter(vertices[index[6]]), getter(vertices[index[9]]));
+}
+
+inline __m128 dot3(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+#endif
+
+// Computes cross(p1 - p0, p2 - p0) for each triangle in [begin, end). The length of each normal is
+// twice the area of the triangle, which weights the sum at each vertex by area.
+void calculateFaceNormals(const std::vector<TriangleBuffer::Vertex>& vertices,
+                          const std::vector<u32>& indices, FaceVectors& out, usize begin,
+                          usize end) {
+    usize t = begin;
+#ifdef DW_SIMD_SSE
+    auto px = [](const TriangleBuffer::Vertex& v) { return v.position.x; };
+    auto py = [](const TriangleBuffer::Vertex& v) { return v.position.y; };
+    auto pz = [](const TriangleBuffer::Vertex& v) { return v.position.z; };
+    for (; t + 4 <= end; t += 4) {
+        __m128 p0x = gatherCorners(vertices, indices, t, 0, px);
+        __m128 p0y = gatherCorners(vertices, indices, t, 0, py);
+        __m128 p0z = gatherCorners(vertices, indices, t, 0, pz);
+        __m128 e1x = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, px), p0x);
+        __m128 e1y = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, py), p0y);
+        __m128 e1z = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, pz), p0z);
+        __m128 e2x = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, px), p0x);
+        __m128 e2y = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, py), p0y);
+        __m128 e2z = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, pz), p0z);
+        _mm_storeu_ps(&out.x[t], _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y)));
+        _mm_storeu_ps(&out.y[t], _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z)));
+        _mm_storeu_ps(&out.z[t], _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x)));
+    }
+#endif
+    for (; t < end; ++t) {
+        const Vec3& p0 = vertices[indices[t * 3]].position;
+        Vec3 normal = (vertices[indices[t * 3 + 1]].position - p0)
+                          .Cross(vertices[indices[t * 3 + 2]].position - p0);
+        out.x[t] = normal.x;
+        out.y[t] = normal.y;
+        out.z[t] = normal.z;
+    }
+}
+
+// Computes the unit tangent of each triangle in [begin, end), scaled by the area of the triangle.
+// Triangles with degenerate texture coordinates get a zero tangent.
+void calculateFaceTangents(const std::vector<TriangleBuffer::Vertex>& vertices,
+                           const std::vector<u32>& indices, FaceVectors& out, usize begin,
+                           usize end) {
+    usize t = begin;
+#ifdef DW_SIMD_SSE
+    auto px = [](const TriangleBuffer::Vertex& v) { return v.position.x; };
+    auto py = [](const TriangleBuffer::Vertex& v) { return v.position.y; };
+    auto pz = [](const TriangleBuffer::Vertex& v) { return v.position.z; };
+    auto tu = [](const TriangleBuffer::Vertex& v) { return v.tex_coord.x; };
+    auto tv = [](const TriangleBuffer::Vertex& v) { return v.tex_coord.y; };
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 epsilon = _mm_set1_ps(M_EPSILON);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (; t + 4 <= end; t += 4) {
+        __m128 p0x = gatherCorners(vertices, indices, t, 0, px);
+        __m128 p0y = gatherCorners(vertices, indices, t, 0, py);
+        __m128 p0z = gatherCorners(vertices, indices, t, 0, pz);
+        __m128 e1x = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, px), p0x);
+        __m128 e1y = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, py), p0y);
+        __m128 e1z = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, pz), p0z);
+        __m128 e2x = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, px), p0x);
+        __m128 e2y = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, py), p0y);
+        __m128 e2z = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, pz), p0z);
+        __m128 uv0u = gatherCorners(vertices, indices, t, 0, tu);
+        __m128 uv0v = gatherCorners(vertices, indices, t, 0, tv);
+        __m128 du1 = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, tu), uv0u);
+        __m128 dv1 = _mm_sub_ps(gatherCorners(vertices, indices, t, 1, tv), uv0v);
+        __m128 du2 = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, tu), uv0u);
+        __m128 dv2 = _mm_sub_ps(gatherCorners(vertices, indices, t, 2, tv), uv0v);
+
+        // Tangent = (e1 * dv2 - e2 * dv1) / det. As the tangent is normalised afterwards, only the
+        // sign of the determinant matters.
+        __m128 det = _mm_sub_ps(_mm_mul_ps(du1, dv2), _mm_mul_ps(du2, dv1));
+        __m128 valid = _mm_cmpgt_ps(_mm_and_ps(det, abs_mask), epsilon);
+        __m128 sign = _mm_or_ps(_mm_and_ps(det, _mm_castsi128_ps(_mm_set1_epi32(0x80000000))),
+                                _mm_set1_ps(1.0f));
+        __m128 tx = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(e1x, dv2), _mm_mul_ps(e2x, dv1)), sign);
+        __m128 ty = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(e1y, dv2), _mm_mul_ps(e2y, dv1)), sign);
+        __m128 tz = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(e1z, dv2), _mm_mul_ps(e2z, dv1)), sign);
+
+        // Scale the unit tangent by the triangle area.
+        __m128 nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+        __m128 ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+        __m128 nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+        __m128 area = _mm_mul_ps(_mm_sqrt_ps(dot3(nx, ny, nz, nx, ny, nz)), half);
+        __m128 tangent_length = _mm_sqrt_ps(dot3(tx, ty, tz, tx, ty, tz));
+        valid = _mm_and_ps(valid, _mm_cmpgt_ps(tangent_length, zero));
+        __m128 scale = _mm_and_ps(valid, _mm_div_ps(area, tangent_length));
+        _mm_storeu_ps(&out.x[t], _mm_mul_ps(_mm_and_ps(valid, tx), scale));
+        _mm_storeu_ps(&out.y[t], _mm_mul_ps(_mm_and_ps(valid, ty), scale));
+        _mm_storeu_ps(&out.z[t], _mm_mul_ps(_mm_and_ps(valid, tz), scale));
+    }
+#endif
+    for (; t < end; ++t) {
+        const auto& v0 = vertices[indices[t * 3]];
+        const auto& v1 = vertices[indices[t * 3 + 1]];
+        const auto& v2 = vertices[indices[t * 3 + 2]];
+        Vec3 e1 = v1.position - v0.position;
+        Vec3 e2 = v2.position - v0.position;
+        Vec2 duv1 = v1.tex_coord - v0.tex_coord;
+        Vec2 duv2 = v2.tex_coord - v0.tex_coord;
+        float det = duv1.x * duv2.y - duv2.x * duv1.y;
+        Vec3 tangent = (e1 * duv2.y - e2 * duv1.y) * (det < 0.0f ? -1.0f : 1.0f);
+        float tangent_length = tangent.Length();
+        if (std::abs(det) > M_EPSILON && tangent_length > 0.0f) {
+            tangent *= e1.Cross(e2).Length() * 0.5f / tangent_length;
+        } else {
+            tangent = Vec3::zero;
+        }
+        out.x[t] = tangent.x;
+        out.y[t] = tangent.y;
+        out.z[t] = tangent.z;
+    }
+}
+#ifdef DW_SIMD_SSE
+// The x, y and z components of a Vec3 member of four consecutive vertices.
+struct Vec3x4 {
+    __m128 x;
+    __m128 y;
+    __m128 z;
+};
+
+inline Vec3x4 loadVec3x4(const TriangleBuffer::Vertex* v, Vec3 TriangleBuffer::Vertex::*member) {
+    return {_mm_setr_ps((v[0].*member).x, (v[1].*member).x, (v[2].*member).x, (v[3].*member).x),
+            _mm_setr_ps((v[0].*member).y, (v[1].*member).y, (v[2].*member).y, (v[3].*member).y),
+            _mm_setr_ps((v[0].*member).z, (v[1].*member).z, (v[2].*member).z, (v[3].*member).z)};
+}
+
+inline void storeVec3x4(const Vec3x4& v, TriangleBuffer::Vertex* out,
+                        Vec3 TriangleBuffer::Vertex::*member) {
+    alignas(16) float x[4], y[4], z[4];
+    _mm_store_ps(x, v.x);
+    _mm_store_ps(y, v.y);
+    _mm_store_ps(z, v.z);
+    for (int i = 0; i < 4; ++i) {
+        out[i].*member = {x[i], y[i], z[i]};
+    }
+}
+
+// Multiplies four vectors by the upper 3x3 of a matrix whose elements are broadcast to m[row][col].
+inline Vec3x4 transformVec3x4(const __m128 m[3][4], const Vec3x4& v) {
+    return {_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], v.x), _mm_mul_ps(m[0][1], v.y)),
+                       _mm_mul_ps(m[0][2], v.z)),
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1][0], v.x), _mm_mul_ps(m[1][1], v.y)),
+                       _mm_mul_ps(m[1][2], v.z)),
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2][0], v.x), _mm_mul_ps(m[2][1], v.y)),
+                       _mm_mul_ps(m[2][2], v.z))};
+}
+
+// Normalises four vectors. Zero length vectors are left unchanged.
+inline Vec3x4 normalisedVec3x4(const Vec3x4& v) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 length_sq = dot3(v.x, v.y, v.z, v.x, v.y, v.z);
+    __m128 non_zero = _mm_cmpgt_ps(length_sq, _mm_setzero_ps());
+    __m128 inv_length = _mm_div_ps(one, _mm_sqrt_ps(length_sq));
+    __m128 scale = _mm_or_ps(_mm_and_ps(non_zero, inv_length), _mm_andnot_ps(non_zero, one));
+    return {_mm_mul_ps(v.x, scale), _mm_mul_ps(v.y, scale), _mm_mul_ps(v.z, scale)};
+}
+#endif
+
+// Normalises a vector. Zero length vectors are left unchanged, instead of becoming NaN.
+Vec3 normalisedOrZero(const Vec3& v) {
+    float length = v.Length();
+    return length > 0.0f ? v / length : v;
+}
+
+// Transforms positions, normals and tangents of a range of vertices.
+void transformVertices(const TriangleBuffer::Vertex* in, TriangleBuffer::Vertex* out, usize count,
+                       const Mat4& transform) {
+    const Mat3 normal_transform = transform.Float3x3Part().InverseTransposed();
+    usize i = 0;
+#ifdef DW_SIMD_SSE
+    // Transform four vertices at a time, with each component of the four vertices in one register.
+    __m128 m[3][4];
+    __m128 normal_m[3][4];
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            m[row][col] = _mm_set1_ps(transform.At(row, col));
+            normal_m[row][col] = _mm_set1_ps(col < 3 ? normal_transform.At(row, col) : 0.0f);
+        }
+    }
+    for (; i + 4 <= count; i += 4) {
+        Vec3x4 position = transformVec3x4(m, loadVec3x4(in + i, &TriangleBuffer::Vertex::position));
+        position.x = _mm_add_ps(position.x, m[0][3]);
+        position.y = _mm_add_ps(position.y, m[1][3]);
+        position.z = _mm_add_ps(position.z, m[2][3]);
+        storeVec3x4(position, out + i, &TriangleBuffer::Vertex::position);
+        storeVec3x4(normalisedVec3x4(transformVec3x4(
+                        normal_m, loadVec3x4(in + i, &TriangleBuffer::Vertex::normal))),
+                    out + i, &TriangleBuffer::Vertex::normal);
+        storeVec3x4(normalisedVec3x4(
+                        transformVec3x4(m, loadVec3x4(in + i, &TriangleBuffer::Vertex::tangent))),
+                    out + i, &TriangleBuffer::Vertex::tangent);
+        for (usize j = i; j < i + 4; ++j) {
+            out[j].tex_coord = in[j].tex_coord;
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i].position = transform.TransformPos(in[i].position);
+        out[i].normal = normalisedOrZero(normal_transform * in[i].normal);
+        out[i].tex_coord = in[i].tex_coord;
+        out[i].tangent = normalisedOrZero(transform.TransformDir(in[i].tangent));
+    }
+}
+
+// Calculates smooth normals from the vertex positions. Vertices which share a position share a
+// normal, so that texture coordinate seams do not create hard edges.
+std::vector<Vec3> calculateSmoothNormals(const std::vector<TriangleBuffer::Vertex>& vertices,
+                                         const std::vector<u32>& indices) {
+    assert(indices.size() % 3 == 0);
+    const usize triangle_count = indices.size() / 3;
+
+    std::vector<u32> position_group(vertices.size());
+    std::unordered_map<Vec3, u32, PositionHash, PositionEqual> position_groups;
+    position_groups.reserve(vertices.size());
+    for (usize i = 0; i < vertices.size(); ++i) {
+        position_group[i] =
+            position_groups.emplace(vertices[i].position, static_cast<u32>(position_groups.size()))
+                .first->second;
+    }
+
+    // Area weighted face normals.
+    FaceVectors face_normals(triangle_count);
+    parallelFor(triangle_count, kMinTrianglesPerThread, [&](usize begin, usize end) {
+        calculateFaceNormals(vertices, indices, face_normals, begin, end);
+    });
+
+    // Sum the face normals around each position.
+    auto adjacency = buildVertexTriangleAdjacency(indices, position_group, position_groups.size());
+    std::vector<Vec3> group_normals(position_groups.size());
+    parallelFor(group_normals.size(), kMinVerticesPerThread, [&](usize begin, usize end) {
+        for (usize g = begin; g < end; ++g) {
+            Vec3 sum = Vec3::zero;
+            for (u32 i = adjacency.offsets[g]; i < adjacency.offsets[g + 1]; ++i) {
+                u32 t = adjacency.triangles[i];
+                sum += Vec3{face_normals.x[t], face_normals.y[t], face_normals.z[t]};
+            }
+            float length = sum.Length();
+            group_normals[g] = length > 0.0f ? sum / length : Vec3::unitZ;
+        }
+    });
+    std::vector<Vec3> normals(vertices.size());
+    for (usize i = 0; i < vertices.size(); ++i) {
+        normals[i] = group_normals[position_group[i]];
+    }
+    return normals;
+}
+}  // namespace
+
 Vec3 calculateTangent(const Vec3& p1, const Vec3& p2, const Vec3& p3, const Vec2& tc1,
                       const Vec2& tc2, const Vec2& tc3) {
     Vec3 edge1 = p2 - p1;
     Vec3 edge2 = p3 - p1;
     Vec2 deltaUV1 = tc2 - tc1;
-    Vec2 deltaUV2 = tc3 - tc2;
+    Vec2 deltaUV2 = tc3 - tc1;
 
     float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
     Vec3 tangent;
@@ -22,7 +346,8 @@ Vec3 calculateTangent(const Vec3& p1, const Vec3& p2, const Vec3& p3, const Vec2
     return tangent;
 }
 
-TriangleBuffer::TriangleBuffer() : contains_normals_(false), contains_texcoords_(false) {
+TriangleBuffer::TriangleBuffer()
+    : contains_normals_(false), contains_texcoords_(false), contains_tangents_(false) {
 }
 
 void TriangleBuffer::estimateVertexCount(uint count) {
@@ -42,8 +367,39 @@ void TriangleBuffer::begin() {
 }
 
 Mesh TriangleBuffer::end(Renderer& r) {
-    // Set up vertex data.
-    Memory data;
+    // Upload to GPU.
+    Mesh result{r.createVertexBuffer(packVertices(), vertexDecl()),
+                r.createIndexBuffer(Memory(indices_), IndexBufferType::U32),
+                static_cast<uint>(vertices_.size()), static_cast<uint>(indices_.size())};
+    result.bounds = boundingBox();
+    result.bounding_sphere = boundingSphere();
+    return result;
+}
+
+AABB TriangleBuffer::boundingBox() const {
+    if (vertices_.empty()) {
+        return AABB{Vec3{0.0f, 0.0f, 0.0f}, Vec3{0.0f, 0.0f, 0.0f}};
+    }
+    AABB bounds{vertices_[0].position, vertices_[0].position};
+    for (const auto& v : vertices_) {
+        bounds.minPoint = bounds.minPoint.Min(v.position);
+        bounds.maxPoint = bounds.maxPoint.Max(v.position);
+    }
+    return bounds;
+}
+
+Sphere TriangleBuffer::boundingSphere() const {
+    // Centred on the bounding box, which is close to minimal for most meshes and avoids a second
+    // iterative pass.
+    const Vec3 centre = boundingBox().CenterPoint();
+    float radius_sq = 0.0f;
+    for (const auto& v : vertices_) {
+        radius_sq = std::max(radius_sq, v.position.DistanceSq(centre));
+    }
+    return Sphere{centre, std::sqrt(radius_sq)};
+}
+
+VertexDecl TriangleBuffer::vertexDecl() const {
     VertexDecl decl;
     decl.begin();
     decl.add(VertexDecl::Attribute::Position, 3, VertexDecl::AttributeType::Float);
@@ -57,46 +413,45 @@ Mesh TriangleBuffer::end(Renderer& r) {
         decl.add(VertexDecl::Attribute::Tangent, 3, VertexDecl::AttributeType::Float, true);
     }
     decl.end();
+    return decl;
+}
+
+Memory TriangleBuffer::packVertices() const {
     if (contains_normals_ && contains_texcoords_ && contains_tangents_) {
         // We can just copy over the vertices directly.
-        data = Memory(vertices_);
-    } else {
-        // Build packed buffer based on parameters.
-        data = Memory(vertices_.size() * decl.stride());
-        const uint stride =
-            decl.stride() / sizeof(float);  // convert stride in bytes to stride in floats.
-        auto* packed_data = reinterpret_cast<float*>(data.data());
-        for (size_t i = 0; i < vertices_.size(); ++i) {
-            uint offset = 0;
-            Vertex& source_vertex = vertices_[i];
-            float* vertex = &packed_data[i * stride];
-            // Copy data.
-            vertex[offset++] = source_vertex.position.x;
-            vertex[offset++] = source_vertex.position.y;
-            vertex[offset++] = source_vertex.position.z;
-            if (contains_normals_) {
-                vertex[offset++] = source_vertex.normal.x;
-                vertex[offset++] = source_vertex.normal.y;
-                vertex[offset++] = source_vertex.normal.z;
-            }
-            if (contains_texcoords_) {
-                vertex[offset++] = source_vertex.tex_coord.x;
-                vertex[offset++] = source_vertex.tex_coord.y;
-            }
-            if (contains_tangents_) {
-                vertex[offset++] = source_vertex.tangent.x;
-                vertex[offset++] = source_vertex.tangent.y;
-                vertex[offset++] = source_vertex.tangent.z;
-            }
-            assert(offset == stride);
-        }
+        return Memory(vertices_);
     }
 
-    // Upload to GPU.
-    Mesh result{r.createVertexBuffer(std::move(data), decl),
-                r.createIndexBuffer(Memory(indices_), IndexBufferType::U32),
-                static_cast<uint>(vertices_.size()), static_cast<uint>(indices_.size())};
-    return result;
+    // Build packed buffer based on parameters.
+    const VertexDecl decl = vertexDecl();
+    Memory data(vertices_.size() * decl.stride());
+    const uint stride = decl.stride() / sizeof(float);  // convert stride in bytes to stride in floats.
+    auto* packed_data = reinterpret_cast<float*>(data.data());
+    for (size_t i = 0; i < vertices_.size(); ++i) {
+        uint offset = 0;
+        const Vertex& source_vertex = vertices_[i];
+        float* vertex = &packed_data[i * stride];
+        // Copy data.
+        vertex[offset++] = source_vertex.position.x;
+        vertex[offset++] = source_vertex.position.y;
+        vertex[offset++] = source_vertex.position.z;
+        if (contains_normals_) {
+            vertex[offset++] = source_vertex.normal.x;
+            vertex[offset++] = source_vertex.normal.y;
+            vertex[offset++] = source_vertex.normal.z;
+        }
+        if (contains_texcoords_) {
+            vertex[offset++] = source_vertex.tex_coord.x;
+            vertex[offset++] = source_vertex.tex_coord.y;
+        }
+        if (contains_tangents_) {
+            vertex[offset++] = source_vertex.tangent.x;
+            vertex[offset++] = source_vertex.tangent.y;
+            vertex[offset++] = source_vertex.tangent.z;
+        }
+        assert(offset == stride);
+    }
+    return data;
 }
 
 void TriangleBuffer::position(const Vec3& p) {
@@ -125,20 +480,88 @@ void TriangleBuffer::triangle(u32 v0, u32 v1, u32 v2) {
     indices_.emplace_back(v2);
 }
 
+void TriangleBuffer::append(const TriangleBuffer& other, const Mat4& transform) {
+    const auto base_vertex = static_cast<u32>(vertices_.size());
+    vertices_.resize(vertices_.size() + other.vertices_.size());
+    transformVertices(other.vertices_.data(), vertices_.data() + base_vertex,
+                      other.vertices_.size(), transform);
+
+    // A transform which mirrors the geometry also flips the winding order.
+    const bool flip_winding = transform.Float3x3Part().Determinant() < 0.0f;
+    indices_.reserve(indices_.size() + other.indices_.size());
+    for (usize i = 0; i + 2 < other.indices_.size(); i += 3) {
+        indices_.emplace_back(base_vertex + other.indices_[i]);
+        indices_.emplace_back(base_vertex + other.indices_[flip_winding ? i + 2 : i + 1]);
+        indices_.emplace_back(base_vertex + other.indices_[flip_winding ? i + 1 : i + 2]);
+    }
+    contains_normals_ |= other.contains_normals_;
+    contains_texcoords_ |= other.contains_texcoords_;
+    contains_tangents_ |= other.contains_tangents_;
+}
+
+void TriangleBuffer::calculateNormals() {
+    std::vector<Vec3> normals = calculateSmoothNormals(vertices_, indices_);
+    for (usize i = 0; i < vertices_.size(); ++i) {
+        vertices_[i].normal = normals[i];
+    }
+    contains_normals_ = true;
+}
+
 void TriangleBuffer::calculateTangents() {
     assert(indices_.size() % 3 == 0);
     // Calculating tangents relies on texcoords.
     if (!contains_texcoords_) {
         return;
     }
-    for (usize i = 0; i < indices_.size(); i += 3) {
-        auto& v1 = vertices_[indices_[i]];
-        auto& v2 = vertices_[indices_[i + 1]];
-        auto& v3 = vertices_[indices_[i + 2]];
-        v1.tangent = v2.tangent = v3.tangent = calculateTangent(
-            v1.position, v2.position, v3.position, v1.tex_coord, v2.tex_coord, v3.tex_coord);
+    // Tangents are orthogonalised against the vertex normals. If there are none, use smooth
+    // normals which aren't added to the buffer, so the vertex layout doesn't change.
+    std::vector<Vec3> temporary_normals;
+    if (!contains_normals_) {
+        temporary_normals = calculateSmoothNormals(vertices_, indices_);
+    }
+    const usize triangle_count = indices_.size() / 3;
+
+    // Area weighted face tangents.
+    FaceVectors face_tangents(triangle_count);
+    parallelFor(triangle_count, kMinTrianglesPerThread, [&](usize begin, usize end) {
+        calculateFaceTangents(vertices_, indices_, face_tangents, begin, end);
+    });
+
+    // Accumulate the tangents of the faces around each vertex, then orthogonalise against the
+    // normal (Gram-Schmidt).
+    std::vector<u32> identity(vertices_.size());
+    for (usize i = 0; i < identity.size(); ++i) {
+        identity[i] = static_cast<u32>(i);
     }
+    auto adjacency = buildVertexTriangleAdjacency(indices_, identity, vertices_.size());
+    parallelFor(vertices_.size(), kMinVerticesPerThread, [&](usize begin, usize end) {
+        for (usize v = begin; v < end; ++v) {
+            Vec3 sum = Vec3::zero;
+            for (u32 i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i) {
+                u32 t = adjacency.triangles[i];
+                sum += Vec3{face_tangents.x[t], face_tangents.y[t], face_tangents.z[t]};
+            }
+            const Vec3& n = contains_normals_ ? vertices_[v].normal : temporary_normals[v];
+            Vec3 tangent = sum - n * n.Dot(sum);
+            float length = tangent.Length();
+            if (length <= M_LARGE_EPSILON) {
+                // No usable texture coordinates around this vertex. Pick any direction
+                // perpendicular to the normal.
+                tangent = n.Cross(std::abs(n.x) < 0.9f ? Vec3::unitX : Vec3::unitY);
+                length = tangent.Length();
+            }
+            vertices_[v].tangent = length > 0.0f ? tangent / length : Vec3::unitX;
+        }
+    });
     contains_tangents_ = true;
 }
+
+const std::vector<TriangleBuffer::Vertex>& TriangleBuffer::vertices() const {
+    return vertices_;
+}
+
+const std::vector<u32>& TriangleBuffer::indices() const {
+    return indices_;
+}
 }  // namespace gfx
 }  // namespace dw
@@ -0,0 +1,421 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Visibility.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <thread>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Below this number of objects, culling runs on the calling thread.
+constexpr usize kMinObjectsPerThread = 8192;
+// Number of subtrees to split the tree into per thread, so that uneven subtrees balance out.
+constexpr usize kSubtreesPerThread = 4;
+
+AABB combine(const AABB& a, const AABB& b) {
+    return AABB{a.minPoint.Min(b.minPoint), a.maxPoint.Max(b.maxPoint)};
+}
+
+bool contains(const AABB& outer, const AABB& inner) {
+    return outer.minPoint.x <= inner.minPoint.x && outer.minPoint.y <= inner.minPoint.y &&
+           outer.minPoint.z <= inner.minPoint.z && inner.maxPoint.x <= outer.maxPoint.x &&
+           inner.maxPoint.y <= outer.maxPoint.y && inner.maxPoint.z <= outer.maxPoint.z;
+}
+
+float surfaceArea(const AABB& bounds) {
+    const Vec3 size = bounds.maxPoint - bounds.minPoint;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+enum class Containment { Outside, Intersecting, Inside };
+}  // namespace
+
+struct VisibilityWorld::FrustumPlanes {
+    // Each plane is dot(n, x) = d, with n pointing out of the frustum. Padding planes have n = 0
+    // and d = 1, so every point is inside them.
+    alignas(16) float nx[8];
+    alignas(16) float ny[8];
+    alignas(16) float nz[8];
+    alignas(16) float d[8];
+
+    explicit FrustumPlanes(const Frustum& frustum) {
+        Plane planes[6];
+        frustum.GetPlanes(planes);
+        for (int i = 0; i < 8; ++i) {
+            nx[i] = i < 6 ? planes[i].normal.x : 0.0f;
+            ny[i] = i < 6 ? planes[i].normal.y : 0.0f;
+            nz[i] = i < 6 ? planes[i].normal.z : 0.0f;
+            d[i] = i < 6 ? planes[i].d : 1.0f;
+        }
+    }
+
+    // Tests a box against every plane at once.
+    Containment test(const AABB& bounds) const {
+        const Vec3 centre = (bounds.minPoint + bounds.maxPoint) * 0.5f;
+        const Vec3 extent = (bounds.maxPoint - bounds.minPoint) * 0.5f;
+#ifdef DW_SIMD_SSE
+        const __m128 sign_mask = _mm_set1_ps(-0.0f);
+        const __m128 cx = _mm_set1_ps(centre.x), cy = _mm_set1_ps(centre.y),
+                     cz = _mm_set1_ps(centre.z);
+        const __m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y),
+                     ez = _mm_set1_ps(extent.z);
+        int outside = 0, intersecting = 0;
+        for (int i = 0; i < 8; i += 4) {
+            const __m128 px = _mm_load_ps(nx + i), py = _mm_load_ps(ny + i),
+                         pz = _mm_load_ps(nz + i);
+            // Signed distance from the box centre to each plane, and the projected box radius.
+            const __m128 distance = _mm_sub_ps(
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)), _mm_mul_ps(pz, cz)),
+                _mm_load_ps(d + i));
+            const __m128 radius =
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, px), ex),
+                                      _mm_mul_ps(_mm_andnot_ps(sign_mask, py), ey)),
+                           _mm_mul_ps(_mm_andnot_ps(sign_mask, pz), ez));
+            outside |= _mm_movemask_ps(_mm_cmpgt_ps(distance, radius));
+            intersecting |= _mm_movemask_ps(_mm_cmpgt_ps(distance, _mm_xor_ps(radius, sign_mask)));
+        }
+#else
+        bool outside = false, intersecting = false;
+        for (int i = 0; i < 6; ++i) {
+            const float distance = nx[i] * centre.x + ny[i] * centre.y + nz[i] * centre.z - d[i];
+            const float radius = std::abs(nx[i]) * extent.x + std::abs(ny[i]) * extent.y +
+                                 std::abs(nz[i]) * extent.z;
+            outside |= distance > radius;
+            intersecting |= distance > -radius;
+        }
+#endif
+        if (outside) {
+            return Containment::Outside;
+        }
+        return intersecting ? Containment::Intersecting : Containment::Inside;
+    }
+};
+
+VisibilityWorld::VisibilityWorld(float margin)
+    : margin_(margin), root_(kNullNode), free_list_(kNullNode), object_count_(0) {
+}
+
+VisibilityWorld::ObjectId VisibilityWorld::insert(const AABB& bounds) {
+    const i32 leaf = allocateNode();
+    const Vec3 margin{margin_, margin_, margin_};
+    nodes_[leaf].bounds = AABB{bounds.minPoint - margin, bounds.maxPoint + margin};
+    nodes_[leaf].height = 0;
+    insertLeaf(leaf);
+    object_count_++;
+    return static_cast<ObjectId>(leaf);
+}
+
+bool VisibilityWorld::move(ObjectId id, const AABB& bounds) {
+    const auto leaf = static_cast<i32>(id);
+    assert(leaf < static_cast<i32>(nodes_.size()) && nodes_[leaf].isLeaf());
+    if (contains(nodes_[leaf].bounds, bounds)) {
+        return false;
+    }
+    removeLeaf(leaf);
+    const Vec3 margin{margin_, margin_, margin_};
+    nodes_[leaf].bounds = AABB{bounds.minPoint - margin, bounds.maxPoint + margin};
+    insertLeaf(leaf);
+    return true;
+}
+
+void VisibilityWorld::remove(ObjectId id) {
+    const auto leaf = static_cast<i32>(id);
+    assert(leaf < static_cast<i32>(nodes_.size()) && nodes_[leaf].isLeaf());
+    removeLeaf(leaf);
+    freeNode(leaf);
+    object_count_--;
+}
+
+void VisibilityWorld::cull(const Frustum& frustum, std::vector<ObjectId>& visible) const {
+    visible.clear();
+    if (root_ == kNullNode) {
+        return;
+    }
+    const FrustumPlanes planes{frustum};
+
+    const usize thread_count = std::max(1u, std::thread::hardware_concurrency());
+    if (object_count_ < kMinObjectsPerThread * 2 || thread_count == 1) {
+        cullSubtree(root_, planes, visible);
+        return;
+    }
+
+    // Split the top of the tree into independent subtrees. The nodes above the subtrees are left
+    // untested, which only costs a few redundant tests at the roots of the subtrees.
+    std::vector<i32> subtrees{root_};
+    std::vector<i32> next_subtrees;
+    while (subtrees.size() < thread_count * kSubtreesPerThread) {
+        next_subtrees.clear();
+        for (i32 node : subtrees) {
+            if (nodes_[node].isLeaf()) {
+                next_subtrees.emplace_back(node);
+            } else {
+                next_subtrees.emplace_back(nodes_[node].child1);
+                next_subtrees.emplace_back(nodes_[node].child2);
+            }
+        }
+        if (next_subtrees.size() == subtrees.size()) {
+            break;
+        }
+        subtrees.swap(next_subtrees);
+    }
+
+    std::vector<std::vector<ObjectId>> subtree_visible(subtrees.size());
+    parallelFor(subtrees.size(), 1, [&](usize begin, usize end) {
+        for (usize i = begin; i < end; ++i) {
+            cullSubtree(subtrees[i], planes, subtree_visible[i]);
+        }
+    });
+    usize visible_count = 0;
+    for (const auto& ids : subtree_visible) {
+        visible_count += ids.size();
+    }
+    visible.reserve(visible_count);
+    for (const auto& ids : subtree_visible) {
+        visible.insert(visible.end(), ids.begin(), ids.end());
+    }
+}
+
+const AABB& VisibilityWorld::bounds(ObjectId id) const {
+    return nodes_[id].bounds;
+}
+
+usize VisibilityWorld::objectCount() const {
+    return object_count_;
+}
+
+int VisibilityWorld::height() const {
+    return root_ == kNullNode ? 0 : nodes_[root_].height;
+}
+
+i32 VisibilityWorld::allocateNode() {
+    i32 node;
+    if (free_list_ != kNullNode) {
+        node = free_list_;
+        free_list_ = nodes_[node].parent;
+    } else {
+        node = static_cast<i32>(nodes_.size());
+        nodes_.emplace_back();
+    }
+    nodes_[node].parent = kNullNode;
+    nodes_[node].child1 = kNullNode;
+    nodes_[node].child2 = kNullNode;
+    nodes_[node].height = 0;
+    return node;
+}
+
+void VisibilityWorld::freeNode(i32 node) {
+    nodes_[node].parent = free_list_;
+    nodes_[node].height = -1;
+    free_list_ = node;
+}
+
+void VisibilityWorld::insertLeaf(i32 leaf) {
+    if (root_ == kNullNode) {
+        root_ = leaf;
+        nodes_[leaf].parent = kNullNode;
+        return;
+    }
+
+    // Find the best sibling for the leaf, using the surface area heuristic.
+    const AABB leaf_bounds = nodes_[leaf].bounds;
+    i32 index = root_;
+    while (!nodes_[index].isLeaf()) {
+        const Node& node = nodes_[index];
+        const float area = surfaceArea(node.bounds);
+        const float combined_area = surfaceArea(combine(node.bounds, leaf_bounds));
+
+        // Cost of creating a new parent for this node and the new leaf, and the minimum cost of
+        // pushing the leaf further down the tree.
+        const float cost = 2.0f * combined_area;
+        const float inheritance_cost = 2.0f * (combined_area - area);
+        auto child_cost = [&](i32 child) {
+            const float combined = surfaceArea(combine(leaf_bounds, nodes_[child].bounds));
+            return nodes_[child].isLeaf() ? combined + inheritance_cost
+                                          : combined - surfaceArea(nodes_[child].bounds) +
+                                                inheritance_cost;
+        };
+        const float cost1 = child_cost(node.child1);
+        const float cost2 = child_cost(node.child2);
+        if (cost < cost1 && cost < cost2) {
+            break;
+        }
+        index = cost1 < cost2 ? node.child1 : node.child2;
+    }
+    const i32 sibling = index;
+
+    // Create a new parent for the sibling and the leaf.
+    const i32 old_parent = nodes_[sibling].parent;
+    const i32 new_parent = allocateNode();
+    nodes_[new_parent].parent = old_parent;
+    nodes_[new_parent].bounds = combine(leaf_bounds, nodes_[sibling].bounds);
+    nodes_[new_parent].height = nodes_[sibling].height + 1;
+    nodes_[new_parent].child1 = sibling;
+    nodes_[new_parent].child2 = leaf;
+    nodes_[sibling].parent = new_parent;
+    nodes_[leaf].parent = new_parent;
+    if (old_parent != kNullNode) {
+        if (nodes_[old_parent].child1 == sibling) {
+            nodes_[old_parent].child1 = new_parent;
+        } else {
+            nodes_[old_parent].child2 = new_parent;
+        }
+    } else {
+        root_ = new_parent;
+    }
+
+    refit(nodes_[leaf].parent);
+}
+
+void VisibilityWorld::removeLeaf(i32 leaf) {
+    if (leaf == root_) {
+        root_ = kNullNode;
+        return;
+    }
+
+    // Replace the parent of the leaf with its sibling.
+    const i32 parent = nodes_[leaf].parent;
+    const i32 grandparent = nodes_[parent].parent;
+    const i32 sibling =
+        nodes_[parent].child1 == leaf ? nodes_[parent].child2 : nodes_[parent].child1;
+    freeNode(parent);
+    nodes_[sibling].parent = grandparent;
+    nodes_[leaf].parent = kNullNode;
+    if (grandparent == kNullNode) {
+        root_ = sibling;
+        return;
+    }
+    if (nodes_[grandparent].child1 == parent) {
+        nodes_[grandparent].child1 = sibling;
+    } else {
+        nodes_[grandparent].child2 = sibling;
+    }
+    refit(grandparent);
+}
+
+void VisibilityWorld::refit(i32 node) {
+    // Walk back up the tree, rebalancing and fixing the bounds and heights of each ancestor.
+    while (node != kNullNode) {
+        node = balance(node);
+        Node& n = nodes_[node];
+        n.bounds = combine(nodes_[n.child1].bounds, nodes_[n.child2].bounds);
+        n.height = 1 + std::max(nodes_[n.child1].height, nodes_[n.child2].height);
+        node = n.parent;
+    }
+}
+
+i32 VisibilityWorld::balance(i32 a) {
+    // Performs a left or right rotation if a is imbalanced, and returns the new root of the
+    // subtree.
+    Node& node_a = nodes_[a];
+    if (node_a.isLeaf() || node_a.height < 2) {
+        return a;
+    }
+    const i32 b = node_a.child1;
+    const i32 c = node_a.child2;
+    Node& node_b = nodes_[b];
+    Node& node_c = nodes_[c];
+    const int imbalance = node_c.height - node_b.height;
+
+    // Rotates child up to replace a. Returns the new root.
+    auto rotate = [this, a, &node_a](i32 child, Node& node_child, Node& node_other,
+                                     bool child_is_child2) {
+        const i32 f = node_child.child1;
+        const i32 g = node_child.child2;
+        Node& node_f = nodes_[f];
+        Node& node_g = nodes_[g];
+
+        // Swap a and child.
+        node_child.child1 = a;
+        node_child.parent = node_a.parent;
+        node_a.parent = child;
+        if (node_child.parent != kNullNode) {
+            Node& parent = nodes_[node_child.parent];
+            if (parent.child1 == a) {
+                parent.child1 = child;
+            } else {
+                parent.child2 = child;
+            }
+        } else {
+            root_ = child;
+        }
+
+        // Keep the taller grandchild under child, and move the shorter one under a.
+        const bool f_taller = node_f.height > node_g.height;
+        const i32 keep = f_taller ? f : g;
+        const i32 give = f_taller ? g : f;
+        node_child.child2 = keep;
+        if (child_is_child2) {
+            node_a.child2 = give;
+        } else {
+            node_a.child1 = give;
+        }
+        nodes_[give].parent = a;
+        node_a.bounds = combine(node_other.bounds, nodes_[give].bounds);
+        node_a.height = 1 + std::max(node_other.height, nodes_[give].height);
+        node_child.bounds = combine(node_a.bounds, nodes_[keep].bounds);
+        node_child.height = 1 + std::max(node_a.height, nodes_[keep].height);
+        return child;
+    };
+
+    if (imbalance > 1) {
+        return rotate(c, node_c, node_b, true);
+    }
+    if (imbalance < -1) {
+        return rotate(b, node_b, node_c, false);
+    }
+    return a;
+}
+
+void VisibilityWorld::cullSubtree(i32 root, const FrustumPlanes& planes,
+                                  std::vector<ObjectId>& visible) const {
+    std::vector<i32> stack;
+    std::vector<i32> leaf_stack;
+    stack.emplace_back(root);
+    while (!stack.empty()) {
+        const i32 index = stack.back();
+        stack.pop_back();
+        const Node& node = nodes_[index];
+        switch (planes.test(node.bounds)) {
+            case Containment::Outside:
+                break;
+            case Containment::Inside:
+                // Everything below this node is visible, so skip the remaining tests.
+                collectLeaves(index, leaf_stack, visible);
+                break;
+            case Containment::Intersecting:
+                if (node.isLeaf()) {
+                    visible.emplace_back(static_cast<ObjectId>(index));
+                } else {
+                    stack.emplace_back(node.child1);
+                    stack.emplace_back(node.child2);
+                }
+                break;
+        }
+    }
+}
+
+void VisibilityWorld::collectLeaves(i32 root, std::vector<i32>& stack,
+                                    std::vector<ObjectId>& visible) const {
+    stack.clear();
+    stack.emplace_back(root);
+    while (!stack.empty()) {
+        const Node& node = nodes_[stack.back()];
+        const i32 index = stack.back();
+        stack.pop_back();
+        if (node.isLeaf()) {
+            visible.emplace_back(static_cast<ObjectId>(index));
+        } else {
+            stack.emplace_back(node.child1);
+            stack.emplace_back(node.child2);
+        }
+    }
+}
+}  // namespace gfx
+}  // namespace dw
@@ -7,11 +7,13 @@
 #include "gl/RenderContextGL.h"
 #include "Input.h"
 
+#include <algorithm>
 #include <dga/string_algorithms.h>
 #include <fmt/format.h>
 #include <locale>
 #include <exception>
 #include <codecvt>
+#include <cstring>
 #include <map>
 
 /**
@@ -38,6 +40,19 @@
 #define GL_CHECK(call) call
 #endif
 
+// GL 4.3 constants used by compute programs.
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif  // GL_COMPUTE_SHADER
+
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif  // GL_SHADER_STORAGE_BUFFER
+
+#ifndef GL_ALL_BARRIER_BITS
+#define GL_ALL_BARRIER_BITS 0xFFFFFFFF
+#endif  // GL_ALL_BARRIER_BITS
+
 namespace dw {
 namespace gfx {
 namespace {
@@ -194,8 +209,19 @@ const std::unordered_map<BlendFunc, GLenum> kBlendFuncMap = {
     {BlendFunc::OneMinusConstantAlpha, GL_ONE_MINUS_CONSTANT_ALPHA},
     {BlendFunc::SrcAlphaSaturate, GL_SRC_ALPHA_SATURATE},
 };
+// GL_ANY_SAMPLES_PASSED_CONSERVATIVE is only available from GL 4.3, so desktop GL uses the exact
+// version instead.
+#if DW_GL_VERSION == DW_GL_410
+const GLenum kOcclusionQueryTarget = GL_ANY_SAMPLES_PASSED;
+#else
+const GLenum kOcclusionQueryTarget = GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+#endif
+
 const std::unordered_map<ShaderStage, GLenum> kShaderStageMap = {
-    {ShaderStage::Vertex, GL_VERTEX_SHADER}, {ShaderStage::Geometry, GL_GEOMETRY_SHADER}, {ShaderStage::Fragment, GL_FRAGMENT_SHADER}};
+    {ShaderStage::Vertex, GL_VERTEX_SHADER},
+    {ShaderStage::Geometry, GL_GEOMETRY_SHADER},
+    {ShaderStage::Fragment, GL_FRAGMENT_SHADER},
+    {ShaderStage::Compute, GL_COMPUTE_SHADER}};
 
 // GLFW key map.
 const std::unordered_map<int, Key::Enum> kGlfwKeyMap = {
@@ -316,48 +342,37 @@ static_assert(static_cast<int>(TextureFormat::Count) ==
                   sizeof(kTextureFormatMap) / sizeof(kTextureFormatMap[0]),
               "Texture format mapping mismatch.");
 
-// Uniform binder.
-class UniformBinder {
-public:
-    UniformBinder() : uniform_location_{0} {
-    }
-
-    void operator()(const int& value) {
-        GL_CHECK(glUniform1i(uniform_location_, value));
-    }
-
-    void operator()(const float& value) {
-        GL_CHECK(glUniform1f(uniform_location_, value));
-    }
-
-    void operator()(const Vec2& value) {
-        GL_CHECK(glUniform2f(uniform_location_, value.x, value.y));
-    }
-
-    void operator()(const Vec3& value) {
-        GL_CHECK(glUniform3f(uniform_location_, value.x, value.y, value.z));
-    }
-
-    void operator()(const Vec4& value) {
-        GL_CHECK(glUniform4f(uniform_location_, value.x, value.y, value.z, value.w));
-    }
-
-    void operator()(const Mat3& value) {
-        GL_CHECK(glUniformMatrix3fv(uniform_location_, 1, GL_FALSE, value.ptr()));
-    }
+// Size of the ring buffer which uniform blocks are written to.
+constexpr GLsizeiptr kUniformRingBufferSize = 1 << 20;
 
-    void operator()(const Mat4& value) {
-        GL_CHECK(glUniformMatrix4fv(uniform_location_, 1, GL_FALSE, value.ptr()));
+// Writes a uniform value to a std140 uniform block member of the given size, and returns true if
+// the member changed. The columns of a mat3 are padded to the size of a vec4. Arrays are already
+// packed with the std140 layout, and elements past the end of the member are dropped.
+bool writeStd140Uniform(byte* dst, usize size, const UniformData& data) {
+    auto write = [](byte* dst, const void* src, usize size) {
+        if (std::memcmp(dst, src, size) == 0) {
+            return false;
+        }
+        std::memcpy(dst, src, size);
+        return true;
+    };
+    if (const auto* mat3 = std::get_if<Mat3>(&data)) {
+        bool changed = false;
+        for (usize column = 0; column < 3 && (column * 4 + 3) * sizeof(float) <= size; ++column) {
+            changed |= write(dst + column * 4 * sizeof(float), mat3->ptr() + column * 3,
+                             3 * sizeof(float));
+        }
+        return changed;
     }
-
-    void updateUniform(GLint location, const UniformData& data) {
-        uniform_location_ = location;
-        visit(*this, data);
+    if (const auto* array = std::get_if<UniformArray>(&data)) {
+        return write(dst, array->data.data(), std::min(size, array->data.size()));
     }
-
-private:
-    GLint uniform_location_;
-};
+    return std::visit(
+        [&write, dst, size](const auto& value) {
+            return write(dst, &value, std::min(size, sizeof(value)));
+        },
+        data);
+}
 }  // namespace
 
 int last_error_code = 0;
@@ -428,7 +443,18 @@ void SamplerCacheGL::clear() {
 }
 
 RenderContextGL::RenderContextGL(Logger& logger)
-    : RenderContext(logger), max_supported_anisotropy_(0.0f) {
+    : RenderContext(logger),
+      max_supported_anisotropy_(0.0f),
+      enabled_vertex_attributes_(0),
+      uniform_ring_buffer_(0),
+      uniform_ring_offset_(0),
+      uniform_ring_generation_(0),
+      uniform_buffer_offset_alignment_(1),
+      gl_dispatch_compute_(nullptr),
+      gl_memory_barrier_(nullptr),
+      gl_bind_image_texture_(nullptr),
+      upload_window_(nullptr),
+      stop_upload_thread_(false) {
 }
 
 RenderContextGL::~RenderContextGL() {
@@ -513,6 +539,19 @@ Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
         return Error(fmt::format("glfwCreateWindow failed. Code: {:#x}. Description: {}",
                                  last_error_code, last_error_description));
     }
+#ifndef DGA_EMSCRIPTEN
+    // Create a hidden window for the upload thread, whose context shares objects with the main
+    // window's context.
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    upload_window_ = glfwCreateWindow(1, 1, "", nullptr, window_);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!upload_window_) {
+        return Error(
+            fmt::format("glfwCreateWindow failed for the upload context. Code: {:#x}. "
+                        "Description: {}",
+                        last_error_code, last_error_description));
+    }
+#endif
     Vec2i fb_size = framebufferSize();
     backbuffer_width_ = static_cast<u16>(fb_size.x);
     backbuffer_height_ = static_cast<u16>(fb_size.y);
@@ -614,6 +653,21 @@ Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
     GL_CHECK(glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_supported_anisotropy_));
     sampler_cache_.setMaxSupportedAnisotropy(max_supported_anisotropy_);
 
+    // Load compute entry points if the context is GL 4.3 or later.
+#if DW_GL_VERSION == DW_GL_410
+    GLint major_version, minor_version;
+    GL_CHECK(glGetIntegerv(GL_MAJOR_VERSION, &major_version));
+    GL_CHECK(glGetIntegerv(GL_MINOR_VERSION, &minor_version));
+    if (major_version > 4 || (major_version == 4 && minor_version >= 3)) {
+        gl_dispatch_compute_ = reinterpret_cast<decltype(gl_dispatch_compute_)>(
+            glfwGetProcAddress("glDispatchCompute"));
+        gl_memory_barrier_ = reinterpret_cast<decltype(gl_memory_barrier_)>(
+            glfwGetProcAddress("glMemoryBarrier"));
+        gl_bind_image_texture_ = reinterpret_cast<decltype(gl_bind_image_texture_)>(
+            glfwGetProcAddress("glBindImageTexture"));
+    }
+#endif
+
     // Print GL information.
     logger_.info("OpenGL: {} - GLSL: {}", glGetString(GL_VERSION),
                  glGetString(GL_SHADING_LANGUAGE_VERSION));
@@ -625,10 +679,17 @@ Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
                  static_cast<bool>(GLAD_GL_EXT_texture_filter_anisotropic));
     logger_.info("Capabilities:");
     logger_.info("- Max supported anisotropy: {}", max_supported_anisotropy_);
+    logger_.info("- Compute shaders: {}", gl_dispatch_compute_ != nullptr);
 
     // Hand off context to render thread.
     glfwMakeContextCurrent(nullptr);
 
+    // Start the upload thread.
+#ifndef DGA_EMSCRIPTEN
+    stop_upload_thread_ = false;
+    upload_thread_ = std::thread{[this]() { uploadThread(); }};
+#endif
+
     return {};
 }
 
@@ -636,6 +697,11 @@ void RenderContextGL::destroyWindow() {
     if (window_) {
         sampler_cache_.clear();
 
+        stopUploadThread();
+        if (upload_window_) {
+            glfwDestroyWindow(upload_window_);
+            upload_window_ = nullptr;
+        }
         glfwDestroyWindow(window_);
         window_ = nullptr;
         glfwTerminate();
@@ -671,11 +737,16 @@ void RenderContextGL::startRendering() {
 
     GL_CHECK(glGenVertexArrays(1, &vao_));
     GL_CHECK(glBindVertexArray(vao_));
+
+    GL_CHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_buffer_offset_alignment_));
+    GL_CHECK(glGenBuffers(1, &uniform_ring_buffer_));
+    orphanUniformRingBuffer();
 }
 
 void RenderContextGL::stopRendering() {
     GL_CHECK(glBindVertexArray(0));
     GL_CHECK(glDeleteVertexArrays(1, &vao_));
+    GL_CHECK(glDeleteBuffers(1, &uniform_ring_buffer_));
 }
 
 void RenderContextGL::prepareFrame() {
@@ -691,28 +762,42 @@ void RenderContextGL::processCommandList(std::vector<RenderCommand>& command_lis
 bool RenderContextGL::frame(const Frame* frame) {
     assert(window_);
 
+    // Collect the results of occlusion queries from previous frames which have completed.
+    readOcclusionQueryResults();
+
+    // Start writing uniform blocks to new storage, so that this frame doesn't wait for the
+    // previous frame to finish reading them.
+    orphanUniformRingBuffer();
+
     // Upload transient vertex/element buffer data.
     auto& tvb = frame->transient_vb_storage;
     if (tvb.handle && tvb.size > 0) {
-        GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_map_.at(*tvb.handle).vertex_buffer));
+        GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, getVertexBuffer(*tvb.handle).vertex_buffer));
         GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, 0, tvb.size, tvb.data.data()));
     }
     auto& tib = frame->transient_ib_storage;
     if (tib.handle && tib.size > 0) {
-        GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-                              index_buffer_map_.at(*tib.handle).element_buffer));
+        GL_CHECK(
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, getIndexBuffer(*tib.handle).element_buffer));
         GL_CHECK(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, tib.size, tib.data.data()));
     }
 
     // Process render queues.
     for (auto& q : frame->render_queues) {
+        // Dispatch compute items before the queue's draws.
+        for (const auto& item : q.compute_items) {
+            dispatchCompute(*frame, item);
+        }
+
         // Set up framebuffer.
         u16 fb_width, fb_height;
         if (q.frame_buffer) {
             FrameBufferData& fb_data = frame_buffer_map_.at(*q.frame_buffer);
             fb_width = fb_data.width;
             fb_height = fb_data.height;
-            GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb_data.frame_buffer));
+            GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb_data.samples > 1
+                                                           ? fb_data.msaa_frame_buffer
+                                                           : fb_data.frame_buffer));
         } else {
             fb_width = backbuffer_width_;
             fb_height = backbuffer_height_;
@@ -723,173 +808,146 @@ bool RenderContextGL::frame(const Frame* frame) {
         (void)fb_width;
         (void)fb_height;
 
-        // Clear frame buffer.
-        if (q.clear_parameters) {
-            auto colour = q.clear_parameters->colour;
+        // Clear or invalidate frame buffer attachments.
+        const AttachmentOps& ops = *q.attachment_ops;
+        GLbitfield clear_mask = 0;
+        if (ops.colour_load == AttachmentLoadOp::Clear) {
+            auto colour = q.clear_parameters ? q.clear_parameters->colour : Colour{};
             GL_CHECK(glClearColor(colour.r(), colour.g(), colour.b(), colour.a()));
-            GLbitfield clear_mask = 0;
-            if (q.clear_parameters->clear_colour) {
-                clear_mask |= GL_COLOR_BUFFER_BIT;
-            }
-            if (q.clear_parameters->clear_depth) {
-                clear_mask |= GL_DEPTH_BUFFER_BIT;
-            }
+            clear_mask |= GL_COLOR_BUFFER_BIT;
+        }
+        if (ops.depth_load == AttachmentLoadOp::Clear) {
+            clear_mask |= GL_DEPTH_BUFFER_BIT;
+        }
+        if (clear_mask != 0) {
             GL_CHECK(glClear(clear_mask));
         }
+        invalidateAttachments(q, ops.colour_load == AttachmentLoadOp::DontCare,
+                              ops.depth_load == AttachmentLoadOp::DontCare);
 
         // Render items.
         u32 previous_max_texture_unit = 0;
+        bool occlusion_query_active = false;
+        bool queue_uniforms_overridden = false;
         for (uint i = 0; i < q.render_items.size(); ++i) {
             auto* previous = i > 0 ? &q.render_items[i - 1] : nullptr;
             auto* current = &q.render_items[i];
 
-            // Update render state.
-            if (!previous || previous->cull_face_enabled != current->cull_face_enabled) {
-                if (current->cull_face_enabled) {
+            // Begin and end occlusion queries.
+            if (!previous || previous->occlusion_query != current->occlusion_query) {
+                if (occlusion_query_active) {
+                    GL_CHECK(glEndQuery(kOcclusionQueryTarget));
+                    occlusion_query_active = false;
+                }
+                if (current->occlusion_query) {
+                    occlusion_query_active = beginOcclusionQuery(*current->occlusion_query);
+                }
+            }
+
+            // Update the render state which differs from the previous item.
+            const PackedRenderState& state = current->state;
+            u64 changed_state = previous ? previous->state.bits() ^ state.bits() : ~u64{0};
+            if (changed_state & PackedRenderState::kCullFaceEnabled) {
+                if (state.cullFaceEnabled()) {
                     GL_CHECK(glEnable(GL_CULL_FACE));
                 } else {
                     GL_CHECK(glDisable(GL_CULL_FACE));
                 }
             }
-            if (!previous || previous->cull_front_face != current->cull_front_face) {
-                GL_CHECK(
-                    glFrontFace(current->cull_front_face == CullFrontFace::CCW ? GL_CCW : GL_CW));
+            if (changed_state & PackedRenderState::kCullFrontFace) {
+                GL_CHECK(glFrontFace(state.cullFrontFace() == CullFrontFace::CCW ? GL_CCW : GL_CW));
             }
-            if (!previous || previous->polygon_mode != current->polygon_mode) {
-                GL_CHECK(glPolygonMode(GL_FRONT_AND_BACK, current->polygon_mode == PolygonMode::Fill
+            if (changed_state & PackedRenderState::kPolygonMode) {
+                GL_CHECK(glPolygonMode(GL_FRONT_AND_BACK, state.polygonMode() == PolygonMode::Fill
                                                               ? GL_FILL
                                                               : GL_LINE));
             }
-            if (!previous || previous->depth_enabled != current->depth_enabled) {
-                if (current->depth_enabled) {
+            if (changed_state & PackedRenderState::kDepthEnabled) {
+                if (state.depthEnabled()) {
                     GL_CHECK(glEnable(GL_DEPTH_TEST));
                 } else {
                     GL_CHECK(glDisable(GL_DEPTH_TEST));
                 }
             }
-            if (!previous || previous->blend_enabled != current->blend_enabled) {
-                if (current->blend_enabled) {
+            if (changed_state & PackedRenderState::kBlendEnabled) {
+                if (state.blendEnabled()) {
                     GL_CHECK(glEnable(GL_BLEND));
                 } else {
                     GL_CHECK(glDisable(GL_BLEND));
                 }
             }
-            if (!previous || previous->blend_equation_rgb != current->blend_equation_rgb ||
-                previous->blend_equation_a != current->blend_equation_a) {
-                GL_CHECK(glBlendEquationSeparate(kBlendEquationMap.at(current->blend_equation_rgb),
-                                                 kBlendEquationMap.at(current->blend_equation_a)));
+            if (changed_state & PackedRenderState::kBlendEquation) {
+                GL_CHECK(glBlendEquationSeparate(kBlendEquationMap.at(state.blendEquationRgb()),
+                                                 kBlendEquationMap.at(state.blendEquationA())));
             }
-            if (!previous || previous->blend_src_rgb != current->blend_src_rgb ||
-                previous->blend_src_a != current->blend_src_a ||
-                previous->blend_dest_rgb != current->blend_dest_rgb ||
-                previous->blend_dest_a != current->blend_dest_a) {
-                GL_CHECK(glBlendFuncSeparate(kBlendFuncMap.at(current->blend_src_rgb),
-                                             kBlendFuncMap.at(current->blend_dest_rgb),
-                                             kBlendFuncMap.at(current->blend_src_a),
-                                             kBlendFuncMap.at(current->blend_dest_a)));
+            if (changed_state & PackedRenderState::kBlendFunc) {
+                GL_CHECK(glBlendFuncSeparate(kBlendFuncMap.at(state.blendSrcRgb()),
+                                             kBlendFuncMap.at(state.blendDestRgb()),
+                                             kBlendFuncMap.at(state.blendSrcA()),
+                                             kBlendFuncMap.at(state.blendDestA())));
             }
 
             // Bind Program.
-            ProgramData& program_data = program_map_.at(*current->program);
-            if (!previous || previous->program != current->program) {
+            ProgramData& program_data = getProgram(*current->program);
+            bool program_changed = !previous || previous->program != current->program;
+            if (program_changed) {
                 GL_CHECK(glUseProgram(program_data.program));
             }
 
-            // Bind uniforms.
-            UniformBinder binder;
-            for (auto& entry : current->uniforms) {
-                auto uniform_name = entry.first;
-                auto location = program_data.uniform_location_map.find(uniform_name);
-                GLint uniform_location;
-                if (location != program_data.uniform_location_map.end()) {
-                    uniform_location = (*location).second;
-                } else {
-                    // A uniform inside a (converted) uniform block may have been remapped to a
-                    // location inside a struct uniform caled _<id>. When looking up the uniform
-                    // location, take this into account.
-                    auto uniform_remap_id = program_data.uniform_remap_ids.find(uniform_name);
-                    std::string remapped_uniform_name =
-                        uniform_remap_id == program_data.uniform_remap_ids.end()
-                            ? uniform_name
-                            : fmt::format("_{}.{}", uniform_remap_id->second, uniform_name);
-
-                    // Look up the uniform location.
-                    GL_CHECK(uniform_location = glGetUniformLocation(
-                                 program_data.program, remapped_uniform_name.c_str()));
-                    program_data.uniform_location_map.emplace(uniform_name, uniform_location);
-                    if (uniform_location == -1) {
-                        logger_.warn("[Frame] Unknown or optimised out uniform '{}', skipping.",
-                                     uniform_name);
+            // Items which continue the previous item share its uniforms, textures and vertex
+            // attributes.
+            if (!current->continues_previous) {
+                // Apply the render queue's uniforms, which the item's uniforms override. They're
+                // applied again after an item which overrode them, so the override only lasts for
+                // that item.
+                if (program_changed || queue_uniforms_overridden) {
+                    for (const auto& uniform : q.uniforms) {
+                        setUniform(program_data, uniform.first, uniform.second);
                     }
                 }
-                if (uniform_location == -1) {
-                    continue;
-                }
-                binder.updateUniform(uniform_location, entry.second);
-            }
-
-            // Bind textures.
-            for (uint j = 0; j < current->textures.size(); ++j) {
-                const auto& texture = current->textures[j];
-
-                GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
+                queue_uniforms_overridden = overridesQueueUniforms(*frame, q, *current);
+                bindUniforms(program_data, *frame, *current);
+                bindTextures(program_data, *frame, *current);
 
-                auto texture_unit_it =
-                    program_data.binding_location_to_texture_unit.find(texture.binding_location);
-                if (texture_unit_it == program_data.binding_location_to_texture_unit.end()) {
-                    logger_.warn("Binding location {} does not correspond to a texture.",
-                                 texture.binding_location);
+                // Unbind any previously bound texture units.
+                for (int j = current->textures.count; j < previous_max_texture_unit; ++j) {
+                    GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
                     GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
                     GL_CHECK(glBindSampler(j, 0));
-                    continue;
                 }
-
-                const auto& texture_data = texture_map_.at(texture.handle);
-                GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture_data.texture));
-                if (texture.sampler_info.sampler_flags != 0) {
-                    auto sampler_info = texture.sampler_info;
-                    if (!texture_data.has_mip_maps) {
-                        sampler_info.sampler_flags &= ~SamplerFlag::maskMipFilter;
-                    }
-                    GLuint sampler = sampler_cache_.findOrCreate(sampler_info);
-                    GL_CHECK(glBindSampler(j, sampler));
-                } else {
-                    GL_CHECK(glBindSampler(j, 0));
-                }
-            }
-            // Unbind any previously bound texture units.
-            for (int j = current->textures.size(); j < previous_max_texture_unit; ++j) {
-                GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
-                GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
-                GL_CHECK(glBindSampler(j, 0));
             }
 
             // Bind vertex data.
             if (!previous || previous->vb != current->vb) {
                 if (current->vb) {
                     GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER,
-                                          vertex_buffer_map_.at(*current->vb).vertex_buffer));
+                                          getVertexBuffer(*current->vb).vertex_buffer));
                 }
             }
 
-            // Bind attributes.
-            for (uint attrib = 0; attrib < current_vertex_decl.attributes_.size(); ++attrib) {
-                GL_CHECK(glDisableVertexAttribArray(attrib));
-            }
-            if (current->vb) {
-                current_vertex_decl = current->vertex_decl_override.empty()
-                                          ? vertex_buffer_map_.at(*current->vb).decl
-                                          : current->vertex_decl_override;
-                setupVertexArrayAttributes(current_vertex_decl, current->vb_offset);
-            } else {
-                current_vertex_decl = VertexDecl{};
+            if (!current->continues_previous) {
+                // Bind attributes.
+                for (uint attrib = 0; attrib < enabled_vertex_attributes_; ++attrib) {
+                    GL_CHECK(glDisableVertexAttribArray(attrib));
+                }
+                enabled_vertex_attributes_ = 0;
+                if (current->vb) {
+                    const auto& layout = vertex_layouts_.at(current->vertex_layout);
+#if DW_GL_VERSION == DW_GL_410
+                    setupVertexArrayAttributes(layout, current->vb_offset);
+#else
+                    // GLES 3.0 has no base vertex draws, so offset the attribute pointers instead.
+                    setupVertexArrayAttributes(
+                        layout, current->vb_offset + current->base_vertex * layout.stride);
+#endif
+                }
             }
 
             // Bind element data.
             if (!previous || previous->ib != current->ib) {
                 if (current->ib) {
                     GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-                                          index_buffer_map_.at(*current->ib).element_buffer));
+                                          getIndexBuffer(*current->ib).element_buffer));
                 } else {
                     GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
                 }
@@ -897,10 +955,10 @@ bool RenderContextGL::frame(const Frame* frame) {
 
             // Set viewport masks. These will need to be unset after processing the command to avoid
             // clobbering the next glClear call.
-            if (!current->colour_write) {
+            if (!state.colourWrite()) {
                 GL_CHECK(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
             }
-            if (!current->depth_write) {
+            if (!state.depthWrite()) {
                 GL_CHECK(glDepthMask(GL_FALSE));
             }
             if (current->scissor_enabled) {
@@ -913,20 +971,37 @@ bool RenderContextGL::frame(const Frame* frame) {
             // Submit.
             if (current->primitive_count > 0) {
                 if (current->ib) {
-                    GLenum element_type = index_buffer_map_.at(*current->ib).type;
-                    GL_CHECK(glDrawElements(
-                        GL_TRIANGLES, current->primitive_count * 3, element_type,
-                        reinterpret_cast<void*>(static_cast<std::intptr_t>(current->ib_offset))));
+                    GLenum element_type = getIndexBuffer(*current->ib).type;
+                    if (current->index_type_override) {
+                        element_type = *current->index_type_override == IndexBufferType::U16
+                                           ? GL_UNSIGNED_SHORT
+                                           : GL_UNSIGNED_INT;
+                    }
+                    auto* indices =
+                        reinterpret_cast<void*>(static_cast<std::intptr_t>(current->ib_offset));
+#if DW_GL_VERSION == DW_GL_410
+                    if (current->base_vertex > 0) {
+                        GL_CHECK(glDrawElementsBaseVertex(
+                            GL_TRIANGLES, current->primitive_count * 3, element_type, indices,
+                            static_cast<GLint>(current->base_vertex)));
+                    } else {
+                        GL_CHECK(glDrawElements(GL_TRIANGLES, current->primitive_count * 3,
+                                                element_type, indices));
+                    }
+#else
+                    GL_CHECK(glDrawElements(GL_TRIANGLES, current->primitive_count * 3,
+                                            element_type, indices));
+#endif
                 } else {
                     GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, current->primitive_count * 3));
                 }
             }
 
             // Restore viewport masks.
-            if (!current->colour_write) {
+            if (!state.colourWrite()) {
                 GL_CHECK(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
             }
-            if (!current->depth_write) {
+            if (!state.depthWrite()) {
                 GL_CHECK(glDepthMask(GL_TRUE));
             }
             if (current->scissor_enabled) {
@@ -934,12 +1009,32 @@ bool RenderContextGL::frame(const Frame* frame) {
             }
         }
 
+        // End the last occlusion query.
+        if (occlusion_query_active) {
+            GL_CHECK(glEndQuery(kOcclusionQueryTarget));
+        }
+
         // Unbind all previously bound texture units.
         for (int j = 0; j < previous_max_texture_unit; ++j) {
             GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
             GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
             GL_CHECK(glBindSampler(j, 0));
         }
+
+        // Resolve multisampled colour buffers into the frame buffer's textures. The multisampled
+        // colour buffers are discarded afterwards.
+        bool multisampled = false;
+        if (q.frame_buffer) {
+            const auto& fb_data = frame_buffer_map_.at(*q.frame_buffer);
+            multisampled = fb_data.samples > 1;
+            if (multisampled && ops.colour_store == AttachmentStoreOp::Store) {
+                resolveFrameBuffer(fb_data);
+            }
+        }
+
+        // Discard attachments which aren't stored.
+        invalidateAttachments(q, multisampled || ops.colour_store == AttachmentStoreOp::DontCare,
+                              ops.depth_store == AttachmentStoreOp::DontCare);
     }
 
     // Swap buffers.
@@ -949,22 +1044,59 @@ bool RenderContextGL::frame(const Frame* frame) {
     return true;
 }
 
+void RenderContextGL::operator()(const cmd::CreateVertexLayout& c) {
+    static std::unordered_map<VertexDecl::AttributeType, GLenum> attribute_type_map = {
+        {VertexDecl::AttributeType::Float, GL_FLOAT},
+        {VertexDecl::AttributeType::Uint8, GL_UNSIGNED_BYTE}};
+
+    VertexLayoutData layout{static_cast<GLsizei>(c.decl.stride()), {}};
+    layout.attributes.reserve(c.decl.attributes_.size());
+    for (auto& attrib : c.decl.attributes_) {
+        // Decode attribute.
+        VertexDecl::Attribute attribute;
+        usize count;
+        VertexDecl::AttributeType type;
+        bool normalised;
+        VertexDecl::decodeAttributes(attrib.first, attribute, count, type, normalised);
+
+        // Convert type.
+        auto gl_type = attribute_type_map.find(type);
+        if (gl_type == attribute_type_map.end()) {
+            logger_.warn("[CreateVertexLayout] Unknown attribute type: {}", (uint)type);
+            continue;
+        }
+        layout.attributes.emplace_back(VertexLayoutData::Attribute{
+            static_cast<GLint>(count), gl_type->second,
+            static_cast<GLboolean>(normalised ? GL_TRUE : GL_FALSE),
+            static_cast<uint>(reinterpret_cast<std::uintptr_t>(attrib.second))});
+    }
+    if (vertex_layouts_.size() <= c.id) {
+        vertex_layouts_.resize(c.id + 1);
+    }
+    vertex_layouts_[c.id] = std::move(layout);
+}
+
 void RenderContextGL::operator()(const cmd::CreateVertexBuffer& c) {
-    // Create vertex buffer object.
+    // Create vertex buffer object. Buffers are filled through the copy write target, as the upload
+    // context has no vertex array object to hold an element array buffer binding.
     GLenum usage = mapBufferUsage(c.usage);
     GLuint vbo;
     GL_CHECK(glGenBuffers(1, &vbo));
-    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vbo));
-    if (c.data.data()) {
-        GL_CHECK(glBufferData(GL_ARRAY_BUFFER, c.data.size(), c.data.data(), usage));
-    } else {
-        GL_CHECK(glBufferData(GL_ARRAY_BUFFER, c.size, nullptr, usage));
-    }
-    vertex_buffer_map_.insert({c.handle, VertexBufferData{vbo, c.decl, usage, c.size}});
+    UploadGL vbo_upload = upload([vbo, usage, data = c.data, size = c.size]() {
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, vbo));
+        if (data.data()) {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, data.size(), data.data(), usage));
+        } else {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, usage));
+        }
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    });
+    vertex_buffer_map_.insert(
+        {c.handle, VertexBufferData{vbo, usage, c.size, std::move(vbo_upload)}});
 }
 
 void RenderContextGL::operator()(const cmd::UpdateVertexBuffer& c) {
-    auto& vb_data = vertex_buffer_map_.at(c.handle);
+    auto& vb_data = getVertexBuffer(c.handle);
     GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vb_data.vertex_buffer));
     if (c.data.size() > vb_data.size) {
         GL_CHECK(glBufferData(GL_ARRAY_BUFFER, c.data.size(), c.data.data(), vb_data.usage));
@@ -976,6 +1108,7 @@ void RenderContextGL::operator()(const cmd::UpdateVertexBuffer& c) {
 
 void RenderContextGL::operator()(const cmd::DeleteVertexBuffer& c) {
     auto it = vertex_buffer_map_.find(c.handle);
+    waitForUpload(it->second.upload);
     GL_CHECK(glDeleteBuffers(1, &it->second.vertex_buffer));
     vertex_buffer_map_.erase(it);
 }
@@ -985,22 +1118,25 @@ void RenderContextGL::operator()(const cmd::CreateIndexBuffer& c) {
     GLenum usage = mapBufferUsage(c.usage);
     GLuint ebo;
     GL_CHECK(glGenBuffers(1, &ebo));
-    GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo));
-    if (c.data.data()) {
-        GL_CHECK(glBufferData(GL_ELEMENT_ARRAY_BUFFER, c.data.size(), c.data.data(), usage));
-    } else {
-        GL_CHECK(glBufferData(GL_ELEMENT_ARRAY_BUFFER, c.size, nullptr, usage));
-    }
+    UploadGL ebo_upload = upload([ebo, usage, data = c.data, size = c.size]() {
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, ebo));
+        if (data.data()) {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, data.size(), data.data(), usage));
+        } else {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, usage));
+        }
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    });
     index_buffer_map_.insert(
         {c.handle,
          IndexBufferData{ebo,
                          static_cast<GLenum>(c.type == IndexBufferType::U16 ? GL_UNSIGNED_SHORT
                                                                             : GL_UNSIGNED_INT),
-                         usage, c.size}});
+                         usage, c.size, std::move(ebo_upload)}});
 }
 
 void RenderContextGL::operator()(const cmd::UpdateIndexBuffer& c) {
-    auto& ib_data = index_buffer_map_.at(c.handle);
+    auto& ib_data = getIndexBuffer(c.handle);
     GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib_data.element_buffer));
     if (c.data.size() > ib_data.size) {
         GL_CHECK(
@@ -1013,135 +1149,194 @@ void RenderContextGL::operator()(const cmd::UpdateIndexBuffer& c) {
 
 void RenderContextGL::operator()(const cmd::DeleteIndexBuffer& c) {
     auto it = index_buffer_map_.find(c.handle);
+    waitForUpload(it->second.upload);
     GL_CHECK(glDeleteBuffers(1, &it->second.element_buffer));
     index_buffer_map_.erase(it);
 }
 
 void RenderContextGL::operator()(const cmd::CreateProgram& c) {
-    ProgramData program_data;
-    GL_CHECK(program_data.program = glCreateProgram());
-
-    // Transpile each provided shader stage to GLSL.
-    std::vector<GLuint> created_shaders;
-    created_shaders.reserve(c.stages.size());
-    for (const auto& stage : c.stages) {
-        GLuint shader = 0;
-        GL_CHECK(shader = glCreateShader(kShaderStageMap.at(stage.stage)));
-
-        // Convert SPIR-V into GLSL.
-        spirv_cross::CompilerGLSL glsl{reinterpret_cast<const u32*>(stage.spirv.data()),
-                                       stage.spirv.size() / sizeof(u32)};
-        spirv_cross::ShaderResources resources = glsl.get_shader_resources();
-
-        // Remap texture binding locations.
-        u32 next_texture_binding_location = 0;
-        std::map<u32, const spirv_cross::Resource*> sampled_images_by_binding;
-        for (const auto& resource : resources.sampled_images) {
-            sampled_images_by_binding[glsl.get_decoration(resource.id, spv::DecorationBinding)] =
-                &resource;
-        }
-        for (const auto& entry : sampled_images_by_binding) {
-            const auto& resource = *entry.second;
-            u32 set = glsl.get_decoration(resource.id, spv::DecorationDescriptorSet);
-            u32 binding = glsl.get_decoration(resource.id, spv::DecorationBinding);
-            u32 new_binding = next_texture_binding_location++;
-            logger_.debug(
-                "Remapping sampled image with location(set={}, binding={}) to location(binding={})",
-                set, binding, new_binding);
-            glsl.unset_decoration(resource.id, spv::DecorationDescriptorSet);
-            glsl.set_decoration(resource.id, spv::DecorationBinding, new_binding);
-            assert(program_data.binding_location_to_texture_unit.count(binding) == 0);
-            program_data.binding_location_to_texture_unit[binding] = new_binding;
-        }
+    // Shaders are transpiled, compiled and linked on the upload thread. The upload only writes to
+    // its own reflection, including the messages to log, which getProgram moves into the program
+    // data on the render thread once the upload has finished.
+    GLuint program;
+    GL_CHECK(program = glCreateProgram());
+    auto reflection = std::make_shared<ProgramData::Reflection>();
+    auto& program_data = program_map_[c.handle];
+    program_data.program = program;
+    program_data.reflection = reflection;
+    bool compute_supported = gl_dispatch_compute_ != nullptr;
+    program_data.upload = upload([program, reflection, compute_supported, stages = c.stages]() {
+        auto log = [&reflection](LogLevel level, std::string message) {
+            reflection->messages.emplace_back(level, std::move(message));
+        };
+
+        // Transpile each provided shader stage to GLSL.
+        std::vector<GLuint> created_shaders;
+        created_shaders.reserve(stages.size());
+        std::vector<std::pair<u32, u32>> uniform_block_resources;
+        std::vector<std::pair<std::string, u32>> uniform_block_names;
+        for (const auto& stage : stages) {
+            if (stage.stage == ShaderStage::Compute && !compute_supported) {
+                log(LogLevel::Error, "[CreateProgram] Compute shaders require OpenGL 4.3.");
+                return;
+            }
+
+            GLuint shader = 0;
+            GL_CHECK(shader = glCreateShader(kShaderStageMap.at(stage.stage)));
+
+            // Convert SPIR-V into GLSL.
+            spirv_cross::CompilerGLSL glsl{reinterpret_cast<const u32*>(stage.spirv.data()),
+                                           stage.spirv.size() / sizeof(u32)};
+            spirv_cross::ShaderResources resources = glsl.get_shader_resources();
 
-        // If we use the 'emit_uniform_buffer_as_plain_uniforms' option on an empty uniform block,
-        // variables are going to be prefixed with _<id>, where <id> is the resource ID in SPIR-V.
-        // In those cases, we need to store that information so it can be looked up during frame().
-        for (const auto& resource : resources.uniform_buffers) {
-            if (!glsl.get_name(resource.id).empty()) {
-                continue;
+            // Remap texture binding locations.
+            u32 next_texture_binding_location = 0;
+            std::map<u32, const spirv_cross::Resource*> sampled_images_by_binding;
+            for (const auto& resource : resources.sampled_images) {
+                sampled_images_by_binding[glsl.get_decoration(resource.id,
+                                                              spv::DecorationBinding)] = &resource;
+            }
+            for (const auto& entry : sampled_images_by_binding) {
+                const auto& resource = *entry.second;
+                u32 set = glsl.get_decoration(resource.id, spv::DecorationDescriptorSet);
+                u32 binding = glsl.get_decoration(resource.id, spv::DecorationBinding);
+                u32 new_binding = next_texture_binding_location++;
+                log(LogLevel::Debug, fmt::format("Remapping sampled image with location(set={}, "
+                                                 "binding={}) to location(binding={})",
+                                                 set, binding, new_binding));
+                glsl.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+                glsl.set_decoration(resource.id, spv::DecorationBinding, new_binding);
+                assert(reflection->binding_location_to_texture_unit.count(binding) == 0);
+                reflection->binding_location_to_texture_unit[binding] = new_binding;
             }
 
-            const spirv_cross::SPIRType& type = glsl.get_type(resource.base_type_id);
-            usize member_count = type.member_types.size();
-            for (usize i = 0; i < member_count; ++i) {
-                auto member_name = glsl.get_member_name(type.self, i);
-                assert(program_data.uniform_remap_ids.count(member_name) == 0);
-                program_data.uniform_remap_ids[member_name] = resource.id;
+            // Reflect uniform blocks. Uniforms are named "<instance name>.<member name>", or just
+            // "<member name>" if the block has no instance name, like the Vulkan backend. GLSL 4.10
+            // and GLSL ES 3.00 can't declare a block's binding, so it's set after linking instead.
+            for (const auto& resource : resources.uniform_buffers) {
+                u32 binding = glsl.get_decoration(resource.id, spv::DecorationBinding);
+                glsl.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+                glsl.unset_decoration(resource.id, spv::DecorationBinding);
+                uniform_block_resources.emplace_back(resource.id, binding);
+
+                // Blocks used by multiple stages are only added once.
+                if (std::any_of(reflection->uniform_blocks.begin(),
+                                reflection->uniform_blocks.end(),
+                                [binding](const ProgramData::UniformBlock& block) {
+                                    return block.binding == binding;
+                                })) {
+                    continue;
+                }
+                const spirv_cross::SPIRType& type = glsl.get_type(resource.base_type_id);
+                usize block_index = reflection->uniform_blocks.size();
+                reflection->uniform_blocks.emplace_back(ProgramData::UniformBlock{
+                    binding, std::vector<byte>(glsl.get_declared_struct_size(type), 0), true, 0,
+                    0, {}});
+                const std::string& instance_name = glsl.get_name(resource.id);
+                std::string prefix = instance_name.empty() ? "" : instance_name + ".";
+                usize member_count = type.member_types.size();
+                for (u32 i = 0; i < member_count; ++i) {
+                    std::string qualified_name = prefix + glsl.get_member_name(type.self, i);
+                    bool is_array = !glsl.get_type(type.member_types[i]).array.empty();
+                    reflection->uniforms.emplace(
+                        std::move(qualified_name),
+                        ProgramData::Uniform{
+                            block_index, glsl.type_struct_member_offset(type, i),
+                            glsl.get_declared_struct_member_size(type, i),
+                            is_array ? glsl.type_struct_member_array_stride(type, i) : 0});
+                }
             }
-        }
 
-        // Compile to GLSL, ready to give to GL driver.
-        spirv_cross::CompilerGLSL::Options options;
-        options.emit_push_constant_as_uniform_buffer = true;
-        options.emit_uniform_buffer_as_plain_uniforms = true;
+            // Compile to GLSL, ready to give to GL driver.
+            spirv_cross::CompilerGLSL::Options options;
+            options.emit_push_constant_as_uniform_buffer = true;
+            options.emit_uniform_buffer_as_plain_uniforms = false;
 #if DW_GL_VERSION == DW_GL_410
-        options.version = 410;
-        options.es = false;
+            // Compute shaders were added in GLSL 4.30.
+            options.version = stage.stage == ShaderStage::Compute ? 430 : 410;
+            options.es = false;
 #elif DW_GL_VERSION == DW_GLES_300
-        options.version = 300;
-        options.es = true;
+            options.version = 300;
+            options.es = true;
 #else
 #error "Unsupported DW_GL_VERSION"
 #endif
-        glsl.set_common_options(options);
-        std::string source = glsl.compile();
+            glsl.set_common_options(options);
+            std::string source = glsl.compile();
+            for (const auto& block : uniform_block_resources) {
+                uniform_block_names.emplace_back(glsl.get_remapped_declared_block_name(block.first),
+                                                 block.second);
+            }
+            uniform_block_resources.clear();
 
-        // Postprocess the GLSL to remove a GL 4.2 extension, which doesn't exist on macOS.
+            // Postprocess the GLSL to remove a GL 4.2 extension, which doesn't exist on macOS.
 #if DGA_PLATFORM == DGA_MACOS
-        source = dga::strReplaceAll(source, "#extension GL_ARB_shading_language_420pack : require",
-                                    "#extension GL_ARB_shading_language_420pack : disable");
+            source = dga::strReplaceAll(source,
+                                        "#extension GL_ARB_shading_language_420pack : require",
+                                        "#extension GL_ARB_shading_language_420pack : disable");
 #endif
 
-        // Compile the shader.
-        // logger_.debug("Decompiled GLSL from SPIR-V: {}", source);
-        const char* sources_cstr = source.c_str();
-        GL_CHECK(glShaderSource(shader, 1, &sources_cstr, nullptr));
-        GL_CHECK(glCompileShader(shader));
+            // Compile the shader.
+            // log(LogLevel::Debug, fmt::format("Decompiled GLSL from SPIR-V: {}", source));
+            const char* sources_cstr = source.c_str();
+            GL_CHECK(glShaderSource(shader, 1, &sources_cstr, nullptr));
+            GL_CHECK(glCompileShader(shader));
+
+            // Check compilation result.
+            GLint result;
+            GL_CHECK(glGetShaderiv(shader, GL_COMPILE_STATUS, &result));
+            if (result == GL_FALSE) {
+                int info_log_length;
+                GL_CHECK(glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length));
+                std::string error_message(info_log_length, '\0');
+                GL_CHECK(
+                    glGetShaderInfoLog(shader, info_log_length, nullptr, error_message.data()));
+                log(LogLevel::Error,
+                    fmt::format("[CreateProgram] Shader compile error: {}", error_message));
+                return;
+            }
+
+            // Attach shader to program.
+            GL_CHECK(glAttachShader(program, shader));
+            created_shaders.push_back(shader);
+        }
+
+        // Link program.
+        GL_CHECK(glLinkProgram(program));
 
-        // Check compilation result.
-        GLint result;
-        GL_CHECK(glGetShaderiv(shader, GL_COMPILE_STATUS, &result));
+        // Check the result of the link process.
+        GLint result = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &result);
         if (result == GL_FALSE) {
             int info_log_length;
-            GL_CHECK(glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length));
+            GL_CHECK(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length));
             std::string error_message(info_log_length, '\0');
-            GL_CHECK(glGetShaderInfoLog(shader, info_log_length, nullptr, error_message.data()));
-            logger_.error("[CreateProgram] Shader compile error: {}", error_message);
-            return;
+            GL_CHECK(
+                glGetProgramInfoLog(program, info_log_length, nullptr, error_message.data()));
+            log(LogLevel::Error,
+                fmt::format("[CreateProgram] Shader link error: {}", error_message));
         }
 
-        // Attach shader to program.
-        GL_CHECK(glAttachShader(program_data.program, shader));
-        created_shaders.push_back(shader);
-    }
-
-    // Link program.
-    GL_CHECK(glLinkProgram(program_data.program));
-
-    // Check the result of the link process.
-    GLint result = GL_FALSE;
-    glGetProgramiv(program_data.program, GL_LINK_STATUS, &result);
-    if (result == GL_FALSE) {
-        int info_log_length;
-        GL_CHECK(glGetProgramiv(program_data.program, GL_INFO_LOG_LENGTH, &info_log_length));
-        std::string error_message(info_log_length, '\0');
-        GL_CHECK(glGetProgramInfoLog(program_data.program, info_log_length, nullptr,
-                                     error_message.data()));
-        logger_.error("[CreateProgram] Shader link error: {}", error_message);
-    }
-
-    // Destroy leftover shaders.
-    for (auto shader : created_shaders) {
-        GL_CHECK(glDeleteShader(shader));
-    }
+        // Assign uniform blocks to their binding locations.
+        for (const auto& block : uniform_block_names) {
+            GLuint block_index;
+            GL_CHECK(block_index = glGetUniformBlockIndex(program, block.first.c_str()));
+            if (block_index != GL_INVALID_INDEX) {
+                GL_CHECK(glUniformBlockBinding(program, block_index, block.second));
+            }
+        }
 
-    program_map_.emplace(c.handle, std::move(program_data));
+        // Destroy leftover shaders.
+        for (auto shader : created_shaders) {
+            GL_CHECK(glDeleteShader(shader));
+        }
+    });
 }
 
 void RenderContextGL::operator()(const cmd::DeleteProgram& c) {
     auto it = program_map_.find(c.handle);
     if (it != program_map_.end()) {
+        getProgram(c.handle);
         GL_CHECK(glDeleteProgram(it->second.program));
         program_map_.erase(it);
     } else {
@@ -1149,10 +1344,81 @@ void RenderContextGL::operator()(const cmd::DeleteProgram& c) {
     }
 }
 
+void RenderContextGL::operator()(const cmd::CreateUniformBuffer& c) {
+    GLenum usage = mapBufferUsage(c.usage);
+    GLuint buffer;
+    GL_CHECK(glGenBuffers(1, &buffer));
+    UploadGL buffer_upload = upload([buffer, usage, data = c.data, size = c.size]() {
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, buffer));
+        if (data.data()) {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, data.size(), data.data(), usage));
+        } else {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, usage));
+        }
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    });
+    uniform_buffer_map_.insert(
+        {c.handle, UniformBufferData{buffer, usage, c.size, std::move(buffer_upload)}});
+}
+
+void RenderContextGL::operator()(const cmd::UpdateUniformBuffer& c) {
+    auto& ub_data = getUniformBuffer(c.handle);
+    GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, ub_data.buffer));
+    if (c.data.size() > ub_data.size) {
+        GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, c.data.size(), c.data.data(), ub_data.usage));
+        ub_data.size = c.data.size();
+    } else {
+        GL_CHECK(glBufferSubData(GL_COPY_WRITE_BUFFER, c.offset, c.data.size(), c.data.data()));
+    }
+    GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+}
+
+void RenderContextGL::operator()(const cmd::DeleteUniformBuffer& c) {
+    auto it = uniform_buffer_map_.find(c.handle);
+    waitForUpload(it->second.upload);
+    GL_CHECK(glDeleteBuffers(1, &it->second.buffer));
+    uniform_buffer_map_.erase(it);
+}
+
+void RenderContextGL::operator()(const cmd::CreateStorageBuffer& c) {
+    GLenum usage = mapBufferUsage(c.usage);
+    GLuint buffer;
+    GL_CHECK(glGenBuffers(1, &buffer));
+    UploadGL buffer_upload = upload([buffer, usage, data = c.data, size = c.size]() {
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, buffer));
+        if (data.data()) {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, data.size(), data.data(), usage));
+        } else {
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, usage));
+        }
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    });
+    storage_buffer_map_.insert(
+        {c.handle, StorageBufferData{buffer, usage, c.size, std::move(buffer_upload)}});
+}
+
+void RenderContextGL::operator()(const cmd::UpdateStorageBuffer& c) {
+    auto& sb_data = getStorageBuffer(c.handle);
+    GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, sb_data.buffer));
+    if (c.data.size() > sb_data.size) {
+        GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, c.data.size(), c.data.data(), sb_data.usage));
+        sb_data.size = c.data.size();
+    } else {
+        GL_CHECK(glBufferSubData(GL_COPY_WRITE_BUFFER, c.offset, c.data.size(), c.data.data()));
+    }
+    GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+}
+
+void RenderContextGL::operator()(const cmd::DeleteStorageBuffer& c) {
+    auto it = storage_buffer_map_.find(c.handle);
+    waitForUpload(it->second.upload);
+    GL_CHECK(glDeleteBuffers(1, &it->second.buffer));
+    storage_buffer_map_.erase(it);
+}
+
 void RenderContextGL::operator()(const cmd::CreateTexture2D& c) {
     GLuint texture;
     GL_CHECK(glGenTextures(1, &texture));
-    GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture));
 
     // Give image data to OpenGL.
     TextureFormatGL format = kTextureFormatMap[static_cast<int>(c.format)];
@@ -1161,20 +1427,32 @@ void RenderContextGL::operator()(const cmd::CreateTexture2D& c) {
         "- type: {:#x}",
         static_cast<u32>(c.format), format.internal_format, format.internal_format_srgb,
         format.format, format.type);
-    GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, c.width, c.height, 0,
-                          format.format, format.type, c.data.data()));
+    UploadGL texture_upload = upload([texture, format, c]() {
+        GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture));
+        GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, c.width, c.height, 0,
+                              format.format, format.type, c.data.data()));
+
+        // Generate mipmaps. Storage images must be complete to be bound, so textures without
+        // mipmaps are limited to their first level.
+        if (c.generate_mipmaps) {
+            GL_CHECK(glGenerateMipmap(GL_TEXTURE_2D));
+        } else if (c.storage_usage) {
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0));
+        }
 
-    // Generate mipmaps.
-    if (c.generate_mipmaps) {
-        GL_CHECK(glGenerateMipmap(GL_TEXTURE_2D));
-    }
+        // Unbind the texture, so that it isn't kept alive by the upload context after it's
+        // deleted.
+        GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+    });
 
     // Add texture.
-    texture_map_.emplace(c.handle, TextureData{texture, c.generate_mipmaps});
+    texture_map_.emplace(c.handle, TextureData{texture, c.generate_mipmaps, format.internal_format,
+                                               std::move(texture_upload)});
 }
 
 void RenderContextGL::operator()(const cmd::DeleteTexture& c) {
     auto it = texture_map_.find(c.handle);
+    waitForUpload(it->second.upload);
     GL_CHECK(glDeleteTextures(1, &it->second.texture));
     texture_map_.erase(it);
 }
@@ -1184,6 +1462,12 @@ void RenderContextGL::operator()(const cmd::CreateFrameBuffer& c) {
     fb_data.textures = c.textures;
     fb_data.width = c.width;
     fb_data.height = c.height;
+    fb_data.msaa_frame_buffer = 0;
+
+    // Clamp the sample count to what the driver supports.
+    GLint max_samples = 1;
+    GL_CHECK(glGetIntegerv(GL_MAX_SAMPLES, &max_samples));
+    fb_data.samples = std::max(1, std::min(static_cast<GLint>(c.samples), max_samples));
 
     GL_CHECK(glGenFramebuffers(1, &fb_data.frame_buffer));
     GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb_data.frame_buffer));
@@ -1192,20 +1476,64 @@ void RenderContextGL::operator()(const cmd::CreateFrameBuffer& c) {
     std::vector<GLenum> draw_buffers;
     u8 attachment = 0;
     for (auto texture : fb_data.textures) {
-        auto gl_texture = texture_map_.find(texture);
-        assert(gl_texture != texture_map_.end());
+        const auto& gl_texture = getTexture(texture);
         draw_buffers.emplace_back(GL_COLOR_ATTACHMENT0 + attachment++);
         GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, draw_buffers.back(), GL_TEXTURE_2D,
-                                        gl_texture->second.texture, 0));
+                                        gl_texture.texture, 0));
+    }
+    if (draw_buffers.empty()) {
+        // Depth only frame buffer. glDrawBuffer isn't available in GLES 3.0.
+        GLenum none = GL_NONE;
+        GL_CHECK(glDrawBuffers(1, &none));
+        GL_CHECK(glReadBuffer(GL_NONE));
+    } else {
+        GL_CHECK(glDrawBuffers(static_cast<GLsizei>(draw_buffers.size()), draw_buffers.data()));
+    }
+
+    // Bind depth texture.
+    fb_data.depth_render_buffer = 0;
+    if (c.depth_texture) {
+        const auto& gl_texture = getTexture(*c.depth_texture);
+        GLenum depth_attachment = gl_texture.internal_format == GL_DEPTH24_STENCIL8
+                                      ? GL_DEPTH_STENCIL_ATTACHMENT
+                                      : GL_DEPTH_ATTACHMENT;
+        GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, depth_attachment, GL_TEXTURE_2D,
+                                        gl_texture.texture, 0));
     }
-    GL_CHECK(glDrawBuffers(static_cast<GLsizei>(draw_buffers.size()), draw_buffers.data()));
 
-    // Create depth buffer.
-    GL_CHECK(glGenRenderbuffers(1, &fb_data.depth_render_buffer));
-    GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, fb_data.depth_render_buffer));
-    GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, c.width, c.height));
-    GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
-                                       fb_data.depth_render_buffer));
+    // If multisampled, create a second frame buffer with multisampled colour buffers. The depth
+    // buffer is only needed in the frame buffer which is rendered to.
+    if (fb_data.samples > 1) {
+        GL_CHECK(glGenFramebuffers(1, &fb_data.msaa_frame_buffer));
+        GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb_data.msaa_frame_buffer));
+        fb_data.msaa_render_buffers.resize(fb_data.textures.size());
+        GL_CHECK(glGenRenderbuffers(static_cast<GLsizei>(fb_data.msaa_render_buffers.size()),
+                                    fb_data.msaa_render_buffers.data()));
+        for (usize i = 0; i < fb_data.textures.size(); ++i) {
+            GLenum internal_format = getTexture(fb_data.textures[i]).internal_format;
+            GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, fb_data.msaa_render_buffers[i]));
+            GL_CHECK(glRenderbufferStorageMultisample(GL_RENDERBUFFER, fb_data.samples,
+                                                      internal_format, c.width, c.height));
+            GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, draw_buffers[i], GL_RENDERBUFFER,
+                                               fb_data.msaa_render_buffers[i]));
+        }
+        GL_CHECK(glDrawBuffers(static_cast<GLsizei>(draw_buffers.size()), draw_buffers.data()));
+    }
+
+    // Create depth buffer if there's no depth texture.
+    if (!c.depth_texture) {
+        GL_CHECK(glGenRenderbuffers(1, &fb_data.depth_render_buffer));
+        GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, fb_data.depth_render_buffer));
+        if (fb_data.samples > 1) {
+            GL_CHECK(glRenderbufferStorageMultisample(GL_RENDERBUFFER, fb_data.samples,
+                                                      GL_DEPTH24_STENCIL8, c.width, c.height));
+        } else {
+            GL_CHECK(
+                glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, c.width, c.height));
+        }
+        GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                                           GL_RENDERBUFFER, fb_data.depth_render_buffer));
+    }
 
     // Check frame buffer status.
     GLenum status;
@@ -1221,42 +1549,486 @@ void RenderContextGL::operator()(const cmd::CreateFrameBuffer& c) {
     frame_buffer_map_.emplace(c.handle, fb_data);
 }
 
-void RenderContextGL::operator()(const cmd::DeleteFrameBuffer&) {
-    // TODO: unimplemented.
+void RenderContextGL::operator()(const cmd::DeleteFrameBuffer& c) {
+    auto it = frame_buffer_map_.find(c.handle);
+    if (it == frame_buffer_map_.end()) {
+        logger_.error("Frame buffer handle {} invalid.", c.handle);
+        return;
+    }
+    auto& fb_data = it->second;
+    if (fb_data.depth_render_buffer != 0) {
+        GL_CHECK(glDeleteRenderbuffers(1, &fb_data.depth_render_buffer));
+    }
+    GL_CHECK(glDeleteFramebuffers(1, &fb_data.frame_buffer));
+    if (fb_data.samples > 1) {
+        GL_CHECK(glDeleteRenderbuffers(static_cast<GLsizei>(fb_data.msaa_render_buffers.size()),
+                                       fb_data.msaa_render_buffers.data()));
+        GL_CHECK(glDeleteFramebuffers(1, &fb_data.msaa_frame_buffer));
+    }
+    frame_buffer_map_.erase(it);
 }
 
-void RenderContextGL::setupVertexArrayAttributes(const VertexDecl& decl, uint vb_offset) {
-    static std::unordered_map<VertexDecl::AttributeType, GLenum> attribute_type_map = {
-        {VertexDecl::AttributeType::Float, GL_FLOAT},
-        {VertexDecl::AttributeType::Uint8, GL_UNSIGNED_BYTE}};
-    u16 attrib_counter = 0;
-    for (auto& attrib : decl.attributes_) {
-        // Decode attribute.
-        VertexDecl::Attribute attribute;
-        usize count;
-        VertexDecl::AttributeType type;
-        bool normalised;
-        VertexDecl::decodeAttributes(attrib.first, attribute, count, type, normalised);
+void RenderContextGL::operator()(const cmd::CreateOcclusionQuery& c) {
+    occlusion_query_map_.emplace(c.handle, OcclusionQueryData{});
+}
 
-        // Convert type.
-        auto gl_type = attribute_type_map.find(type);
-        if (gl_type == attribute_type_map.end()) {
-            logger_.warn("[SetupVertexArrayAttributes] Unknown attribute type: {}", (uint)type);
+void RenderContextGL::operator()(const cmd::DeleteOcclusionQuery& c) {
+    auto it = occlusion_query_map_.find(c.handle);
+    if (it == occlusion_query_map_.end()) {
+        return;
+    }
+    for (GLuint query : it->second.pending_queries) {
+        GL_CHECK(glDeleteQueries(1, &query));
+    }
+    for (GLuint query : it->second.free_queries) {
+        GL_CHECK(glDeleteQueries(1, &query));
+    }
+    occlusion_query_map_.erase(it);
+    removeOcclusionQueryResult(c.handle);
+}
+
+void RenderContextGL::uploadThread() {
+    glfwMakeContextCurrent(upload_window_);
+    std::unique_lock<std::mutex> lock{upload_mutex_};
+    while (true) {
+        upload_cv_.wait(lock, [this]() { return stop_upload_thread_ || !upload_jobs_.empty(); });
+        // Finish any remaining uploads before stopping, so that nothing waits on them forever.
+        if (upload_jobs_.empty()) {
+            break;
+        }
+        auto job = std::move(upload_jobs_.front());
+        upload_jobs_.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+    glfwMakeContextCurrent(nullptr);
+}
+
+RenderContextGL::UploadGL RenderContextGL::upload(std::function<void()> job) {
+    auto fence = std::make_shared<std::promise<GLsync>>();
+    UploadGL upload = fence->get_future().share();
+#ifndef DGA_EMSCRIPTEN
+    {
+        std::lock_guard<std::mutex> lock{upload_mutex_};
+        upload_jobs_.emplace_back([job = std::move(job), fence]() {
+            job();
+            GLsync sync;
+            GL_CHECK(sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+            // Flush the upload context, otherwise the fence may never be signalled for the render
+            // thread which waits on it.
+            GL_CHECK(glFlush());
+            fence->set_value(sync);
+        });
+    }
+    upload_cv_.notify_one();
+#else
+    job();
+    fence->set_value(nullptr);
+#endif
+    return upload;
+}
+
+void RenderContextGL::waitForUpload(UploadGL& upload) {
+    if (!upload.valid()) {
+        return;
+    }
+    // Wait until the upload has been issued, then make the GPU wait for it to complete. The
+    // render thread itself doesn't block on the GPU.
+    GLsync fence = upload.get();
+    if (fence) {
+        GL_CHECK(glWaitSync(fence, 0, GL_TIMEOUT_IGNORED));
+        GL_CHECK(glDeleteSync(fence));
+    }
+    upload = UploadGL{};
+}
+
+void RenderContextGL::stopUploadThread() {
+    if (!upload_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock{upload_mutex_};
+        stop_upload_thread_ = true;
+    }
+    upload_cv_.notify_one();
+    upload_thread_.join();
+}
+
+RenderContextGL::VertexBufferData& RenderContextGL::getVertexBuffer(VertexBufferHandle handle) {
+    auto& vb_data = vertex_buffer_map_.at(handle);
+    waitForUpload(vb_data.upload);
+    return vb_data;
+}
+
+RenderContextGL::IndexBufferData& RenderContextGL::getIndexBuffer(IndexBufferHandle handle) {
+    auto& ib_data = index_buffer_map_.at(handle);
+    waitForUpload(ib_data.upload);
+    return ib_data;
+}
+
+RenderContextGL::UniformBufferData& RenderContextGL::getUniformBuffer(
+    UniformBufferHandle handle) {
+    auto& ub_data = uniform_buffer_map_.at(handle);
+    waitForUpload(ub_data.upload);
+    return ub_data;
+}
+
+RenderContextGL::StorageBufferData& RenderContextGL::getStorageBuffer(
+    StorageBufferHandle handle) {
+    auto& sb_data = storage_buffer_map_.at(handle);
+    waitForUpload(sb_data.upload);
+    return sb_data;
+}
+
+RenderContextGL::ProgramData& RenderContextGL::getProgram(ProgramHandle handle) {
+    auto& program_data = program_map_.at(handle);
+    waitForUpload(program_data.upload);
+    if (program_data.reflection) {
+        auto& reflection = *program_data.reflection;
+        for (const auto& message : reflection.messages) {
+            logger_.log(message.first, message.second);
+        }
+        program_data.binding_location_to_texture_unit =
+            std::move(reflection.binding_location_to_texture_unit);
+        program_data.uniform_blocks = std::move(reflection.uniform_blocks);
+        program_data.uniforms = std::move(reflection.uniforms);
+        program_data.reflection.reset();
+    }
+    return program_data;
+}
+
+RenderContextGL::TextureData& RenderContextGL::getTexture(TextureHandle handle) {
+    auto& texture_data = texture_map_.at(handle);
+    waitForUpload(texture_data.upload);
+    return texture_data;
+}
+
+void RenderContextGL::setUniform(ProgramData& program_data, const std::string& name,
+                                 const UniformData& data) {
+    // Uniforms are stored in their blocks, which keep them for later items. Blocks are only
+    // written to the ring buffer again if a uniform changes.
+    auto uniform = program_data.uniforms.find(name);
+    if (uniform == program_data.uniforms.end()) {
+        logger_.warn("[Frame] Unknown uniform '{}', skipping.", name);
+        return;
+    }
+    const auto* array = std::get_if<UniformArray>(&data);
+    if (array && array->stride != uniform->second.array_stride) {
+        logger_.warn("[Frame] Uniform '{}' isn't an array with a stride of {} bytes, skipping.",
+                     name, array->stride);
+        return;
+    }
+    auto& block = program_data.uniform_blocks[uniform->second.block];
+    if (writeStd140Uniform(block.data.data() + uniform->second.offset, uniform->second.size,
+                           data)) {
+        block.dirty = true;
+    }
+}
+
+void RenderContextGL::setUniformBlocks(ProgramData& program_data, const Frame& frame,
+                                       const RenderItem& item) {
+    for (const auto& entry : frame.uniformBlocks(item)) {
+        auto block = std::find_if(program_data.uniform_blocks.begin(),
+                                  program_data.uniform_blocks.end(),
+                                  [&entry](const ProgramData::UniformBlock& block) {
+                                      return block.binding == entry.binding_location;
+                                  });
+        if (block == program_data.uniform_blocks.end()) {
+            logger_.warn("[Frame] Unknown uniform block binding {}, skipping.",
+                         entry.binding_location);
+            continue;
+        }
+        if (!checkUniformBlockLayout(
+                program_data, static_cast<usize>(block - program_data.uniform_blocks.begin()),
+                entry)) {
+            continue;
+        }
+        auto data = frame.uniformBlockData(entry);
+        if (!std::equal(data.begin(), data.end(), block->data.begin())) {
+            std::memcpy(block->data.data(), data.begin(), data.size());
+            block->dirty = true;
+        }
+    }
+}
+
+bool RenderContextGL::checkUniformBlockLayout(ProgramData& program_data, usize block_index,
+                                              const RenderItem::UniformBlockData& entry) {
+    auto& block = program_data.uniform_blocks[block_index];
+    if (!entry.layout) {
+        if (block.data.size() != entry.data.count) {
+            logger_.warn("[Frame] Uniform block binding {} is {} bytes, but {} bytes were set.",
+                         entry.binding_location, block.data.size(), entry.data.count);
+            return false;
+        }
+        return true;
+    }
+
+    // Struct layouts are only checked the first time they're used with a block.
+    auto checked = block.checked_layouts.find(entry.layout);
+    if (checked != block.checked_layouts.end()) {
+        return checked->second;
+    }
+    bool matches = true;
+    if (block.data.size() != entry.layout->size) {
+        logger_.warn("[Frame] Uniform block binding {} is {} bytes, but the struct is {} bytes.",
+                     entry.binding_location, block.data.size(), entry.layout->size);
+        matches = false;
+    }
+    for (const auto& member : entry.layout->members) {
+        auto uniform = std::find_if(
+            program_data.uniforms.begin(), program_data.uniforms.end(),
+            [&](const std::pair<const std::string, ProgramData::Uniform>& uniform) {
+                // Uniforms are named "<instance name>.<member name>" or "<member name>".
+                const std::string& name = uniform.first;
+                usize name_start = name.rfind('.') + 1;
+                return uniform.second.block == block_index &&
+                       name.compare(name_start, std::string::npos, member.name) == 0;
+            });
+        if (uniform == program_data.uniforms.end()) {
+            logger_.warn("[Frame] Uniform block binding {} has no member '{}'.",
+                         entry.binding_location, member.name);
+            matches = false;
+        } else if (uniform->second.offset != member.offset) {
+            logger_.warn("[Frame] Member '{}' of uniform block binding {} is at offset {}, but "
+                         "the struct has it at offset {}.",
+                         member.name, entry.binding_location, uniform->second.offset,
+                         member.offset);
+            matches = false;
+        }
+    }
+    block.checked_layouts.emplace(entry.layout, matches);
+    return matches;
+}
+
+void RenderContextGL::bindUniforms(ProgramData& program_data, const Frame& frame,
+                                   const RenderItem& item) {
+    setUniformBlocks(program_data, frame, item);
+    for (const auto& uniform : frame.uniforms(item)) {
+        setUniform(program_data, uniform.first, uniform.second);
+    }
+    auto uniform_buffers = frame.uniformBuffers(item);
+
+    // Bind each block to either a range of a user uniform buffer, or the range of the uniform ring
+    // buffer containing its contents.
+    for (auto& block : program_data.uniform_blocks) {
+        auto size = static_cast<GLsizeiptr>(block.data.size());
+        auto binding_it =
+            std::find_if(uniform_buffers.begin(), uniform_buffers.end(),
+                         [&block](const RenderItem::UniformBufferBinding& binding) {
+                             return binding.binding_location == block.binding;
+                         });
+        if (binding_it != uniform_buffers.end()) {
+            GL_CHECK(glBindBufferRange(GL_UNIFORM_BUFFER, block.binding,
+                                       getUniformBuffer(binding_it->handle).buffer,
+                                       binding_it->offset, size));
+            continue;
+        }
+
+        if (block.dirty || block.ring_generation != uniform_ring_generation_) {
+            GLintptr offset = (uniform_ring_offset_ + uniform_buffer_offset_alignment_ - 1) /
+                              uniform_buffer_offset_alignment_ * uniform_buffer_offset_alignment_;
+            if (offset + size > kUniformRingBufferSize) {
+                orphanUniformRingBuffer();
+                offset = 0;
+            }
+            GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, uniform_ring_buffer_));
+            GL_CHECK(glBufferSubData(GL_UNIFORM_BUFFER, offset, size, block.data.data()));
+            uniform_ring_offset_ = offset + size;
+            block.dirty = false;
+            block.ring_offset = offset;
+            block.ring_generation = uniform_ring_generation_;
+        }
+        GL_CHECK(glBindBufferRange(GL_UNIFORM_BUFFER, block.binding, uniform_ring_buffer_,
+                                   block.ring_offset, size));
+    }
+}
+
+void RenderContextGL::orphanUniformRingBuffer() {
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, uniform_ring_buffer_));
+    GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, kUniformRingBufferSize, nullptr, GL_STREAM_DRAW));
+    uniform_ring_offset_ = 0;
+    ++uniform_ring_generation_;
+}
+
+void RenderContextGL::bindTextures(ProgramData& program_data, const Frame& frame,
+                                   const RenderItem& item) {
+    auto textures = frame.textures(item);
+    for (uint j = 0; j < textures.size(); ++j) {
+        const auto& texture = textures[j];
+
+        GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
+
+        auto texture_unit_it =
+            program_data.binding_location_to_texture_unit.find(texture.binding_location);
+        if (texture_unit_it == program_data.binding_location_to_texture_unit.end()) {
+            logger_.warn("Binding location {} does not correspond to a texture.",
+                         texture.binding_location);
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+            GL_CHECK(glBindSampler(j, 0));
             continue;
         }
 
-        //        logger_.debug("[SetupVertexArrayAttributes] Attrib {}: Count='{}' Type='{}'
-        //        Stride='{}' Offset='{}'",
-        //                    attrib_counter, count, static_cast<int>(gl_type->first), decl.stride_,
-        //                    reinterpret_cast<uintptr_t>(attrib.second));
+        const auto& texture_data = getTexture(texture.handle);
+        GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture_data.texture));
+        if (texture.sampler_info.sampler_flags != 0) {
+            auto sampler_info = texture.sampler_info;
+            if (!texture_data.has_mip_maps) {
+                sampler_info.sampler_flags &= ~SamplerFlag::maskMipFilter;
+            }
+            GLuint sampler = sampler_cache_.findOrCreate(sampler_info);
+            GL_CHECK(glBindSampler(j, sampler));
+        } else {
+            GL_CHECK(glBindSampler(j, 0));
+        }
+    }
+}
 
-        // Set attribute.
-        GL_CHECK(glEnableVertexAttribArray(attrib_counter));
-        GL_CHECK(glVertexAttribPointer(attrib_counter, count, gl_type->second,
-                                       static_cast<GLboolean>(normalised ? GL_TRUE : GL_FALSE),
-                                       decl.stride_, attrib.second + vb_offset));
-        attrib_counter++;
+void RenderContextGL::dispatchCompute(const Frame& frame, const RenderItem& item) {
+    if (!gl_dispatch_compute_) {
+        logger_.error("[Frame] Compute programs require OpenGL 4.3, skipping dispatch.");
+        return;
     }
+
+    ProgramData& program_data = getProgram(*item.program);
+    GL_CHECK(glUseProgram(program_data.program));
+    bindUniforms(program_data, frame, item);
+    bindTextures(program_data, frame, item);
+
+    // Storage buffer and image binding locations are used as is, as they don't share binding
+    // points with anything else.
+    for (const auto& storage_buffer : frame.storageBuffers(item)) {
+        GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, storage_buffer.binding_location,
+                                  getStorageBuffer(storage_buffer.handle).buffer));
+    }
+    for (const auto& storage_image : frame.storageImages(item)) {
+        const auto& texture_data = getTexture(storage_image.handle);
+        GL_CHECK(gl_bind_image_texture_(storage_image.binding_location, texture_data.texture, 0,
+                                        GL_FALSE, 0, GL_READ_WRITE,
+                                        texture_data.internal_format));
+    }
+
+    GL_CHECK(gl_dispatch_compute_(item.group_count_x, item.group_count_y, item.group_count_z));
+
+    // Make the writes visible to later dispatches and draws, whichever way they read them.
+    GL_CHECK(gl_memory_barrier_(GL_ALL_BARRIER_BITS));
+
+    for (uint j = 0; j < item.textures.count; ++j) {
+        GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
+        GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+        GL_CHECK(glBindSampler(j, 0));
+    }
+}
+
+void RenderContextGL::setupVertexArrayAttributes(const VertexLayoutData& layout, uint vb_offset) {
+    for (const auto& attrib : layout.attributes) {
+        auto offset = static_cast<std::uintptr_t>(attrib.offset + vb_offset);
+        GL_CHECK(glEnableVertexAttribArray(enabled_vertex_attributes_));
+        GL_CHECK(glVertexAttribPointer(enabled_vertex_attributes_, attrib.count, attrib.type,
+                                       attrib.normalised, layout.stride,
+                                       reinterpret_cast<void*>(offset)));
+        enabled_vertex_attributes_++;
+    }
+}
+
+bool RenderContextGL::beginOcclusionQuery(OcclusionQueryHandle handle) {
+    auto it = occlusion_query_map_.find(handle);
+    if (it == occlusion_query_map_.end()) {
+        logger_.error("Occlusion query handle {} invalid.", handle);
+        return false;
+    }
+    auto& data = it->second;
+    GLuint query;
+    if (data.free_queries.empty()) {
+        GL_CHECK(glGenQueries(1, &query));
+    } else {
+        query = data.free_queries.back();
+        data.free_queries.pop_back();
+    }
+    GL_CHECK(glBeginQuery(kOcclusionQueryTarget, query));
+    data.pending_queries.push_back(query);
+    return true;
+}
+
+void RenderContextGL::readOcclusionQueryResults() {
+    for (auto& entry : occlusion_query_map_) {
+        auto& data = entry.second;
+
+        // Queries complete in order, so stop at the first query without a result to avoid
+        // stalling.
+        while (!data.pending_queries.empty()) {
+            GLuint query = data.pending_queries.front();
+            GLuint available = GL_FALSE;
+            GL_CHECK(glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+            if (available == GL_FALSE) {
+                break;
+            }
+            GLuint any_samples_passed = GL_FALSE;
+            GL_CHECK(glGetQueryObjectuiv(query, GL_QUERY_RESULT, &any_samples_passed));
+            setOcclusionQueryResult(entry.first, any_samples_passed != GL_FALSE);
+            data.pending_queries.pop_front();
+            data.free_queries.push_back(query);
+        }
+    }
+}
+
+void RenderContextGL::resolveFrameBuffer(const FrameBufferData& fb_data) {
+    GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, fb_data.msaa_frame_buffer));
+    GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fb_data.frame_buffer));
+
+    // Blit each colour buffer separately, as a blit copies the read buffer to all draw buffers.
+    auto attachment_count = static_cast<GLsizei>(fb_data.textures.size());
+    std::vector<GLenum> draw_buffers(attachment_count, GL_NONE);
+    for (GLsizei i = 0; i < attachment_count; ++i) {
+        draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        GL_CHECK(glReadBuffer(draw_buffers[i]));
+        GL_CHECK(glDrawBuffers(attachment_count, draw_buffers.data()));
+        GL_CHECK(glBlitFramebuffer(0, 0, fb_data.width, fb_data.height, 0, 0, fb_data.width,
+                                   fb_data.height, GL_COLOR_BUFFER_BIT, GL_NEAREST));
+        draw_buffers[i] = GL_NONE;
+    }
+
+    // Restore the draw buffers, and bind the multisampled frame buffer again.
+    for (GLsizei i = 0; i < attachment_count; ++i) {
+        draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    }
+    GL_CHECK(glDrawBuffers(attachment_count, draw_buffers.data()));
+    GL_CHECK(glReadBuffer(GL_COLOR_ATTACHMENT0));
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb_data.msaa_frame_buffer));
+}
+
+void RenderContextGL::invalidateAttachments(const RenderQueue& q, bool colour, bool depth) {
+#if DW_GL_VERSION == DW_GL_410
+    // glInvalidateFramebuffer requires GL 4.3, so the attachments are left as they are.
+    (void)q;
+    (void)colour;
+    (void)depth;
+#elif DW_GL_VERSION == DW_GLES_300
+    std::vector<GLenum> attachments;
+    if (q.frame_buffer) {
+        if (colour) {
+            auto texture_count = frame_buffer_map_.at(*q.frame_buffer).textures.size();
+            for (GLenum i = 0; i < texture_count; ++i) {
+                attachments.emplace_back(GL_COLOR_ATTACHMENT0 + i);
+            }
+        }
+        if (depth) {
+            attachments.emplace_back(GL_DEPTH_STENCIL_ATTACHMENT);
+        }
+    } else {
+        if (colour) {
+            attachments.emplace_back(GL_COLOR);
+        }
+        if (depth) {
+            attachments.emplace_back(GL_DEPTH);
+            attachments.emplace_back(GL_STENCIL);
+        }
+    }
+    if (!attachments.empty()) {
+        GL_CHECK(glInvalidateFramebuffer(GL_FRAMEBUFFER, static_cast<GLsizei>(attachments.size()),
+                                         attachments.data()));
+    }
+#endif
 }
 }  // namespace gfx
 }  // namespace dw
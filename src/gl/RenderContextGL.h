@@ -10,6 +10,11 @@
 
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
 
 namespace dw {
 namespace gfx {
@@ -59,6 +64,7 @@ public:
     bool frame(const Frame* frame) override;
 
     // Command queue walker methods. Executed on the render thread.
+    void operator()(const cmd::CreateVertexLayout& c);
     void operator()(const cmd::CreateVertexBuffer& c);
     void operator()(const cmd::UpdateVertexBuffer& c);
     void operator()(const cmd::DeleteVertexBuffer& c);
@@ -67,10 +73,18 @@ public:
     void operator()(const cmd::DeleteIndexBuffer& c);
     void operator()(const cmd::CreateProgram& c);
     void operator()(const cmd::DeleteProgram& c);
+    void operator()(const cmd::CreateUniformBuffer& c);
+    void operator()(const cmd::UpdateUniformBuffer& c);
+    void operator()(const cmd::DeleteUniformBuffer& c);
+    void operator()(const cmd::CreateStorageBuffer& c);
+    void operator()(const cmd::UpdateStorageBuffer& c);
+    void operator()(const cmd::DeleteStorageBuffer& c);
     void operator()(const cmd::CreateTexture2D& c);
     void operator()(const cmd::DeleteTexture& c);
     void operator()(const cmd::CreateFrameBuffer& c);
     void operator()(const cmd::DeleteFrameBuffer& c);
+    void operator()(const cmd::CreateOcclusionQuery& c);
+    void operator()(const cmd::DeleteOcclusionQuery& c);
     template <typename T> void operator()(const T& c) {
         static_assert(!std::is_same<T, T>::value, "Unimplemented RenderCommand");
     }
@@ -92,31 +106,121 @@ private:
     std::function<void(const Vec2& offset)> on_mouse_scroll_;
 
     GLuint vao_;
-    VertexDecl current_vertex_decl;
+    usize enabled_vertex_attributes_;
+
+    // Uniform blocks which aren't bound to a uniform buffer are written to a ring buffer. The ring
+    // buffer is orphaned at the start of each frame and whenever it fills up, which increments
+    // the generation, so blocks written in an earlier generation are written again.
+    GLuint uniform_ring_buffer_;
+    GLintptr uniform_ring_offset_;
+    u64 uniform_ring_generation_;
+    GLint uniform_buffer_offset_alignment_;
+
+    // Compute entry points. These are only available from GL 4.3, which is newer than the GL
+    // version loaded by glad, so they're loaded separately and are null if the context doesn't
+    // support them.
+    void(GLAD_API_PTR* gl_dispatch_compute_)(GLuint, GLuint, GLuint);
+    void(GLAD_API_PTR* gl_memory_barrier_)(GLbitfield);
+    void(GLAD_API_PTR* gl_bind_image_texture_)(GLuint, GLuint, GLint, GLboolean, GLint, GLenum,
+                                                GLenum);
+
+    // Buffer and texture uploads and shader compiles run on a thread with its own context, which
+    // shares objects with the window's context. Object names are generated on the render thread,
+    // and each upload holds a fence which is signalled once the GL commands issued by the upload
+    // have completed. The render thread waits on the fence when the object is first used.
+    // On the web, uploads run immediately on the render thread instead.
+    using UploadGL = std::shared_future<GLsync>;
+    GLFWwindow* upload_window_;
+    std::thread upload_thread_;
+    std::mutex upload_mutex_;
+    std::condition_variable upload_cv_;
+    std::deque<std::function<void()>> upload_jobs_;
+    bool stop_upload_thread_;
+
+    // Vertex layouts, indexed by id. The attributes of each layout are converted to the arguments
+    // of glVertexAttribPointer when the layout is created.
+    struct VertexLayoutData {
+        struct Attribute {
+            GLint count;
+            GLenum type;
+            GLboolean normalised;
+            uint offset;
+        };
+        GLsizei stride;
+        std::vector<Attribute> attributes;
+    };
+    std::vector<VertexLayoutData> vertex_layouts_;
 
     // Vertex and index buffers.
     struct VertexBufferData {
         GLuint vertex_buffer;
-        VertexDecl decl;
         GLenum usage;
         size_t size;
+        UploadGL upload;
     };
     struct IndexBufferData {
         GLuint element_buffer;
         GLenum type;
         GLenum usage;
         size_t size;
+        UploadGL upload;
     };
     std::unordered_map<VertexBufferHandle, VertexBufferData> vertex_buffer_map_;
     std::unordered_map<IndexBufferHandle, IndexBufferData> index_buffer_map_;
 
+    // Uniform buffers.
+    struct UniformBufferData {
+        GLuint buffer;
+        GLenum usage;
+        size_t size;
+        UploadGL upload;
+    };
+    std::unordered_map<UniformBufferHandle, UniformBufferData> uniform_buffer_map_;
+
+    // Storage buffers.
+    struct StorageBufferData {
+        GLuint buffer;
+        GLenum usage;
+        size_t size;
+        UploadGL upload;
+    };
+    std::unordered_map<StorageBufferHandle, StorageBufferData> storage_buffer_map_;
+
     // Shaders programs.
     struct ProgramData {
         GLuint program;
-        std::unordered_map<std::string, u32> uniform_remap_ids;
         std::unordered_map<u32, u32> binding_location_to_texture_unit;
-        // This is a cache of uniform locations that is built up during rendering.
-        std::unordered_map<std::string, GLint> uniform_location_map;
+        // Uniform blocks, which keep a std140 copy of their contents between items.
+        struct UniformBlock {
+            u32 binding;
+            std::vector<byte> data;
+            bool dirty;
+            // The range of the uniform ring buffer that the block was last written to.
+            GLintptr ring_offset;
+            u64 ring_generation;
+            // Whether each struct layout set on the block matches it.
+            std::unordered_map<const UniformBlockLayout*, bool> checked_layouts;
+        };
+        std::vector<UniformBlock> uniform_blocks;
+        struct Uniform {
+            usize block;
+            usize offset;
+            usize size;
+            // Zero if the uniform isn't an array.
+            usize array_stride;
+        };
+        std::unordered_map<std::string, Uniform> uniforms;
+        // Tables filled in by the upload thread, which getProgram moves into the tables above once
+        // the upload has finished. The upload thread doesn't use the logger, so it keeps the
+        // messages to log as well.
+        struct Reflection {
+            std::unordered_map<u32, u32> binding_location_to_texture_unit;
+            std::vector<UniformBlock> uniform_blocks;
+            std::unordered_map<std::string, Uniform> uniforms;
+            std::vector<std::pair<LogLevel, std::string>> messages;
+        };
+        std::shared_ptr<Reflection> reflection;
+        UploadGL upload;
     };
     std::unordered_map<ProgramHandle, ProgramData> program_map_;
 
@@ -124,6 +228,8 @@ private:
     struct TextureData {
         GLuint texture;
         bool has_mip_maps;
+        GLenum internal_format;
+        UploadGL upload;
     };
     std::unordered_map<TextureHandle, TextureData> texture_map_;
     SamplerCacheGL sampler_cache_;
@@ -131,15 +237,55 @@ private:
     // Frame buffers.
     struct FrameBufferData {
         GLuint frame_buffer;
+        // Only created if the frame buffer doesn't have a depth texture.
         GLuint depth_render_buffer;
         u16 width;
         u16 height;
         std::vector<TextureHandle> textures;
+        // Multisampled frame buffer which is rendered to, then resolved into frame_buffer. Only
+        // used if samples is greater than 1.
+        GLsizei samples;
+        GLuint msaa_frame_buffer;
+        std::vector<GLuint> msaa_render_buffers;
     };
     std::unordered_map<FrameBufferHandle, FrameBufferData> frame_buffer_map_;
 
+    // Occlusion queries. Each time a query is issued it uses a separate query object, which is
+    // reused once its result has been read.
+    struct OcclusionQueryData {
+        std::deque<GLuint> pending_queries;
+        std::vector<GLuint> free_queries;
+    };
+    std::unordered_map<OcclusionQueryHandle, OcclusionQueryData> occlusion_query_map_;
+
+    // Upload helpers.
+    void uploadThread();
+    UploadGL upload(std::function<void()> job);
+    void waitForUpload(UploadGL& upload);
+    void stopUploadThread();
+
+    // Resource lookups. These wait for the resource's upload to complete.
+    VertexBufferData& getVertexBuffer(VertexBufferHandle handle);
+    IndexBufferData& getIndexBuffer(IndexBufferHandle handle);
+    UniformBufferData& getUniformBuffer(UniformBufferHandle handle);
+    StorageBufferData& getStorageBuffer(StorageBufferHandle handle);
+    ProgramData& getProgram(ProgramHandle handle);
+    TextureData& getTexture(TextureHandle handle);
+
     // Helper functions.
-    void setupVertexArrayAttributes(const VertexDecl& decl, uint vb_offset);
+    void setUniform(ProgramData& program_data, const std::string& name, const UniformData& data);
+    void setUniformBlocks(ProgramData& program_data, const Frame& frame, const RenderItem& item);
+    bool checkUniformBlockLayout(ProgramData& program_data, usize block_index,
+                                 const RenderItem::UniformBlockData& entry);
+    void bindUniforms(ProgramData& program_data, const Frame& frame, const RenderItem& item);
+    void orphanUniformRingBuffer();
+    void bindTextures(ProgramData& program_data, const Frame& frame, const RenderItem& item);
+    void dispatchCompute(const Frame& frame, const RenderItem& item);
+    void setupVertexArrayAttributes(const VertexLayoutData& layout, uint vb_offset);
+    bool beginOcclusionQuery(OcclusionQueryHandle handle);
+    void readOcclusionQueryResults();
+    void invalidateAttachments(const RenderQueue& q, bool colour, bool depth);
+    void resolveFrameBuffer(const FrameBufferData& fb_data);
 };
 }  // namespace gfx
 }  // namespace dw
@@ -3,9 +3,12 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "vulkan/RenderContextVK.h"
+#include <algorithm>
 #include <cstring>
 #include <set>
 #include <cstdint>
+#include <iterator>
+#include <limits>
 #include <map>
 
 #include <spirv_cross.hpp>
@@ -103,6 +106,64 @@ const std::unordered_map<BlendFunc, vk::BlendFactor> kBlendFuncMap = {
 const std::array<const char*, 1> kValidationLayers = {"VK_LAYER_KHRONOS_validation"};
 const std::array<const char*, 1> kRequiredDeviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 constexpr auto kMaxFramesInFlight = 2;
+constexpr u32 kMaxOcclusionQueriesPerFrame = 1024;
+// Pipeline stages which access resources written by the upload queue.
+const vk::PipelineStageFlags kUploadWaitStages =
+    vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader |
+    vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader;
+// Pipeline stages and accesses which read or write buffers. Storage buffers can also be used as
+// indirect buffers.
+const vk::PipelineStageFlags kBufferAccessStages =
+    kUploadWaitStages | vk::PipelineStageFlagBits::eDrawIndirect;
+const vk::AccessFlags kBufferAccessMask =
+    vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+    vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead |
+    vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead;
+
+// Pipeline stages which access an image in a layout, used as the source stages of a barrier which
+// moves an image out of the layout, and the destination stages of one which moves it in.
+vk::PipelineStageFlags layoutStages(vk::ImageLayout layout) {
+    switch (layout) {
+        case vk::ImageLayout::eUndefined:
+        case vk::ImageLayout::ePreinitialized:
+            return vk::PipelineStageFlagBits::eTopOfPipe;
+        case vk::ImageLayout::eGeneral:
+            return vk::PipelineStageFlagBits::eComputeShader |
+                   vk::PipelineStageFlagBits::eFragmentShader;
+        case vk::ImageLayout::eColorAttachmentOptimal:
+            return vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        case vk::ImageLayout::eDepthStencilAttachmentOptimal:
+        case vk::ImageLayout::eDepthStencilReadOnlyOptimal:
+            return vk::PipelineStageFlagBits::eEarlyFragmentTests |
+                   vk::PipelineStageFlagBits::eLateFragmentTests;
+        case vk::ImageLayout::eShaderReadOnlyOptimal:
+            return vk::PipelineStageFlagBits::eVertexShader |
+                   vk::PipelineStageFlagBits::eFragmentShader |
+                   vk::PipelineStageFlagBits::eComputeShader;
+        case vk::ImageLayout::eTransferSrcOptimal:
+        case vk::ImageLayout::eTransferDstOptimal:
+            return vk::PipelineStageFlagBits::eTransfer;
+        case vk::ImageLayout::ePresentSrcKHR:
+            return vk::PipelineStageFlagBits::eBottomOfPipe;
+        default:
+            return vk::PipelineStageFlagBits::eAllCommands;
+    }
+}
+
+// Records image layout transitions as a single barrier, which waits for the stages that used each
+// image in its old layout, and blocks the stages that use it in its new layout.
+void recordImageBarriers(vk::CommandBuffer command_buffer,
+                         const std::vector<vk::ImageMemoryBarrier>& barriers) {
+    if (barriers.empty()) {
+        return;
+    }
+    vk::PipelineStageFlags src_stages, dst_stages;
+    for (const auto& barrier : barriers) {
+        src_stages |= layoutStages(barrier.oldLayout);
+        dst_stages |= layoutStages(barrier.newLayout);
+    }
+    command_buffer.pipelineBarrier(src_stages, dst_stages, {}, nullptr, nullptr, barriers);
+}
 
 VKAPI_ATTR VkBool32 VKAPI_CALL
 debugMessageCallback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
@@ -148,6 +209,25 @@ struct QueueFamilyIndices {
     bool isComplete() {
         return graphics_family.has_value() && present_family.has_value();
     }
+
+    // Returns a queue family which only supports transfers, if there is one. These are usually
+    // backed by dedicated copy engines which run alongside the graphics queue.
+    static std::optional<u32> findTransferFamily(vk::PhysicalDevice device) {
+        std::vector<vk::QueueFamilyProperties> queue_families = device.getQueueFamilyProperties();
+        std::optional<u32> transfer_family;
+        for (u32 i = 0; i < queue_families.size(); ++i) {
+            auto flags = queue_families[i].queueFlags;
+            if (!(flags & vk::QueueFlagBits::eTransfer) || (flags & vk::QueueFlagBits::eGraphics)) {
+                continue;
+            }
+            // Prefer a family without compute support, as compute families can be used for
+            // async compute.
+            if (!transfer_family || !(flags & vk::QueueFlagBits::eCompute)) {
+                transfer_family = i;
+            }
+        }
+        return transfer_family;
+    }
 };
 
 struct SwapChainSupportDetails {
@@ -210,16 +290,171 @@ struct VariantToBytesHelper {
     template <typename T> VariantSpan operator()(const T& data) {
         return VariantSpan{reinterpret_cast<const byte*>(&data), sizeof(T)};
     }
+    VariantSpan operator()(const UniformArray& array) {
+        return VariantSpan{array.data.data(), array.data.size()};
+    }
 };
 
+// Descriptor sets are shared between uniform buffer bindings which only differ in their offsets, as
+// the offsets are passed as dynamic offsets instead.
+std::vector<RenderItem::UniformBufferBinding> descriptorUniformBuffers(
+    ArenaView<RenderItem::UniformBufferBinding> view) {
+    std::vector<RenderItem::UniformBufferBinding> bindings{view.begin(), view.end()};
+    for (auto& binding : bindings) {
+        binding.offset = 0;
+    }
+    return bindings;
+}
+
 vk::ShaderStageFlagBits convertShaderStage(ShaderStage stage) {
     static const std::unordered_map<ShaderStage, vk::ShaderStageFlagBits> shader_stage_map = {
         {ShaderStage::Vertex, vk::ShaderStageFlagBits::eVertex},
         {ShaderStage::Geometry, vk::ShaderStageFlagBits::eGeometry},
         {ShaderStage::Fragment, vk::ShaderStageFlagBits::eFragment},
+        {ShaderStage::Compute, vk::ShaderStageFlagBits::eCompute},
     };
     return shader_stage_map.at(stage);
 }
+
+// Load and store ops of the render passes used to create frame buffers and pipelines. Render
+// passes which only differ in their load and store ops are compatible with these.
+constexpr AttachmentOps kDefaultAttachmentOps = {AttachmentLoadOp::Clear, AttachmentStoreOp::Store,
+                                                 AttachmentLoadOp::Clear,
+                                                 AttachmentStoreOp::DontCare};
+
+u32 attachmentOpsKey(const AttachmentOps& ops) {
+    return static_cast<u32>(ops.colour_load) | static_cast<u32>(ops.colour_store) << 2 |
+           static_cast<u32>(ops.depth_load) << 3 | static_cast<u32>(ops.depth_store) << 5;
+}
+
+vk::AttachmentLoadOp convertLoadOp(AttachmentLoadOp op) {
+    switch (op) {
+        case AttachmentLoadOp::Clear:
+            return vk::AttachmentLoadOp::eClear;
+        case AttachmentLoadOp::Load:
+            return vk::AttachmentLoadOp::eLoad;
+        default:
+            return vk::AttachmentLoadOp::eDontCare;
+    }
+}
+
+vk::AttachmentStoreOp convertStoreOp(AttachmentStoreOp op) {
+    return op == AttachmentStoreOp::Store ? vk::AttachmentStoreOp::eStore
+                                          : vk::AttachmentStoreOp::eDontCare;
+}
+
+// Creates a render pass with a single subpass which writes to a number of colour attachments and
+// a depth attachment. Attachments are left in their attachment layout (or colour_layout for colour
+// attachments) at the end of the render pass, and are expected to be in that layout at the start
+// if they're loaded.
+//
+// If multisampled, the subpass renders to multisampled colour attachments, which are resolved into
+// the colour attachments. The multisampled attachments are never loaded or stored, so they can use
+// lazily allocated memory. The attachments are ordered: colour, multisampled colour, depth.
+vk::RenderPass createRenderPass(vk::Device device, const std::vector<vk::Format>& colour_formats,
+                                vk::ImageLayout colour_layout, vk::Format depth_format,
+                                vk::SampleCountFlagBits samples, const AttachmentOps& ops) {
+    bool multisampled = samples != vk::SampleCountFlagBits::e1;
+
+    // Setup colour attachments. If multisampled, these are the resolve attachments, so their
+    // previous contents are never needed.
+    std::vector<vk::AttachmentDescription> attachment_descriptions;
+    std::vector<vk::AttachmentReference> colour_attachment_refs;
+    for (vk::Format format : colour_formats) {
+        vk::AttachmentDescription colour_attachment;
+        colour_attachment.format = format;
+        colour_attachment.samples = vk::SampleCountFlagBits::e1;
+        colour_attachment.loadOp =
+            multisampled ? vk::AttachmentLoadOp::eDontCare : convertLoadOp(ops.colour_load);
+        colour_attachment.storeOp = convertStoreOp(ops.colour_store);
+        colour_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+        colour_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+        colour_attachment.initialLayout =
+            !multisampled && ops.colour_load == AttachmentLoadOp::Load
+                ? colour_layout
+                : vk::ImageLayout::eUndefined;
+        colour_attachment.finalLayout = colour_layout;
+        attachment_descriptions.emplace_back(colour_attachment);
+
+        vk::AttachmentReference colour_attachment_ref;
+        colour_attachment_ref.attachment = attachment_descriptions.size() - 1;
+        colour_attachment_ref.layout = vk::ImageLayout::eColorAttachmentOptimal;
+        colour_attachment_refs.emplace_back(colour_attachment_ref);
+    }
+
+    // Setup multisampled colour attachments.
+    std::vector<vk::AttachmentReference> msaa_attachment_refs;
+    if (multisampled) {
+        for (vk::Format format : colour_formats) {
+            vk::AttachmentDescription msaa_attachment;
+            msaa_attachment.format = format;
+            msaa_attachment.samples = samples;
+            msaa_attachment.loadOp = ops.colour_load == AttachmentLoadOp::Clear
+                                         ? vk::AttachmentLoadOp::eClear
+                                         : vk::AttachmentLoadOp::eDontCare;
+            msaa_attachment.storeOp = vk::AttachmentStoreOp::eDontCare;
+            msaa_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+            msaa_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+            msaa_attachment.initialLayout = vk::ImageLayout::eUndefined;
+            msaa_attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+            attachment_descriptions.emplace_back(msaa_attachment);
+
+            vk::AttachmentReference msaa_attachment_ref;
+            msaa_attachment_ref.attachment = attachment_descriptions.size() - 1;
+            msaa_attachment_ref.layout = vk::ImageLayout::eColorAttachmentOptimal;
+            msaa_attachment_refs.emplace_back(msaa_attachment_ref);
+        }
+    }
+
+    // Depth attachment.
+    vk::AttachmentDescription depth_attachment;
+    depth_attachment.format = depth_format;
+    depth_attachment.samples = samples;
+    depth_attachment.loadOp = convertLoadOp(ops.depth_load);
+    depth_attachment.storeOp = convertStoreOp(ops.depth_store);
+    depth_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    depth_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    depth_attachment.initialLayout = ops.depth_load == AttachmentLoadOp::Load
+                                         ? vk::ImageLayout::eDepthStencilAttachmentOptimal
+                                         : vk::ImageLayout::eUndefined;
+    depth_attachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    attachment_descriptions.emplace_back(depth_attachment);
+
+    vk::AttachmentReference depth_attachment_ref;
+    depth_attachment_ref.attachment = attachment_descriptions.size() - 1;
+    depth_attachment_ref.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+    // Subpass.
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    if (multisampled) {
+        subpass.colorAttachmentCount = msaa_attachment_refs.size();
+        subpass.pColorAttachments = msaa_attachment_refs.data();
+        subpass.pResolveAttachments = colour_attachment_refs.data();
+    } else {
+        subpass.colorAttachmentCount = colour_attachment_refs.size();
+        subpass.pColorAttachments = colour_attachment_refs.data();
+    }
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+    vk::SubpassDependency dependency;
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    dependency.srcAccessMask = {};
+    dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    dependency.dstAccessMask =
+        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+
+    vk::RenderPassCreateInfo render_pass_info;
+    render_pass_info.attachmentCount = attachment_descriptions.size();
+    render_pass_info.pAttachments = attachment_descriptions.data();
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = 1;
+    render_pass_info.pDependencies = &dependency;
+    return device.createRenderPass(render_pass_info);
+}
 }  // namespace
 
 DeviceVK::DeviceVK(vk::PhysicalDevice physical_device, vk::Device device,
@@ -260,6 +495,17 @@ u32 DeviceVK::findMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties
     throw std::runtime_error("failed to find a suitable memory type.");
 }
 
+bool DeviceVK::hasMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties) {
+    auto mem_properties = physical_device_.getMemoryProperties();
+    for (u32 i = 0; i < mem_properties.memoryTypeCount; i++) {
+        if ((type_filter & (1u << i)) &&
+            (mem_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return true;
+        }
+    }
+    return false;
+}
+
 vk::DeviceSize DeviceVK::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
                                       vk::MemoryPropertyFlags properties, vk::Buffer& buffer,
                                       vk::DeviceMemory& buffer_memory) {
@@ -280,16 +526,6 @@ vk::DeviceSize DeviceVK::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags
     return mem_requirements.size;
 }
 
-void DeviceVK::copyBuffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size) {
-    vk::CommandBuffer command_buffer = beginSingleUseCommands();
-
-    vk::BufferCopy copyRegion;
-    copyRegion.size = size;
-    command_buffer.copyBuffer(src_buffer, dst_buffer, copyRegion);
-
-    endSingleUseCommands(command_buffer);
-}
-
 void DeviceVK::copyBufferToImage(vk::Buffer buffer, vk::Image image, u32 width, u32 height) {
     vk::CommandBuffer command_buffer = beginSingleUseCommands();
 
@@ -355,7 +591,8 @@ void DeviceVK::transitionImageLayout(vk::Image image, vk::Format format, vk::Ima
 
 void DeviceVK::createImage(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling,
                            vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties,
-                           vk::Image& image, vk::DeviceMemory& image_memory) {
+                           vk::Image& image, vk::DeviceMemory& image_memory,
+                           vk::SampleCountFlagBits samples) {
     vk::ImageCreateInfo image_info;
     image_info.imageType = vk::ImageType::e2D;
     image_info.extent.width = width;
@@ -368,10 +605,14 @@ void DeviceVK::createImage(u32 width, u32 height, vk::Format format, vk::ImageTi
     image_info.initialLayout = vk::ImageLayout::eUndefined;
     image_info.usage = usage;
     image_info.sharingMode = vk::SharingMode::eExclusive;
-    image_info.samples = vk::SampleCountFlagBits::e1;
+    image_info.samples = samples;
     image = device_.createImage(image_info);
 
     vk::MemoryRequirements mem_requirements = device_.getImageMemoryRequirements(image);
+    if ((properties & vk::MemoryPropertyFlagBits::eLazilyAllocated) &&
+        !hasMemoryType(mem_requirements.memoryTypeBits, properties)) {
+        properties &= ~vk::MemoryPropertyFlags{vk::MemoryPropertyFlagBits::eLazilyAllocated};
+    }
     vk::MemoryAllocateInfo alloc_info;
     alloc_info.allocationSize = mem_requirements.size;
     alloc_info.memoryTypeIndex = findMemoryType(mem_requirements.memoryTypeBits, properties);
@@ -431,44 +672,445 @@ const vk::PhysicalDeviceProperties& DeviceVK::properties() {
     return properties_;
 }
 
-BufferVK::BufferVK(DeviceVK* device, const byte* data, vk::DeviceSize size, BufferUsage usage,
-                   vk::BufferUsageFlags buffer_type, usize swap_chain_size)
-    : device(device), size(size), usage(usage) {
-    if (usage == BufferUsage::Static) {
-        // Static memory uses a staging buffer to upload static vertex data to device local memory.
+UploadQueueVK::UploadQueueVK(DeviceVK* device, vk::Queue queue, u32 queue_family_index,
+                             u32 graphics_queue_family_index)
+    : device_(device),
+      queue_(queue),
+      queue_family_index_(queue_family_index),
+      graphics_queue_family_index_(graphics_queue_family_index),
+      stop_(false),
+      recording_(false) {
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.queueFamilyIndex = queue_family_index_;
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    command_pool_ = device_->getDevice().createCommandPool(pool_info);
+
+    thread_ = std::thread{&UploadQueueVK::run, this};
+}
+
+UploadQueueVK::~UploadQueueVK() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+
+    // Batches which were never submitted are freed along with the submitted batches.
+    submissions_.emplace_back(Submission{vk::Fence{}, std::move(recorded_batches_)});
+    releaseSubmissions(true);
+    device_->getDevice().destroy(command_pool_);
+}
+
+void UploadQueueVK::uploadBuffer(vk::Buffer buffer, Memory data) {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        pending_uploads_.emplace_back(
+            Upload{buffer, vk::Image{}, 0, 0, data.size(), std::move(data)});
+    }
+    cv_.notify_all();
+}
+
+void UploadQueueVK::uploadImage(vk::Image image, u32 width, u32 height, vk::DeviceSize size,
+                                Memory data) {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        pending_uploads_.emplace_back(
+            Upload{vk::Buffer{}, image, width, height, size, std::move(data)});
+    }
+    cv_.notify_all();
+}
+
+std::optional<vk::Semaphore> UploadQueueVK::submit(vk::CommandBuffer graphics_command_buffer) {
+    std::vector<Batch> batches;
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        cv_.wait(lock, [this]() { return pending_uploads_.empty() && !recording_; });
+        batches = std::move(recorded_batches_);
+        recorded_batches_.clear();
+    }
+    if (batches.empty()) {
+        return std::nullopt;
+    }
+
+    vk::Device device = device_->getDevice();
+    std::vector<vk::CommandBuffer> command_buffers;
+    std::vector<vk::BufferMemoryBarrier> buffer_barriers;
+    std::vector<vk::ImageMemoryBarrier> image_barriers;
+    for (const auto& batch : batches) {
+        command_buffers.emplace_back(batch.command_buffer);
+        buffer_barriers.insert(buffer_barriers.end(), batch.buffer_acquire_barriers.begin(),
+                               batch.buffer_acquire_barriers.end());
+        image_barriers.insert(image_barriers.end(), batch.image_acquire_barriers.begin(),
+                              batch.image_acquire_barriers.end());
+    }
+
+    vk::Semaphore semaphore = device.createSemaphore(vk::SemaphoreCreateInfo{});
+    vk::Fence fence = device.createFence(vk::FenceCreateInfo{});
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = static_cast<u32>(command_buffers.size());
+    submit_info.pCommandBuffers = command_buffers.data();
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &semaphore;
+    queue_.submit(submit_info, fence);
+
+    // The graphics queue waits on the semaphore in the stages which read uploaded resources, so
+    // the acquire barriers start from the same stages.
+    if (!buffer_barriers.empty() || !image_barriers.empty()) {
+        graphics_command_buffer.pipelineBarrier(kUploadWaitStages, kUploadWaitStages, {}, nullptr,
+                                                buffer_barriers, image_barriers);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        submissions_.emplace_back(Submission{fence, std::move(batches)});
+    }
+    return semaphore;
+}
+
+void UploadQueueVK::run() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+        cv_.wait(lock, [this]() { return stop_ || !pending_uploads_.empty(); });
+        if (stop_) {
+            return;
+        }
+        std::vector<Upload> uploads = std::move(pending_uploads_);
+        pending_uploads_.clear();
+        recording_ = true;
+        lock.unlock();
+
+        releaseSubmissions(false);
+        Batch batch = record(uploads);
+
+        lock.lock();
+        recorded_batches_.emplace_back(std::move(batch));
+        recording_ = false;
+        cv_.notify_all();
+    }
+}
+
+UploadQueueVK::Batch UploadQueueVK::record(const std::vector<Upload>& uploads) {
+    vk::Device device = device_->getDevice();
+    bool transfer_ownership = queue_family_index_ != graphics_queue_family_index_;
+    u32 src_queue_family = transfer_ownership ? queue_family_index_ : VK_QUEUE_FAMILY_IGNORED;
+    u32 dst_queue_family =
+        transfer_ownership ? graphics_queue_family_index_ : VK_QUEUE_FAMILY_IGNORED;
+
+    Batch batch;
+    vk::CommandBufferAllocateInfo alloc_info;
+    alloc_info.level = vk::CommandBufferLevel::ePrimary;
+    alloc_info.commandPool = command_pool_;
+    alloc_info.commandBufferCount = 1;
+    batch.command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    batch.command_buffer.begin(begin_info);
+
+    std::vector<vk::BufferMemoryBarrier> buffer_release_barriers;
+    std::vector<vk::ImageMemoryBarrier> image_release_barriers;
+    for (const auto& upload : uploads) {
+        // Fill a staging buffer.
         vk::Buffer staging_buffer;
         vk::DeviceMemory staging_buffer_memory;
-        device->createBuffer(
-            size, vk::BufferUsageFlagBits::eTransferSrc,
+        device_->createBuffer(
+            upload.size, vk::BufferUsageFlagBits::eTransferSrc,
             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
             staging_buffer, staging_buffer_memory);
+        void* mapped_data = device.mapMemory(staging_buffer_memory, 0, upload.size);
+        memcpy(mapped_data, upload.data.data(),
+               std::min(upload.data.size(), static_cast<usize>(upload.size)));
+        device.unmapMemory(staging_buffer_memory);
+        batch.staging_buffers.emplace_back(staging_buffer);
+        batch.staging_buffer_memory.emplace_back(staging_buffer_memory);
+
+        if (upload.buffer) {
+            vk::BufferCopy region;
+            region.size = upload.size;
+            batch.command_buffer.copyBuffer(staging_buffer, upload.buffer, region);
+
+            vk::BufferMemoryBarrier barrier;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.srcQueueFamilyIndex = src_queue_family;
+            barrier.dstQueueFamilyIndex = dst_queue_family;
+            barrier.buffer = upload.buffer;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+            if (transfer_ownership) {
+                buffer_release_barriers.emplace_back(barrier);
+                // The buffer may also be bound as a uniform or storage buffer.
+                barrier.srcAccessMask = {};
+                barrier.dstAccessMask =
+                    vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                    vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead |
+                    vk::AccessFlagBits::eShaderWrite;
+                batch.buffer_acquire_barriers.emplace_back(barrier);
+            }
+        } else {
+            vk::ImageMemoryBarrier barrier;
+            barrier.oldLayout = vk::ImageLayout::eUndefined;
+            barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = upload.image;
+            barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount = 1;
+            batch.command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                                 vk::PipelineStageFlagBits::eTransfer, {}, nullptr,
+                                                 nullptr, barrier);
+
+            vk::BufferImageCopy region;
+            region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+            region.imageSubresource.mipLevel = 0;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent = vk::Extent3D{upload.width, upload.height, 1};
+            batch.command_buffer.copyBufferToImage(staging_buffer, upload.image,
+                                                   vk::ImageLayout::eTransferDstOptimal, region);
+
+            // Move the image to the layout it's sampled in. If ownership is transferred, this is
+            // done by the release and acquire barriers.
+            barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+            barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.dstAccessMask = {};
+            barrier.srcQueueFamilyIndex = src_queue_family;
+            barrier.dstQueueFamilyIndex = dst_queue_family;
+            image_release_barriers.emplace_back(barrier);
+            if (transfer_ownership) {
+                barrier.srcAccessMask = {};
+                barrier.dstAccessMask =
+                    vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+                batch.image_acquire_barriers.emplace_back(barrier);
+            }
+        }
+    }
+    if (!buffer_release_barriers.empty() || !image_release_barriers.empty()) {
+        batch.command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {},
+            nullptr, buffer_release_barriers, image_release_barriers);
+    }
 
-        void* mapped_data = device->getDevice().mapMemory(staging_buffer_memory, 0, size);
-        memcpy(mapped_data, data, static_cast<std::size_t>(size));
-        device->getDevice().unmapMemory(staging_buffer_memory);
+    batch.command_buffer.end();
+    return batch;
+}
 
-        // Copy staging data into buffers.
+void UploadQueueVK::releaseSubmissions(bool wait) {
+    vk::Device device = device_->getDevice();
+    std::vector<Submission> completed;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto it = std::partition(
+            submissions_.begin(), submissions_.end(), [wait, device](const Submission& s) {
+                return !wait && s.fence && device.getFenceStatus(s.fence) != vk::Result::eSuccess;
+            });
+        std::move(it, submissions_.end(), std::back_inserter(completed));
+        submissions_.erase(it, submissions_.end());
+    }
+    for (auto& submission : completed) {
+        if (submission.fence) {
+            if (wait) {
+                device.waitForFences(submission.fence, VK_TRUE, UINT64_MAX);
+            }
+            device.destroy(submission.fence);
+        }
+        for (auto& batch : submission.batches) {
+            device.freeCommandBuffers(command_pool_, batch.command_buffer);
+            for (usize i = 0; i < batch.staging_buffers.size(); ++i) {
+                device.destroy(batch.staging_buffers[i]);
+                device.free(batch.staging_buffer_memory[i]);
+            }
+        }
+    }
+}
+
+StagingRingVK::StagingRingVK(DeviceVK* device, vk::DeviceSize page_size)
+    : device_(device), page_size_(page_size) {
+}
+
+StagingRingVK::~StagingRingVK() {
+    for (const auto& page : current_pages_) {
+        destroyPage(page);
+    }
+    for (const auto& page : submitted_pages_) {
+        destroyPage(page);
+    }
+    for (const auto& page : free_pages_) {
+        destroyPage(page);
+    }
+}
+
+void StagingRingVK::upload(vk::Buffer buffer, const byte* data, vk::DeviceSize size,
+                           vk::DeviceSize offset) {
+    if (size == 0) {
+        return;
+    }
+
+    // Find a page with enough space left, otherwise start a new one.
+    auto page = std::find_if(current_pages_.begin(), current_pages_.end(),
+                             [size](const Page& p) { return p.size - p.used >= size; });
+    if (page == current_pages_.end()) {
+        current_pages_.emplace_back(allocatePage(size));
+        page = current_pages_.end() - 1;
+    }
+    vk::DeviceSize src_offset = page->used;
+    memcpy(page->data + usize(src_offset), data, usize(size));
+    page->used += size;
+
+    vk::BufferCopy region;
+    region.srcOffset = src_offset;
+    region.dstOffset = offset;
+    region.size = size;
+    pending_copies_.emplace_back(Copy{page->buffer, buffer, region});
+}
+
+void StagingRingVK::record(vk::CommandBuffer command_buffer, u64 frame) {
+    if (pending_copies_.empty()) {
+        return;
+    }
+
+    // Earlier frames may still be reading the buffers, or writing them from a shader.
+    std::vector<vk::BufferMemoryBarrier> barriers;
+    for (const auto& copy : pending_copies_) {
+        auto existing = std::find_if(
+            barriers.begin(), barriers.end(),
+            [&copy](const vk::BufferMemoryBarrier& b) { return b.buffer == copy.dst; });
+        if (existing != barriers.end()) {
+            continue;
+        }
+        vk::BufferMemoryBarrier barrier;
+        barrier.srcAccessMask = kBufferAccessMask;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = copy.dst;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        barriers.emplace_back(barrier);
+    }
+    command_buffer.pipelineBarrier(kBufferAccessStages, vk::PipelineStageFlagBits::eTransfer, {},
+                                   nullptr, barriers, nullptr);
+
+    // Copies aren't ordered with respect to each other, so later updates to a range which is
+    // already being written in this batch wait for the earlier copy.
+    std::vector<const Copy*> batch;
+    for (const auto& copy : pending_copies_) {
+        bool overlaps = std::any_of(batch.begin(), batch.end(), [&copy](const Copy* other) {
+            return other->dst == copy.dst &&
+                   other->region.dstOffset < copy.region.dstOffset + copy.region.size &&
+                   copy.region.dstOffset < other->region.dstOffset + other->region.size;
+        });
+        if (overlaps) {
+            vk::MemoryBarrier barrier;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+            command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                           vk::PipelineStageFlagBits::eTransfer, {}, barrier,
+                                           nullptr, nullptr);
+            batch.clear();
+        }
+        command_buffer.copyBuffer(copy.src, copy.dst, copy.region);
+        batch.emplace_back(&copy);
+    }
+
+    // Make the new contents visible to the rest of the frame.
+    for (auto& barrier : barriers) {
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = kBufferAccessMask;
+    }
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, kBufferAccessStages, {},
+                                   nullptr, barriers, nullptr);
+    pending_copies_.clear();
+
+    for (auto& page : current_pages_) {
+        page.frame = frame;
+        submitted_pages_.emplace_back(page);
+    }
+    current_pages_.clear();
+}
+
+void StagingRingVK::release(u64 completed_frame) {
+    while (!submitted_pages_.empty() && submitted_pages_.front().frame <= completed_frame) {
+        Page page = submitted_pages_.front();
+        submitted_pages_.pop_front();
+        // Pages made for large updates aren't kept.
+        if (page.size > page_size_) {
+            destroyPage(page);
+        } else {
+            page.used = 0;
+            free_pages_.emplace_back(page);
+        }
+    }
+}
+
+StagingRingVK::Page StagingRingVK::allocatePage(vk::DeviceSize min_size) {
+    if (min_size <= page_size_ && !free_pages_.empty()) {
+        Page page = free_pages_.back();
+        free_pages_.pop_back();
+        return page;
+    }
+    Page page;
+    page.size = std::max(min_size, page_size_);
+    page.used = 0;
+    page.frame = 0;
+    device_->createBuffer(
+        page.size, vk::BufferUsageFlagBits::eTransferSrc,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        page.buffer, page.memory);
+    page.data =
+        reinterpret_cast<byte*>(device_->getDevice().mapMemory(page.memory, 0, page.size));
+    return page;
+}
+
+void StagingRingVK::destroyPage(const Page& page) {
+    device_->getDevice().unmapMemory(page.memory);
+    device_->getDevice().destroy(page.buffer);
+    device_->getDevice().free(page.memory);
+}
+
+BufferVK::BufferVK(DeviceVK* device, UploadQueueVK* upload_queue, StagingRingVK* staging_ring,
+                   const Memory& data, vk::DeviceSize size, BufferUsage usage,
+                   vk::BufferUsageFlags buffer_type, usize swap_chain_size)
+    : device(device), size(size), usage(usage), staging_ring(staging_ring) {
+    if (usage == BufferUsage::Static || usage == BufferUsage::Dynamic) {
+        // Static and dynamic memory is stored in device local memory, and written through a
+        // staging buffer. Static buffers are never written again, so they can be uploaded in the
+        // background. Dynamic buffers are written through the staging ring, so that later
+        // updates are ordered after the initial contents.
         buffer.resize(1);
         buffer_memory.resize(1);
         device->createBuffer(size, vk::BufferUsageFlagBits::eTransferDst | buffer_type,
                              vk::MemoryPropertyFlagBits::eDeviceLocal, buffer[0], buffer_memory[0]);
-        device->copyBuffer(staging_buffer, buffer[0], size);
-
-        device->getDevice().destroy(staging_buffer);
-        device->getDevice().free(staging_buffer_memory);
+        if (data.data()) {
+            if (usage == BufferUsage::Static) {
+                upload_queue->uploadBuffer(buffer[0], data);
+            } else {
+                staging_ring->upload(buffer[0], data.data(),
+                                     std::min(vk::DeviceSize(data.size()), size), 0);
+            }
+        }
     } else if (usage == BufferUsage::Stream) {
-        // Streaming buffers are stored as host coherent buffers.
+        // Streaming buffers are stored as host coherent buffers, with one copy per frame.
         buffer.resize(swap_chain_size);
         buffer_memory.resize(swap_chain_size);
+        stream_data.resize(usize(size));
+        stale_ranges.resize(swap_chain_size, {0, 0});
+        if (data.data()) {
+            memcpy(stream_data.data(), data.data(), std::min(data.size(), usize(size)));
+        }
         for (usize i = 0; i < swap_chain_size; ++i) {
             device->createBuffer(size, buffer_type,
                                  vk::MemoryPropertyFlagBits::eHostVisible |
                                      vk::MemoryPropertyFlagBits::eHostCoherent,
                                  buffer[i], buffer_memory[i]);
-
-            void* mapped_data = device->getDevice().mapMemory(buffer_memory[i], 0, size);
-            memcpy(mapped_data, data, usize(size));
-            device->getDevice().unmapMemory(buffer_memory[i]);
+            if (data.data()) {
+                write(static_cast<u32>(i), stream_data.data(), size, 0);
+            }
         }
     }
 }
@@ -482,16 +1124,21 @@ BufferVK::~BufferVK() {
 }
 
 BufferVK::BufferVK(BufferVK&& other) noexcept
-    : device(other.device), size(other.size), usage(other.usage) {
+    : device(other.device), size(other.size), usage(other.usage), staging_ring(other.staging_ring) {
     std::swap(buffer, other.buffer);
     std::swap(buffer_memory, other.buffer_memory);
+    std::swap(stream_data, other.stream_data);
+    std::swap(stale_ranges, other.stale_ranges);
 }
 
 BufferVK& BufferVK::operator=(BufferVK&& other) noexcept {
     device = other.device;
     size = other.size;
+    staging_ring = other.staging_ring;
     std::swap(buffer, other.buffer);
     std::swap(buffer_memory, other.buffer_memory);
+    std::swap(stream_data, other.stream_data);
+    std::swap(stale_ranges, other.stale_ranges);
     usage = other.usage;
     return *this;
 }
@@ -507,21 +1154,67 @@ bool BufferVK::update(u32 frame_index, const byte* data, vk::DeviceSize data_siz
             return false;
 
         case BufferUsage::Dynamic:
-            // TODO: Not implemented.
+            if (offset + data_size > size) {
+                return false;
+            }
+            staging_ring->upload(buffer[0], data, data_size, offset);
             return true;
 
         case BufferUsage::Stream: {
-            const auto& current_buffer_memory = buffer_memory[getIndex(frame_index)];
-            void* mapped_data = device->getDevice().mapMemory(current_buffer_memory, usize(offset),
-                                                              usize(data_size));
-            memcpy(mapped_data, data + usize(offset), usize(data_size));
-            device->getDevice().unmapMemory(current_buffer_memory);
+            if (offset + data_size > size) {
+                return false;
+            }
+            u32 index = getIndex(frame_index);
+            vk::DeviceSize end = offset + data_size;
+
+            // Bring this frame's copy up to date, unless the update overwrites the stale range.
+            auto& stale_range = stale_ranges[index];
+            if (stale_range.first < offset || stale_range.second > end) {
+                sync(frame_index);
+            }
+            stale_range = {0, 0};
+
+            // Write this frame's copy. The other copies may still be in use by frames in flight,
+            // so they're written when they're next used.
+            memcpy(stream_data.data() + usize(offset), data, usize(data_size));
+            write(index, data, data_size, offset);
+            for (u32 i = 0; i < stale_ranges.size(); ++i) {
+                if (i == index) {
+                    continue;
+                }
+                auto& range = stale_ranges[i];
+                if (range.first == range.second) {
+                    range = {offset, end};
+                } else {
+                    range = {std::min(range.first, offset), std::max(range.second, end)};
+                }
+            }
             return true;
         }
     }
     return false;
 }
 
+void BufferVK::sync(u32 frame_index) {
+    if (usage != BufferUsage::Stream) {
+        return;
+    }
+    u32 index = getIndex(frame_index);
+    auto& stale_range = stale_ranges[index];
+    if (stale_range.first != stale_range.second) {
+        write(index, stream_data.data() + usize(stale_range.first),
+              stale_range.second - stale_range.first, stale_range.first);
+        stale_range = {0, 0};
+    }
+}
+
+void BufferVK::write(u32 index, const byte* data, vk::DeviceSize data_size,
+                     vk::DeviceSize offset) {
+    void* mapped_data = device->getDevice().mapMemory(buffer_memory[index], offset, data_size);
+    memcpy(mapped_data, data, usize(data_size));
+    device->getDevice().unmapMemory(buffer_memory[index]);
+}
+
 u32 BufferVK::getIndex(u32 frame_index) const {
     if (buffer.size() == 1) {
         return 0;
@@ -598,9 +1291,16 @@ vk::Format VertexDeclVK::getVertexAttributeFormat(VertexDecl::AttributeType type
                     static_cast<int>(type), count, normalised));
 }
 
+void ProgramVK::destroy(vk::Device device) const {
+    device.destroy(descriptor_set_layout);
+    for (const auto& stage : stages) {
+        device.destroy(stage.second.module);
+    }
+}
+
 UniformScratchBuffer::UniformScratchBuffer(
     DeviceVK* device /*, vk::DescriptorPool descriptor_pool*/, usize size)
-    : device_(device), current_size_(0) {
+    : device_(device), current_size_(0), generation_(0) {
     maximum_size_ = device_->createBuffer(
         size, vk::BufferUsageFlagBits::eUniformBuffer,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
@@ -627,6 +1327,11 @@ UniformScratchBuffer::Allocation UniformScratchBuffer::alloc(usize size) {
 
 void UniformScratchBuffer::reset() {
     current_size_ = 0;
+    ++generation_;
+}
+
+u64 UniformScratchBuffer::generation() const {
+    return generation_;
 }
 
 vk::Buffer UniformScratchBuffer::getBuffer() const {
@@ -634,8 +1339,15 @@ vk::Buffer UniformScratchBuffer::getBuffer() const {
 }
 
 void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayout new_layout) {
+    auto imb = transitionLayout(new_layout);
+    if (imb) {
+        recordImageBarriers(command_buffer, {*imb});
+    }
+}
+
+std::optional<vk::ImageMemoryBarrier> TextureVK::transitionLayout(vk::ImageLayout new_layout) {
     if (new_layout == image_layout) {
-        return;
+        return std::nullopt;
     }
 
     vk::AccessFlags src_access_mask = {};
@@ -645,6 +1357,7 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
         case vk::ImageLayout::eUndefined:
             break;
         case vk::ImageLayout::eGeneral:
+            src_access_mask |= vk::AccessFlagBits::eShaderWrite;
             break;
         case vk::ImageLayout::eColorAttachmentOptimal:
             src_access_mask |= vk::AccessFlagBits::eColorAttachmentWrite;
@@ -661,6 +1374,7 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
             src_access_mask |= vk::AccessFlagBits::eTransferRead;
             break;
         case vk::ImageLayout::eTransferDstOptimal:
+            src_access_mask |= vk::AccessFlagBits::eTransferWrite;
             break;
         case vk::ImageLayout::ePreinitialized:
             src_access_mask |= vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eTransferWrite;
@@ -676,25 +1390,30 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
         case vk::ImageLayout::eUndefined:
             break;
         case vk::ImageLayout::eGeneral:
+            dst_access_mask |= vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
             break;
         case vk::ImageLayout::eColorAttachmentOptimal:
-            dst_access_mask |= vk::AccessFlagBits::eColorAttachmentWrite;
+            // Attachments are read when they're loaded or blended.
+            dst_access_mask |= vk::AccessFlagBits::eColorAttachmentRead |
+                               vk::AccessFlagBits::eColorAttachmentWrite;
             break;
         case vk::ImageLayout::eDepthStencilAttachmentOptimal:
-            dst_access_mask |= vk::AccessFlagBits::eDepthStencilAttachmentWrite;
-            // aspectMask     = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+            dst_access_mask |= vk::AccessFlagBits::eDepthStencilAttachmentRead |
+                               vk::AccessFlagBits::eDepthStencilAttachmentWrite;
             break;
         case vk::ImageLayout::eDepthStencilReadOnlyOptimal:
+            dst_access_mask |=
+                vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eShaderRead;
             break;
         case vk::ImageLayout::eShaderReadOnlyOptimal:
             dst_access_mask |=
                 vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eInputAttachmentRead;
             break;
         case vk::ImageLayout::eTransferSrcOptimal:
-            dst_access_mask |= vk::AccessFlagBits::eShaderRead;
+            dst_access_mask |= vk::AccessFlagBits::eTransferRead;
             break;
         case vk::ImageLayout::eTransferDstOptimal:
-            dst_access_mask |= vk::AccessFlagBits::eTransferRead;
+            dst_access_mask |= vk::AccessFlagBits::eTransferWrite;
             break;
         case vk::ImageLayout::ePreinitialized:
             break;
@@ -718,91 +1437,70 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
     imb.subresourceRange.levelCount = 1;
     imb.subresourceRange.baseArrayLayer = 0;
     imb.subresourceRange.layerCount = 1;
-    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
-                                   vk::PipelineStageFlagBits::eAllCommands, {}, {}, {}, imb);
-
-    image_layout = new_layout;
-}
-
-FramebufferVK::FramebufferVK(DeviceVK* device, u16 width, u16 height,
-                             std::vector<TextureVK*> attachments)
-    : extent(width, height), images(std::move(attachments)) {
-    // Create depth image.
-    auto depth_image_format = vk::Format::eD32Sfloat;
-    device->createImage(width, height, depth_image_format, vk::ImageTiling::eOptimal,
-                        vk::ImageUsageFlagBits::eDepthStencilAttachment,
-                        vk::MemoryPropertyFlagBits::eDeviceLocal, depth.image, depth.image_memory);
-    depth.image_view =
-        device->createImageView(depth.image, depth_image_format, vk::ImageAspectFlagBits::eDepth);
 
-    // Create render pass.
-    std::vector<vk::ImageView> image_views;
-
-    // Setup colour attachments.
-    std::vector<vk::AttachmentDescription> attachment_descriptions;
-    std::vector<vk::AttachmentReference> colour_attachment_refs;
-    for (TextureVK* attachment : images) {
-        vk::AttachmentDescription colour_attachment;
-        colour_attachment.format = attachment->image_format;
-        colour_attachment.samples = vk::SampleCountFlagBits::e1;
-        colour_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-        colour_attachment.storeOp = vk::AttachmentStoreOp::eStore;
-        colour_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-        colour_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-        colour_attachment.initialLayout = vk::ImageLayout::eUndefined;
-        colour_attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
-        attachment_descriptions.emplace_back(colour_attachment);
-
-        vk::AttachmentReference colour_attachment_ref;
-        colour_attachment_ref.attachment = attachment_descriptions.size() - 1;
-        colour_attachment_ref.layout = vk::ImageLayout::eColorAttachmentOptimal;
-        colour_attachment_refs.emplace_back(colour_attachment_ref);
-
-        image_views.emplace_back(attachment->image_view);
-    }
-
-    // Depth attachment.
-    vk::AttachmentDescription depth_attachment;
-    depth_attachment.format = depth_image_format;
-    depth_attachment.samples = vk::SampleCountFlagBits::e1;
-    depth_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-    depth_attachment.storeOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    depth_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    depth_attachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-    attachment_descriptions.emplace_back(depth_attachment);
-
-    vk::AttachmentReference depth_attachment_ref;
-    depth_attachment_ref.attachment = attachment_descriptions.size() - 1;
-    depth_attachment_ref.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-
-    image_views.emplace_back(depth.image_view);
-
-    // Subpass.
-    vk::SubpassDescription subpass;
-    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-    subpass.colorAttachmentCount = colour_attachment_refs.size();
-    subpass.pColorAttachments = colour_attachment_refs.data();
-    subpass.pDepthStencilAttachment = &depth_attachment_ref;
-
-    vk::SubpassDependency dependency;
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.srcAccessMask = {};
-    dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.dstAccessMask =
-        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+    image_layout = new_layout;
+    return imb;
+}
 
-    vk::RenderPassCreateInfo render_pass_info;
-    render_pass_info.attachmentCount = attachment_descriptions.size();
-    render_pass_info.pAttachments = attachment_descriptions.data();
-    render_pass_info.subpassCount = 1;
-    render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
-    render_pass = device->getDevice().createRenderPass(render_pass_info);
+void TextureVK::destroy(vk::Device device) const {
+    device.destroy(image_view);
+    device.destroy(image);
+    device.free(image_memory);
+}
+
+FramebufferVK::FramebufferVK(DeviceVK* device, u16 width, u16 height,
+                             std::vector<TextureVK*> attachments, TextureVK* depth_texture,
+                             vk::SampleCountFlagBits samples)
+    : depth_texture(depth_texture),
+      samples(samples),
+      images(std::move(attachments)),
+      extent(width, height) {
+    // Create depth image, unless a depth texture was provided.
+    if (depth_texture) {
+        depth_format = depth_texture->image_format;
+    } else {
+        depth_format = vk::Format::eD32Sfloat;
+        device->createImage(width, height, depth_format, vk::ImageTiling::eOptimal,
+                            vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                            vk::MemoryPropertyFlagBits::eDeviceLocal, depth.image,
+                            depth.image_memory, samples);
+        depth.image_view =
+            device->createImageView(depth.image, depth_format, vk::ImageAspectFlagBits::eDepth);
+        depth.aspect_mask = vk::ImageAspectFlagBits::eDepth;
+    }
+    depth.image_layout = vk::ImageLayout::eUndefined;
+
+    // Create render pass.
+    std::vector<vk::Format> colour_formats;
+    std::vector<vk::ImageView> image_views;
+    for (TextureVK* attachment : images) {
+        colour_formats.emplace_back(attachment->image_format);
+        image_views.emplace_back(attachment->image_view);
+    }
+    if (samples != vk::SampleCountFlagBits::e1) {
+        // Multisampled images are only used within a render pass, so don't need to be backed by
+        // memory on tiled GPUs.
+        for (TextureVK* attachment : images) {
+            TextureVK msaa_image;
+            msaa_image.image_format = attachment->image_format;
+            msaa_image.image_layout = vk::ImageLayout::eUndefined;
+            msaa_image.aspect_mask = vk::ImageAspectFlagBits::eColor;
+            device->createImage(width, height, msaa_image.image_format, vk::ImageTiling::eOptimal,
+                                vk::ImageUsageFlagBits::eColorAttachment |
+                                    vk::ImageUsageFlagBits::eTransientAttachment,
+                                vk::MemoryPropertyFlagBits::eDeviceLocal |
+                                    vk::MemoryPropertyFlagBits::eLazilyAllocated,
+                                msaa_image.image, msaa_image.image_memory, samples);
+            msaa_image.image_view = device->createImageView(
+                msaa_image.image, msaa_image.image_format, vk::ImageAspectFlagBits::eColor);
+            image_views.emplace_back(msaa_image.image_view);
+            msaa_images.emplace_back(msaa_image);
+        }
+    }
+    image_views.emplace_back(depth_texture ? depth_texture->image_view : depth.image_view);
+    render_pass = createRenderPass(device->getDevice(), colour_formats,
+                                   vk::ImageLayout::eColorAttachmentOptimal, depth_format, samples,
+                                   kDefaultAttachmentOps);
 
     // Create framebuffer.
     vk::FramebufferCreateInfo framebuffer_info;
@@ -815,7 +1513,44 @@ FramebufferVK::FramebufferVK(DeviceVK* device, u16 width, u16 height,
     framebuffer = device->getDevice().createFramebuffer(framebuffer_info);
 }
 
-RenderContextVK::RenderContextVK(Logger& logger) : RenderContext{logger}, current_frame_(0) {
+vk::RenderPass FramebufferVK::findOrCreateRenderPass(vk::Device device, const AttachmentOps& ops) {
+    if (ops == kDefaultAttachmentOps) {
+        return render_pass;
+    }
+    auto it = render_pass_variants.find(attachmentOpsKey(ops));
+    if (it != render_pass_variants.end()) {
+        return it->second;
+    }
+    std::vector<vk::Format> colour_formats;
+    for (TextureVK* attachment : images) {
+        colour_formats.emplace_back(attachment->image_format);
+    }
+    auto variant = createRenderPass(device, colour_formats,
+                                    vk::ImageLayout::eColorAttachmentOptimal, depth_format, samples,
+                                    ops);
+    render_pass_variants.emplace(attachmentOpsKey(ops), variant);
+    return variant;
+}
+
+void FramebufferVK::destroy(vk::Device device) const {
+    device.destroy(render_pass);
+    for (const auto& variant : render_pass_variants) {
+        device.destroy(variant.second);
+    }
+    device.destroy(framebuffer);
+    if (!depth_texture) {
+        depth.destroy(device);
+    }
+    for (const auto& msaa_image : msaa_images) {
+        msaa_image.destroy(device);
+    }
+}
+
+RenderContextVK::RenderContextVK(Logger& logger)
+    : RenderContext{logger},
+      depth_image_initialised_(false),
+      current_frame_(0),
+      submitted_frame_count_(0) {
 }
 
 RenderContextVK::~RenderContextVK() {
@@ -861,6 +1596,7 @@ Result<void, std::string> RenderContextVK::createWindow(u16 width, u16 height,
     createCommandBuffers();
     createDescriptorPool();
     createSyncObjects();
+    createQueryPools();
 
     uniform_scratch_buffers_.reserve(swap_chain_image_views_.size());
     for (usize i = 0; i < swap_chain_image_views_.size(); ++i) {
@@ -917,6 +1653,11 @@ void RenderContextVK::prepareFrame() {
     // Wait for in-flight fence.
     vk_device_.waitForFences(in_flight_fences_[current_frame_], VK_TRUE, UINT64_MAX);
 
+    // Frames complete in the order they were submitted, so every frame up to the one which last
+    // used this fence has completed.
+    destroyCompletedResources(in_flight_frame_numbers_[current_frame_]);
+    staging_ring_->release(in_flight_frame_numbers_[current_frame_]);
+
     // Acquire next image.
     vk_device_.acquireNextImageKHR(swap_chain_, UINT64_MAX,
                                    image_available_semaphores_[current_frame_], vk::Fence{},
@@ -953,83 +1694,184 @@ bool RenderContextVK::frame(const Frame* frame) {
                                frame->transient_ib_storage.size, 0);
     }
 
+    // Apply updates to stream buffers made while this frame's copies were in use.
+    for (auto& entry : vertex_buffer_map_) {
+        entry.second.buffer.sync(next_frame_index_);
+    }
+    for (auto& entry : index_buffer_map_) {
+        entry.second.buffer.sync(next_frame_index_);
+    }
+    for (auto& entry : uniform_buffer_map_) {
+        entry.second.sync(next_frame_index_);
+    }
+    for (auto& entry : storage_buffer_map_) {
+        entry.second.sync(next_frame_index_);
+    }
+
     uniform_scratch_buffers_[next_frame_index_]->reset();
 
+    // The previous frame which used this swapchain image has completed, so its occlusion query
+    // results are available.
+    auto& query_pool = occlusion_query_pools_[next_frame_index_];
+    readOcclusionQueryResults(query_pool);
+
     auto command_buffer = command_buffers_[next_frame_index_];
     vk::CommandBufferBeginInfo begin_info;
     begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
     command_buffer.begin(begin_info);
 
-    // Write render queues to command buffer.
-    const FramebufferVK* previous_frame_buffer = nullptr;
+    // Queries must be reset outside of a render pass.
+    command_buffer.resetQueryPool(query_pool.pool, 0, kMaxOcclusionQueriesPerFrame);
+
+    // Submit the uploads recorded since the last frame. The frame waits for them to complete.
+    std::optional<vk::Semaphore> upload_semaphore = upload_queue_->submit(command_buffer);
+
+    // Copy the dynamic buffer updates made since the last frame.
+    staging_ring_->record(command_buffer, submitted_frame_count_ + 1);
+
+    // Write render queues to command buffer. Consecutive render queues which render to the same
+    // frame buffer and load all of its attachments share a render pass, which then stores the
+    // attachments according to the last render queue in the run. Compute items can't be
+    // dispatched inside a render pass, and the textures a render queue reads must be transitioned
+    // before the render pass begins, so render queues with either always start a new one.
+    const auto& render_queues = frame->render_queues;
+    auto continues_render_pass = [&render_queues](usize i) {
+        const auto& q = render_queues[i];
+        return i > 0 && q.frame_buffer == render_queues[i - 1].frame_buffer &&
+               q.attachment_ops->colour_load == AttachmentLoadOp::Load &&
+               q.attachment_ops->depth_load == AttachmentLoadOp::Load &&
+               q.read_textures.empty() && q.compute_items.empty();
+    };
+    FramebufferVK* previous_frame_buffer = nullptr;
     bool in_render_pass = false;
-    for (const auto& q : frame->render_queues) {
+    for (usize queue_index = 0; queue_index < render_queues.size(); ++queue_index) {
+        const auto& q = render_queues[queue_index];
+
         // Get framebuffer.
-        const FramebufferVK* current_frame_buffer = nullptr;
+        FramebufferVK* current_frame_buffer = nullptr;
         vk::Framebuffer target_framebuffer;
-        vk::RenderPass target_render_pass;
         vk::Extent2D target_extent;
         if (q.frame_buffer) {
-            const auto& fb = framebuffer_map_.at(*q.frame_buffer);
+            auto& fb = framebuffer_map_.at(*q.frame_buffer);
             target_framebuffer = fb.framebuffer;
-            target_render_pass = fb.render_pass;
             target_extent = fb.extent;
             current_frame_buffer = &fb;
         } else {
             // Bind to backbuffer.
             target_framebuffer = swap_chain_framebuffers_[next_frame_index_];
-            target_render_pass = swapchain_render_pass_;
             target_extent = swap_chain_extent_;
         }
 
-        // If the framebuffer has changed, start a new render pass.
-        if (!in_render_pass || current_frame_buffer != previous_frame_buffer) {
+        // Start a new render pass unless this render queue continues the current one.
+        if (!in_render_pass || !continues_render_pass(queue_index)) {
             // End the previous render pass.
             if (in_render_pass) {
                 command_buffer.endRenderPass();
                 in_render_pass = false;
             }
 
-            // Transition framebuffer state.
+            // Dispatch compute items, which must be recorded outside of a render pass.
+            recordComputeItems(command_buffer, *frame, q);
+
+            // Transition framebuffer state. The transitions are collected and issued as a single
+            // barrier, which also covers the textures this queue declared that it reads.
+            std::vector<vk::ImageMemoryBarrier> barriers;
+            auto add_barrier = [&barriers](TextureVK* image, vk::ImageLayout layout) {
+                auto imb = image->transitionLayout(layout);
+                if (imb) {
+                    barriers.emplace_back(*imb);
+                }
+            };
             if (previous_frame_buffer && current_frame_buffer != previous_frame_buffer) {
                 for (TextureVK* image : previous_frame_buffer->images) {
-                    image->setImageBarrier(command_buffer, vk::ImageLayout::eShaderReadOnlyOptimal);
+                    add_barrier(image, vk::ImageLayout::eShaderReadOnlyOptimal);
+                }
+                if (previous_frame_buffer->depth_texture) {
+                    add_barrier(previous_frame_buffer->depth_texture,
+                                vk::ImageLayout::eShaderReadOnlyOptimal);
                 }
-                // TODO: Depth.
             }
             if (current_frame_buffer) {
                 for (TextureVK* image : current_frame_buffer->images) {
-                    image->setImageBarrier(command_buffer,
-                                           vk::ImageLayout::eColorAttachmentOptimal);
+                    add_barrier(image, vk::ImageLayout::eColorAttachmentOptimal);
+                }
+                if (current_frame_buffer->depth_texture) {
+                    add_barrier(current_frame_buffer->depth_texture,
+                                vk::ImageLayout::eDepthStencilAttachmentOptimal);
                 }
-                // TODO: Depth.
+            }
+            // Renderer::setRenderQueueInputs rejects attachments of the queue's own frame buffer,
+            // so none of these are also transitioned to an attachment layout above.
+            for (TextureHandle handle : q.read_textures) {
+                add_barrier(&texture_map_.at(handle), vk::ImageLayout::eShaderReadOnlyOptimal);
+            }
+            recordImageBarriers(command_buffer, barriers);
+
+            // Load ops come from this render queue, and store ops from the last render queue which
+            // continues this render pass. Attachments which have never been rendered to can't be
+            // loaded, as they're still in an undefined layout.
+            usize last_queue_index = queue_index;
+            while (last_queue_index + 1 < render_queues.size() &&
+                   continues_render_pass(last_queue_index + 1)) {
+                ++last_queue_index;
+            }
+            AttachmentOps ops = *q.attachment_ops;
+            ops.colour_store = render_queues[last_queue_index].attachment_ops->colour_store;
+            ops.depth_store = render_queues[last_queue_index].attachment_ops->depth_store;
+            bool colour_initialised =
+                current_frame_buffer || swap_chain_images_initialised_[next_frame_index_];
+            // Depth textures have already been transitioned by the barrier above.
+            bool depth_initialised = depth_image_initialised_;
+            if (current_frame_buffer) {
+                depth_initialised =
+                    current_frame_buffer->depth_texture ||
+                    current_frame_buffer->depth.image_layout != vk::ImageLayout::eUndefined;
+            }
+            if (ops.colour_load == AttachmentLoadOp::Load && !colour_initialised) {
+                ops.colour_load = AttachmentLoadOp::DontCare;
+            }
+            if (ops.depth_load == AttachmentLoadOp::Load && !depth_initialised) {
+                ops.depth_load = AttachmentLoadOp::DontCare;
+            }
+            if (current_frame_buffer) {
+                current_frame_buffer->depth.image_layout =
+                    vk::ImageLayout::eDepthStencilAttachmentOptimal;
+            } else {
+                swap_chain_images_initialised_[next_frame_index_] = true;
+                depth_image_initialised_ = true;
             }
 
             // Begin render pass.
             vk::RenderPassBeginInfo render_pass_info;
-            render_pass_info.renderPass = target_render_pass;
+            render_pass_info.renderPass =
+                current_frame_buffer ? current_frame_buffer->findOrCreateRenderPass(vk_device_, ops)
+                                     : findOrCreateSwapchainRenderPass(ops);
             render_pass_info.framebuffer = target_framebuffer;
             render_pass_info.renderArea.offset = vk::Offset2D{0, 0};
             render_pass_info.renderArea.extent = target_extent;
 
-            // Set clear parameters.
+            // Set clear parameters. These are only needed if an attachment is cleared.
             std::vector<vk::ClearValue> clear_values;
-            int colour_attachment_count = 1;
-            if (current_frame_buffer) {
-                colour_attachment_count = current_frame_buffer->images.size();
-            }
-            vk::ClearColorValue clear_colour;
-            if (q.clear_parameters.has_value()) {
-                const auto& colour = q.clear_parameters.value().colour;
-                clear_colour = {
-                    std::array<float, 4>{colour.r(), colour.g(), colour.b(), colour.a()}};
-            } else {
-                clear_colour = {std::array<float, 4>{0.0f, 0.0f, 0.0f, 0.0f}};
-            }
-            for (int i = 0; i < colour_attachment_count; ++i) {
-                clear_values.emplace_back(clear_colour);
+            if (ops.colour_load == AttachmentLoadOp::Clear ||
+                ops.depth_load == AttachmentLoadOp::Clear) {
+                usize colour_attachment_count = 1;
+                if (current_frame_buffer) {
+                    colour_attachment_count = current_frame_buffer->images.size() +
+                                              current_frame_buffer->msaa_images.size();
+                }
+                vk::ClearColorValue clear_colour;
+                if (q.clear_parameters.has_value()) {
+                    const auto& colour = q.clear_parameters.value().colour;
+                    clear_colour = {
+                        std::array<float, 4>{colour.r(), colour.g(), colour.b(), colour.a()}};
+                } else {
+                    clear_colour = {std::array<float, 4>{0.0f, 0.0f, 0.0f, 0.0f}};
+                }
+                for (usize i = 0; i < colour_attachment_count; ++i) {
+                    clear_values.emplace_back(clear_colour);
+                }
+                clear_values.emplace_back(vk::ClearDepthStencilValue{1.0f, 0});
             }
-            clear_values.emplace_back(vk::ClearDepthStencilValue{1.0f, 0});
             render_pass_info.clearValueCount = clear_values.size();
             render_pass_info.pClearValues = clear_values.data();
 
@@ -1039,73 +1881,85 @@ bool RenderContextVK::frame(const Frame* frame) {
         }
         previous_frame_buffer = current_frame_buffer;
 
+        std::optional<OcclusionQueryHandle> occlusion_query;
+        std::optional<u32> occlusion_query_slot;
+        std::optional<ProgramHandle> previous_program;
+        bool queue_uniforms_overridden = false;
         for (auto& ri : q.render_items) {
-            auto& program = program_map_.at(*ri.program);
-
-            // Apply uniforms.
-            for (auto& entry : ri.uniforms) {
-                auto uniform = program.uniform_locations.find(entry.first);
-                if (uniform == program.uniform_locations.end()) {
-                    logger_.warn("Unknown uniform '{}' in program {}", entry.first, *ri.program);
-                    continue;
+            // Begin and end occlusion queries.
+            if (ri.occlusion_query != occlusion_query) {
+                if (occlusion_query_slot) {
+                    command_buffer.endQuery(query_pool.pool, *occlusion_query_slot);
+                    occlusion_query_slot.reset();
                 }
-                uniform->second.data = std::move(entry.second);
-            }
-
-            // If there are no vertices to render, we are done.
-            if (!ri.vb) {
-                continue;
-            }
-
-            // Upload uniforms to uniform buffer.
-            std::map<usize, UniformScratchBuffer::Allocation> ubo_data;
-            for (const auto& ubo : program.uniform_buffers) {
-                const u32 alignment = device_->properties().limits.minUniformBufferOffsetAlignment;
-                const u32 vsize = strideAlign(ubo.size, alignment);
-                ubo_data[ubo.binding] = uniform_scratch_buffers_[next_frame_index_]->alloc(vsize);
-            }
-            for (const auto& uniform_entry : program.uniform_locations) {
-                const auto& uniform = uniform_entry.second;
-                if (!uniform.binding_location.has_value()) {
-                    logger_.warn("Push constants not implemented yet.");
-                    continue;
+                occlusion_query = ri.occlusion_query;
+                if (occlusion_query) {
+                    if (occlusion_queries_.count(*occlusion_query) == 0) {
+                        logger_.error("Occlusion query handle {} invalid.", *occlusion_query);
+                    } else if (query_pool.queries.size() >= kMaxOcclusionQueriesPerFrame) {
+                        logger_.warn("Too many occlusion queries in a single frame.");
+                    } else {
+                        occlusion_query_slot = static_cast<u32>(query_pool.queries.size());
+                        query_pool.queries.emplace_back(*occlusion_query);
+                        command_buffer.beginQuery(query_pool.pool, *occlusion_query_slot, {});
+                    }
                 }
+            }
 
-                // Write to memory.
-                if (uniform.data) {
-                    auto variant_bytes = std::visit(VariantToBytesHelper{}, *uniform.data);
-                    byte* data_dst = ubo_data.at(*uniform.binding_location).ptr + uniform.offset;
-                    std::memcpy(data_dst, variant_bytes.data, variant_bytes.size);
-                    /*
-                    logger_.info("Writing {} (size {}) to offset {} in UBO {}", uniform_pair.first,
-                                 variant_bytes.size, uniform_location.offset,
-                                 *uniform_location.ubo_location);
-                    */
+            // Items which continue the previous item share its pipeline, uniforms, descriptor set
+            // and vertex buffer, so only the scissor and index range need to be updated.
+            if (!ri.continues_previous) {
+                auto& program = program_map_.at(*ri.program);
+
+                // Apply the render queue's uniforms, which the item's uniforms override. They're
+                // applied again after an item which overrode them, so the override only lasts for
+                // that item.
+                if (ri.program != previous_program || queue_uniforms_overridden) {
+                    for (const auto& uniform : q.uniforms) {
+                        applyUniform(program, uniform.first, uniform.second);
+                    }
+                    previous_program = ri.program;
                 }
-#ifndef NDEBUG
-                if (!uniform.data) {
-                    logger_.warn("Uniform {} is uninitialised.", uniform_entry.first);
+                queue_uniforms_overridden = overridesQueueUniforms(*frame, q, ri);
+                applyUniformBlocks(program, *frame, ri);
+                for (const auto& uniform : frame->uniforms(ri)) {
+                    applyUniform(program, uniform.first, uniform.second);
                 }
-#endif
-            }
 
-            const auto& vb = vertex_buffer_map_.at(*ri.vb);
+                // If there are no vertices to render, we are done.
+                if (!ri.vb) {
+                    continue;
+                }
 
-            // Get (or create) vertex decl.
-            const auto& current_vertex_decl =
-                ri.vertex_decl_override.empty() ? vb.decl : ri.vertex_decl_override;
-            auto decl_it = vertex_decl_cache_.find(current_vertex_decl);
-            if (decl_it == vertex_decl_cache_.end()) {
-                decl_it = vertex_decl_cache_
-                              .emplace(current_vertex_decl, VertexDeclVK{current_vertex_decl})
-                              .first;
+                // Upload uniforms to uniform buffer.
+                auto uniform_buffers = frame->uniformBuffers(ri);
+                std::vector<u32> dynamic_offsets = uploadUniforms(program, uniform_buffers);
+
+                const auto& vb = vertex_buffer_map_.at(*ri.vb);
+                const auto& decl = vertex_layout_map_.at(ri.vertex_layout);
+
+                // Bind (and create) graphics pipeline.
+                auto graphics_pipeline = findOrCreateGraphicsPipeline(
+                    PipelineVK::Info{ri.state, &vb, &decl, &program, current_frame_buffer});
+                command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                            graphics_pipeline.pipeline);
+
+                // Bind descriptor set.
+                auto textures = frame->textures(ri);
+                auto descriptor_set = findOrCreateDescriptorSet(
+                    DescriptorSetVK::Info{&program,
+                                          {textures.begin(), textures.end()},
+                                          descriptorUniformBuffers(uniform_buffers)});
+                command_buffer.bindDescriptorSets(
+                    vk::PipelineBindPoint::eGraphics, graphics_pipeline.layout, 0,
+                    descriptor_set.descriptor_sets[next_frame_index_], dynamic_offsets);
+
+                // Bind vertex buffer.
+                command_buffer.bindVertexBuffers(0, vb.buffer.get(next_frame_index_),
+                                                 ri.vb_offset);
             }
 
-            // Bind (and create) graphics pipeline.
-            auto graphics_pipeline = findOrCreateGraphicsPipeline(
-                PipelineVK::Info{&ri, &vb, &decl_it->second, &program, current_frame_buffer});
-            command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
-                                        graphics_pipeline.pipeline);
+            // Set scissor.
             if (ri.scissor_enabled) {
                 command_buffer.setScissor(
                     0, vk::Rect2D{vk::Offset2D{ri.scissor_x, ri.scissor_y},
@@ -1114,30 +1968,28 @@ bool RenderContextVK::frame(const Frame* frame) {
                 command_buffer.setScissor(0, vk::Rect2D{vk::Offset2D{0, 0}, swap_chain_extent_});
             }
 
-            // Calculate dynamic offsets for the UBOs.
-            std::vector<u32> dynamic_offsets;
-            for (const auto& ubo_entry : ubo_data) {
-                dynamic_offsets.emplace_back(ubo_entry.second.offset_from_base);
-            }
-
-            // Bind descriptor set.
-            auto descriptor_set =
-                findOrCreateDescriptorSet(DescriptorSetVK::Info{&program, std::move(ri.textures)});
-            command_buffer.bindDescriptorSets(
-                vk::PipelineBindPoint::eGraphics, graphics_pipeline.layout, 0,
-                descriptor_set.descriptor_sets[next_frame_index_], dynamic_offsets);
-
-            // Bind vertex/index buffers and draw.
-            command_buffer.bindVertexBuffers(0, vb.buffer.get(next_frame_index_), ri.vb_offset);
+            // Bind index buffer and draw.
             if (ri.ib) {
                 const auto& ib = index_buffer_map_.at(*ri.ib);
+                vk::IndexType index_type = ib.type;
+                if (ri.index_type_override) {
+                    index_type = *ri.index_type_override == IndexBufferType::U16
+                                     ? vk::IndexType::eUint16
+                                     : vk::IndexType::eUint32;
+                }
                 command_buffer.bindIndexBuffer(ib.buffer.get(next_frame_index_), ri.ib_offset,
-                                               ib.type);
-                command_buffer.drawIndexed(ri.primitive_count * 3, 1, 0, 0, 0);
+                                               index_type);
+                command_buffer.drawIndexed(ri.primitive_count * 3, 1, 0,
+                                           static_cast<i32>(ri.base_vertex), 0);
             } else {
                 command_buffer.draw(ri.primitive_count * 3, 1, 0, 0);
             }
         }
+
+        // End the last occlusion query, as queries can't span multiple render passes.
+        if (occlusion_query_slot) {
+            command_buffer.endQuery(query_pool.pool, *occlusion_query_slot);
+        }
     }
     if (in_render_pass) {
         command_buffer.endRenderPass();
@@ -1148,11 +2000,16 @@ bool RenderContextVK::frame(const Frame* frame) {
 
     // Submit command buffer.
     vk::SubmitInfo submit_info;
-    vk::Semaphore wait_semaphores[] = {image_available_semaphores_[current_frame_]};
-    vk::PipelineStageFlags wait_stages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = wait_semaphores;
-    submit_info.pWaitDstStageMask = wait_stages;
+    std::vector<vk::Semaphore> wait_semaphores = {image_available_semaphores_[current_frame_]};
+    std::vector<vk::PipelineStageFlags> wait_stages = {
+        vk::PipelineStageFlagBits::eColorAttachmentOutput};
+    if (upload_semaphore) {
+        wait_semaphores.emplace_back(*upload_semaphore);
+        wait_stages.emplace_back(kUploadWaitStages);
+    }
+    submit_info.waitSemaphoreCount = static_cast<u32>(wait_semaphores.size());
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &command_buffers_[next_frame_index_];
     vk::Semaphore signal_semaphores[] = {render_finished_semaphores_[current_frame_]};
@@ -1160,6 +2017,11 @@ bool RenderContextVK::frame(const Frame* frame) {
     submit_info.pSignalSemaphores = signal_semaphores;
     vk_device_.resetFences(in_flight_fences_[current_frame_]);
     graphics_queue_.submit(submit_info, in_flight_fences_[current_frame_]);
+    in_flight_frame_numbers_[current_frame_] = ++submitted_frame_count_;
+    if (upload_semaphore) {
+        deferDestruction(
+            [device = vk_device_, semaphore = *upload_semaphore]() { device.destroy(semaphore); });
+    }
 
     // Present.
     vk::PresentInfoKHR presentInfo;
@@ -1174,15 +2036,14 @@ bool RenderContextVK::frame(const Frame* frame) {
     return true;
 }
 
-void RenderContextVK::operator()(const cmd::CreateVertexBuffer& c) {
-    if (c.usage == BufferUsage::Dynamic) {
-        throw std::invalid_argument(
-            "Dynamic vertex buffers are unimplemented in the Vulkan backend.");
-    }
+void RenderContextVK::operator()(const cmd::CreateVertexLayout& c) {
+    vertex_layout_map_.emplace(c.id, VertexDeclVK{c.decl});
+}
 
-    VertexBufferVK vb{c.decl,
-                      BufferVK{device_.get(), c.data.data(), c.data.size(), c.usage,
-                               vk::BufferUsageFlagBits::eVertexBuffer, swap_chain_images_.size()}};
+void RenderContextVK::operator()(const cmd::CreateVertexBuffer& c) {
+    VertexBufferVK vb{BufferVK{device_.get(), upload_queue_.get(), staging_ring_.get(), c.data,
+                               c.data.size(), c.usage, vk::BufferUsageFlagBits::eVertexBuffer,
+                               swap_chain_images_.size()}};
     vertex_buffer_map_.emplace(c.handle, std::move(vb));
 }
 
@@ -1196,15 +2057,22 @@ void RenderContextVK::operator()(const cmd::UpdateVertexBuffer& c) {
 
 void RenderContextVK::operator()(const cmd::DeleteVertexBuffer& c) {
     assert(vertex_buffer_map_.count(c.handle) > 0);
-    vertex_buffer_map_.erase(vertex_buffer_map_.find(c.handle));
+    auto it = vertex_buffer_map_.find(c.handle);
+    evictGraphicsPipelines(
+        [vb = &it->second](const PipelineVK::Info& info) { return info.vb == vb; });
+    // The buffer is freed when the last copy of the shared pointer is destroyed.
+    auto buffer = std::make_shared<VertexBufferVK>(std::move(it->second));
+    deferDestruction([buffer]() mutable { buffer.reset(); });
+    vertex_buffer_map_.erase(it);
 }
 
 void RenderContextVK::operator()(const cmd::CreateIndexBuffer& c) {
     vk::IndexType type =
         c.type == IndexBufferType::U16 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
     IndexBufferVK ib{type,
-                     BufferVK{device_.get(), c.data.data(), c.data.size(), c.usage,
-                              vk::BufferUsageFlagBits::eIndexBuffer, swap_chain_images_.size()}};
+                     BufferVK{device_.get(), upload_queue_.get(), staging_ring_.get(), c.data,
+                              c.data.size(), c.usage, vk::BufferUsageFlagBits::eIndexBuffer,
+                              swap_chain_images_.size()}};
     index_buffer_map_.emplace(c.handle, std::move(ib));
 }
 
@@ -1218,7 +2086,10 @@ void RenderContextVK::operator()(const cmd::UpdateIndexBuffer& c) {
 
 void RenderContextVK::operator()(const cmd::DeleteIndexBuffer& c) {
     assert(index_buffer_map_.count(c.handle) > 0);
-    index_buffer_map_.erase(index_buffer_map_.find(c.handle));
+    auto it = index_buffer_map_.find(c.handle);
+    auto buffer = std::make_shared<IndexBufferVK>(std::move(it->second));
+    deferDestruction([buffer]() mutable { buffer.reset(); });
+    index_buffer_map_.erase(it);
 }
 
 void RenderContextVK::operator()(const cmd::CreateProgram& c) {
@@ -1251,9 +2122,11 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
             usize member_count = type.member_types.size();
             struct_layout.fields.reserve(member_count);
             for (usize i = 0; i < member_count; ++i) {
+                bool is_array = !comp.get_type(type.member_types[i]).array.empty();
                 struct_layout.fields.emplace_back(ShaderVK::StructLayout::StructField{
                     comp.get_member_name(type.self, i), comp.type_struct_member_offset(type, i),
-                    comp.get_declared_struct_member_size(type, i)});
+                    comp.get_declared_struct_member_size(type, i),
+                    is_array ? comp.type_struct_member_array_stride(type, i) : 0});
             }
             shader.uniform_buffer_bindings.emplace(
                 comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
@@ -1281,6 +2154,16 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
                 comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
                 vk::DescriptorType::eSampler);
         }
+        for (const auto& resource : res.storage_buffers) {
+            shader.descriptor_type_bindings.emplace(
+                comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
+                vk::DescriptorType::eStorageBuffer);
+        }
+        for (const auto& resource : res.storage_images) {
+            shader.descriptor_type_bindings.emplace(
+                comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
+                vk::DescriptorType::eStorageImage);
+        }
 
         vk::PipelineShaderStageCreateInfo stage_info;
         stage_info.stage = convertShaderStage(shader.stage);
@@ -1344,7 +2227,8 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
         ProgramVK::UniformBuffer ubo;
         ubo.binding = binding.first;
         ubo.size = binding.second.size;
-        program.uniform_buffers.push_back(ubo);
+        ubo.data.resize(ubo.size, 0);
+        program.uniform_buffers.push_back(std::move(ubo));
 
         // Find uniform locations.
         for (const auto& field : binding.second.fields) {
@@ -1354,7 +2238,7 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
                 (binding.second.name.empty() ? "" : binding.second.name + ".") + field.name;
             program.uniform_locations.emplace(
                 std::move(qualified_name),
-                ProgramVK::Uniform{binding.first, field.offset, field.size, {}});
+                ProgramVK::Uniform{binding.first, field.offset, field.size, field.array_stride});
         }
     }
 
@@ -1362,12 +2246,88 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
 }
 
 void RenderContextVK::operator()(const cmd::DeleteProgram& c) {
-    auto& program = program_map_.at(c.handle);
-    vk_device_.destroy(program.descriptor_set_layout);
-    for (const auto& stage : program.stages) {
-        vk_device_.destroy(stage.second.module);
-    }
-    program_map_.erase(c.handle);
+    auto it = program_map_.find(c.handle);
+    assert(it != program_map_.end());
+    const ProgramVK* program = &it->second;
+    evictGraphicsPipelines(
+        [program](const PipelineVK::Info& info) { return info.program == program; });
+    evictDescriptorSets(
+        [program](const DescriptorSetVK::Info& info) { return info.program == program; });
+    auto compute_pipeline = compute_pipeline_cache_.find(program);
+    if (compute_pipeline != compute_pipeline_cache_.end()) {
+        deferDestruction([device = vk_device_, pipeline = compute_pipeline->second]() {
+            device.destroy(pipeline.layout);
+            device.destroy(pipeline.pipeline);
+        });
+        compute_pipeline_cache_.erase(compute_pipeline);
+    }
+    auto shared_program = std::make_shared<ProgramVK>(std::move(it->second));
+    deferDestruction(
+        [device = vk_device_, shared_program]() { shared_program->destroy(device); });
+    program_map_.erase(it);
+}
+
+void RenderContextVK::operator()(const cmd::CreateUniformBuffer& c) {
+    uniform_buffer_map_.emplace(
+        c.handle,
+        BufferVK{device_.get(), upload_queue_.get(), staging_ring_.get(), c.data, c.size, c.usage,
+                 vk::BufferUsageFlagBits::eUniformBuffer, swap_chain_images_.size()});
+}
+
+void RenderContextVK::operator()(const cmd::UpdateUniformBuffer& c) {
+    assert(uniform_buffer_map_.count(c.handle) > 0);
+    auto& buffer = uniform_buffer_map_.at(c.handle);
+    if (!buffer.update(next_frame_index_, c.data.data(), c.data.size(), c.offset)) {
+        logger_.warn("Unable to update uniform buffer {}", c.handle);
+    }
+}
+
+void RenderContextVK::operator()(const cmd::DeleteUniformBuffer& c) {
+    assert(uniform_buffer_map_.count(c.handle) > 0);
+    auto it = uniform_buffer_map_.find(c.handle);
+    evictDescriptorSets([handle = c.handle](const DescriptorSetVK::Info& info) {
+        return std::any_of(info.uniform_buffers.begin(), info.uniform_buffers.end(),
+                           [handle](const RenderItem::UniformBufferBinding& uniform_buffer) {
+                               return uniform_buffer.handle == handle;
+                           });
+    });
+    auto buffer = std::make_shared<BufferVK>(std::move(it->second));
+    deferDestruction([buffer]() mutable { buffer.reset(); });
+    uniform_buffer_map_.erase(it);
+}
+
+void RenderContextVK::operator()(const cmd::CreateStorageBuffer& c) {
+    // Storage buffers can also be used as vertex, index or indirect buffers, so that compute
+    // programs can generate geometry and draw arguments.
+    vk::BufferUsageFlags buffer_type =
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer |
+        vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eIndirectBuffer;
+    storage_buffer_map_.emplace(c.handle,
+                                BufferVK{device_.get(), upload_queue_.get(), staging_ring_.get(),
+                                         c.data, c.size, c.usage, buffer_type,
+                                         swap_chain_images_.size()});
+}
+
+void RenderContextVK::operator()(const cmd::UpdateStorageBuffer& c) {
+    assert(storage_buffer_map_.count(c.handle) > 0);
+    auto& buffer = storage_buffer_map_.at(c.handle);
+    if (!buffer.update(next_frame_index_, c.data.data(), c.data.size(), c.offset)) {
+        logger_.warn("Unable to update storage buffer {}", c.handle);
+    }
+}
+
+void RenderContextVK::operator()(const cmd::DeleteStorageBuffer& c) {
+    assert(storage_buffer_map_.count(c.handle) > 0);
+    auto it = storage_buffer_map_.find(c.handle);
+    evictDescriptorSets([handle = c.handle](const DescriptorSetVK::Info& info) {
+        return std::any_of(info.storage_buffers.begin(), info.storage_buffers.end(),
+                           [handle](const RenderItem::StorageBufferBinding& storage_buffer) {
+                               return storage_buffer.handle == handle;
+                           });
+    });
+    auto buffer = std::make_shared<BufferVK>(std::move(it->second));
+    deferDestruction([buffer]() mutable { buffer.reset(); });
+    storage_buffer_map_.erase(it);
 }
 
 void RenderContextVK::operator()(const cmd::CreateTexture2D& c) {
@@ -1378,57 +2338,62 @@ void RenderContextVK::operator()(const cmd::CreateTexture2D& c) {
     vk::DeviceSize buffer_size = c.width * c.height * 4;
     assert(c.data.size() <= buffer_size);
 
-    texture.aspect_mask = vk::ImageAspectFlagBits::eColor;
+    // Depth textures are only sampled through their depth aspect, but barriers need to cover the
+    // stencil aspect too if the format has one.
+    bool is_depth = isDepthFormat(c.format);
+    vk::ImageAspectFlags view_aspect_mask =
+        is_depth ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor;
+    texture.aspect_mask = view_aspect_mask;
+    if (texture.image_format == vk::Format::eD24UnormS8Uint) {
+        texture.aspect_mask |= vk::ImageAspectFlagBits::eStencil;
+    }
 
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled;
+    if (c.storage_usage) {
+        usage |= vk::ImageUsageFlagBits::eStorage;
+    }
     if (c.framebuffer_usage) {
-        device_->createImage(
-            static_cast<u32>(c.width), static_cast<u32>(c.height), texture.image_format,
-            vk::ImageTiling::eOptimal,
-            vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
-            vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image, texture.image_memory);
+        usage |= is_depth ? vk::ImageUsageFlagBits::eDepthStencilAttachment
+                          : vk::ImageUsageFlagBits::eColorAttachment;
+        device_->createImage(static_cast<u32>(c.width), static_cast<u32>(c.height),
+                             texture.image_format, vk::ImageTiling::eOptimal, usage,
+                             vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image,
+                             texture.image_memory);
         texture.image_layout = vk::ImageLayout::eUndefined;
     } else {
-        // Create image by copying to a staging buffer.
-        vk::Buffer staging_buffer;
-        vk::DeviceMemory staging_buffer_memory;
-        device_->createBuffer(
-            buffer_size, vk::BufferUsageFlagBits::eTransferSrc,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            staging_buffer, staging_buffer_memory);
-
-        void* data = vk_device_.mapMemory(staging_buffer_memory, 0, buffer_size);
-        memcpy(data, c.data.data(), static_cast<std::size_t>(c.data.size()));
-        vk_device_.unmapMemory(staging_buffer_memory);
-
-        // Create image.
-        device_->createImage(
-            static_cast<u32>(c.width), static_cast<u32>(c.height), texture.image_format,
-            vk::ImageTiling::eOptimal,
-            vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-            vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image, texture.image_memory);
-
-        device_->transitionImageLayout(texture.image, texture.image_format,
-                                       vk::ImageLayout::eUndefined,
-                                       vk::ImageLayout::eTransferDstOptimal);
-        device_->copyBufferToImage(staging_buffer, texture.image, static_cast<u32>(c.width),
-                                   static_cast<u32>(c.height));
-        device_->transitionImageLayout(texture.image, texture.image_format,
-                                       vk::ImageLayout::eTransferDstOptimal,
-                                       vk::ImageLayout::eShaderReadOnlyOptimal);
+        // Create image, and upload its contents in the background.
+        device_->createImage(static_cast<u32>(c.width), static_cast<u32>(c.height),
+                             texture.image_format, vk::ImageTiling::eOptimal,
+                             usage | vk::ImageUsageFlagBits::eTransferDst,
+                             vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image,
+                             texture.image_memory);
+        upload_queue_->uploadImage(texture.image, static_cast<u32>(c.width),
+                                   static_cast<u32>(c.height), buffer_size, c.data);
         texture.image_layout = vk::ImageLayout::eShaderReadOnlyOptimal;
-
-        vk_device_.destroy(staging_buffer);
-        vk_device_.free(staging_buffer_memory);
     }
 
     // Create image view.
-    texture.image_view = device_->createImageView(texture.image, texture.image_format,
-                                                  vk::ImageAspectFlagBits::eColor);
+    texture.image_view =
+        device_->createImageView(texture.image, texture.image_format, view_aspect_mask);
 
     texture_map_.emplace(c.handle, std::move(texture));
 }
 
 void RenderContextVK::operator()(const cmd::DeleteTexture& c) {
+    auto it = texture_map_.find(c.handle);
+    assert(it != texture_map_.end());
+    evictDescriptorSets([handle = c.handle](const DescriptorSetVK::Info& info) {
+        return std::any_of(info.textures.begin(), info.textures.end(),
+                           [handle](const RenderItem::TextureBinding& texture) {
+                               return texture.handle == handle;
+                           }) ||
+               std::any_of(info.storage_images.begin(), info.storage_images.end(),
+                           [handle](const RenderItem::StorageImageBinding& storage_image) {
+                               return storage_image.handle == handle;
+                           });
+    });
+    deferDestruction([device = vk_device_, texture = it->second]() { texture.destroy(device); });
+    texture_map_.erase(it);
 }
 
 void RenderContextVK::operator()(const cmd::CreateFrameBuffer& c) {
@@ -1437,11 +2402,40 @@ void RenderContextVK::operator()(const cmd::CreateFrameBuffer& c) {
     for (const auto& texture_handle : c.textures) {
         textures.push_back(&texture_map_.at(texture_handle));
     }
-    FramebufferVK framebuffer{device_.get(), c.width, c.height, std::move(textures)};
+    // Use the highest supported sample count which doesn't exceed the requested count.
+    const auto& limits = device_->properties().limits;
+    auto supported_samples =
+        limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+    auto samples = vk::SampleCountFlagBits::e1;
+    for (uint count = 2; count <= c.samples && count <= 64; count *= 2) {
+        if (supported_samples & static_cast<vk::SampleCountFlagBits>(count)) {
+            samples = static_cast<vk::SampleCountFlagBits>(count);
+        }
+    }
+    TextureVK* depth_texture = c.depth_texture ? &texture_map_.at(*c.depth_texture) : nullptr;
+    FramebufferVK framebuffer{device_.get(), c.width, c.height, std::move(textures),
+                              depth_texture, samples};
     framebuffer_map_.emplace(c.handle, std::move(framebuffer));
 }
 
 void RenderContextVK::operator()(const cmd::DeleteFrameBuffer& c) {
+    auto it = framebuffer_map_.find(c.handle);
+    assert(it != framebuffer_map_.end());
+    evictGraphicsPipelines([framebuffer = &it->second](const PipelineVK::Info& info) {
+        return info.framebuffer == framebuffer;
+    });
+    deferDestruction(
+        [device = vk_device_, framebuffer = it->second]() { framebuffer.destroy(device); });
+    framebuffer_map_.erase(it);
+}
+
+void RenderContextVK::operator()(const cmd::CreateOcclusionQuery& c) {
+    occlusion_queries_.emplace(c.handle);
+}
+
+void RenderContextVK::operator()(const cmd::DeleteOcclusionQuery& c) {
+    occlusion_queries_.erase(c.handle);
+    removeOcclusionQueryResult(c.handle);
 }
 
 bool RenderContextVK::checkValidationLayerSupport() {
@@ -1601,11 +2595,18 @@ void RenderContextVK::createDevice() {
     auto indices = QueueFamilyIndices::fromPhysicalDevice(physical_device, surface_);
     graphics_queue_family_index_ = indices.graphics_family.value();
     present_queue_family_index_ = indices.present_family.value();
+    auto transfer_family = QueueFamilyIndices::findTransferFamily(physical_device);
+    transfer_queue_family_index_ = transfer_family.value_or(graphics_queue_family_index_);
+    if (transfer_family) {
+        logger_.info("Using queue family {} for uploads.", *transfer_family);
+    } else {
+        logger_.info("No dedicated transfer queue family, uploading through the graphics queue.");
+    }
 
     // Create a logical device.
     std::vector<vk::DeviceQueueCreateInfo> queue_create_infos;
-    std::set<u32> unique_queues_families = {graphics_queue_family_index_,
-                                            present_queue_family_index_};
+    std::set<u32> unique_queues_families = {
+        graphics_queue_family_index_, present_queue_family_index_, transfer_queue_family_index_};
     float queue_priority = 1.0f;
     for (u32 queue_family : unique_queues_families) {
         vk::DeviceQueueCreateInfo queue_create_info;
@@ -1636,6 +2637,7 @@ void RenderContextVK::createDevice() {
     // Get queue handles.
     graphics_queue_ = vk_device_.getQueue(indices.graphics_family.value(), 0);
     present_queue_ = vk_device_.getQueue(indices.present_family.value(), 0);
+    transfer_queue_ = vk_device_.getQueue(transfer_queue_family_index_, 0);
 
     // Create command pool.
     vk::CommandPoolCreateInfo pool_info;
@@ -1646,6 +2648,14 @@ void RenderContextVK::createDevice() {
     // Create device wrapper.
     device_ =
         std::make_unique<DeviceVK>(physical_device, vk_device_, command_pool, graphics_queue_);
+
+    // Create upload queue.
+    upload_queue_ = std::make_unique<UploadQueueVK>(device_.get(), transfer_queue_,
+                                                    transfer_queue_family_index_,
+                                                    graphics_queue_family_index_);
+
+    // Create the staging ring used to update dynamic buffers.
+    staging_ring_ = std::make_unique<StagingRingVK>(device_.get(), 4 * 1024 * 1024);
 }
 
 void RenderContextVK::createSwapChain() {
@@ -1689,6 +2699,7 @@ void RenderContextVK::createSwapChain() {
 
     swap_chain_ = vk_device_.createSwapchainKHR(create_info);
     swap_chain_images_ = vk_device_.getSwapchainImagesKHR(swap_chain_);
+    swap_chain_images_initialised_.assign(swap_chain_images_.size(), false);
     swap_chain_image_format_ = create_info.imageFormat;
     swap_chain_extent_ = create_info.imageExtent;
 
@@ -1710,59 +2721,24 @@ void RenderContextVK::createSwapChain() {
 }
 
 void RenderContextVK::createRenderPass() {
-    // Colour attachment.
-    vk::AttachmentDescription colour_attachment;
-    colour_attachment.format = swap_chain_image_format_;
-    colour_attachment.samples = vk::SampleCountFlagBits::e1;
-    colour_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-    colour_attachment.storeOp = vk::AttachmentStoreOp::eStore;
-    colour_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    colour_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    colour_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    colour_attachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
-    vk::AttachmentReference colour_attachment_ref;
-    colour_attachment_ref.attachment = 0;
-    colour_attachment_ref.layout = vk::ImageLayout::eColorAttachmentOptimal;
-
-    // Depth attachment.
-    vk::AttachmentDescription depth_attachment;
-    depth_attachment.format = depth_format_;
-    depth_attachment.samples = vk::SampleCountFlagBits::e1;
-    depth_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-    depth_attachment.storeOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    depth_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    depth_attachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-    vk::AttachmentReference depth_attachment_ref;
-    depth_attachment_ref.attachment = 1;
-    depth_attachment_ref.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-
-    // Subpass.
-    vk::SubpassDescription subpass;
-    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colour_attachment_ref;
-    subpass.pDepthStencilAttachment = &depth_attachment_ref;
-
-    vk::SubpassDependency dependency;
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.srcAccessMask = {};
-    dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.dstAccessMask =
-        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+    swapchain_render_pass_ =
+        createRenderPass(vk_device_, {swap_chain_image_format_}, vk::ImageLayout::ePresentSrcKHR,
+                         depth_format_, vk::SampleCountFlagBits::e1, kDefaultAttachmentOps);
+}
 
-    std::array<vk::AttachmentDescription, 2> attachments = {colour_attachment, depth_attachment};
-    vk::RenderPassCreateInfo render_pass_info;
-    render_pass_info.attachmentCount = attachments.size();
-    render_pass_info.pAttachments = attachments.data();
-    render_pass_info.subpassCount = 1;
-    render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
-    swapchain_render_pass_ = vk_device_.createRenderPass(render_pass_info);
+vk::RenderPass RenderContextVK::findOrCreateSwapchainRenderPass(const AttachmentOps& ops) {
+    if (ops == kDefaultAttachmentOps) {
+        return swapchain_render_pass_;
+    }
+    auto it = swapchain_render_pass_variants_.find(attachmentOpsKey(ops));
+    if (it != swapchain_render_pass_variants_.end()) {
+        return it->second;
+    }
+    auto variant =
+        createRenderPass(vk_device_, {swap_chain_image_format_}, vk::ImageLayout::ePresentSrcKHR,
+                         depth_format_, vk::SampleCountFlagBits::e1, ops);
+    swapchain_render_pass_variants_.emplace(attachmentOpsKey(ops), variant);
+    return variant;
 }
 
 void RenderContextVK::createFramebuffers() {
@@ -1800,6 +2776,8 @@ void RenderContextVK::createDescriptorPool() {
     };
 
     vk::DescriptorPoolCreateInfo poolInfo;
+    // Descriptor sets are freed individually when they're evicted from the cache.
+    poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
     poolInfo.poolSizeCount = sizeof(dps) / sizeof(dps[0]);
     poolInfo.pPoolSizes = dps;
     poolInfo.maxSets = 10 << 10;
@@ -1823,6 +2801,19 @@ void RenderContextVK::createSyncObjects() {
     }
 
     images_in_flight_.resize(swap_chain_images_.size());
+    in_flight_frame_numbers_.resize(kMaxFramesInFlight, 0);
+}
+
+void RenderContextVK::createQueryPools() {
+    vk::QueryPoolCreateInfo query_pool_info;
+    query_pool_info.queryType = vk::QueryType::eOcclusion;
+    query_pool_info.queryCount = kMaxOcclusionQueriesPerFrame;
+
+    occlusion_query_pools_.resize(swap_chain_images_.size());
+    for (auto& query_pool : occlusion_query_pools_) {
+        query_pool.pool = vk_device_.createQueryPool(query_pool_info);
+        query_pool.queries.reserve(kMaxOcclusionQueriesPerFrame);
+    }
 }
 
 PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info) {
@@ -1870,9 +2861,9 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
     rasterizer.polygonMode = vk::PolygonMode::eFill;
     rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = info.render_item->cull_face_enabled ? vk::CullModeFlagBits::eNone
-                                                              : vk::CullModeFlagBits::eNone;
-    rasterizer.frontFace = info.render_item->cull_front_face == CullFrontFace::CW
+    rasterizer.cullMode =
+        info.state.cullFaceEnabled() ? vk::CullModeFlagBits::eNone : vk::CullModeFlagBits::eNone;
+    rasterizer.frontFace = info.state.cullFrontFace() == CullFrontFace::CW
                                ? vk::FrontFace::eClockwise
                                : vk::FrontFace::eCounterClockwise;
     rasterizer.depthBiasEnable = VK_FALSE;
@@ -1882,7 +2873,8 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
 
     vk::PipelineMultisampleStateCreateInfo multisampling;
     multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
+    multisampling.rasterizationSamples =
+        info.framebuffer ? info.framebuffer->samples : vk::SampleCountFlagBits::e1;
     multisampling.minSampleShading = 1.0f;
     multisampling.pSampleMask = nullptr;
     multisampling.alphaToCoverageEnable = VK_FALSE;
@@ -1892,24 +2884,18 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
     usize colour_attachment_count = info.framebuffer ? info.framebuffer->images.size() : 1;
     for (usize i = 0; i < colour_attachment_count; ++i) {
         vk::PipelineColorBlendAttachmentState colour_blend_attachment;
-        if (info.render_item->colour_write) {
+        if (info.state.colourWrite()) {
             colour_blend_attachment.colorWriteMask =
                 vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
                 vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
         }
-        colour_blend_attachment.blendEnable = info.render_item->blend_enabled;
-        colour_blend_attachment.srcColorBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_src_rgb);
-        colour_blend_attachment.dstColorBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_dest_rgb);
-        colour_blend_attachment.colorBlendOp =
-            kBlendEquationMap.at(info.render_item->blend_equation_rgb);
-        colour_blend_attachment.srcAlphaBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_src_a);
-        colour_blend_attachment.dstAlphaBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_dest_a);
-        colour_blend_attachment.alphaBlendOp =
-            kBlendEquationMap.at(info.render_item->blend_equation_a);
+        colour_blend_attachment.blendEnable = info.state.blendEnabled();
+        colour_blend_attachment.srcColorBlendFactor = kBlendFuncMap.at(info.state.blendSrcRgb());
+        colour_blend_attachment.dstColorBlendFactor = kBlendFuncMap.at(info.state.blendDestRgb());
+        colour_blend_attachment.colorBlendOp = kBlendEquationMap.at(info.state.blendEquationRgb());
+        colour_blend_attachment.srcAlphaBlendFactor = kBlendFuncMap.at(info.state.blendSrcA());
+        colour_blend_attachment.dstAlphaBlendFactor = kBlendFuncMap.at(info.state.blendDestA());
+        colour_blend_attachment.alphaBlendOp = kBlendEquationMap.at(info.state.blendEquationA());
         colour_blend_attachments.push_back(colour_blend_attachment);
     }
 
@@ -1937,8 +2923,8 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
 
     // Depth / Stencil.
     vk::PipelineDepthStencilStateCreateInfo depth_stencil;
-    depth_stencil.depthTestEnable = info.render_item->depth_enabled ? VK_TRUE : VK_FALSE;
-    depth_stencil.depthWriteEnable = info.render_item->depth_write ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthTestEnable = info.state.depthEnabled() ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthWriteEnable = info.state.depthWrite() ? VK_TRUE : VK_FALSE;
     depth_stencil.depthCompareOp = vk::CompareOp::eLess;
     depth_stencil.depthBoundsTestEnable = VK_FALSE;
     depth_stencil.minDepthBounds = 0.0f;
@@ -1971,6 +2957,38 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
     return graphics_pipeline;
 }
 
+PipelineVK RenderContextVK::findOrCreateComputePipeline(const ProgramVK* program) {
+    auto cached_pipeline = compute_pipeline_cache_.find(program);
+    if (cached_pipeline != compute_pipeline_cache_.end()) {
+        return cached_pipeline->second;
+    }
+
+    // Cache miss. Create a new compute pipeline.
+    PipelineVK compute_pipeline;
+
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &program->descriptor_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 0;
+    pipeline_layout_info.pPushConstantRanges = nullptr;
+    compute_pipeline.layout = vk_device_.createPipelineLayout(pipeline_layout_info);
+
+    auto stage = std::find_if(program->pipeline_stages.begin(), program->pipeline_stages.end(),
+                              [](const vk::PipelineShaderStageCreateInfo& stage_info) {
+                                  return stage_info.stage == vk::ShaderStageFlagBits::eCompute;
+                              });
+    assert(stage != program->pipeline_stages.end());
+
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage = *stage;
+    pipeline_info.layout = compute_pipeline.layout;
+    compute_pipeline.pipeline =
+        vk_device_.createComputePipelines(vk::PipelineCache{}, pipeline_info)[0];
+
+    compute_pipeline_cache_.emplace(program, compute_pipeline);
+    return compute_pipeline;
+}
+
 DescriptorSetVK RenderContextVK::findOrCreateDescriptorSet(DescriptorSetVK::Info info) {
     auto cached_descriptor_set = descriptor_set_cache_.find(info);
     if (cached_descriptor_set != descriptor_set_cache_.end()) {
@@ -2014,7 +3032,18 @@ DescriptorSetVK RenderContextVK::findOrCreateDescriptorSet(DescriptorSetVK::Info
                         });
                     assert(uniform_buffer_it != info.program->uniform_buffers.end());
 
-                    buffer_info.buffer = uniform_scratch_buffers_[i]->getBuffer();
+                    // Use the user uniform buffer bound to this binding, if there is one.
+                    auto user_buffer_it = std::find_if(
+                        info.uniform_buffers.begin(), info.uniform_buffers.end(),
+                        [binding = binding.binding](const RenderItem::UniformBufferBinding& b) {
+                            return b.binding_location == binding;
+                        });
+                    if (user_buffer_it != info.uniform_buffers.end()) {
+                        buffer_info.buffer = uniform_buffer_map_.at(user_buffer_it->handle)
+                                                 .get(static_cast<u32>(i));
+                    } else {
+                        buffer_info.buffer = uniform_scratch_buffers_[i]->getBuffer();
+                    }
                     buffer_info.offset = 0;
                     buffer_info.range = uniform_buffer_it->size;
                     descriptor_write.pBufferInfo = &buffer_info;
@@ -2045,6 +3074,52 @@ DescriptorSetVK RenderContextVK::findOrCreateDescriptorSet(DescriptorSetVK::Info
                     image_info.sampler = findOrCreateSampler(texture_info.sampler_info);
                     descriptor_write.pImageInfo = &image_info;
                 } break;
+                case vk::DescriptorType::eStorageBuffer: {
+                    auto storage_buffer_it =
+                        std::find_if(info.storage_buffers.begin(), info.storage_buffers.end(),
+                                     [binding = binding.binding](
+                                         const RenderItem::StorageBufferBinding& buffer) {
+                                         return buffer.binding_location == binding;
+                                     });
+                    if (storage_buffer_it == info.storage_buffers.end()) {
+                        logger_.error("Binding location {} requires a storage buffer to be bound.",
+                                      binding.binding);
+                        continue;
+                    }
+
+                    const auto& storage_buffer = storage_buffer_map_.at(storage_buffer_it->handle);
+
+                    buffer_info_storage.emplace_back(std::make_unique<vk::DescriptorBufferInfo>());
+                    auto& buffer_info = *buffer_info_storage.back();
+
+                    buffer_info.buffer = storage_buffer.get(static_cast<u32>(i));
+                    buffer_info.offset = 0;
+                    buffer_info.range = VK_WHOLE_SIZE;
+                    descriptor_write.pBufferInfo = &buffer_info;
+                } break;
+                case vk::DescriptorType::eStorageImage: {
+                    auto storage_image_it = std::find_if(
+                        info.storage_images.begin(), info.storage_images.end(),
+                        [binding = binding.binding](const RenderItem::StorageImageBinding& image) {
+                            return image.binding_location == binding;
+                        });
+                    if (storage_image_it == info.storage_images.end()) {
+                        logger_.error("Binding location {} requires a storage image to be bound.",
+                                      binding.binding);
+                        continue;
+                    }
+
+                    const auto& texture = texture_map_.at(storage_image_it->handle);
+
+                    image_info_storage.emplace_back(std::make_unique<vk::DescriptorImageInfo>());
+                    auto& image_info = *image_info_storage.back();
+
+                    // Storage images are only accessed by dispatches, which move them into the
+                    // general layout.
+                    image_info.imageLayout = vk::ImageLayout::eGeneral;
+                    image_info.imageView = texture.image_view;
+                    descriptor_write.pImageInfo = &image_info;
+                } break;
                 default:
                     logger_.error("Unhandled descriptor type {}",
                                   vk::to_string(binding.descriptorType));
@@ -2114,9 +3189,304 @@ vk::Sampler RenderContextVK::findOrCreateSampler(RenderItem::SamplerInfo info) {
     return sampler;
 }
 
+void RenderContextVK::readOcclusionQueryResults(OcclusionQueryPoolVK& query_pool) {
+    if (query_pool.queries.empty()) {
+        return;
+    }
+
+    std::vector<u64> results(query_pool.queries.size());
+    auto result = vk_device_.getQueryPoolResults(
+        query_pool.pool, 0, static_cast<u32>(results.size()), results.size() * sizeof(u64),
+        results.data(), sizeof(u64), vk::QueryResultFlagBits::e64);
+    if (result == vk::Result::eSuccess) {
+        // If a query was issued multiple times, the last result wins.
+        for (usize i = 0; i < results.size(); ++i) {
+            if (occlusion_queries_.count(query_pool.queries[i]) > 0) {
+                setOcclusionQueryResult(query_pool.queries[i], results[i] != 0);
+            }
+        }
+    }
+    query_pool.queries.clear();
+}
+
+void RenderContextVK::applyUniform(ProgramVK& program, const std::string& name,
+                                   const UniformData& data) {
+    auto uniform = program.uniform_locations.find(name);
+    if (uniform == program.uniform_locations.end()) {
+        logger_.warn("Unknown uniform '{}'", name);
+        return;
+    }
+    if (!uniform->second.binding_location.has_value()) {
+        logger_.warn("Push constants not implemented yet.");
+        return;
+    }
+    const auto* array = std::get_if<UniformArray>(&data);
+    if (array && array->stride != uniform->second.array_stride) {
+        logger_.warn("Uniform '{}' isn't an array with a stride of {} bytes", name,
+                     array->stride);
+        return;
+    }
+    auto ubo = std::find_if(program.uniform_buffers.begin(), program.uniform_buffers.end(),
+                            [&uniform](const ProgramVK::UniformBuffer& ubo) {
+                                return ubo.binding == *uniform->second.binding_location;
+                            });
+    if (ubo == program.uniform_buffers.end()) {
+        return;
+    }
+
+    // Only mark the uniform's buffer as dirty if the value changes.
+    auto bytes = std::visit(VariantToBytesHelper{}, data);
+    usize size = std::min(bytes.size, uniform->second.size);
+    byte* dest = ubo->data.data() + uniform->second.offset;
+    if (std::memcmp(dest, bytes.data, size) != 0) {
+        std::memcpy(dest, bytes.data, size);
+        ubo->dirty = true;
+    }
+}
+
+void RenderContextVK::applyUniformBlocks(ProgramVK& program, const Frame& frame,
+                                         const RenderItem& item) {
+    for (const auto& block : frame.uniformBlocks(item)) {
+        auto ubo = std::find_if(program.uniform_buffers.begin(), program.uniform_buffers.end(),
+                                [&block](const ProgramVK::UniformBuffer& ubo) {
+                                    return ubo.binding == block.binding_location;
+                                });
+        if (ubo == program.uniform_buffers.end()) {
+            logger_.warn("Unknown uniform block binding {}", block.binding_location);
+            continue;
+        }
+        if (!checkUniformBlockLayout(program, *ubo, block)) {
+            continue;
+        }
+        auto data = frame.uniformBlockData(block);
+        if (!std::equal(data.begin(), data.end(), ubo->data.begin())) {
+            std::memcpy(ubo->data.data(), data.begin(), data.size());
+            ubo->dirty = true;
+        }
+    }
+}
+
+bool RenderContextVK::checkUniformBlockLayout(ProgramVK& program, ProgramVK::UniformBuffer& ubo,
+                                              const RenderItem::UniformBlockData& block) {
+    if (!block.layout) {
+        if (ubo.size != block.data.count) {
+            logger_.warn("Uniform block binding {} is {} bytes, but {} bytes were set.",
+                         block.binding_location, ubo.size, block.data.count);
+            return false;
+        }
+        return true;
+    }
+
+    // Struct layouts are only checked the first time they're used with a uniform buffer.
+    auto checked = ubo.checked_layouts.find(block.layout);
+    if (checked != ubo.checked_layouts.end()) {
+        return checked->second;
+    }
+    bool matches = true;
+    if (ubo.size != block.layout->size) {
+        logger_.warn("Uniform block binding {} is {} bytes, but the struct is {} bytes.",
+                     block.binding_location, ubo.size, block.layout->size);
+        matches = false;
+    }
+    for (const auto& member : block.layout->members) {
+        auto uniform = std::find_if(
+            program.uniform_locations.begin(), program.uniform_locations.end(),
+            [&](const std::pair<const std::string, ProgramVK::Uniform>& uniform) {
+                // Uniforms are named "<instance name>.<member name>" or "<member name>".
+                const std::string& name = uniform.first;
+                usize name_start = name.rfind('.') + 1;
+                return uniform.second.binding_location == ubo.binding &&
+                       name.compare(name_start, std::string::npos, member.name) == 0;
+            });
+        if (uniform == program.uniform_locations.end()) {
+            logger_.warn("Uniform block binding {} has no member '{}'.", block.binding_location,
+                         member.name);
+            matches = false;
+        } else if (uniform->second.offset != member.offset) {
+            logger_.warn("Member '{}' of uniform block binding {} is at offset {}, but the struct "
+                         "has it at offset {}.",
+                         member.name, block.binding_location, uniform->second.offset,
+                         member.offset);
+            matches = false;
+        }
+    }
+    ubo.checked_layouts.emplace(block.layout, matches);
+    return matches;
+}
+
+std::vector<u32> RenderContextVK::uploadUniforms(
+    ProgramVK& program, ArenaView<RenderItem::UniformBufferBinding> bindings) {
+    // Dynamic offsets are ordered by binding, so store the offset of every uniform buffer.
+    std::map<usize, u32> dynamic_offset_map;
+    UniformScratchBuffer* scratch_buffer = uniform_scratch_buffers_[next_frame_index_].get();
+    for (auto& ubo : program.uniform_buffers) {
+        auto binding_it = std::find_if(bindings.begin(), bindings.end(),
+                                       [&ubo](const RenderItem::UniformBufferBinding& binding) {
+                                           return binding.binding_location == ubo.binding;
+                                       });
+        if (binding_it != bindings.end()) {
+            dynamic_offset_map[ubo.binding] = binding_it->offset;
+            continue;
+        }
+
+        // Reuse the buffer's previous range if nothing has changed since it was written this
+        // frame, which is usually the case for uniforms set per render queue.
+        if (!ubo.dirty && ubo.scratch_buffer == scratch_buffer &&
+            ubo.scratch_generation == scratch_buffer->generation()) {
+            dynamic_offset_map[ubo.binding] = ubo.scratch_offset;
+            continue;
+        }
+        const u32 alignment = device_->properties().limits.minUniformBufferOffsetAlignment;
+        const u32 vsize = strideAlign(ubo.size, alignment);
+        auto allocation = scratch_buffer->alloc(vsize);
+        std::memcpy(allocation.ptr, ubo.data.data(), ubo.size);
+        ubo.dirty = false;
+        ubo.scratch_buffer = scratch_buffer;
+        ubo.scratch_generation = scratch_buffer->generation();
+        ubo.scratch_offset = allocation.offset_from_base;
+        dynamic_offset_map[ubo.binding] = ubo.scratch_offset;
+    }
+
+    std::vector<u32> dynamic_offsets;
+    for (const auto& offset_entry : dynamic_offset_map) {
+        dynamic_offsets.emplace_back(offset_entry.second);
+    }
+    return dynamic_offsets;
+}
+
+void RenderContextVK::recordComputeItems(vk::CommandBuffer command_buffer, const Frame& frame,
+                                         const RenderQueue& q) {
+    std::vector<TextureVK*> storage_images;
+    for (const auto& ri : q.compute_items) {
+        auto& program = program_map_.at(*ri.program);
+        if (program.stages.count(vk::ShaderStageFlagBits::eCompute) == 0) {
+            logger_.error("Program {} has no compute stage, skipping dispatch.", *ri.program);
+            continue;
+        }
+        applyUniformBlocks(program, frame, ri);
+        for (const auto& uniform : frame.uniforms(ri)) {
+            applyUniform(program, uniform.first, uniform.second);
+        }
+        auto uniform_buffers = frame.uniformBuffers(ri);
+        auto textures = frame.textures(ri);
+        auto storage_buffers = frame.storageBuffers(ri);
+        auto storage_images = frame.storageImages(ri);
+        std::vector<u32> dynamic_offsets = uploadUniforms(program, uniform_buffers);
+
+        // Move sampled textures and storage images into the layouts used by the dispatch.
+        std::vector<vk::ImageMemoryBarrier> barriers;
+        for (const auto& texture : textures) {
+            auto imb = texture_map_.at(texture.handle)
+                           .transitionLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+            if (imb) {
+                barriers.emplace_back(*imb);
+            }
+        }
+        for (const auto& storage_image : storage_images) {
+            TextureVK* image = &texture_map_.at(storage_image.handle);
+            auto imb = image->transitionLayout(vk::ImageLayout::eGeneral);
+            if (imb) {
+                barriers.emplace_back(*imb);
+            }
+            storage_images.emplace_back(image);
+        }
+        recordImageBarriers(command_buffer, barriers);
+
+        // Bind (and create) compute pipeline and descriptor set, then dispatch.
+        auto compute_pipeline = findOrCreateComputePipeline(&program);
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, compute_pipeline.pipeline);
+        auto descriptor_set = findOrCreateDescriptorSet(DescriptorSetVK::Info{
+            &program,
+            {textures.begin(), textures.end()},
+            descriptorUniformBuffers(uniform_buffers),
+            {storage_buffers.begin(), storage_buffers.end()},
+            {storage_images.begin(), storage_images.end()}});
+        command_buffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute, compute_pipeline.layout, 0,
+            descriptor_set.descriptor_sets[next_frame_index_], dynamic_offsets);
+        command_buffer.dispatch(ri.group_count_x, ri.group_count_y, ri.group_count_z);
+
+        // Make the writes visible to later dispatches, and to draws which read the results as
+        // vertices, indices, indirect arguments or from their shaders.
+        vk::MemoryBarrier memory_barrier;
+        memory_barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        memory_barrier.dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite |
+            vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eVertexAttributeRead |
+            vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eIndirectCommandRead;
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect |
+                vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader |
+                vk::PipelineStageFlagBits::eFragmentShader,
+            {}, memory_barrier, {}, {});
+    }
+
+    // Storage images are sampled by everything after the dispatches.
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    for (TextureVK* image : storage_images) {
+        auto imb = image->transitionLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+        if (imb) {
+            barriers.emplace_back(*imb);
+        }
+    }
+    recordImageBarriers(command_buffer, barriers);
+}
+
+void RenderContextVK::deferDestruction(std::function<void()> destroy) {
+    // Frames submitted from now on can't use the resource, but an upload to it may not be
+    // submitted until the next frame, which waits for the upload to complete.
+    pending_destructions_.emplace_back(
+        PendingDestruction{submitted_frame_count_ + 1, std::move(destroy)});
+}
+
+void RenderContextVK::destroyCompletedResources(u64 completed_frame) {
+    while (!pending_destructions_.empty() &&
+           pending_destructions_.front().frame <= completed_frame) {
+        pending_destructions_.front().destroy();
+        pending_destructions_.pop_front();
+    }
+}
+
+void RenderContextVK::evictGraphicsPipelines(
+    const std::function<bool(const PipelineVK::Info&)>& predicate) {
+    for (auto it = graphics_pipeline_cache_.begin(); it != graphics_pipeline_cache_.end();) {
+        if (predicate(it->first)) {
+            deferDestruction([device = vk_device_, pipeline = it->second]() {
+                device.destroy(pipeline.layout);
+                device.destroy(pipeline.pipeline);
+            });
+            it = graphics_pipeline_cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void RenderContextVK::evictDescriptorSets(
+    const std::function<bool(const DescriptorSetVK::Info&)>& predicate) {
+    for (auto it = descriptor_set_cache_.begin(); it != descriptor_set_cache_.end();) {
+        if (predicate(it->first)) {
+            deferDestruction([device = vk_device_, pool = descriptor_pool_,
+                              descriptor_set = it->second]() mutable {
+                descriptor_set.destroy(device, pool);
+            });
+            it = descriptor_set_cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void RenderContextVK::cleanup() {
     vk_device_.waitIdle();
 
+    // Stop recording uploads, then destroy deleted resources. All frames have completed, so
+    // nothing can be using them.
+    upload_queue_.reset();
+    staging_ring_.reset();
+    destroyCompletedResources(std::numeric_limits<u64>::max());
+
     // Clear cached objects.
     for (const auto& entry : sampler_cache_) {
         vk_device_.destroy(entry.second);
@@ -2128,35 +3498,38 @@ void RenderContextVK::cleanup() {
         vk_device_.destroy(entry.second.pipeline);
     }
     graphics_pipeline_cache_.clear();
-    vertex_decl_cache_.clear();
+    for (const auto& entry : compute_pipeline_cache_) {
+        vk_device_.destroy(entry.second.layout);
+        vk_device_.destroy(entry.second.pipeline);
+    }
+    compute_pipeline_cache_.clear();
 
     // Free resources.
     for (const auto& entry : framebuffer_map_) {
-        vk_device_.destroy(entry.second.render_pass);
-        vk_device_.destroy(entry.second.framebuffer);
-        vk_device_.destroy(entry.second.depth.image_view);
-        vk_device_.destroy(entry.second.depth.image);
-        vk_device_.free(entry.second.depth.image_memory);
+        entry.second.destroy(vk_device_);
     }
     framebuffer_map_.clear();
     for (const auto& entry : texture_map_) {
-        vk_device_.destroy(entry.second.image_view);
-        vk_device_.destroy(entry.second.image);
-        vk_device_.free(entry.second.image_memory);
+        entry.second.destroy(vk_device_);
     }
     texture_map_.clear();
     for (const auto& entry : program_map_) {
-        vk_device_.destroy(entry.second.descriptor_set_layout);
-        for (const auto& stage : entry.second.stages) {
-            vk_device_.destroy(stage.second.module);
-        }
+        entry.second.destroy(vk_device_);
     }
     program_map_.clear();
+    storage_buffer_map_.clear();
+    uniform_buffer_map_.clear();
     index_buffer_map_.clear();
+    vertex_layout_map_.clear();
     vertex_buffer_map_.clear();
 
     uniform_scratch_buffers_.clear();
     vk_device_.destroy(descriptor_pool_);
+    for (const auto& query_pool : occlusion_query_pools_) {
+        vk_device_.destroy(query_pool.pool);
+    }
+    occlusion_query_pools_.clear();
+    occlusion_queries_.clear();
 
     // Destroy swapchain.
     for (const auto& fence : in_flight_fences_) {
@@ -2164,6 +3537,7 @@ void RenderContextVK::cleanup() {
     }
     images_in_flight_.clear();
     in_flight_fences_.clear();
+    in_flight_frame_numbers_.clear();
     for (const auto& semaphore : render_finished_semaphores_) {
         vk_device_.destroy(semaphore);
     }
@@ -2174,6 +3548,10 @@ void RenderContextVK::cleanup() {
     image_available_semaphores_.clear();
 
     vk_device_.destroy(swapchain_render_pass_);
+    for (const auto& variant : swapchain_render_pass_variants_) {
+        vk_device_.destroy(variant.second);
+    }
+    swapchain_render_pass_variants_.clear();
     for (const auto& framebuffer : swap_chain_framebuffers_) {
         vk_device_.destroy(framebuffer);
     }
@@ -13,7 +13,13 @@
 #include <vulkan/vulkan.hpp>
 #include <GLFW/glfw3.h>
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 /*
  * TODOs:
@@ -40,19 +46,22 @@ public:
     vk::CommandPool getCommandPool() const;
 
     u32 findMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties);
+    bool hasMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties);
 
     // Returns the allocation size of the buffe rmemory.
     vk::DeviceSize createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
                                 vk::MemoryPropertyFlags properties, vk::Buffer& buffer,
                                 vk::DeviceMemory& buffer_memory);
-    void copyBuffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size);
     void copyBufferToImage(vk::Buffer buffer, vk::Image image, u32 width, u32 height);
     void transitionImageLayout(vk::Image image, vk::Format format, vk::ImageLayout old_layout,
                                vk::ImageLayout new_layout);
 
+    // If lazily allocated memory is requested but not available, device local memory is used
+    // instead.
     void createImage(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling,
                      vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties,
-                     vk::Image& image, vk::DeviceMemory& image_memory);
+                     vk::Image& image, vk::DeviceMemory& image_memory,
+                     vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1);
     vk::ImageView createImageView(vk::Image image, vk::Format format,
                                   vk::ImageAspectFlags aspect_flags);
 
@@ -70,14 +79,143 @@ private:
     vk::PhysicalDeviceProperties properties_;
 };
 
-// A buffer of data used by vertex and index buffers (and possibly user managed uniform buffers in
-// the future).
+// Uploads the initial contents of resources through a transfer queue. Staging buffers are filled
+// and copy commands are recorded on a background thread, then the recorded uploads are submitted
+// at the start of each frame, and the frame waits for them on the GPU. If the transfer queue is
+// from a different queue family to the graphics queue, the transfer queue releases ownership of
+// each resource and the frame acquires it.
+class UploadQueueVK {
+public:
+    UploadQueueVK(DeviceVK* device, vk::Queue queue, u32 queue_family_index,
+                  u32 graphics_queue_family_index);
+    ~UploadQueueVK();
+
+    UploadQueueVK(const UploadQueueVK&) = delete;
+    UploadQueueVK(UploadQueueVK&&) = delete;
+    UploadQueueVK& operator=(const UploadQueueVK&) = delete;
+    UploadQueueVK& operator=(UploadQueueVK&&) = delete;
+
+    // Copies data to the start of a buffer.
+    void uploadBuffer(vk::Buffer buffer, Memory data);
+
+    // Copies data to an image of the given size in bytes, then moves it into the shader read only
+    // layout. If there is less data than the size of the image, the rest is left undefined.
+    void uploadImage(vk::Image image, u32 width, u32 height, vk::DeviceSize size, Memory data);
+
+    // Waits for the uploads queued so far to be recorded, then submits them. The barriers which
+    // acquire the uploaded resources are recorded into the graphics command buffer, which must be
+    // submitted after waiting on the returned semaphore. Returns std::nullopt if there was
+    // nothing to upload.
+    std::optional<vk::Semaphore> submit(vk::CommandBuffer graphics_command_buffer);
+
+private:
+    struct Upload {
+        vk::Buffer buffer;
+        vk::Image image;
+        u32 width;
+        u32 height;
+        vk::DeviceSize size;
+        Memory data;
+    };
+
+    struct Batch {
+        vk::CommandBuffer command_buffer;
+        std::vector<vk::Buffer> staging_buffers;
+        std::vector<vk::DeviceMemory> staging_buffer_memory;
+        std::vector<vk::BufferMemoryBarrier> buffer_acquire_barriers;
+        std::vector<vk::ImageMemoryBarrier> image_acquire_barriers;
+    };
+
+    struct Submission {
+        vk::Fence fence;
+        std::vector<Batch> batches;
+    };
+
+    DeviceVK* device_;
+    vk::Queue queue_;
+    u32 queue_family_index_;
+    u32 graphics_queue_family_index_;
+    // Only used by the upload thread.
+    vk::CommandPool command_pool_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+    bool recording_;
+    std::vector<Upload> pending_uploads_;
+    std::vector<Batch> recorded_batches_;
+    std::vector<Submission> submissions_;
+
+    void run();
+    Batch record(const std::vector<Upload>& uploads);
+    // Frees the batches of submissions which have completed, or all submissions if wait is true.
+    void releaseSubmissions(bool wait);
+};
+
+// Copies updates to device local buffers through host visible staging pages. The copies are
+// recorded into the graphics command buffer at the start of the next frame, so they are ordered
+// after earlier frames which read the buffers without waiting for the device to become idle. A
+// page is reused once the frame which copied out of it has completed.
+class StagingRingVK {
+public:
+    StagingRingVK(DeviceVK* device, vk::DeviceSize page_size);
+    ~StagingRingVK();
+
+    StagingRingVK(const StagingRingVK&) = delete;
+    StagingRingVK(StagingRingVK&&) = delete;
+    StagingRingVK& operator=(const StagingRingVK&) = delete;
+    StagingRingVK& operator=(StagingRingVK&&) = delete;
+
+    // Copies data into staging memory, and queues a copy of it into a range of a buffer.
+    void upload(vk::Buffer buffer, const byte* data, vk::DeviceSize size, vk::DeviceSize offset);
+
+    // Records the queued copies into a command buffer outside of a render pass, between barriers
+    // which order them after earlier reads of the buffers and before later ones. The pages used
+    // by the copies are reused once the given frame has completed.
+    void record(vk::CommandBuffer command_buffer, u64 frame);
+
+    // Recycles the pages used by frames up to and including completed_frame.
+    void release(u64 completed_frame);
+
+private:
+    struct Page {
+        vk::Buffer buffer;
+        vk::DeviceMemory memory;
+        byte* data;
+        vk::DeviceSize size;
+        vk::DeviceSize used;
+        u64 frame;
+    };
+
+    struct Copy {
+        vk::Buffer src;
+        vk::Buffer dst;
+        vk::BufferCopy region;
+    };
+
+    DeviceVK* device_;
+    vk::DeviceSize page_size_;
+    // Pages which are being filled, pages read by frames in flight, and unused pages.
+    std::vector<Page> current_pages_;
+    std::deque<Page> submitted_pages_;
+    std::vector<Page> free_pages_;
+    std::vector<Copy> pending_copies_;
+
+    Page allocatePage(vk::DeviceSize min_size);
+    void destroyPage(const Page& page);
+};
+
+// A buffer of data used by vertex, index, uniform and storage buffers.
 struct BufferVK {
     DeviceVK* device;
     vk::DeviceSize size;
     BufferUsage usage;
 
-    BufferVK(DeviceVK* device, const byte* data, vk::DeviceSize size, BufferUsage usage,
+    // Static buffers are uploaded through the upload queue, and dynamic buffers through the
+    // staging ring.
+    BufferVK(DeviceVK* device, UploadQueueVK* upload_queue, StagingRingVK* staging_ring,
+             const Memory& data, vk::DeviceSize size, BufferUsage usage,
              vk::BufferUsageFlags buffer_type, usize swap_chain_size);
     ~BufferVK();
 
@@ -90,11 +228,22 @@ struct BufferVK {
 
     bool update(u32 frame_index, const byte* data, vk::DeviceSize data_size, vk::DeviceSize offset);
 
+    // Brings a stream buffer's copy for a frame up to date with updates made while it was in use
+    // by an earlier frame.
+    void sync(u32 frame_index);
+
 private:
     u32 getIndex(u32 frame_index) const;
+    void write(u32 index, const byte* data, vk::DeviceSize data_size, vk::DeviceSize offset);
 
+    StagingRingVK* staging_ring;
     std::vector<vk::Buffer> buffer;
     std::vector<vk::DeviceMemory> buffer_memory;
+
+    // Stream buffers keep their contents on the CPU, along with the range of each per-frame copy
+    // which is out of date. Copies are only written once the frame using them has completed.
+    std::vector<byte> stream_data;
+    std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>> stale_ranges;
 };
 
 struct VertexDeclVK {
@@ -108,7 +257,6 @@ struct VertexDeclVK {
 };
 
 struct VertexBufferVK {
-    VertexDecl decl;
     BufferVK buffer;
 };
 
@@ -129,6 +277,8 @@ struct ShaderVK {
             std::string name;
             usize offset;
             usize size;
+            // Zero if the field isn't an array.
+            usize array_stride;
         };
 
         std::string name;
@@ -140,30 +290,6 @@ struct ShaderVK {
     std::map<u32, vk::DescriptorType> descriptor_type_bindings;
 };
 
-struct ProgramVK {
-    std::unordered_map<vk::ShaderStageFlagBits, ShaderVK> stages;
-    std::vector<vk::PipelineShaderStageCreateInfo> pipeline_stages;
-    std::vector<vk::DescriptorSetLayoutBinding> layout_bindings;
-    vk::DescriptorSetLayout descriptor_set_layout;
-
-    // Uniforms.
-    struct Uniform {
-        // Empty optional indicates a push_constant buffer.
-        std::optional<usize> binding_location;
-        usize offset = 0;
-        usize size = 0;
-        std::optional<UniformData> data;
-    };
-    std::unordered_map<std::string, Uniform> uniform_locations;
-
-    // Uniform buffers.
-    struct UniformBuffer {
-        usize binding = 0;
-        usize size = 0;
-    };
-    std::vector<UniformBuffer> uniform_buffers;
-};
-
 class UniformScratchBuffer {
 public:
     struct Allocation {
@@ -182,6 +308,9 @@ public:
     Allocation alloc(usize size);
     void reset();
 
+    // Incremented each time the buffer is reset.
+    u64 generation() const;
+
     vk::Buffer getBuffer() const;
 
 private:
@@ -191,6 +320,43 @@ private:
     byte* data_;
     usize current_size_;
     usize maximum_size_;
+    u64 generation_;
+};
+
+struct ProgramVK {
+    std::unordered_map<vk::ShaderStageFlagBits, ShaderVK> stages;
+    std::vector<vk::PipelineShaderStageCreateInfo> pipeline_stages;
+    std::vector<vk::DescriptorSetLayoutBinding> layout_bindings;
+    vk::DescriptorSetLayout descriptor_set_layout;
+
+    // Uniforms.
+    struct Uniform {
+        // Empty optional indicates a push_constant buffer.
+        std::optional<usize> binding_location;
+        usize offset = 0;
+        usize size = 0;
+        usize array_stride = 0;
+    };
+    std::unordered_map<std::string, Uniform> uniform_locations;
+
+    // Uniform buffers.
+    struct UniformBuffer {
+        usize binding = 0;
+        usize size = 0;
+        // A copy of the buffer's contents, which keeps uniforms between items.
+        std::vector<byte> data;
+        // Unchanged uniform buffers reuse the range of the uniform scratch buffer that they were
+        // last written to, if it was written to in the current frame.
+        bool dirty = true;
+        const UniformScratchBuffer* scratch_buffer = nullptr;
+        u64 scratch_generation = 0;
+        usize scratch_offset = 0;
+        // Whether each struct layout set on the buffer matches it.
+        std::unordered_map<const UniformBlockLayout*, bool> checked_layouts;
+    };
+    std::vector<UniformBuffer> uniform_buffers;
+
+    void destroy(vk::Device device) const;
 };
 
 struct TextureVK {
@@ -202,6 +368,12 @@ struct TextureVK {
     vk::ImageAspectFlags aspect_mask;
 
     void setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayout new_layout);
+
+    // Returns the barrier needed to move the image to a new layout, or std::nullopt if it's
+    // already in that layout. The image is assumed to be in the new layout afterwards.
+    std::optional<vk::ImageMemoryBarrier> transitionLayout(vk::ImageLayout new_layout);
+
+    void destroy(vk::Device device) const;
 };
 
 struct DescriptorSetVK {
@@ -217,21 +389,44 @@ struct DescriptorSetVK {
         // descriptor sets for multiple programs of the same "shape".
         const ProgramVK* program;
         std::vector<RenderItem::TextureBinding> textures;
+        // Offsets are zero, as they are passed as dynamic offsets when binding the set.
+        std::vector<RenderItem::UniformBufferBinding> uniform_buffers;
+        std::vector<RenderItem::StorageBufferBinding> storage_buffers;
+        std::vector<RenderItem::StorageImageBinding> storage_images;
 
         bool operator==(const Info& other) const {
-            return program == other.program && textures == other.textures;
+            return program == other.program && textures == other.textures &&
+                   uniform_buffers == other.uniform_buffers &&
+                   storage_buffers == other.storage_buffers &&
+                   storage_images == other.storage_images;
         }
     };
 };
 
 struct FramebufferVK {
+    // Render pass used to create the frame buffer and its pipelines.
     vk::RenderPass render_pass;
+    // Compatible render passes with different load and store ops.
+    std::unordered_map<u32, vk::RenderPass> render_pass_variants;
+    // Depth texture, or nullptr if the frame buffer uses its own depth image.
+    TextureVK* depth_texture;
     TextureVK depth;
+    vk::Format depth_format;
+    // Multisampled colour attachments, which are resolved into images at the end of each render
+    // pass. Only used if samples is greater than 1.
+    vk::SampleCountFlagBits samples;
+    std::vector<TextureVK> msaa_images;
     vk::Framebuffer framebuffer;
     std::vector<TextureVK*> images;
     vk::Extent2D extent;
 
-    FramebufferVK(DeviceVK* device, u16 width, u16 height, std::vector<TextureVK*> attachments);
+    FramebufferVK(DeviceVK* device, u16 width, u16 height, std::vector<TextureVK*> attachments,
+                  TextureVK* depth_texture, vk::SampleCountFlagBits samples);
+
+    vk::RenderPass findOrCreateRenderPass(vk::Device device, const AttachmentOps& ops);
+
+    // Destroys the objects owned by the frame buffer. The attached textures are left alone.
+    void destroy(vk::Device device) const;
 };
 
 struct PipelineVK {
@@ -239,27 +434,15 @@ struct PipelineVK {
     vk::Pipeline pipeline;
 
     struct Info {
-        // TODO: Replace RenderItem ptr with a copy of the render state used by the pipeline, which
-        // we can hash separately.
-        const RenderItem* render_item;
+        PackedRenderState state;
         const VertexBufferVK* vb;
         const VertexDeclVK* decl;
         const ProgramVK* program;
         const FramebufferVK* framebuffer;
 
         bool operator==(const Info& other) const {
-            return render_item->colour_write == other.render_item->colour_write &&
-                   render_item->blend_enabled == other.render_item->blend_enabled &&
-                   render_item->blend_src_rgb == other.render_item->blend_src_rgb &&
-                   render_item->blend_dest_rgb == other.render_item->blend_dest_rgb &&
-                   render_item->blend_equation_rgb == other.render_item->blend_equation_rgb &&
-                   render_item->blend_src_a == other.render_item->blend_src_a &&
-                   render_item->blend_dest_a == other.render_item->blend_dest_a &&
-                   render_item->blend_equation_a == other.render_item->blend_equation_a &&
-                   render_item->cull_face_enabled == other.render_item->cull_face_enabled &&
-                   render_item->cull_front_face == other.render_item->cull_front_face &&
-                   vb == other.vb && decl == other.decl && program == other.program &&
-                   framebuffer == other.framebuffer;
+            return state == other.state && vb == other.vb && decl == other.decl &&
+                   program == other.program && framebuffer == other.framebuffer;
         }
     };
 };
@@ -270,13 +453,7 @@ namespace std {
 template <> struct hash<dw::gfx::PipelineVK::Info> {
     std::size_t operator()(const dw::gfx::PipelineVK::Info& i) const {
         std::size_t hash = 0;
-        dga::hashCombine(hash, i.render_item->colour_write, i.render_item->blend_enabled,
-                         i.render_item->blend_src_rgb, i.render_item->blend_dest_rgb,
-                         i.render_item->blend_equation_rgb, i.render_item->blend_src_a,
-                         i.render_item->blend_dest_a, i.render_item->blend_equation_a,
-                         i.render_item->depth_enabled, i.render_item->depth_write,
-                         i.render_item->cull_face_enabled, i.render_item->cull_front_face);
-        dga::hashCombine(hash, i.vb, i.decl, i.program, i.framebuffer);
+        dga::hashCombine(hash, i.state.bits(), i.vb, i.decl, i.program, i.framebuffer);
         return hash;
     }
 };
@@ -288,6 +465,15 @@ template <> struct hash<dw::gfx::DescriptorSetVK::Info> {
         for (const auto& texture : i.textures) {
             dga::hashCombine(hash, texture.handle, texture.sampler_info);
         }
+        for (const auto& uniform_buffer : i.uniform_buffers) {
+            dga::hashCombine(hash, uniform_buffer.binding_location, uniform_buffer.handle);
+        }
+        for (const auto& storage_buffer : i.storage_buffers) {
+            dga::hashCombine(hash, storage_buffer.binding_location, storage_buffer.handle);
+        }
+        for (const auto& storage_image : i.storage_images) {
+            dga::hashCombine(hash, storage_image.binding_location, storage_image.handle);
+        }
         return hash;
     }
 };
@@ -326,6 +512,7 @@ public:
     bool frame(const Frame* frame) override;
 
     // Variant walker methods. Executed on the render thread.
+    void operator()(const cmd::CreateVertexLayout& c);
     void operator()(const cmd::CreateVertexBuffer& c);
     void operator()(const cmd::UpdateVertexBuffer& c);
     void operator()(const cmd::DeleteVertexBuffer& c);
@@ -334,10 +521,18 @@ public:
     void operator()(const cmd::DeleteIndexBuffer& c);
     void operator()(const cmd::CreateProgram& c);
     void operator()(const cmd::DeleteProgram& c);
+    void operator()(const cmd::CreateUniformBuffer& c);
+    void operator()(const cmd::UpdateUniformBuffer& c);
+    void operator()(const cmd::DeleteUniformBuffer& c);
+    void operator()(const cmd::CreateStorageBuffer& c);
+    void operator()(const cmd::UpdateStorageBuffer& c);
+    void operator()(const cmd::DeleteStorageBuffer& c);
     void operator()(const cmd::CreateTexture2D& c);
     void operator()(const cmd::DeleteTexture& c);
     void operator()(const cmd::CreateFrameBuffer& c);
     void operator()(const cmd::DeleteFrameBuffer& c);
+    void operator()(const cmd::CreateOcclusionQuery& c);
+    void operator()(const cmd::DeleteOcclusionQuery& c);
     template <typename T> void operator()(const T& c) {
         static_assert(!std::is_same<T, T>::value, "Unimplemented RenderCommand");
     }
@@ -354,8 +549,12 @@ private:
 
     vk::Queue graphics_queue_;
     vk::Queue present_queue_;
+    vk::Queue transfer_queue_;
     u32 graphics_queue_family_index_;
     u32 present_queue_family_index_;
+    u32 transfer_queue_family_index_;
+    std::unique_ptr<UploadQueueVK> upload_queue_;
+    std::unique_ptr<StagingRingVK> staging_ring_;
 
     // Swapchain
     // =========
@@ -373,6 +572,12 @@ private:
 
     std::vector<vk::Framebuffer> swap_chain_framebuffers_;
     vk::RenderPass swapchain_render_pass_;
+    std::unordered_map<u32, vk::RenderPass> swapchain_render_pass_variants_;
+
+    // Whether each swap chain image and the swap chain depth image have been rendered to, so that
+    // loading them doesn't read an image in an undefined layout.
+    std::vector<bool> swap_chain_images_initialised_;
+    bool depth_image_initialised_;
 
     std::vector<vk::CommandBuffer> command_buffers_;
 
@@ -384,6 +589,19 @@ private:
     std::size_t current_frame_;
     u32 next_frame_index_;
 
+    // Number of frames submitted so far, and the frame most recently submitted with each in-flight
+    // fence.
+    u64 submitted_frame_count_;
+    std::vector<u64> in_flight_frame_numbers_;
+
+    // Deleted resources which may still be used by frames in flight. Each resource is destroyed
+    // once the last frame submitted before it was deleted has completed.
+    struct PendingDestruction {
+        u64 frame;
+        std::function<void()> destroy;
+    };
+    std::deque<PendingDestruction> pending_destructions_;
+
     // Resources
     // =========
 
@@ -392,17 +610,31 @@ private:
     // Per frame uniform scratch buffers (one per swapchain image).
     std::vector<std::unique_ptr<UniformScratchBuffer>> uniform_scratch_buffers_;
 
-    // Resource maps.
+    // Resource maps. Vertex layouts are kept in a map rather than a vector indexed by id, as
+    // pipeline keys point to them.
+    std::unordered_map<VertexLayoutId, VertexDeclVK> vertex_layout_map_;
     std::unordered_map<VertexBufferHandle, VertexBufferVK> vertex_buffer_map_;
     std::unordered_map<IndexBufferHandle, IndexBufferVK> index_buffer_map_;
     std::unordered_map<ProgramHandle, ProgramVK> program_map_;
+    std::unordered_map<UniformBufferHandle, BufferVK> uniform_buffer_map_;
+    std::unordered_map<StorageBufferHandle, BufferVK> storage_buffer_map_;
     std::unordered_map<TextureHandle, TextureVK> texture_map_;
     std::unordered_map<FrameBufferHandle, FramebufferVK> framebuffer_map_;
+    std::unordered_set<OcclusionQueryHandle> occlusion_queries_;
+
+    // Per frame occlusion query pools (one per swapchain image). The results are read once the
+    // previous frame which used the swapchain image has completed.
+    struct OcclusionQueryPoolVK {
+        vk::QueryPool pool;
+        // The occlusion query written to each slot in the pool.
+        std::vector<OcclusionQueryHandle> queries;
+    };
+    std::vector<OcclusionQueryPoolVK> occlusion_query_pools_;
 
     // Cached objects.
     // TODO: Implement some form of cache eviction.
-    std::unordered_map<VertexDecl, VertexDeclVK> vertex_decl_cache_;
     std::unordered_map<PipelineVK::Info, PipelineVK> graphics_pipeline_cache_;
+    std::unordered_map<const ProgramVK*, PipelineVK> compute_pipeline_cache_;
     std::unordered_map<DescriptorSetVK::Info, DescriptorSetVK> descriptor_set_cache_;
     std::unordered_map<RenderItem::SamplerInfo, vk::Sampler> sampler_cache_;
 
@@ -416,14 +648,39 @@ private:
     void createDevice();
     void createSwapChain();
     void createRenderPass();
+    vk::RenderPass findOrCreateSwapchainRenderPass(const AttachmentOps& ops);
     void createFramebuffers();
     void createCommandBuffers();
     void createDescriptorPool();
     void createSyncObjects();
+    void createQueryPools();
 
     PipelineVK findOrCreateGraphicsPipeline(PipelineVK::Info info);
+    PipelineVK findOrCreateComputePipeline(const ProgramVK* program);
     DescriptorSetVK findOrCreateDescriptorSet(DescriptorSetVK::Info info);
     vk::Sampler findOrCreateSampler(RenderItem::SamplerInfo info);
+    void readOcclusionQueryResults(OcclusionQueryPoolVK& query_pool);
+
+    // Stores uniforms and uniform blocks in a program, which keeps them for later items.
+    void applyUniform(ProgramVK& program, const std::string& name, const UniformData& data);
+    void applyUniformBlocks(ProgramVK& program, const Frame& frame, const RenderItem& item);
+    bool checkUniformBlockLayout(ProgramVK& program, ProgramVK::UniformBuffer& ubo,
+                                 const RenderItem::UniformBlockData& block);
+    // Writes a program's uniforms to this frame's uniform scratch buffer, and returns the dynamic
+    // offsets of its uniform buffers. Uniform blocks bound to a user uniform buffer are skipped,
+    // and use the offset that the buffer was bound with instead.
+    std::vector<u32> uploadUniforms(ProgramVK& program,
+                                    ArenaView<RenderItem::UniformBufferBinding> bindings);
+
+    // Records the compute items of a render queue, followed by barriers which make their writes
+    // visible to the rest of the frame. Must be called outside of a render pass.
+    void recordComputeItems(vk::CommandBuffer command_buffer, const Frame& frame,
+                            const RenderQueue& q);
+
+    void deferDestruction(std::function<void()> destroy);
+    void destroyCompletedResources(u64 completed_frame);
+    void evictGraphicsPipelines(const std::function<bool(const PipelineVK::Info&)>& predicate);
+    void evictDescriptorSets(const std::function<bool(const DescriptorSetVK::Info&)>& predicate);
 
     void cleanup();
 };
@@ -0,0 +1,37 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include <dawn-gfx/Renderer.h>
+
+#include <gtest/gtest.h>
+
+namespace dw {
+namespace gfx {
+// Discards messages, but counts errors so that tests can check that one was reported.
+class NullLogger : public Logger {
+public:
+    void log(LogLevel level, const std::string&) const override {
+        if (level == LogLevel::Error) {
+            error_count++;
+        }
+    }
+
+    mutable usize error_count = 0;
+};
+
+// Provides a renderer using the null backend, which accepts every command without a window or a
+// GPU.
+class NullRendererTest : public ::testing::Test {
+protected:
+    NullLogger logger_;
+    Renderer r_{logger_};
+
+    void SetUp() override {
+        ASSERT_TRUE(r_.init(RendererType::Null, 640, 480, "Test", InputCallbacks{}, false));
+    }
+};
+}  // namespace gfx
+}  // namespace dw
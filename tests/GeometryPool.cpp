@@ -0,0 +1,174 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Common.h"
+
+#include <dawn-gfx/GeometryPool.h>
+
+using namespace dw::gfx;
+
+TEST(OffsetAllocatorTest, AllocatesContiguousRanges) {
+    OffsetAllocator allocator{100};
+    EXPECT_EQ(allocator.allocate(10), std::optional<u32>{0});
+    EXPECT_EQ(allocator.allocate(20), std::optional<u32>{10});
+    EXPECT_EQ(allocator.allocate(30), std::optional<u32>{30});
+    EXPECT_EQ(allocator.freeSpace(), 40u);
+    EXPECT_EQ(allocator.largestFreeRange(), 40u);
+}
+
+TEST(OffsetAllocatorTest, RejectsEmptyAndOversizedAllocations) {
+    OffsetAllocator allocator{64};
+    EXPECT_FALSE(allocator.allocate(0).has_value());
+    EXPECT_FALSE(allocator.allocate(65).has_value());
+    EXPECT_EQ(allocator.allocate(64), std::optional<u32>{0});
+    EXPECT_FALSE(allocator.allocate(1).has_value());
+    EXPECT_EQ(allocator.freeSpace(), 0u);
+}
+
+TEST(OffsetAllocatorTest, RejectsAllocationsLargerThanAnyFreeRange) {
+    OffsetAllocator allocator{30};
+    auto a = allocator.allocate(10);
+    auto b = allocator.allocate(10);
+    auto c = allocator.allocate(10);
+    allocator.free(*a, 10);
+    allocator.free(*c, 10);
+
+    // There are 20 elements free, but not next to each other.
+    EXPECT_EQ(allocator.freeSpace(), 20u);
+    EXPECT_EQ(allocator.largestFreeRange(), 10u);
+    EXPECT_FALSE(allocator.allocate(15).has_value());
+    (void)b;
+}
+
+TEST(OffsetAllocatorTest, UsesBestFit) {
+    OffsetAllocator allocator{100};
+    auto a = allocator.allocate(30);
+    auto b = allocator.allocate(10);
+    auto c = allocator.allocate(10);
+    auto d = allocator.allocate(10);
+    allocator.free(*a, 30);
+    allocator.free(*c, 10);
+
+    // The 10 element hole left by c fits exactly, so it is preferred over the hole left by a and
+    // the space at the end.
+    EXPECT_EQ(allocator.allocate(8), c);
+    EXPECT_EQ(allocator.allocate(25), a);
+    (void)b;
+    (void)d;
+}
+
+TEST(OffsetAllocatorTest, MergesFreedNeighbours) {
+    OffsetAllocator allocator{40};
+    auto a = allocator.allocate(10);
+    auto b = allocator.allocate(10);
+    auto c = allocator.allocate(10);
+    auto d = allocator.allocate(10);
+
+    // Free out of order so that ranges are merged with the preceding range, the following range,
+    // and both.
+    allocator.free(*b, 10);
+    allocator.free(*d, 10);
+    EXPECT_EQ(allocator.largestFreeRange(), 10u);
+    allocator.free(*c, 10);
+    EXPECT_EQ(allocator.largestFreeRange(), 30u);
+    allocator.free(*a, 10);
+    EXPECT_EQ(allocator.largestFreeRange(), 40u);
+    EXPECT_EQ(allocator.freeSpace(), allocator.capacity());
+
+    EXPECT_EQ(allocator.allocate(40), std::optional<u32>{0});
+}
+
+TEST(OffsetAllocatorTest, RoundTripsRandomAllocations) {
+    OffsetAllocator allocator{1000};
+    std::vector<std::pair<u32, u32>> allocations;
+    u32 seed = 1;
+    auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    for (int i = 0; i < 2000; ++i) {
+        if (allocations.empty() || next() % 3 != 0) {
+            const u32 size = next() % 50 + 1;
+            if (auto offset = allocator.allocate(size)) {
+                // The new range must not overlap any live allocation.
+                for (const auto& allocation : allocations) {
+                    ASSERT_TRUE(*offset + size <= allocation.first ||
+                                allocation.first + allocation.second <= *offset);
+                }
+                allocations.emplace_back(*offset, size);
+            }
+        } else {
+            const usize index = next() % allocations.size();
+            allocator.free(allocations[index].first, allocations[index].second);
+            allocations.erase(allocations.begin() + index);
+        }
+    }
+    for (const auto& allocation : allocations) {
+        allocator.free(allocation.first, allocation.second);
+    }
+    EXPECT_EQ(allocator.freeSpace(), allocator.capacity());
+    EXPECT_EQ(allocator.largestFreeRange(), allocator.capacity());
+}
+
+namespace {
+TriangleBuffer makeTriangle() {
+    TriangleBuffer buffer;
+    buffer.begin();
+    buffer.position(Vec3{0.0f, 0.0f, 0.0f});
+    buffer.position(Vec3{1.0f, 0.0f, 0.0f});
+    buffer.position(Vec3{0.0f, 1.0f, 0.0f});
+    buffer.triangle(0, 1, 2);
+    return buffer;
+}
+}  // namespace
+
+class GeometryPoolTest : public NullRendererTest {};
+
+TEST_F(GeometryPoolTest, SharesPagesBetweenMeshes) {
+    const TriangleBuffer buffer = makeTriangle();
+    GeometryPool pool{r_, buffer.vertexDecl(), 6, 6};
+
+    auto a = pool.add(buffer);
+    auto b = pool.add(buffer);
+    ASSERT_TRUE(a.has_value());
+    ASSERT_TRUE(b.has_value());
+    EXPECT_EQ(pool.pageCount(), 1u);
+    EXPECT_EQ(a->vb, b->vb);
+    EXPECT_EQ(a->base_vertex, 0u);
+    EXPECT_EQ(b->base_vertex, 3u);
+    EXPECT_EQ(b->first_index, 3u);
+
+    // The first page is full, so a third mesh starts a new page.
+    auto c = pool.add(buffer);
+    ASSERT_TRUE(c.has_value());
+    EXPECT_EQ(pool.pageCount(), 2u);
+    EXPECT_NE(c->vb, a->vb);
+}
+
+TEST_F(GeometryPoolTest, ReusesSpaceOfRemovedMeshes) {
+    const TriangleBuffer buffer = makeTriangle();
+    GeometryPool pool{r_, buffer.vertexDecl(), 6, 6};
+
+    auto a = pool.add(buffer);
+    auto b = pool.add(buffer);
+    pool.remove(*a);
+    auto c = pool.add(buffer);
+    ASSERT_TRUE(c.has_value());
+    EXPECT_EQ(pool.pageCount(), 1u);
+    EXPECT_EQ(c->base_vertex, a->base_vertex);
+    EXPECT_EQ(c->first_index, a->first_index);
+    (void)b;
+}
+
+TEST_F(GeometryPoolTest, RejectsMeshesWhichDontFit) {
+    const TriangleBuffer buffer = makeTriangle();
+    GeometryPool pool{r_, buffer.vertexDecl(), 2, 6};
+    EXPECT_FALSE(pool.add(buffer).has_value());
+
+    TriangleBuffer empty;
+    empty.begin();
+    GeometryPool empty_pool{r_, buffer.vertexDecl()};
+    EXPECT_FALSE(empty_pool.add(empty).has_value());
+    EXPECT_EQ(pool.pageCount() + empty_pool.pageCount(), 0u);
+}
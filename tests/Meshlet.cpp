@@ -0,0 +1,114 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Common.h"
+
+#include <dawn-gfx/Meshlet.h>
+
+using namespace dw::gfx;
+
+namespace {
+// Adds a flat grid of quads in the XY plane facing +Z, with cells of size 1 / cells.
+void addGrid(TriangleBuffer& buffer, u32 cells, const Vec3& offset) {
+    const u32 first_vertex = static_cast<u32>(buffer.vertices().size());
+    const u32 row_length = cells + 1;
+    for (u32 y = 0; y <= cells; ++y) {
+        for (u32 x = 0; x <= cells; ++x) {
+            buffer.position(offset + Vec3{float(x) / float(cells) - 0.5f,
+                                          float(y) / float(cells) - 0.5f, 0.0f});
+        }
+    }
+    for (u32 y = 0; y < cells; ++y) {
+        for (u32 x = 0; x < cells; ++x) {
+            const u32 v = first_vertex + y * row_length + x;
+            buffer.triangle(v, v + 1, v + row_length + 1);
+            buffer.triangle(v, v + row_length + 1, v + row_length);
+        }
+    }
+}
+
+TriangleBuffer makeGrid(u32 cells, const Vec3& offset = Vec3{0.0f, 0.0f, 0.0f}) {
+    TriangleBuffer buffer;
+    buffer.begin();
+    addGrid(buffer, cells, offset);
+    return buffer;
+}
+}  // namespace
+
+TEST(MeshletTest, RespectsVertexAndTriangleLimits) {
+    const TriangleBuffer buffer = makeGrid(32);
+    for (auto limits : {std::make_pair(kMaxMeshletVertices, kMaxMeshletTriangles),
+                        std::make_pair(16u, 8u), std::make_pair(3u, 124u)}) {
+        const MeshletMesh mesh = buildMeshlets(buffer, limits.first, limits.second);
+        ASSERT_FALSE(mesh.meshlets.empty());
+        for (const auto& meshlet : mesh.meshlets) {
+            EXPECT_GT(meshlet.triangle_count, 0u);
+            EXPECT_LE(meshlet.vertex_count, limits.first);
+            EXPECT_LE(meshlet.triangle_count, limits.second);
+        }
+    }
+}
+
+TEST(MeshletTest, KeepsEveryTriangleInOrder) {
+    const TriangleBuffer buffer = makeGrid(32);
+    const MeshletMesh mesh = buildMeshlets(buffer, 16, 8);
+    EXPECT_EQ(mesh.source_vertex_count, buffer.vertices().size());
+
+    // Map the local indices of each meshlet back to mesh indices, which should reproduce the
+    // original index buffer.
+    std::vector<u32> indices;
+    for (const auto& meshlet : mesh.meshlets) {
+        for (u32 i = 0; i < meshlet.triangle_count * 3; ++i) {
+            const u8 local_index = mesh.triangles[meshlet.triangle_offset * 3 + i];
+            ASSERT_LT(local_index, meshlet.vertex_count);
+            indices.emplace_back(mesh.vertices[meshlet.vertex_offset + local_index]);
+        }
+    }
+    EXPECT_EQ(indices, buffer.indices());
+}
+
+TEST(MeshletTest, BoundingSphereContainsVertices) {
+    TriangleBuffer buffer = makeGrid(16);
+    addGrid(buffer, 8, Vec3{3.0f, -2.0f, 1.5f});
+    const MeshletMesh mesh = buildMeshlets(buffer, 32, 24);
+    for (const auto& meshlet : mesh.meshlets) {
+        for (u32 i = 0; i < meshlet.vertex_count; ++i) {
+            const Vec3& p = buffer.vertices()[mesh.vertices[meshlet.vertex_offset + i]].position;
+            EXPECT_LE((p - meshlet.centre).Length(), meshlet.radius + 1e-4f);
+        }
+    }
+}
+
+TEST(MeshletTest, FlatMeshletHasNarrowCone) {
+    const MeshletMesh mesh = buildMeshlets(makeGrid(4));
+    ASSERT_EQ(mesh.meshlets.size(), 1u);
+    const Meshlet& meshlet = mesh.meshlets[0];
+    EXPECT_NEAR(meshlet.cone_axis.z, 1.0f, 1e-4f);
+    EXPECT_NEAR(meshlet.cone_cutoff, 0.0f, 1e-3f);
+}
+
+class MeshletCullerTest : public NullRendererTest {};
+
+// The identity matrix makes object space the clip space, so the frustum is the cube from -1 to 1.
+TEST_F(MeshletCullerTest, CullsMeshletsOutsideFrustum) {
+    TriangleBuffer buffer = makeGrid(4);
+    addGrid(buffer, 4, Vec3{10.0f, 0.0f, 0.0f});
+    MeshletCuller culler{buildMeshlets(buffer, 64, 32)};
+    ASSERT_EQ(culler.mesh().meshlets.size(), 2u);
+
+    auto result = culler.cull(r_, Mat4::identity, Vec3{0.0f, 0.0f, 5.0f});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->visible_meshlets, 1u);
+    EXPECT_EQ(result->index_count, culler.mesh().meshlets[0].triangle_count * 3);
+}
+
+TEST_F(MeshletCullerTest, CullsBackfacingMeshlets) {
+    MeshletCuller culler{buildMeshlets(makeGrid(4))};
+
+    auto front = culler.cull(r_, Mat4::identity, Vec3{0.0f, 0.0f, 5.0f});
+    ASSERT_TRUE(front.has_value());
+    EXPECT_EQ(front->visible_meshlets, 1u);
+
+    EXPECT_FALSE(culler.cull(r_, Mat4::identity, Vec3{0.0f, 0.0f, -5.0f}).has_value());
+}
@@ -0,0 +1,123 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Common.h"
+
+#include <dawn-gfx/OcclusionCuller.h>
+
+using namespace dw::gfx;
+
+namespace {
+// A camera at the origin looking down -Z with a 90 degree field of view.
+Mat4 viewProj() {
+    return Mat4::OpenGLPerspProjRH(0.1f, 100.0f, 0.2f, 0.2f);
+}
+
+AABB box(const Vec3& centre, float half_size = 1.0f) {
+    const Vec3 extent{half_size, half_size, half_size};
+    return AABB{centre - extent, centre + extent};
+}
+
+// Adds a square wall facing the camera, centred on the view axis.
+void addWall(OcclusionCuller& culler, float half_size, float z, bool flip_winding = false) {
+    const Vec3 positions[] = {{-half_size, -half_size, z},
+                              {half_size, -half_size, z},
+                              {half_size, half_size, z},
+                              {-half_size, half_size, z}};
+    const u32 indices[] = {0, 1, 2, 0, 2, 3};
+    const u32 flipped_indices[] = {0, 2, 1, 0, 3, 2};
+    culler.addOccluder(positions, 4, flip_winding ? flipped_indices : indices, 6, Mat4::identity);
+}
+}  // namespace
+
+TEST(OcclusionCullerTest, RoundsSizeUpToTiles) {
+    OcclusionCuller culler{100, 50};
+    EXPECT_EQ(culler.width(), 104u);
+    EXPECT_EQ(culler.height(), 56u);
+}
+
+TEST(OcclusionCullerTest, EverythingOnScreenIsVisibleWithoutOccluders) {
+    OcclusionCuller culler;
+    culler.beginFrame(viewProj());
+    culler.rasterize();
+    EXPECT_EQ(culler.occluderTriangleCount(), 0u);
+    EXPECT_TRUE(culler.isVisible(box(Vec3{0.0f, 0.0f, -10.0f})));
+    EXPECT_TRUE(culler.isVisible(box(Vec3{5.0f, -5.0f, -20.0f})));
+}
+
+TEST(OcclusionCullerTest, BoxesOffScreenAreNotVisible) {
+    OcclusionCuller culler;
+    culler.beginFrame(viewProj());
+    culler.rasterize();
+    EXPECT_FALSE(culler.isVisible(box(Vec3{50.0f, 0.0f, -10.0f})));
+    EXPECT_FALSE(culler.isVisible(box(Vec3{0.0f, -50.0f, -10.0f})));
+}
+
+TEST(OcclusionCullerTest, BoxesCrossingTheNearPlaneAreVisible) {
+    OcclusionCuller culler;
+    culler.beginFrame(viewProj());
+    addWall(culler, 10.0f, -5.0f);
+    culler.rasterize();
+    EXPECT_TRUE(culler.isVisible(box(Vec3{0.0f, 0.0f, 0.0f})));
+}
+
+TEST(OcclusionCullerTest, WallHidesBoxesBehindIt) {
+    OcclusionCuller culler;
+    culler.beginFrame(viewProj());
+    addWall(culler, 2.0f, -5.0f);
+    culler.rasterize();
+    EXPECT_EQ(culler.occluderTriangleCount(), 2u);
+
+    // Directly behind the wall.
+    EXPECT_FALSE(culler.isVisible(box(Vec3{0.0f, 0.0f, -20.0f})));
+    // In front of the wall.
+    EXPECT_TRUE(culler.isVisible(box(Vec3{0.0f, 0.0f, -3.0f}, 0.5f)));
+    // Behind the wall, but beside it on screen.
+    EXPECT_TRUE(culler.isVisible(box(Vec3{15.0f, 0.0f, -20.0f})));
+    // Behind the wall, and partly beside it on screen.
+    EXPECT_TRUE(culler.isVisible(box(Vec3{8.0f, 0.0f, -20.0f}, 1.5f)));
+    // Passing through the wall.
+    EXPECT_TRUE(culler.isVisible(box(Vec3{0.0f, 0.0f, -5.0f}, 0.5f)));
+}
+
+TEST(OcclusionCullerTest, OccludersAreRasterizedFromBothSides) {
+    OcclusionCuller culler;
+    culler.beginFrame(viewProj());
+    addWall(culler, 2.0f, -5.0f, true);
+    culler.rasterize();
+    EXPECT_FALSE(culler.isVisible(box(Vec3{0.0f, 0.0f, -20.0f})));
+}
+
+TEST(OcclusionCullerTest, BeginFrameClearsOccluders) {
+    OcclusionCuller culler;
+    culler.beginFrame(viewProj());
+    addWall(culler, 2.0f, -5.0f);
+    culler.rasterize();
+    ASSERT_FALSE(culler.isVisible(box(Vec3{0.0f, 0.0f, -20.0f})));
+
+    culler.beginFrame(viewProj());
+    culler.rasterize();
+    EXPECT_EQ(culler.occluderTriangleCount(), 0u);
+    EXPECT_TRUE(culler.isVisible(box(Vec3{0.0f, 0.0f, -20.0f})));
+}
+
+TEST(OcclusionCullerTest, AddsOccludersFromTriangleBuffers) {
+    TriangleBuffer wall;
+    wall.begin();
+    wall.position(Vec3{-2.0f, -2.0f, 0.0f});
+    wall.position(Vec3{2.0f, -2.0f, 0.0f});
+    wall.position(Vec3{2.0f, 2.0f, 0.0f});
+    wall.position(Vec3{-2.0f, 2.0f, 0.0f});
+    wall.triangle(0, 1, 2);
+    wall.triangle(0, 2, 3);
+
+    OcclusionCuller culler;
+    culler.beginFrame(viewProj());
+    // The model transform moves the wall in front of the camera.
+    culler.addOccluder(wall, Mat4::Translate(Vec3{0.0f, 0.0f, -5.0f}).ToFloat4x4());
+    culler.rasterize();
+    EXPECT_EQ(culler.occluderTriangleCount(), 2u);
+    EXPECT_FALSE(culler.isVisible(box(Vec3{0.0f, 0.0f, -20.0f})));
+    EXPECT_TRUE(culler.isVisible(box(Vec3{15.0f, 0.0f, -20.0f})));
+}
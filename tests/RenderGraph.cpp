@@ -0,0 +1,249 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Common.h"
+
+#include <dawn-gfx/RenderGraph.h>
+
+using namespace dw::gfx;
+
+namespace {
+const RenderGraph::TextureDesc kColour{64, 64, TextureFormat::RGBA8};
+}  // namespace
+
+class RenderGraphTest : public NullRendererTest {
+protected:
+    RenderGraph graph_{logger_, r_};
+    std::vector<std::string> executed_;
+
+    // Adds a pass which records that it was executed.
+    void addPass(const std::string& name, std::vector<RenderGraph::TextureId> reads,
+                 std::vector<RenderGraph::TextureId> writes, bool backbuffer = false) {
+        graph_.addPass(
+            name,
+            [=](RenderGraph::PassBuilder& b) {
+                for (auto id : reads) {
+                    b.read(id);
+                }
+                for (auto id : writes) {
+                    b.write(id);
+                }
+                if (backbuffer) {
+                    b.writeBackbuffer();
+                }
+            },
+            [this, name](Renderer&, uint) { executed_.emplace_back(name); });
+    }
+};
+
+TEST_F(RenderGraphTest, OrdersPassesAfterTheirDependencies) {
+    auto a = graph_.createTexture(kColour);
+    auto b = graph_.createTexture(kColour);
+    addPass("final", {a, b}, {}, true);
+    addPass("second", {a}, {b});
+    addPass("first", {}, {a});
+
+    EXPECT_TRUE(graph_.execute());
+    EXPECT_EQ(executed_, (std::vector<std::string>{"first", "second", "final"}));
+    EXPECT_EQ(graph_.executedPassCount(), 3u);
+    EXPECT_EQ(graph_.culledPassCount(), 0u);
+}
+
+TEST_F(RenderGraphTest, IndependentPassesKeepTheirOrder) {
+    auto a = graph_.createTexture(kColour);
+    auto b = graph_.createTexture(kColour);
+    auto c = graph_.createTexture(kColour);
+    addPass("c", {}, {c});
+    addPass("a", {}, {a});
+    addPass("b", {}, {b});
+    addPass("final", {a, b, c}, {}, true);
+
+    EXPECT_TRUE(graph_.execute());
+    EXPECT_EQ(executed_, (std::vector<std::string>{"c", "a", "b", "final"}));
+}
+
+TEST_F(RenderGraphTest, CullsPassesWhoseResultsAreUnused) {
+    auto used = graph_.createTexture(kColour);
+    auto unused = graph_.createTexture(kColour);
+    auto unused_input = graph_.createTexture(kColour);
+    addPass("used", {}, {used});
+    addPass("unused_input", {}, {unused_input});
+    addPass("unused", {unused_input}, {unused});
+    addPass("final", {used}, {}, true);
+
+    EXPECT_TRUE(graph_.execute());
+    EXPECT_EQ(executed_, (std::vector<std::string>{"used", "final"}));
+    EXPECT_EQ(graph_.executedPassCount(), 2u);
+    EXPECT_EQ(graph_.culledPassCount(), 2u);
+}
+
+TEST_F(RenderGraphTest, KeepsPassesWhichWriteImportedTextures) {
+    TextureHandle handle = r_.createTexture2D(64, 64, TextureFormat::RGBA8, Memory(), false, true);
+    auto imported = graph_.importTexture(handle);
+    addPass("export", {}, {imported});
+
+    EXPECT_TRUE(graph_.execute());
+    EXPECT_EQ(executed_, (std::vector<std::string>{"export"}));
+    // Imported textures aren't allocated by the graph, and neither is a depth texture for a pass
+    // which only writes imported textures.
+    EXPECT_EQ(graph_.allocatedTextureCount(), 0u);
+}
+
+TEST_F(RenderGraphTest, AliasesTexturesWithDisjointLifetimes) {
+    // a is last used by the second pass, so c can reuse its texture.
+    auto a = graph_.createTexture(kColour);
+    auto b = graph_.createTexture(kColour);
+    auto c = graph_.createTexture(kColour);
+    std::vector<TextureHandle> handles;
+    auto record = [&](RenderGraph::TextureId id) {
+        return [&, id](Renderer&, uint) { handles.emplace_back(graph_.texture(id)); };
+    };
+    graph_.addPass("a", [&](RenderGraph::PassBuilder& builder) { builder.write(a); }, record(a));
+    graph_.addPass(
+        "b",
+        [&](RenderGraph::PassBuilder& builder) {
+            builder.read(a);
+            builder.write(b);
+        },
+        record(b));
+    graph_.addPass(
+        "c",
+        [&](RenderGraph::PassBuilder& builder) {
+            builder.read(b);
+            builder.write(c);
+        },
+        record(c));
+    addPass("final", {c}, {}, true);
+
+    EXPECT_TRUE(graph_.execute());
+    ASSERT_EQ(handles.size(), 3u);
+    EXPECT_EQ(handles[0], handles[2]);
+    EXPECT_NE(handles[0], handles[1]);
+    // Two colour textures, and one depth texture shared by every pass.
+    EXPECT_EQ(graph_.allocatedTextureCount(), 3u);
+}
+
+TEST_F(RenderGraphTest, DoesntAliasTexturesWithDifferentFormats) {
+    auto a = graph_.createTexture(kColour);
+    auto b = graph_.createTexture(kColour);
+    auto c = graph_.createTexture(RenderGraph::TextureDesc{64, 64, TextureFormat::RGBA16F});
+    addPass("a", {}, {a});
+    addPass("b", {a}, {b});
+    addPass("c", {b}, {c});
+    addPass("final", {c}, {}, true);
+
+    EXPECT_TRUE(graph_.execute());
+    EXPECT_EQ(graph_.allocatedTextureCount(), 4u);
+}
+
+TEST_F(RenderGraphTest, SharesDeclaredDepthTextures) {
+    auto colour = graph_.createTexture(kColour);
+    auto depth = graph_.createTexture(RenderGraph::TextureDesc{64, 64, TextureFormat::D24S8});
+    graph_.addPass(
+        "depth_prepass", [&](RenderGraph::PassBuilder& b) { EXPECT_TRUE(b.writeDepth(depth)); },
+        nullptr);
+    graph_.addPass(
+        "opaque",
+        [&](RenderGraph::PassBuilder& b) {
+            b.write(colour);
+            b.writeDepth(depth);
+        },
+        nullptr);
+    addPass("final", {colour}, {}, true);
+
+    EXPECT_TRUE(graph_.execute());
+    // The prepass is kept, as the opaque pass renders on top of its depth.
+    EXPECT_EQ(graph_.executedPassCount(), 3u);
+    // The declared depth texture is used instead of one per pass.
+    EXPECT_EQ(graph_.allocatedTextureCount(), 2u);
+}
+
+TEST_F(RenderGraphTest, OrdersPassesWhichWriteTheSameTexture) {
+    auto a = graph_.createTexture(kColour);
+    addPass("final", {a}, {}, true);
+    addPass("opaque", {}, {a});
+    addPass("transparent", {}, {a});
+
+    EXPECT_TRUE(graph_.execute());
+    EXPECT_EQ(executed_, (std::vector<std::string>{"opaque", "transparent", "final"}));
+}
+
+TEST_F(RenderGraphTest, ReusesAndEvictsPooledTextures) {
+    for (int i = 0; i < 2; ++i) {
+        auto a = graph_.createTexture(kColour);
+        addPass("a", {}, {a});
+        addPass("final", {a}, {}, true);
+        EXPECT_TRUE(graph_.execute());
+        EXPECT_EQ(graph_.allocatedTextureCount(), 2u);
+    }
+
+    // Textures which go unused for long enough are deleted.
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_TRUE(graph_.execute());
+    }
+    EXPECT_EQ(graph_.allocatedTextureCount(), 0u);
+}
+
+TEST_F(RenderGraphTest, ReportsCycles) {
+    auto x = graph_.createTexture(kColour);
+    auto y = graph_.createTexture(kColour);
+    auto z = graph_.createTexture(kColour);
+    addPass("x", {y}, {x});
+    addPass("y", {x}, {y});
+    addPass("depends_on_cycle", {x}, {}, true);
+    addPass("z", {}, {z});
+    addPass("independent", {z}, {}, true);
+
+    EXPECT_FALSE(graph_.execute());
+    EXPECT_EQ(logger_.error_count, 1u);
+    EXPECT_EQ(executed_, (std::vector<std::string>{"z", "independent"}));
+}
+
+TEST_F(RenderGraphTest, RejectsFeedbackLoops) {
+    auto a = graph_.createTexture(kColour);
+    auto b = graph_.createTexture(kColour);
+    graph_.addPass(
+        "feedback",
+        [&](RenderGraph::PassBuilder& builder) {
+            EXPECT_TRUE(builder.read(a));
+            EXPECT_FALSE(builder.write(a));
+            EXPECT_TRUE(builder.write(b));
+            EXPECT_FALSE(builder.read(b));
+        },
+        nullptr);
+    EXPECT_EQ(logger_.error_count, 2u);
+}
+
+TEST_F(RenderGraphTest, RejectsWritingTexturesAndTheBackbuffer) {
+    auto a = graph_.createTexture(kColour);
+    graph_.addPass(
+        "texture_first",
+        [&](RenderGraph::PassBuilder& b) {
+            EXPECT_TRUE(b.write(a));
+            EXPECT_FALSE(b.writeBackbuffer());
+        },
+        nullptr);
+    graph_.addPass(
+        "backbuffer_first",
+        [&](RenderGraph::PassBuilder& b) {
+            EXPECT_TRUE(b.writeBackbuffer());
+            EXPECT_FALSE(b.write(a));
+        },
+        nullptr);
+    EXPECT_EQ(logger_.error_count, 2u);
+}
+
+TEST_F(RenderGraphTest, RejectsMismatchedAttachmentFormats) {
+    auto colour = graph_.createTexture(kColour);
+    auto depth = graph_.createTexture(RenderGraph::TextureDesc{64, 64, TextureFormat::D32F});
+    graph_.addPass(
+        "pass",
+        [&](RenderGraph::PassBuilder& b) {
+            EXPECT_FALSE(b.write(depth));
+            EXPECT_FALSE(b.writeDepth(colour));
+            EXPECT_FALSE(b.read(1000));
+        },
+        nullptr);
+    EXPECT_EQ(logger_.error_count, 3u);
+}
@@ -0,0 +1,169 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Common.h"
+
+#include <dawn-gfx/Visibility.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace dw::gfx;
+
+namespace {
+// A camera at the origin looking down -Z.
+Frustum makeFrustum(float far_distance = 100.0f) {
+    Frustum frustum;
+    frustum.SetKind(math::FrustumSpaceGL, math::FrustumRightHanded);
+    frustum.SetViewPlaneDistances(0.1f, far_distance);
+    frustum.SetPerspective(M_HALF_PI, M_HALF_PI);
+    frustum.SetFrame(Vec3{0.0f, 0.0f, 0.0f}, Vec3{0.0f, 0.0f, -1.0f}, Vec3{0.0f, 1.0f, 0.0f});
+    return frustum;
+}
+
+AABB box(const Vec3& centre, float half_size = 0.5f) {
+    const Vec3 extent{half_size, half_size, half_size};
+    return AABB{centre - extent, centre + extent};
+}
+
+// Reference implementation which tests a box against every plane.
+bool intersectsPlanes(const Frustum& frustum, const AABB& bounds) {
+    Plane planes[6];
+    frustum.GetPlanes(planes);
+    const Vec3 centre = bounds.CenterPoint();
+    const Vec3 extent = bounds.HalfSize();
+    for (const auto& plane : planes) {
+        const float radius = std::abs(plane.normal.x) * extent.x +
+                             std::abs(plane.normal.y) * extent.y +
+                             std::abs(plane.normal.z) * extent.z;
+        if (plane.normal.Dot(centre) - plane.d > radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool contains(const std::vector<VisibilityWorld::ObjectId>& ids, VisibilityWorld::ObjectId id) {
+    return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+}  // namespace
+
+TEST(VisibilityWorldTest, CullsObjectsOutsideFrustum) {
+    VisibilityWorld world;
+    const auto in_front = world.insert(box(Vec3{0.0f, 0.0f, -10.0f}));
+    const auto behind = world.insert(box(Vec3{0.0f, 0.0f, 10.0f}));
+    const auto to_the_side = world.insert(box(Vec3{50.0f, 0.0f, -10.0f}));
+    const auto too_far = world.insert(box(Vec3{0.0f, 0.0f, -200.0f}));
+    const auto straddling = world.insert(box(Vec3{10.0f, 0.0f, -10.0f}, 1.0f));
+
+    std::vector<VisibilityWorld::ObjectId> visible;
+    world.cull(makeFrustum(), visible);
+    EXPECT_EQ(visible.size(), 2u);
+    EXPECT_TRUE(contains(visible, in_front));
+    EXPECT_TRUE(contains(visible, straddling));
+    EXPECT_FALSE(contains(visible, behind));
+    EXPECT_FALSE(contains(visible, to_the_side));
+    EXPECT_FALSE(contains(visible, too_far));
+}
+
+TEST(VisibilityWorldTest, EmptyWorldHasNothingVisible) {
+    VisibilityWorld world;
+    std::vector<VisibilityWorld::ObjectId> visible{1, 2, 3};
+    world.cull(makeFrustum(), visible);
+    EXPECT_TRUE(visible.empty());
+    EXPECT_EQ(world.objectCount(), 0u);
+}
+
+TEST(VisibilityWorldTest, MovesWithinMarginDontReinsert) {
+    VisibilityWorld world{1.0f};
+    const auto id = world.insert(box(Vec3{0.0f, 0.0f, -10.0f}));
+    EXPECT_FALSE(world.move(id, box(Vec3{0.5f, 0.0f, -10.0f})));
+    EXPECT_TRUE(world.move(id, box(Vec3{5.0f, 0.0f, -10.0f})));
+
+    // The stored bounds are enlarged by the margin.
+    const AABB& bounds = world.bounds(id);
+    EXPECT_FLOAT_EQ(bounds.minPoint.x, 3.5f);
+    EXPECT_FLOAT_EQ(bounds.maxPoint.x, 6.5f);
+
+    // Moving the object out of view removes it from the cull results.
+    std::vector<VisibilityWorld::ObjectId> visible;
+    world.move(id, box(Vec3{0.0f, 0.0f, 10.0f}));
+    world.cull(makeFrustum(), visible);
+    EXPECT_TRUE(visible.empty());
+}
+
+TEST(VisibilityWorldTest, RemovedObjectsAreNotVisible) {
+    VisibilityWorld world;
+    const auto a = world.insert(box(Vec3{0.0f, 0.0f, -10.0f}));
+    const auto b = world.insert(box(Vec3{1.0f, 0.0f, -10.0f}));
+    world.remove(a);
+    EXPECT_EQ(world.objectCount(), 1u);
+
+    std::vector<VisibilityWorld::ObjectId> visible;
+    world.cull(makeFrustum(), visible);
+    ASSERT_EQ(visible.size(), 1u);
+    EXPECT_EQ(visible[0], b);
+
+    world.remove(b);
+    world.cull(makeFrustum(), visible);
+    EXPECT_TRUE(visible.empty());
+    EXPECT_EQ(world.objectCount(), 0u);
+}
+
+TEST(VisibilityWorldTest, StaysBalancedWhenInsertedInOrder) {
+    VisibilityWorld world;
+    constexpr int kObjectCount = 4096;
+    for (int i = 0; i < kObjectCount; ++i) {
+        world.insert(box(Vec3{float(i) * 2.0f, 0.0f, 0.0f}));
+    }
+    EXPECT_EQ(world.objectCount(), usize(kObjectCount));
+    // Without rebalancing, inserting objects in order would build a tree thousands of nodes high.
+    EXPECT_LE(world.height(), 2 * int(std::log2(float(kObjectCount))));
+}
+
+TEST(VisibilityWorldTest, MatchesBruteForce) {
+    std::mt19937 rng{1234};
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 5.0f);
+    std::uniform_real_distribution<float> offset(-3.0f, 3.0f);
+
+    // Enough objects that the tree is culled in parallel.
+    VisibilityWorld world{0.5f};
+    std::vector<AABB> bounds;
+    std::vector<VisibilityWorld::ObjectId> ids;
+    for (int i = 0; i < 20000; ++i) {
+        bounds.emplace_back(box(Vec3{position(rng), position(rng), position(rng)}, size(rng)));
+        ids.emplace_back(world.insert(bounds.back()));
+    }
+    for (usize i = 0; i < bounds.size(); i += 3) {
+        const Vec3 delta{offset(rng), offset(rng), offset(rng)};
+        bounds[i] = AABB{bounds[i].minPoint + delta, bounds[i].maxPoint + delta};
+        world.move(ids[i], bounds[i]);
+    }
+    for (usize i = 1; i < bounds.size(); i += 5) {
+        world.remove(ids[i]);
+    }
+
+    const Frustum frustum = makeFrustum();
+    std::vector<VisibilityWorld::ObjectId> visible;
+    world.cull(frustum, visible);
+    std::sort(visible.begin(), visible.end());
+    EXPECT_TRUE(std::adjacent_find(visible.begin(), visible.end()) == visible.end());
+
+    // Culling is conservative: every object which is inside the frustum must be returned, and
+    // every object returned must have enlarged bounds which are inside the frustum.
+    for (usize i = 0; i < bounds.size(); ++i) {
+        const bool removed = i % 5 == 1;
+        const bool found = std::binary_search(visible.begin(), visible.end(), ids[i]);
+        if (removed) {
+            EXPECT_FALSE(found);
+        } else if (intersectsPlanes(frustum, bounds[i])) {
+            EXPECT_TRUE(found);
+        }
+    }
+    for (const auto id : visible) {
+        EXPECT_TRUE(intersectsPlanes(frustum, world.bounds(id)));
+    }
+}